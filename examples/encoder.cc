@@ -24,6 +24,8 @@
 #if defined(HAVE_STRINGS_H)
 #include <strings.h>
 #endif
+#include <errno.h>
+#include <string.h>
 
 #include "encoder.h"
 
@@ -33,6 +35,22 @@
 
 static const char kMetadataTypeExif[] = "Exif";
 
+bool Encoder::Encode(const struct heif_image_handle* handle,
+    const struct heif_image* image, const std::string& filename) {
+  FILE* fp = fopen(filename.c_str(), "wb");
+  if (!fp) {
+    fprintf(stderr, "Can't open %s: %s\n", filename.c_str(), strerror(errno));
+    return false;
+  }
+
+  bool written = Encode(handle, image, fp);
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Can't write %s: %s\n", filename.c_str(), strerror(errno));
+    written = false;
+  }
+  return written;
+}
+
 // static
 bool Encoder::HasExifMetaData(const struct heif_image_handle* handle) {
   int count = heif_image_handle_get_number_of_metadata_blocks(handle);
@@ -78,3 +96,20 @@ uint8_t* Encoder::GetExifMetaData(const struct heif_image_handle* handle, size_t
 
   return nullptr;
 }
+
+// static
+bool Encoder::WritePlane(FILE* fp, const uint8_t* data, int stride,
+    size_t row_size, int height) {
+  if (static_cast<size_t>(stride) == row_size) {
+    size_t size = row_size * height;
+    return fwrite(data, 1, size, fp) == size;
+  }
+
+  for (int y = 0; y < height; y++) {
+    if (fwrite(data + y * static_cast<size_t>(stride), 1, row_size, fp) != row_size) {
+      return false;
+    }
+  }
+
+  return true;
+}
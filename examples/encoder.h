@@ -20,6 +20,8 @@
 #ifndef EXAMPLE_ENCODER_H
 #define EXAMPLE_ENCODER_H
 
+#include <stdio.h>
+
 #include <string>
 #include <memory>
 
@@ -37,12 +39,22 @@ class Encoder {
     // Override if necessary.
   }
 
+  // Writes the image to an already opened stream, which may also be stdout.
+  // The stream is not closed.
   virtual bool Encode(const struct heif_image_handle* handle,
-      const struct heif_image* image, const std::string& filename) = 0;
+      const struct heif_image* image, FILE* fp) = 0;
+
+  bool Encode(const struct heif_image_handle* handle,
+      const struct heif_image* image, const std::string& filename);
 
  protected:
   static bool HasExifMetaData(const struct heif_image_handle* handle);
   static uint8_t* GetExifMetaData(const struct heif_image_handle* handle, size_t* size);
+
+  // Writes 'height' rows of 'row_size' bytes directly from the plane memory, with a
+  // single write if the rows are contiguous.
+  static bool WritePlane(FILE* fp, const uint8_t* data, int stride,
+      size_t row_size, int height);
 };
 
 #endif  // EXAMPLE_ENCODER_H
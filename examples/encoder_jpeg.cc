@@ -45,13 +45,7 @@ void JpegEncoder::OnJpegError(j_common_ptr cinfo) {
 }
 
 bool JpegEncoder::Encode(const struct heif_image_handle* handle,
-    const struct heif_image* image, const std::string& filename) {
-  FILE* fp = fopen(filename.c_str(), "wb");
-  if (!fp) {
-    fprintf(stderr, "Can't open %s: %s\n", filename.c_str(), strerror(errno));
-    return false;
-  }
-
+    const struct heif_image* image, FILE* fp) {
   struct jpeg_compress_struct cinfo;
   struct ErrorHandler jerr;
   cinfo.err = jpeg_std_error(reinterpret_cast<struct jpeg_error_mgr*>(&jerr));
@@ -59,7 +53,6 @@ bool JpegEncoder::Encode(const struct heif_image_handle* handle,
   if (setjmp(jerr.setjmp_buffer)) {
     cinfo.err->output_message(reinterpret_cast<j_common_ptr>(&cinfo));
     jpeg_destroy_compress(&cinfo);
-    fclose(fp);
     return false;
   }
 
@@ -117,7 +110,6 @@ bool JpegEncoder::Encode(const struct heif_image_handle* handle,
     jpeg_write_scanlines(&cinfo, row, 1);
   }
   jpeg_finish_compress(&cinfo);
-  fclose(fp);
   jpeg_destroy_compress(&cinfo);
   return true;
 }
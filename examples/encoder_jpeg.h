@@ -46,7 +46,7 @@ class JpegEncoder : public Encoder {
       struct heif_decoding_options *options) const override;
 
   bool Encode(const struct heif_image_handle* handle,
-      const struct heif_image* image, const std::string& filename) override;
+      const struct heif_image* image, FILE* fp) override;
 
  private:
   static const int kDefaultQuality = 90;
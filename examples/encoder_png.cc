@@ -18,12 +18,160 @@
  * along with convert.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <png.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #include "encoder_png.h"
 
-PngEncoder::PngEncoder() {}
+namespace {
+
+struct CompressionSettings {
+  int zlib_level;
+  int zlib_strategy;
+  int filter;  // PNG_FILTER_VALUE_*, or -1 to choose the filter for each row
+};
+
+// indexed by PngEncoder::Speed
+const CompressionSettings kCompressionSettings[] = {
+  { 6, Z_DEFAULT_STRATEGY, -1 },
+  { 2, Z_DEFAULT_STRATEGY, PNG_FILTER_VALUE_UP },
+  { 1, Z_RLE, PNG_FILTER_VALUE_SUB },
+};
+
+// Target amount of filtered data deflated by one job in the parallel mode.
+const size_t kBandSize = 128 * 1024;
+
+// Bytes of preceding data used to prime the compressor of each band.
+const size_t kDictionarySize = 32 * 1024;
+
+
+template <typename Func>
+void ParallelFor(int n, int num_threads, Func func) {
+  std::atomic<int> next(0);
+  auto worker = [&]() {
+    for (int i; (i = next++) < n; ) {
+      func(i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 1; t < std::min(num_threads, n); t++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+
+inline uint8_t Paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return static_cast<uint8_t>(a);
+  } else if (pb <= pc) {
+    return static_cast<uint8_t>(b);
+  } else {
+    return static_cast<uint8_t>(c);
+  }
+}
+
+// Writes the filter type byte followed by the filtered row.
+// 'prev' is the unfiltered previous row, all zeros for the first row.
+void FilterRow(int filter, const uint8_t* row, const uint8_t* prev,
+    int bpp, size_t size, uint8_t* out) {
+  *out++ = static_cast<uint8_t>(filter);
+
+  switch (filter) {
+  case PNG_FILTER_VALUE_NONE:
+    memcpy(out, row, size);
+    break;
+  case PNG_FILTER_VALUE_SUB:
+    for (size_t i = 0; i < size; i++) {
+      out[i] = static_cast<uint8_t>(row[i] - (i >= (size_t)bpp ? row[i - bpp] : 0));
+    }
+    break;
+  case PNG_FILTER_VALUE_UP:
+    for (size_t i = 0; i < size; i++) {
+      out[i] = static_cast<uint8_t>(row[i] - prev[i]);
+    }
+    break;
+  case PNG_FILTER_VALUE_AVG:
+    for (size_t i = 0; i < size; i++) {
+      int left = (i >= (size_t)bpp ? row[i - bpp] : 0);
+      out[i] = static_cast<uint8_t>(row[i] - ((left + prev[i]) >> 1));
+    }
+    break;
+  case PNG_FILTER_VALUE_PAETH:
+    for (size_t i = 0; i < size; i++) {
+      if (i >= (size_t)bpp) {
+        out[i] = static_cast<uint8_t>(row[i] - Paeth(row[i - bpp], prev[i], prev[i - bpp]));
+      } else {
+        out[i] = static_cast<uint8_t>(row[i] - prev[i]);
+      }
+    }
+    break;
+  }
+}
+
+// Same heuristic as libpng: use the filter with the smallest sum of absolute
+// (signed) filtered values.
+void FilterRowAdaptive(const uint8_t* row, const uint8_t* prev,
+    int bpp, size_t size, uint8_t* out, std::vector<uint8_t>& scratch) {
+  scratch.resize(size + 1);
+
+  uint64_t best_sum = UINT64_MAX;
+  for (int filter = PNG_FILTER_VALUE_NONE; filter <= PNG_FILTER_VALUE_PAETH; filter++) {
+    FilterRow(filter, row, prev, bpp, size, scratch.data());
+
+    uint64_t sum = 0;
+    for (size_t i = 1; i <= size; i++) {
+      sum += static_cast<uint64_t>(abs(static_cast<int8_t>(scratch[i])));
+    }
+    if (sum < best_sum) {
+      best_sum = sum;
+      memcpy(out, scratch.data(), size + 1);
+    }
+  }
+}
+
+bool WriteUInt32(FILE* fp, uint32_t value) {
+  uint8_t data[4] = {
+    static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16),
+    static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)
+  };
+  return fwrite(data, 1, 4, fp) == 4;
+}
+
+bool WriteChunk(FILE* fp, const char* type, const uint8_t* data, size_t size) {
+  uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+  if (size > 0) {
+    crc = crc32(crc, data, static_cast<uInt>(size));
+  }
+
+  return (WriteUInt32(fp, static_cast<uint32_t>(size)) &&
+          fwrite(type, 1, 4, fp) == 4 &&
+          fwrite(data, 1, size, fp) == size &&
+          WriteUInt32(fp, static_cast<uint32_t>(crc)));
+}
+
+}  // namespace
+
+
+PngEncoder::PngEncoder(Speed speed, int num_threads)
+    : speed_(speed), num_threads_(std::max(num_threads, 1)) {}
 
 inline uint8_t clip(float value) {
   if (value < 0) {
@@ -36,7 +184,11 @@ inline uint8_t clip(float value) {
 }
 
 bool PngEncoder::Encode(const struct heif_image_handle* handle,
-    const struct heif_image* image, const std::string& filename) {
+    const struct heif_image* image, FILE* fp) {
+  if (num_threads_ > 1) {
+    return EncodeParallel(image, fp);
+  }
+
   png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr,
       nullptr, nullptr);
   if (!png_ptr) {
@@ -51,22 +203,21 @@ bool PngEncoder::Encode(const struct heif_image_handle* handle,
     return false;
   }
 
-  FILE* fp = fopen(filename.c_str(), "wb");
-  if (!fp) {
-    fprintf(stderr, "Can't open %s: %s\n", filename.c_str(), strerror(errno));
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    return false;
-  }
-
   if (setjmp(png_jmpbuf(png_ptr))) {
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    fclose(fp);
     fprintf(stderr, "Error while encoding image\n");
     return false;
   }
 
   png_init_io(png_ptr, fp);
 
+  if (speed_ != kSpeedDefault) {
+    const CompressionSettings& settings = kCompressionSettings[speed_];
+    png_set_compression_level(png_ptr, settings.zlib_level);
+    png_set_compression_strategy(png_ptr, settings.zlib_strategy);
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE << settings.filter);
+  }
+
   bool withAlpha = (heif_image_get_chroma_format(image) == heif_chroma_interleaved_32bit);
 
   int width = heif_image_get_width(image, heif_channel_interleaved);
@@ -91,6 +242,167 @@ bool PngEncoder::Encode(const struct heif_image_handle* handle,
   png_write_end(png_ptr, nullptr);
   png_destroy_write_struct(&png_ptr, &info_ptr);
   delete[] row_pointers;
-  fclose(fp);
   return true;
 }
+
+
+// Filters and deflates bands of rows concurrently. Each band is compressed as raw
+// deflate data, primed with the preceding filtered data as dictionary and ended
+// with a sync flush (the last band with Z_FINISH). The concatenated bands form a
+// single zlib stream, whose Adler-32 checksum is combined from the band checksums.
+bool PngEncoder::EncodeParallel(const struct heif_image* image, FILE* fp) const {
+  const CompressionSettings& settings = kCompressionSettings[speed_];
+
+  bool withAlpha = (heif_image_get_chroma_format(image) == heif_chroma_interleaved_32bit);
+  int bpp = withAlpha ? 4 : 3;
+
+  int width = heif_image_get_width(image, heif_channel_interleaved);
+  int height = heif_image_get_height(image, heif_channel_interleaved);
+  if (width <= 0 || height <= 0) {
+    fprintf(stderr, "Invalid image size\n");
+    return false;
+  }
+
+  int stride_rgb;
+  const uint8_t* rgb = heif_image_get_plane_readonly(image,
+      heif_channel_interleaved, &stride_rgb);
+
+  size_t row_size = static_cast<size_t>(width) * bpp;
+  size_t filtered_row_size = row_size + 1;
+
+  int rows_per_band = static_cast<int>(std::max<size_t>(1, kBandSize / filtered_row_size));
+  rows_per_band = std::min(rows_per_band, (height + num_threads_ - 1) / num_threads_);
+  int num_bands = (height + rows_per_band - 1) / rows_per_band;
+
+
+  // --- filter rows
+
+  std::vector<uint8_t> filtered(filtered_row_size * height);
+  std::vector<uint8_t> zero_row(row_size, 0);
+
+  ParallelFor(num_bands, num_threads_, [&](int band) {
+    std::vector<uint8_t> scratch;
+    int y_end = std::min(height, (band + 1) * rows_per_band);
+    for (int y = band * rows_per_band; y < y_end; y++) {
+      const uint8_t* row = rgb + y * stride_rgb;
+      const uint8_t* prev = (y > 0 ? row - stride_rgb : zero_row.data());
+      uint8_t* out = filtered.data() + y * filtered_row_size;
+      if (settings.filter < 0) {
+        FilterRowAdaptive(row, prev, bpp, row_size, out, scratch);
+      } else {
+        FilterRow(settings.filter, row, prev, bpp, row_size, out);
+      }
+    }
+  });
+
+
+  // --- deflate bands
+
+  std::vector<std::vector<uint8_t>> compressed(num_bands);
+  std::vector<uLong> checksums(num_bands);
+  std::vector<char> band_ok(num_bands, 0);
+
+  ParallelFor(num_bands, num_threads_, [&](int band) {
+    size_t begin = band * rows_per_band * filtered_row_size;
+    size_t end = std::min(filtered.size(), begin + rows_per_band * filtered_row_size);
+    bool last = (band == num_bands - 1);
+
+    checksums[band] = adler32(adler32(0, nullptr, 0), filtered.data() + begin,
+                              static_cast<uInt>(end - begin));
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, settings.zlib_level, Z_DEFLATED, -MAX_WBITS, 8,
+                     settings.zlib_strategy) != Z_OK) {
+      return;
+    }
+
+    if (begin > 0) {
+      size_t dict_size = std::min(begin, kDictionarySize);
+      deflateSetDictionary(&strm, filtered.data() + begin - dict_size,
+                           static_cast<uInt>(dict_size));
+    }
+
+    std::vector<uint8_t>& out = compressed[band];
+    out.resize(deflateBound(&strm, static_cast<uLong>(end - begin)) + 16);
+    size_t pos = 0;
+
+    strm.next_in = filtered.data() + begin;
+    strm.avail_in = static_cast<uInt>(end - begin);
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+
+    for (;;) {
+      strm.next_out = out.data() + pos;
+      strm.avail_out = static_cast<uInt>(out.size() - pos);
+      int ret = deflate(&strm, flush);
+      pos = out.size() - strm.avail_out;
+      if (ret == Z_STREAM_ERROR) {
+        deflateEnd(&strm);
+        return;
+      }
+      if (last ? (ret == Z_STREAM_END) : (strm.avail_out != 0)) {
+        break;
+      }
+      out.resize(out.size() * 2);
+    }
+
+    out.resize(pos);
+    deflateEnd(&strm);
+    band_ok[band] = 1;
+  });
+
+  if (std::find(band_ok.begin(), band_ok.end(), 0) != band_ok.end()) {
+    fprintf(stderr, "Error while compressing image\n");
+    return false;
+  }
+
+  uLong checksum = checksums[0];
+  for (int band = 1; band < num_bands; band++) {
+    size_t band_size = std::min(filtered.size() - band * rows_per_band * filtered_row_size,
+                                rows_per_band * filtered_row_size);
+    checksum = adler32_combine(checksum, checksums[band], static_cast<z_off_t>(band_size));
+  }
+
+
+  // --- write PNG
+
+  // zlib header for 32K window, with the level hint used by zlib itself
+  uint8_t flevel = (settings.zlib_level < 2 ? 0 : settings.zlib_level < 6 ? 1 :
+                    settings.zlib_level == 6 ? 2 : 3);
+  uint16_t header = static_cast<uint16_t>((0x78 << 8) | (flevel << 6));
+  header = static_cast<uint16_t>(header + 31 - header % 31);
+
+  std::vector<uint8_t>& first = compressed.front();
+  first.insert(first.begin(), { static_cast<uint8_t>(header >> 8), static_cast<uint8_t>(header) });
+
+  std::vector<uint8_t>& last = compressed.back();
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    last.push_back(static_cast<uint8_t>(checksum >> shift));
+  }
+
+  static const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+  uint8_t ihdr[13] = {
+    static_cast<uint8_t>(width >> 24), static_cast<uint8_t>(width >> 16),
+    static_cast<uint8_t>(width >> 8), static_cast<uint8_t>(width),
+    static_cast<uint8_t>(height >> 24), static_cast<uint8_t>(height >> 16),
+    static_cast<uint8_t>(height >> 8), static_cast<uint8_t>(height),
+    8,  // bit depth
+    static_cast<uint8_t>(withAlpha ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB),
+    PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE, PNG_INTERLACE_NONE
+  };
+
+  bool written = (fwrite(kSignature, 1, sizeof(kSignature), fp) == sizeof(kSignature) &&
+                  WriteChunk(fp, "IHDR", ihdr, sizeof(ihdr)));
+
+  for (int band = 0; band < num_bands && written; band++) {
+    written = WriteChunk(fp, "IDAT", compressed[band].data(), compressed[band].size());
+  }
+
+  written = written && WriteChunk(fp, "IEND", nullptr, 0);
+
+  if (!written) {
+    fprintf(stderr, "Error while writing image: %s\n", strerror(errno));
+  }
+  return written;
+}
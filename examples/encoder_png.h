@@ -26,7 +26,16 @@
 
 class PngEncoder : public Encoder {
  public:
-  PngEncoder();
+  // Compression presets, trading file size for encoding speed.
+  enum Speed {
+    kSpeedDefault,  // libpng defaults: zlib level 6, adaptive row filters
+    kSpeedFast,     // zlib level 2, 'Up' row filter
+    kSpeedFastest   // zlib level 1 with run-length matching only, 'Sub' row filter
+  };
+
+  // With more than one thread, the image is split into bands of rows that are
+  // filtered and deflated concurrently into a single zlib stream.
+  PngEncoder(Speed speed = kSpeedDefault, int num_threads = 1);
 
   heif_colorspace colorspace(bool has_alpha) const override {
     return heif_colorspace_RGB;
@@ -40,9 +49,13 @@ class PngEncoder : public Encoder {
   }
 
   bool Encode(const struct heif_image_handle* handle,
-      const struct heif_image* image, const std::string& filename) override;
+      const struct heif_image* image, FILE* fp) override;
 
  private:
+  bool EncodeParallel(const struct heif_image* image, FILE* fp) const;
+
+  Speed speed_;
+  int num_threads_;
 };
 
 #endif  // EXAMPLE_ENCODER_PNG_H
@@ -0,0 +1,54 @@
+/*
+ * libheif example application "convert".
+ * Copyright (c) 2018 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of convert, an example application using libheif.
+ *
+ * convert is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * convert is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with convert.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <string.h>
+
+#include "encoder_pnm.h"
+
+PnmEncoder::PnmEncoder(Format format) : format_(format) {}
+
+bool PnmEncoder::Encode(const struct heif_image_handle* handle,
+    const struct heif_image* image, FILE* fp) {
+  bool withAlpha = (heif_image_get_chroma_format(image) == heif_chroma_interleaved_32bit);
+  int channels = withAlpha ? 4 : 3;
+
+  int width = heif_image_get_width(image, heif_channel_interleaved);
+  int height = heif_image_get_height(image, heif_channel_interleaved);
+
+  int header_ok;
+  if (format_ == kFormatPPM) {
+    header_ok = fprintf(fp, "P6\n%d %d\n255\n", width, height);
+  } else {
+    header_ok = fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                        width, height, channels, withAlpha ? "RGB_ALPHA" : "RGB");
+  }
+
+  int stride;
+  const uint8_t* data = heif_image_get_plane_readonly(image,
+      heif_channel_interleaved, &stride);
+
+  if (header_ok < 0 ||
+      !WritePlane(fp, data, stride, static_cast<size_t>(width) * channels, height)) {
+    fprintf(stderr, "Error while writing image: %s\n", strerror(errno));
+    return false;
+  }
+
+  return true;
+}
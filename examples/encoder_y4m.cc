@@ -0,0 +1,119 @@
+/*
+ * libheif example application "convert".
+ * Copyright (c) 2018 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of convert, an example application using libheif.
+ *
+ * convert is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * convert is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with convert.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <string.h>
+
+#include <vector>
+
+#include "encoder_y4m.h"
+
+Y4MEncoder::Y4MEncoder() {}
+
+static bool IsBigEndian() {
+  const uint16_t value = 1;
+  return *reinterpret_cast<const uint8_t*>(&value) == 0;
+}
+
+// Y4M stores samples of more than 8 bits as 16-bit little endian values.
+static bool WritePlaneSwapped16(FILE* fp, const uint8_t* data, int stride,
+    int width, int height) {
+  std::vector<uint8_t> row(width * 2);
+  for (int y = 0; y < height; y++) {
+    const uint8_t* in = data + y * static_cast<size_t>(stride);
+    for (int x = 0; x < width; x++) {
+      row[2 * x] = in[2 * x + 1];
+      row[2 * x + 1] = in[2 * x];
+    }
+    if (fwrite(row.data(), 1, row.size(), fp) != row.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Y4MEncoder::Encode(const struct heif_image_handle* handle,
+    const struct heif_image* image, FILE* fp) {
+  heif_colorspace colorspace = heif_image_get_colorspace(image);
+  heif_chroma chroma = heif_image_get_chroma_format(image);
+
+  const char* chroma_tag;
+  switch (chroma) {
+  case heif_chroma_monochrome: chroma_tag = "mono"; break;
+  case heif_chroma_420: chroma_tag = "420"; break;
+  case heif_chroma_422: chroma_tag = "422"; break;
+  case heif_chroma_444: chroma_tag = "444"; break;
+  default: chroma_tag = nullptr; break;
+  }
+
+  if (!chroma_tag ||
+      (colorspace != heif_colorspace_YCbCr && colorspace != heif_colorspace_monochrome)) {
+    fprintf(stderr, "Y4M output requires a YCbCr or monochrome image\n");
+    return false;
+  }
+
+  int bit_depth = heif_image_get_bits_per_pixel(image, heif_channel_Y);
+
+  // Same naming as ffmpeg: "420mpeg2" (HEVC chroma siting) and "mono" for 8 bits,
+  // "420p10" and "mono10" for higher bit depths.
+  std::string colorspace_tag = chroma_tag;
+  if (bit_depth > 8) {
+    if (chroma != heif_chroma_monochrome) {
+      colorspace_tag += "p";
+    }
+    colorspace_tag += std::to_string(bit_depth);
+  } else if (chroma == heif_chroma_420) {
+    colorspace_tag += "mpeg2";
+  }
+
+  std::string range_tag;
+  struct heif_color_profile_nclx* nclx = nullptr;
+  if (heif_image_handle_get_nclx_color_profile(handle, &nclx).code == heif_error_Ok && nclx) {
+    range_tag = nclx->full_range_flag ? " XCOLORRANGE=FULL" : " XCOLORRANGE=LIMITED";
+    heif_nclx_color_profile_free(nclx);
+  }
+
+  int width = heif_image_get_width(image, heif_channel_Y);
+  int height = heif_image_get_height(image, heif_channel_Y);
+
+  bool written = fprintf(fp, "YUV4MPEG2 W%d H%d F25:1 Ip A1:1 C%s%s\nFRAME\n",
+                         width, height, colorspace_tag.c_str(), range_tag.c_str()) >= 0;
+
+  const heif_channel channels[] = { heif_channel_Y, heif_channel_Cb, heif_channel_Cr };
+  int num_channels = (chroma == heif_chroma_monochrome ? 1 : 3);
+
+  for (int c = 0; c < num_channels && written; c++) {
+    int stride;
+    const uint8_t* data = heif_image_get_plane_readonly(image, channels[c], &stride);
+    int plane_width = heif_image_get_width(image, channels[c]);
+    int plane_height = heif_image_get_height(image, channels[c]);
+
+    if (bit_depth > 8 && IsBigEndian()) {
+      written = WritePlaneSwapped16(fp, data, stride, plane_width, plane_height);
+    } else {
+      size_t bytes_per_sample = (bit_depth > 8 ? 2 : 1);
+      written = WritePlane(fp, data, stride, plane_width * bytes_per_sample, plane_height);
+    }
+  }
+
+  if (!written) {
+    fprintf(stderr, "Error while writing image: %s\n", strerror(errno));
+  }
+  return written;
+}
@@ -0,0 +1,45 @@
+/*
+ * libheif example application "convert".
+ * Copyright (c) 2018 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of convert, an example application using libheif.
+ *
+ * convert is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * convert is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with convert.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EXAMPLE_ENCODER_Y4M_H
+#define EXAMPLE_ENCODER_Y4M_H
+
+#include <string>
+
+#include "encoder.h"
+
+// Writes the image as a single YUV4MPEG2 frame in its decoded format (4:2:0, 4:2:2,
+// 4:4:4 or monochrome, 8 to 16 bits). No color conversion takes place.
+class Y4MEncoder : public Encoder {
+ public:
+  Y4MEncoder();
+
+  heif_colorspace colorspace(bool has_alpha) const override {
+    return heif_colorspace_undefined;
+  }
+
+  heif_chroma chroma(bool has_alpha) const override {
+    return heif_chroma_undefined;
+  }
+
+  bool Encode(const struct heif_image_handle* handle,
+      const struct heif_image* image, FILE* fp) override;
+};
+
+#endif  // EXAMPLE_ENCODER_Y4M_H
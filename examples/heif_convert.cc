@@ -26,9 +26,16 @@
 #if defined(HAVE_UNISTD_H)
 #include <unistd.h>
 #endif
+#if defined(_MSC_VER)
+#include <fcntl.h>
+#include <io.h>
+#endif
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <vector>
 
 #include "heif.h"
 
@@ -39,6 +46,8 @@
 #if HAVE_LIBPNG
 #include "encoder_png.h"
 #endif
+#include "encoder_pnm.h"
+#include "encoder_y4m.h"
 
 #if defined(_MSC_VER)
 #include "getopt.h"
@@ -47,10 +56,31 @@
 #define UNUSED(x) (void)x
 
 static int usage(const char* command) {
-  fprintf(stderr, "USAGE: %s [-q quality] <filename> <output>\n", command);
+  fprintf(stderr, "USAGE: %s [-q quality] [-f type] [-s speed] [-j threads] [-r trace] <filename> <output>\n", command);
+  fprintf(stderr, "  Use '-' as <filename> to read from stdin and as <output> to write to stdout.\n");
+  fprintf(stderr, "  -f type     output file type (jpg, png, y4m, ppm, pam), required when writing to stdout\n");
+  fprintf(stderr, "  -s speed    PNG compression speed (default, fast, fastest)\n");
+  fprintf(stderr, "  -j threads  number of threads for decoding and PNG compression\n");
+  fprintf(stderr, "  -r trace    write all input reads to a trace file (see heif-io-replay)\n");
   return 1;
 }
 
+
+static bool read_all(FILE* fp, std::vector<uint8_t>& data) {
+  static const size_t kChunkSize = 64*1024;
+  size_t size = 0;
+  for (;;) {
+    data.resize(size + kChunkSize);
+    size_t n = fread(data.data() + size, 1, kChunkSize, fp);
+    size += n;
+    if (n < kChunkSize) {
+      break;
+    }
+  }
+  data.resize(size);
+  return !ferror(fp);
+}
+
 class ContextReleaser {
  public:
   ContextReleaser(struct heif_context* ctx) : ctx_(ctx) {}
@@ -67,11 +97,27 @@ int main(int argc, char** argv)
   int opt;
   int quality = -1;  // Use default quality.
   UNUSED(quality);  // The quality will only be used by encoders that support it.
-  while ((opt = getopt(argc, argv, "q:")) != -1) {
+  std::string output_type;
+  std::string png_speed = "default";
+  int num_threads = 1;
+  std::string trace_filename;
+  while ((opt = getopt(argc, argv, "q:f:s:j:r:")) != -1) {
     switch (opt) {
     case 'q':
       quality = atoi(optarg);
       break;
+    case 'f':
+      output_type = optarg;
+      break;
+    case 's':
+      png_speed = optarg;
+      break;
+    case 'j':
+      num_threads = atoi(optarg);
+      break;
+    case 'r':
+      trace_filename = optarg;
+      break;
     default: /* '?' */
       return usage(argv[0]);
     }
@@ -84,12 +130,27 @@ int main(int argc, char** argv)
 
   std::string input_filename(argv[optind++]);
   std::string output_filename(argv[optind++]);
-  std::ifstream istr(input_filename.c_str());
+
+  bool read_stdin = (input_filename == "-");
+  bool write_stdout = (output_filename == "-");
+
+  // When the image goes to stdout, our messages must not end up in the image data.
+  FILE* log = write_stdout ? stderr : stdout;
+
+  if (output_type.empty()) {
+    size_t dot = output_filename.rfind('.');
+    if (dot != std::string::npos) {
+      output_type = output_filename.substr(dot + 1);
+    }
+  }
+  std::transform(output_type.begin(), output_type.end(), output_type.begin(), ::tolower);
+  if (output_type == "jpeg") {
+    output_type = "jpg";
+  }
 
   std::unique_ptr<Encoder> encoder;
 #if HAVE_LIBJPEG
-  if (output_filename.size() > 4 &&
-      output_filename.find(".jpg") == output_filename.size() - 4) {
+  if (output_type == "jpg") {
     static const int kDefaultJpegQuality = 90;
     if (quality == -1) {
       quality = kDefaultJpegQuality;
@@ -98,13 +159,36 @@ int main(int argc, char** argv)
   }
 #endif  // HAVE_LIBJPEG
 #if HAVE_LIBPNG
-  if (output_filename.size() > 4 &&
-      output_filename.find(".png") == output_filename.size() - 4) {
-    encoder.reset(new PngEncoder());
+  if (output_type == "png") {
+    PngEncoder::Speed speed;
+    if (png_speed == "default") {
+      speed = PngEncoder::kSpeedDefault;
+    } else if (png_speed == "fast") {
+      speed = PngEncoder::kSpeedFast;
+    } else if (png_speed == "fastest") {
+      speed = PngEncoder::kSpeedFastest;
+    } else {
+      fprintf(stderr, "Unknown PNG compression speed: %s\n", png_speed.c_str());
+      return 1;
+    }
+    encoder.reset(new PngEncoder(speed, num_threads));
   }
 #endif  // HAVE_LIBPNG
+  if (output_type == "y4m") {
+    encoder.reset(new Y4MEncoder());
+  }
+  if (output_type == "ppm") {
+    encoder.reset(new PnmEncoder(PnmEncoder::kFormatPPM));
+  }
+  if (output_type == "pam") {
+    encoder.reset(new PnmEncoder(PnmEncoder::kFormatPAM));
+  }
   if (!encoder) {
-    fprintf(stderr, "Unknown file type in %s\n", output_filename.c_str());
+    if (write_stdout && output_type.empty()) {
+      fprintf(stderr, "Output file type must be set with -f when writing to stdout\n");
+    } else {
+      fprintf(stderr, "Unknown file type in %s\n", output_filename.c_str());
+    }
     return 1;
   }
 
@@ -115,8 +199,31 @@ int main(int argc, char** argv)
   }
 
   ContextReleaser cr(ctx);
+
+  std::shared_ptr<heif_io_recorder> recorder;
+  std::shared_ptr<heif_reading_options> reading_options;
+  if (!trace_filename.empty()) {
+    recorder = std::shared_ptr<heif_io_recorder>(heif_io_recorder_alloc(), heif_io_recorder_free);
+    reading_options = std::shared_ptr<heif_reading_options>(heif_reading_options_alloc(),
+                                                            heif_reading_options_free);
+    reading_options->io_recorder = recorder.get();
+  }
+
   struct heif_error err;
-  err = heif_context_read_from_file(ctx, input_filename.c_str(), nullptr);
+  if (read_stdin) {
+#if defined(_MSC_VER)
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    std::vector<uint8_t> input_data;
+    if (!read_all(stdin, input_data)) {
+      fprintf(stderr, "Could not read from stdin\n");
+      return 1;
+    }
+    err = heif_context_read_from_memory(ctx, input_data.data(), input_data.size(),
+                                        reading_options.get());
+  } else {
+    err = heif_context_read_from_file(ctx, input_filename.c_str(), reading_options.get());
+  }
   if (err.code != 0) {
     std::cerr << "Could not read HEIF file: " << err.message << "\n";
     return 1;
@@ -128,7 +235,18 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  printf("File contains %d images\n", num_images);
+  fprintf(log, "File contains %d images\n", num_images);
+
+  if (write_stdout) {
+#if defined(_MSC_VER)
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    // A stream can only carry a single image. Write the primary image and skip the others.
+    if (num_images > 1) {
+      fprintf(stderr, "Writing only the primary image to stdout\n");
+    }
+    num_images = 1;
+  }
 
   std::string filename;
   size_t image_index = 1;  // Image filenames are "1" based.
@@ -146,7 +264,11 @@ int main(int argc, char** argv)
     }
 
     struct heif_image_handle* handle;
-    err = heif_context_get_image_handle(ctx, idx, &handle);
+    if (write_stdout) {
+      err = heif_context_get_primary_image_handle(ctx, &handle);
+    } else {
+      err = heif_context_get_image_handle(ctx, idx, &handle);
+    }
     if (err.code) {
       std::cerr << "Could not read HEIF image " << idx << ": "
           << err.message << "\n";
@@ -155,6 +277,7 @@ int main(int argc, char** argv)
 
     int has_alpha = heif_image_handle_has_alpha_channel(handle);
     struct heif_decoding_options* decode_options = heif_decoding_options_alloc();
+    decode_options->decoder_threads = num_threads;
     encoder->UpdateDecodingOptions(handle, decode_options);
 
     struct heif_image* image;
@@ -172,18 +295,25 @@ int main(int argc, char** argv)
     }
 
     if (image) {
-      bool written = encoder->Encode(handle, image, filename.c_str());
+      bool written;
+      if (write_stdout) {
+        written = encoder->Encode(handle, image, stdout) && fflush(stdout) == 0;
+      } else {
+        written = encoder->Encode(handle, image, filename);
+      }
       if (!written) {
         fprintf(stderr,"could not write image\n");
       } else {
-        printf("Written to %s\n", filename.c_str());
+        fprintf(log, "Written to %s\n", write_stdout ? "stdout" : filename.c_str());
       }
       heif_image_release(image);
 
 
 
       int has_depth = heif_image_handle_has_depth_channel(handle);
-      if (has_depth) {
+      if (has_depth && write_stdout) {
+        fprintf(stderr, "Depth image is not written to stdout\n");
+      } else if (has_depth) {
         struct heif_image_handle* depth_handle;
         err = heif_image_handle_get_depth_channel_handle(handle, 0, &depth_handle);
         if (err.code) {
@@ -214,7 +344,7 @@ int main(int argc, char** argv)
         if (!written) {
           fprintf(stderr,"could not write depth image\n");
         } else {
-          printf("Depth image written to %s\n", s.str().c_str());
+          fprintf(log, "Depth image written to %s\n", s.str().c_str());
         }
       }
     }
@@ -222,5 +352,13 @@ int main(int argc, char** argv)
     image_index++;
   }
 
+  if (recorder) {
+    err = heif_io_recorder_write_trace(recorder.get(), trace_filename.c_str());
+    if (err.code != 0) {
+      fprintf(stderr, "Could not write trace file %s\n", trace_filename.c_str());
+      return 1;
+    }
+  }
+
   return 0;
 }
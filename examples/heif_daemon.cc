@@ -0,0 +1,1019 @@
+/*
+ * libheif example application "daemon".
+ * Copyright (c) 2018 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of daemon, an example application using libheif.
+ *
+ * daemon is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * daemon is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with daemon.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Long-running decoding service on a Unix domain socket. It avoids process startup
+ * and library initialization for each image and keeps recently decoded images in
+ * a cache that is shared by all connections.
+ *
+ * Each request is a single line of text. The input is a file path, or '-' for a file
+ * descriptor that is sent along with the request (SCM_RIGHTS). Descriptors are
+ * consumed in the order in which the '-' placeholders appear. A request that arrives
+ * with more than four descriptors in one message is rejected.
+ *
+ *   DECODE <input>
+ *       Decode the primary image to 8-bit interleaved RGB (RGBA if the image has
+ *       an alpha channel).
+ *   THUMBNAIL <size> <input>
+ *       Like DECODE, but scaled to fit into size x size. The embedded thumbnail is
+ *       used when it is large enough.
+ *   CONVERT <output> <input>
+ *       Write the primary image to the output file (or '-' descriptor). The file type
+ *       is taken from the output file name (jpg, png, y4m, ppm, pam), with '-' the
+ *       type can be given as 'type:-', e.g. 'png:-'.
+ *   STATS
+ *       Report cache statistics.
+ *
+ * Replies are single lines starting with 'OK' or 'ERROR <message>'. For DECODE and
+ * THUMBNAIL the reply is 'OK <width> <height> <channels> <stride>' and carries a
+ * shared memory descriptor with 'stride * height' bytes of pixel data.
+ *
+ * The output path is the only argument that cannot contain spaces. Request lines are
+ * limited to 8192 bytes. A longer line is answered with an error and the connection
+ * is closed.
+ *
+ * Each request is handled by a thread of the pool, and idle connections do not occupy
+ * a thread. The requests of one connection are handled in order.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "heif.h"
+
+#include "encoder.h"
+#if HAVE_LIBJPEG
+#include "encoder_jpeg.h"
+#endif
+#if HAVE_LIBPNG
+#include "encoder_png.h"
+#endif
+#include "encoder_pnm.h"
+#include "encoder_y4m.h"
+
+
+static int usage(const char* command) {
+  fprintf(stderr, "USAGE: %s [-j threads] [-c cache_megabytes] <socket path>\n", command);
+  return 1;
+}
+
+
+// --- thread pool
+
+class ThreadPool {
+ public:
+  ThreadPool(int num_threads) {
+    for (int i = 0; i < num_threads; i++) {
+      threads_.emplace_back([this]() { Run(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void Submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+  }
+
+ private:
+  void Run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::deque<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_ = false;
+};
+
+
+// --- cache of decoded images
+
+// The handle is kept with the image because the encoders read the metadata from it.
+struct DecodedImage {
+  std::shared_ptr<const heif_image_handle> handle;
+  std::shared_ptr<const heif_image> image;
+  size_t cost = 0;
+};
+
+class ImageCache {
+ public:
+  ImageCache(size_t capacity) : capacity_(capacity) {}
+
+  // Concurrent misses on the same key decode the image more than once. The last
+  // result replaces the earlier ones.
+  bool Get(const std::string& key, DecodedImage& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = entries_.find(key);
+    if (iter == entries_.end()) {
+      misses_++;
+      return false;
+    }
+
+    lru_.splice(lru_.begin(), lru_, iter->second.lru_position);
+    out = iter->second.image;
+    hits_++;
+    return true;
+  }
+
+  void Put(const std::string& key, const DecodedImage& image) {
+    if (image.cost > capacity_) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Remove(key);
+
+    while (size_ + image.cost > capacity_) {
+      std::string oldest = lru_.back();
+      Remove(oldest);
+    }
+
+    lru_.push_front(key);
+    Entry& entry = entries_[key];
+    entry.image = image;
+    entry.lru_position = lru_.begin();
+    size_ += image.cost;
+  }
+
+  std::string Stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream s;
+    s << "entries=" << entries_.size() << " bytes=" << size_
+      << " hits=" << hits_ << " misses=" << misses_;
+    return s.str();
+  }
+
+ private:
+  void Remove(const std::string& key) {
+    auto iter = entries_.find(key);
+    if (iter != entries_.end()) {
+      size_ -= iter->second.image.cost;
+      lru_.erase(iter->second.lru_position);
+      entries_.erase(iter);
+    }
+  }
+
+  struct Entry {
+    DecodedImage image;
+    std::list<std::string>::iterator lru_position;
+  };
+
+  std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+  std::list<std::string> lru_;  // most recently used first
+  size_t capacity_;
+  size_t size_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+
+// --- connection with descriptor passing
+
+class Connection {
+ public:
+  Connection(int fd) : fd_(fd) {}
+
+  ~Connection() {
+    for (int fd : received_fds_) {
+      close(fd);
+    }
+    close(fd_);
+  }
+
+  int fd() const { return fd_; }
+
+  enum ReadResult {
+    kLine,         // 'line' holds the next request
+    kWouldBlock,   // no complete line has been received yet
+    kClosed,       // the client closed the connection or an error occurred
+    kLineTooLong   // the line exceeds kMaxLineLength
+  };
+
+  // Does not block. Data that is received without a complete line is kept for the next call.
+  ReadResult ReadLine(std::string& line) {
+    for (;;) {
+      size_t end = buffer_.find('\n');
+      size_t line_length = (end != std::string::npos ? end : buffer_.size());
+      if (line_length > kMaxLineLength) {
+        return kLineTooLong;
+      }
+
+      if (end != std::string::npos) {
+        line = buffer_.substr(0, end);
+        buffer_.erase(0, end + 1);
+        if (!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+        return kLine;
+      }
+
+      char data[4096];
+      union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * kMaxFdsPerMessage)];
+      } control;
+
+      struct iovec iov = { data, sizeof(data) };
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof(control.buf);
+
+      ssize_t n = recvmsg(fd_, &msg, MSG_DONTWAIT);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return kWouldBlock;
+      }
+      if (n <= 0) {
+        return kClosed;
+      }
+
+      if (msg.msg_flags & MSG_CTRUNC) {
+        descriptors_lost_ = true;
+      }
+
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+          size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          const int* fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+          received_fds_.insert(received_fds_.end(), fds, fds + count);
+        }
+      }
+
+      buffer_.append(data, static_cast<size_t>(n));
+    }
+  }
+
+  // Next descriptor sent by the client, or -1. The caller takes ownership.
+  int TakeFd() {
+    if (received_fds_.empty()) {
+      return -1;
+    }
+
+    int fd = received_fds_.front();
+    received_fds_.pop_front();
+    return fd;
+  }
+
+  // Returns true if descriptors were dropped because more than kMaxFdsPerMessage
+  // were sent at once. The received ones no longer match the placeholders and
+  // are closed.
+  bool DescriptorsLost() {
+    if (!descriptors_lost_) {
+      return false;
+    }
+
+    for (int fd : received_fds_) {
+      close(fd);
+    }
+    received_fds_.clear();
+    descriptors_lost_ = false;
+    return true;
+  }
+
+  bool Reply(const std::string& line, int fd = -1) {
+    std::string data = line + "\n";
+
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct iovec iov = { const_cast<char*>(data.data()), data.size() };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0) {
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof(control.buf);
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    // The descriptor goes with the first byte. Send the rest of the line without it.
+    while (iov.iov_len > 0) {
+      ssize_t n = sendmsg(fd_, &msg, 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+
+      iov.iov_base = static_cast<char*>(iov.iov_base) + n;
+      iov.iov_len -= static_cast<size_t>(n);
+      msg.msg_control = nullptr;
+      msg.msg_controllen = 0;
+    }
+
+    return true;
+  }
+
+ private:
+  static const int kMaxFdsPerMessage = 4;
+  static const size_t kMaxLineLength = 8192;
+
+  int fd_;
+  std::string buffer_;
+  std::deque<int> received_fds_;
+  bool descriptors_lost_ = false;
+};
+
+
+// --- request handling
+
+class RequestError {
+ public:
+  RequestError(const std::string& message) : message(message) {}
+
+  std::string message;
+};
+
+
+class Daemon {
+ public:
+  Daemon(size_t cache_size, int num_threads)
+      : cache_(cache_size), pool_(num_threads) {}
+
+  // Accepts connections and waits for requests on the idle ones. Returns only on errors.
+  void Run(int listen_fd);
+
+ private:
+  // Handles the next request of the connection on a pool thread.
+  void ServeRequest(const std::shared_ptr<Connection>& connection);
+
+  // Returns false if the connection has to be closed.
+  bool HandleRequest(Connection& connection, const std::string& line);
+
+  // Passes a connection without pending requests back to Run().
+  void WaitForRequest(const std::shared_ptr<Connection>& connection);
+
+  // Opened input file, closed when going out of scope.
+  struct Input {
+    ~Input() {
+      if (fd >= 0) close(fd);
+    }
+
+    int fd = -1;
+    size_t size = 0;
+    std::string key;  // identifies the file contents for the cache
+  };
+
+  void OpenInput(Connection& connection, const std::string& path, Input& input);
+
+  DecodedImage GetImage(const Input& input, const std::string& variant,
+      std::function<DecodedImage(const std::shared_ptr<const heif_image_handle>&)> decode);
+
+  std::shared_ptr<const heif_image_handle> ReadPrimaryImage(const Input& input);
+
+  void HandleDecode(Connection& connection, const std::string& args, int thumbnail_size);
+  void HandleConvert(Connection& connection, const std::string& args);
+
+  ImageCache cache_;
+
+  // Non-blocking pipe. A full pipe already wakes up the reader, so writes never need to wait.
+  struct WakePipe {
+    WakePipe() {
+      int fds[2];
+      if (pipe(fds) == 0) {
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+        read_fd = fds[0];
+        write_fd = fds[1];
+      }
+    }
+
+    ~WakePipe() {
+      if (read_fd >= 0) close(read_fd);
+      if (write_fd >= 0) close(write_fd);
+    }
+
+    int read_fd = -1;
+    int write_fd = -1;
+  };
+
+  // Connections passed back by the pool threads. Writing to 'wake_pipe_' interrupts
+  // the poll() in Run().
+  std::mutex waiting_mutex_;
+  std::vector<std::shared_ptr<Connection>> waiting_;
+  WakePipe wake_pipe_;
+
+  // Destroyed first, so that no request is running when the other members are destroyed.
+  ThreadPool pool_;
+};
+
+
+static std::shared_ptr<const heif_image> DecodeImage(const heif_image_handle* handle,
+    heif_colorspace colorspace, heif_chroma chroma) {
+  heif_image* image;
+  heif_error err = heif_decode_image(handle, &image, colorspace, chroma, nullptr);
+  if (err.code) {
+    throw RequestError(std::string("could not decode image: ") + err.message);
+  }
+  return std::shared_ptr<const heif_image>(image, heif_image_release);
+}
+
+
+static size_t ImageCost(const heif_image* image) {
+  size_t cost = 0;
+  for (heif_channel channel : { heif_channel_Y, heif_channel_Cb, heif_channel_Cr,
+                                heif_channel_R, heif_channel_G, heif_channel_B,
+                                heif_channel_Alpha, heif_channel_interleaved }) {
+    int stride;
+    if (heif_image_get_plane_readonly(image, channel, &stride)) {
+      cost += static_cast<size_t>(stride) * heif_image_get_height(image, channel);
+    }
+  }
+  return cost;
+}
+
+
+static std::unique_ptr<Encoder> CreateEncoder(const std::string& type) {
+  std::unique_ptr<Encoder> encoder;
+#if HAVE_LIBJPEG
+  if (type == "jpg" || type == "jpeg") {
+    static const int kDefaultJpegQuality = 90;
+    encoder.reset(new JpegEncoder(kDefaultJpegQuality));
+  }
+#endif
+#if HAVE_LIBPNG
+  if (type == "png") {
+    encoder.reset(new PngEncoder());
+  }
+#endif
+  if (type == "y4m") {
+    encoder.reset(new Y4MEncoder());
+  }
+  if (type == "ppm") {
+    encoder.reset(new PnmEncoder(PnmEncoder::kFormatPPM));
+  }
+  if (type == "pam") {
+    encoder.reset(new PnmEncoder(PnmEncoder::kFormatPAM));
+  }
+  return encoder;
+}
+
+
+void Daemon::OpenInput(Connection& connection, const std::string& path, Input& input) {
+  if (path == "-") {
+    input.fd = connection.TakeFd();
+    if (input.fd < 0) {
+      throw RequestError("no file descriptor received");
+    }
+  } else {
+    input.fd = open(path.c_str(), O_RDONLY);
+    if (input.fd < 0) {
+      throw RequestError("cannot open " + path + ": " + strerror(errno));
+    }
+  }
+
+  struct stat st;
+  if (fstat(input.fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    throw RequestError("input is not a regular file");
+  }
+
+  input.size = static_cast<size_t>(st.st_size);
+
+  std::ostringstream key;
+  key << st.st_dev << ":" << st.st_ino << ":" << st.st_size << ":" << st.st_mtime;
+#if defined(__linux__)
+  key << "." << st.st_mtim.tv_nsec;
+#endif
+  input.key = key.str();
+}
+
+
+std::shared_ptr<const heif_image_handle> Daemon::ReadPrimaryImage(const Input& input) {
+  size_t size = input.size;
+  auto buffer = std::make_shared<std::vector<uint8_t>>(size);
+  size_t pos = 0;
+  while (pos < size) {
+    ssize_t n = pread(input.fd, buffer->data() + pos, size - pos, static_cast<off_t>(pos));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw RequestError("cannot read input");
+    }
+    pos += static_cast<size_t>(n);
+  }
+
+  // The context reads from 'buffer' in place, so it is kept as long as the handle.
+  std::shared_ptr<heif_context> ctx(heif_context_alloc(), heif_context_free);
+  heif_error err = heif_context_read_from_memory_without_copy(ctx.get(), buffer->data(), size, nullptr);
+  if (err.code) {
+    throw RequestError(std::string("could not read HEIF file: ") + err.message);
+  }
+
+  // The handle keeps the context alive.
+  heif_image_handle* handle;
+  err = heif_context_get_primary_image_handle(ctx.get(), &handle);
+  if (err.code) {
+    throw RequestError(std::string("could not get primary image: ") + err.message);
+  }
+
+  return std::shared_ptr<const heif_image_handle>(handle, [buffer](heif_image_handle* h) {
+    heif_image_handle_release(h);
+  });
+}
+
+
+DecodedImage Daemon::GetImage(const Input& input, const std::string& variant,
+    std::function<DecodedImage(const std::shared_ptr<const heif_image_handle>&)> decode) {
+  std::string key = input.key + "|" + variant;
+
+  DecodedImage image;
+  if (cache_.Get(key, image)) {
+    return image;
+  }
+
+  image = decode(ReadPrimaryImage(input));
+
+  // The handle also holds the file data.
+  image.cost = ImageCost(image.image.get()) + input.size;
+  cache_.Put(key, image);
+  return image;
+}
+
+
+static int CreateSharedMemory(size_t size) {
+  static std::atomic<unsigned> counter(0);
+
+  std::ostringstream name;
+  name << "/heif-daemon-" << getpid() << "-" << counter++;
+
+  int fd = shm_open(name.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return -1;
+  }
+
+  shm_unlink(name.str().c_str());
+
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+void Daemon::HandleDecode(Connection& connection, const std::string& path, int thumbnail_size) {
+  Input input;
+  OpenInput(connection, path, input);
+
+  std::string variant = "rgb";
+  if (thumbnail_size > 0) {
+    variant += ":" + std::to_string(thumbnail_size);
+  }
+
+  DecodedImage decoded = GetImage(input, variant,
+      [thumbnail_size](const std::shared_ptr<const heif_image_handle>& handle) {
+    DecodedImage result;
+    result.handle = handle;
+
+    const heif_image_handle* source = handle.get();
+
+    if (thumbnail_size > 0 && heif_image_handle_get_number_of_thumbnails(source) > 0) {
+      const heif_image_handle* thumbnail = heif_image_handle_borrow_thumbnail(source, 0);
+      if (thumbnail &&
+          std::max(heif_image_handle_get_width(thumbnail),
+                   heif_image_handle_get_height(thumbnail)) >= thumbnail_size) {
+        source = thumbnail;
+      }
+    }
+
+    bool has_alpha = heif_image_handle_has_alpha_channel(source);
+    result.image = DecodeImage(source, heif_colorspace_RGB,
+                               has_alpha ? heif_chroma_interleaved_32bit :
+                                           heif_chroma_interleaved_24bit);
+
+    int width = heif_image_get_width(result.image.get(), heif_channel_interleaved);
+    int height = heif_image_get_height(result.image.get(), heif_channel_interleaved);
+
+    if (thumbnail_size > 0 && (width > thumbnail_size || height > thumbnail_size)) {
+      int scaled_width = thumbnail_size;
+      int scaled_height = thumbnail_size;
+      if (width > height) {
+        scaled_height = std::max(1, height * thumbnail_size / width);
+      } else {
+        scaled_width = std::max(1, width * thumbnail_size / height);
+      }
+
+      heif_scaling_options* options = heif_scaling_options_alloc();
+      options->filter = heif_scaling_filter_box;
+
+      heif_image* scaled;
+      heif_error err = heif_image_scale_image(result.image.get(), &scaled,
+                                              scaled_width, scaled_height, options);
+      heif_scaling_options_free(options);
+      if (err.code) {
+        throw RequestError(std::string("could not scale image: ") + err.message);
+      }
+      result.image.reset(scaled, heif_image_release);
+    }
+
+    return result;
+  });
+
+  const heif_image* image = decoded.image.get();
+  int width = heif_image_get_width(image, heif_channel_interleaved);
+  int height = heif_image_get_height(image, heif_channel_interleaved);
+  int channels = (heif_image_get_chroma_format(image) == heif_chroma_interleaved_32bit ? 4 : 3);
+  int stride;
+  const uint8_t* data = heif_image_get_plane_readonly(image, heif_channel_interleaved, &stride);
+
+  size_t row_size = static_cast<size_t>(width) * channels;
+  size_t size = row_size * height;
+
+  int shm_fd = CreateSharedMemory(size);
+  if (shm_fd < 0) {
+    throw RequestError(std::string("cannot create shared memory: ") + strerror(errno));
+  }
+
+  void* mem = (size > 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0) : nullptr);
+  if (mem == MAP_FAILED) {
+    close(shm_fd);
+    throw RequestError(std::string("cannot map shared memory: ") + strerror(errno));
+  }
+
+  for (int y = 0; y < height; y++) {
+    memcpy(static_cast<uint8_t*>(mem) + y * row_size, data + y * static_cast<size_t>(stride), row_size);
+  }
+  if (mem) {
+    munmap(mem, size);
+  }
+
+  std::ostringstream reply;
+  reply << "OK " << width << " " << height << " " << channels << " " << row_size;
+  connection.Reply(reply.str(), shm_fd);
+  close(shm_fd);
+}
+
+
+void Daemon::HandleConvert(Connection& connection, const std::string& args) {
+  size_t space = args.find(' ');
+  if (space == std::string::npos) {
+    throw RequestError("usage: CONVERT <output> <input>");
+  }
+
+  std::string output = args.substr(0, space);
+  std::string path = args.substr(space + 1);
+
+  std::string type;
+  bool output_fd = false;
+  if (output.size() >= 2 && output.compare(output.size() - 2, 2, ":-") == 0) {
+    type = output.substr(0, output.size() - 2);
+    output_fd = true;
+  } else {
+    size_t dot = output.rfind('.');
+    if (dot != std::string::npos) {
+      type = output.substr(dot + 1);
+    }
+  }
+
+  std::unique_ptr<Encoder> encoder = CreateEncoder(type);
+  if (!encoder) {
+    throw RequestError("unknown output type '" + type + "'");
+  }
+
+  // The output comes first on the line, so its descriptor is taken first.
+  Input out;
+  if (output_fd) {
+    out.fd = connection.TakeFd();
+    if (out.fd < 0) {
+      throw RequestError("no output file descriptor received");
+    }
+  }
+
+  Input input;
+  OpenInput(connection, path, input);
+
+  // Encoders choose their own decoded format, which is therefore part of the cache key.
+  const Encoder* enc = encoder.get();
+  DecodedImage decoded = GetImage(input, "encoder:" + type,
+      [enc](const std::shared_ptr<const heif_image_handle>& handle) {
+    DecodedImage result;
+    result.handle = handle;
+
+    bool has_alpha = heif_image_handle_has_alpha_channel(handle.get());
+    heif_decoding_options* options = heif_decoding_options_alloc();
+    enc->UpdateDecodingOptions(handle.get(), options);
+
+    heif_image* image;
+    heif_error err = heif_decode_image(handle.get(), &image,
+                                       enc->colorspace(has_alpha), enc->chroma(has_alpha),
+                                       options);
+    heif_decoding_options_free(options);
+    if (err.code) {
+      throw RequestError(std::string("could not decode image: ") + err.message);
+    }
+
+    result.image.reset(image, heif_image_release);
+    return result;
+  });
+
+  bool written;
+  if (output_fd) {
+    FILE* fp = fdopen(out.fd, "wb");
+    if (!fp) {
+      throw RequestError(std::string("cannot open output: ") + strerror(errno));
+    }
+    out.fd = -1;  // now owned by 'fp'
+    written = encoder->Encode(decoded.handle.get(), decoded.image.get(), fp);
+    written = (fclose(fp) == 0) && written;
+  } else {
+    written = encoder->Encode(decoded.handle.get(), decoded.image.get(), output);
+  }
+
+  if (!written) {
+    throw RequestError("could not write image");
+  }
+
+  connection.Reply("OK");
+}
+
+
+bool Daemon::HandleRequest(Connection& connection, const std::string& line) {
+  size_t space = line.find(' ');
+  std::string command = line.substr(0, space);
+  std::string args = (space == std::string::npos ? "" : line.substr(space + 1));
+
+  try {
+    if (connection.DescriptorsLost()) {
+      throw RequestError("too many file descriptors");
+    }
+
+    if (command == "DECODE") {
+      HandleDecode(connection, args, 0);
+    } else if (command == "THUMBNAIL") {
+      size_t size_end = args.find(' ');
+      int size = atoi(args.substr(0, size_end).c_str());
+      if (size_end == std::string::npos || size <= 0) {
+        throw RequestError("usage: THUMBNAIL <size> <input>");
+      }
+      HandleDecode(connection, args.substr(size_end + 1), size);
+    } else if (command == "CONVERT") {
+      HandleConvert(connection, args);
+    } else if (command == "STATS") {
+      connection.Reply("OK " + cache_.Stats());
+    } else {
+      throw RequestError("unknown command '" + command + "'");
+    }
+  } catch (const RequestError& err) {
+    if (!connection.Reply("ERROR " + err.message)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void Daemon::ServeRequest(const std::shared_ptr<Connection>& connection) {
+  std::string line;
+  switch (connection->ReadLine(line)) {
+  case Connection::kLine:
+    if (HandleRequest(*connection, line)) {
+      // Further requests of this connection queue up behind those of the other connections.
+      pool_.Submit([this, connection]() { ServeRequest(connection); });
+    }
+    break;
+  case Connection::kWouldBlock:
+    WaitForRequest(connection);
+    break;
+  case Connection::kLineTooLong:
+    // The end of the line is unknown, so the following requests cannot be found.
+    connection->Reply("ERROR request line too long");
+    break;
+  case Connection::kClosed:
+    break;
+  }
+
+  // Connections that are not passed on are closed with the last reference.
+}
+
+
+void Daemon::WaitForRequest(const std::shared_ptr<Connection>& connection) {
+  {
+    std::lock_guard<std::mutex> lock(waiting_mutex_);
+    waiting_.push_back(connection);
+  }
+
+  char wake = 0;
+  if (write(wake_pipe_.write_fd, &wake, 1) < 0 && errno != EAGAIN) {
+    fprintf(stderr, "Cannot wake up the daemon: %s\n", strerror(errno));
+  }
+}
+
+
+void Daemon::Run(int listen_fd) {
+  if (wake_pipe_.read_fd < 0) {
+    fprintf(stderr, "Cannot create pipe\n");
+    return;
+  }
+
+  // Connections without a request in progress, by descriptor.
+  std::map<int, std::shared_ptr<Connection>> idle;
+
+  std::vector<struct pollfd> fds;
+
+  for (;;) {
+    fds.clear();
+    fds.push_back({ listen_fd, POLLIN, 0 });
+    fds.push_back({ wake_pipe_.read_fd, POLLIN, 0 });
+    for (const auto& entry : idle) {
+      fds.push_back({ entry.first, POLLIN, 0 });
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "poll failed: %s\n", strerror(errno));
+      return;
+    }
+
+    // Readable (or closed) connections get a pool thread for their next request.
+    for (size_t i = 2; i < fds.size(); i++) {
+      if (fds[i].revents) {
+        auto iter = idle.find(fds[i].fd);
+        std::shared_ptr<Connection> connection = iter->second;
+        idle.erase(iter);
+        pool_.Submit([this, connection]() { ServeRequest(connection); });
+      }
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char data[256];
+      while (read(wake_pipe_.read_fd, data, sizeof(data)) > 0) {
+      }
+
+      std::lock_guard<std::mutex> lock(waiting_mutex_);
+      for (auto& connection : waiting_) {
+        idle[connection->fd()] = connection;
+      }
+      waiting_.clear();
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        fprintf(stderr, "accept failed: %s\n", strerror(errno));
+        return;
+      }
+
+      idle[fd] = std::make_shared<Connection>(fd);
+    }
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  int opt;
+  int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+  int cache_megabytes = 256;
+  while ((opt = getopt(argc, argv, "j:c:")) != -1) {
+    switch (opt) {
+    case 'j':
+      num_threads = atoi(optarg);
+      break;
+    case 'c':
+      cache_megabytes = atoi(optarg);
+      break;
+    default: /* '?' */
+      return usage(argv[0]);
+    }
+  }
+
+  if (optind + 1 != argc) {
+    return usage(argv[0]);
+  }
+
+  num_threads = std::max(num_threads, 1);
+  cache_megabytes = std::max(cache_megabytes, 0);
+
+  std::string socket_path(argv[optind]);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long\n");
+    return 1;
+  }
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    fprintf(stderr, "Cannot create socket: %s\n", strerror(errno));
+    return 1;
+  }
+
+  unlink(socket_path.c_str());
+  if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Cannot listen on %s: %s\n", socket_path.c_str(), strerror(errno));
+    close(listen_fd);
+    return 1;
+  }
+
+  // A client closing its connection must not terminate the daemon.
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("Listening on %s with %d threads\n", socket_path.c_str(), num_threads);
+  fflush(stdout);
+
+  // Up to 'num_threads' requests are processed in parallel, further requests wait in
+  // the queue of the pool.
+  Daemon daemon(static_cast<size_t>(cache_megabytes) * 1024 * 1024, num_threads);
+  daemon.Run(listen_fd);
+
+  close(listen_fd);
+  return 1;
+}
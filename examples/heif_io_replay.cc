@@ -0,0 +1,431 @@
+/*
+ * libheif example application "io-replay".
+ * Copyright (c) 2018 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of io-replay, an example application using libheif.
+ *
+ * io-replay is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * io-replay is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with io-replay.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replays I/O traces written by heif_io_recorder_write_trace() (e.g. with
+ * 'heif-convert -r trace.txt') against a simulated block cache, as used when
+ * files are read with HTTP range requests from remote storage.
+ *
+ * The file is divided into blocks of a fixed size. A read that touches blocks
+ * which are not cached issues one request for each run of missing blocks. With
+ * prefetching, each request additionally fetches the following blocks. The head
+ * option fetches the start of the file with a single request before the trace is
+ * replayed, as a client would do to get the 'meta' box in one go.
+ *
+ * For each combination of block size and prefetch, the number of requests, the
+ * number of fetched bytes, the read amplification (fetched / used bytes) and the
+ * cache hit ratio are reported.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+struct TraceRead
+{
+  uint64_t offset;
+  uint64_t length;
+  std::string stage;
+  uint32_t item_id;
+};
+
+
+struct Trace
+{
+  uint64_t file_size = 0;  // 0 if unknown
+  std::vector<TraceRead> reads;
+};
+
+
+static bool ReadTrace(const char* filename, Trace* trace)
+{
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "Cannot open trace file %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+
+  char line[256];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    line_number++;
+
+    if (line[0] == '#') {
+      unsigned long long file_size;
+      if (sscanf(line, "# file_size %llu", &file_size) == 1) {
+        trace->file_size = file_size;
+      }
+      continue;
+    }
+
+    unsigned long long offset, length;
+    char stage[64];
+    unsigned int item_id;
+    int n = sscanf(line, "%llu %llu %63s %u", &offset, &length, stage, &item_id);
+    if (n == EOF) {
+      continue;
+    }
+    if (n != 4) {
+      fprintf(stderr, "%s:%d: invalid trace line\n", filename, line_number);
+      fclose(fp);
+      return false;
+    }
+
+    TraceRead read;
+    read.offset = offset;
+    read.length = length;
+    read.stage = stage;
+    read.item_id = item_id;
+    trace->reads.push_back(read);
+  }
+
+  fclose(fp);
+  return true;
+}
+
+
+// Set of cached block indices with least-recently-used eviction.
+class BlockCache
+{
+ public:
+  // 'capacity' is the number of blocks, 0 for no limit.
+  explicit BlockCache(uint64_t capacity) : capacity_(capacity) {}
+
+  bool Lookup(uint64_t block) {
+    auto iter = blocks_.find(block);
+    if (iter == blocks_.end()) {
+      return false;
+    }
+
+    lru_.splice(lru_.begin(), lru_, iter->second);
+    return true;
+  }
+
+  void Insert(uint64_t block) {
+    if (Lookup(block)) {
+      return;
+    }
+
+    lru_.push_front(block);
+    blocks_[block] = lru_.begin();
+
+    if (capacity_ > 0 && lru_.size() > capacity_) {
+      blocks_.erase(lru_.back());
+      lru_.pop_back();
+    }
+  }
+
+ private:
+  uint64_t capacity_;
+  std::list<uint64_t> lru_;
+  std::unordered_map<uint64_t, std::list<uint64_t>::iterator> blocks_;
+};
+
+
+struct ReplayResult
+{
+  uint64_t requests = 0;
+  uint64_t bytes_fetched = 0;
+  uint64_t block_accesses = 0;
+  uint64_t block_hits = 0;
+};
+
+
+class Replay
+{
+ public:
+  Replay(uint64_t block_size, uint64_t prefetch_blocks, uint64_t cache_size, uint64_t file_size)
+      : block_size_(block_size),
+        prefetch_blocks_(prefetch_blocks),
+        file_size_(file_size),
+        cache_(cache_size ? std::max<uint64_t>(cache_size / block_size, 1) : 0) {}
+
+  // Fetch [offset, offset + length) with a single request, regardless of the cache.
+  void Fetch(uint64_t offset, uint64_t length) {
+    if (length == 0) {
+      return;
+    }
+
+    FetchBlocks(offset / block_size_, (offset + length - 1) / block_size_);
+  }
+
+  void Read(uint64_t offset, uint64_t length) {
+    if (length == 0) {
+      return;
+    }
+
+    uint64_t first = offset / block_size_;
+    uint64_t last = (offset + length - 1) / block_size_;
+
+    // Missing blocks that are adjacent are fetched together with one request.
+    uint64_t block = first;
+    while (block <= last) {
+      result_.block_accesses++;
+      if (cache_.Lookup(block)) {
+        result_.block_hits++;
+        block++;
+        continue;
+      }
+
+      uint64_t run_end = block;
+      while (run_end + 1 <= last && !cache_.Lookup(run_end + 1)) {
+        run_end++;
+        result_.block_accesses++;
+      }
+
+      FetchBlocks(block, run_end + prefetch_blocks_);
+      block = run_end + 1;
+    }
+  }
+
+  const ReplayResult& result() const { return result_; }
+
+ private:
+  void FetchBlocks(uint64_t first, uint64_t last) {
+    if (file_size_ > 0) {
+      last = std::min(last, (file_size_ - 1) / block_size_);
+
+      // Nothing to fetch for reads past the end of the file.
+      if (first > last) {
+        return;
+      }
+    }
+
+    uint64_t begin = first * block_size_;
+    uint64_t end = (last + 1) * block_size_;
+    if (file_size_ > 0) {
+      end = std::min(end, file_size_);
+    }
+
+    result_.requests++;
+    result_.bytes_fetched += end - begin;
+
+    for (uint64_t block = first; block <= last; block++) {
+      cache_.Insert(block);
+    }
+  }
+
+  uint64_t block_size_;
+  uint64_t prefetch_blocks_;
+  uint64_t file_size_;
+  BlockCache cache_;
+  ReplayResult result_;
+};
+
+
+static bool ParseSize(const char* str, uint64_t* size)
+{
+  char* end;
+  errno = 0;
+  unsigned long long value = strtoull(str, &end, 10);
+  if (errno != 0 || end == str) {
+    return false;
+  }
+
+  if (*end == 'k' || *end == 'K') {
+    value *= 1024;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    value *= 1024 * 1024;
+    end++;
+  }
+
+  if (*end != 0) {
+    return false;
+  }
+
+  *size = value;
+  return true;
+}
+
+
+static bool ParseSizeList(const char* str, std::vector<uint64_t>* sizes)
+{
+  sizes->clear();
+
+  std::string list(str);
+  size_t start = 0;
+  for (;;) {
+    size_t comma = list.find(',', start);
+    std::string element = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+
+    uint64_t size;
+    if (!ParseSize(element.c_str(), &size)) {
+      return false;
+    }
+    sizes->push_back(size);
+
+    if (comma == std::string::npos) {
+      return true;
+    }
+    start = comma + 1;
+  }
+}
+
+
+static std::string FormatSize(uint64_t size)
+{
+  char buf[32];
+  if (size >= 1024 * 1024 && size % (1024 * 1024) == 0) {
+    snprintf(buf, sizeof(buf), "%lluM", (unsigned long long)(size / (1024 * 1024)));
+  } else if (size >= 1024 && size % 1024 == 0) {
+    snprintf(buf, sizeof(buf), "%lluK", (unsigned long long)(size / 1024));
+  } else {
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long)size);
+  }
+  return buf;
+}
+
+
+static int usage(const char* command)
+{
+  fprintf(stderr, "usage: %s [options] trace-file...\n", command);
+  fprintf(stderr, "  -b sizes   block sizes, comma separated (default: 16K,64K,256K,1M)\n");
+  fprintf(stderr, "  -p counts  number of blocks to prefetch, comma separated (default: 0,1,4)\n");
+  fprintf(stderr, "  -c size    cache capacity in bytes, 0 for unlimited (default: 0)\n");
+  fprintf(stderr, "  -h size    fetch the first 'size' bytes with the first request (default: 0)\n");
+  return 1;
+}
+
+
+int main(int argc, char** argv)
+{
+  std::vector<uint64_t> block_sizes = { 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+  std::vector<uint64_t> prefetch_counts = { 0, 1, 4 };
+  uint64_t cache_size = 0;
+  uint64_t head_size = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:p:c:h:")) != -1) {
+    bool valid;
+    switch (opt) {
+    case 'b':
+      valid = ParseSizeList(optarg, &block_sizes) &&
+              std::find(block_sizes.begin(), block_sizes.end(), 0) == block_sizes.end();
+      break;
+    case 'p':
+      valid = ParseSizeList(optarg, &prefetch_counts);
+      break;
+    case 'c':
+      valid = ParseSize(optarg, &cache_size);
+      break;
+    case 'h':
+      valid = ParseSize(optarg, &head_size);
+      break;
+    default: /* '?' */
+      return usage(argv[0]);
+    }
+
+    if (!valid) {
+      fprintf(stderr, "Invalid argument for -%c: %s\n", opt, optarg);
+      return usage(argv[0]);
+    }
+  }
+
+  if (optind >= argc) {
+    return usage(argv[0]);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    Trace trace;
+    if (!ReadTrace(argv[i], &trace)) {
+      return 1;
+    }
+
+    // --- summary of the trace
+
+    struct StageSummary
+    {
+      uint64_t reads = 0;
+      uint64_t bytes = 0;
+    };
+
+    std::map<std::string, StageSummary> stages;
+    uint64_t bytes_read = 0;
+    for (const auto& read : trace.reads) {
+      stages[read.stage].reads++;
+      stages[read.stage].bytes += read.length;
+      bytes_read += read.length;
+    }
+
+    printf("%s: %zu reads, %llu bytes", argv[i], trace.reads.size(),
+           (unsigned long long)bytes_read);
+    if (trace.file_size > 0) {
+      printf(" of %llu", (unsigned long long)trace.file_size);
+    }
+    printf("\n");
+
+    for (const auto& stage : stages) {
+      printf("  %-12s %6llu reads %12llu bytes\n", stage.first.c_str(),
+             (unsigned long long)stage.second.reads,
+             (unsigned long long)stage.second.bytes);
+    }
+    printf("\n");
+
+    // --- replay with all policies
+
+    printf("%10s %9s %9s %14s %14s %9s\n",
+           "block size", "prefetch", "requests", "bytes fetched", "amplification", "hit ratio");
+
+    for (uint64_t block_size : block_sizes) {
+      for (uint64_t prefetch : prefetch_counts) {
+        Replay replay(block_size, prefetch, cache_size, trace.file_size);
+
+        replay.Fetch(0, head_size);
+        for (const auto& read : trace.reads) {
+          replay.Read(read.offset, read.length);
+        }
+
+        const ReplayResult& result = replay.result();
+        double amplification = bytes_read ? (double)result.bytes_fetched / (double)bytes_read : 0.0;
+        double hit_ratio = result.block_accesses ?
+                           (double)result.block_hits / (double)result.block_accesses : 0.0;
+
+        printf("%10s %9llu %9llu %14llu %14.2f %8.1f%%\n",
+               FormatSize(block_size).c_str(),
+               (unsigned long long)prefetch,
+               (unsigned long long)result.requests,
+               (unsigned long long)result.bytes_fetched,
+               amplification,
+               hit_ratio * 100.0);
+      }
+    }
+
+    if (i + 1 < argc) {
+      printf("\n");
+    }
+  }
+
+  return 0;
+}
@@ -51,11 +51,60 @@ HeifImage.prototype.is_primary = function() {
     return !!this.img.is_primary;
 }
 
+// Convert the decoded image to RGBA and store it in "image_data".
+HeifImage.prototype._convert = function(image_data) {
+    var w = this.img.width;
+    var h = this.img.height;
+    var yval;
+    var uval;
+    var vval;
+    var xpos = 0;
+    var ypos = 0;
+    var w2 = w >> 1;
+    var maxi = w2*h;
+    var yoffset = 0;
+    var uoffset = 0;
+    var voffset = 0;
+    var x2;
+    var i2;
+    var y = this.data;
+    var u = this.data.subarray(w * h, w * h + (w * h / 4));
+    var v = this.data.subarray(w * h + (w * h / 4), w * h + (w * h / 2));
+    var stridey = w;
+    var strideu = w / 2;
+    var stridev = w / 2;
+    var dest = image_data.data;
+    for (var i=0; i<maxi; i++) {
+        i2 = i << 1;
+        x2 = (xpos << 1);
+        yval = 1.164 * (y[yoffset + x2] - 16);
+
+        uval = u[uoffset + xpos] - 128;
+        vval = v[voffset + xpos] - 128;
+        dest[(i2<<2)+0] = yval + 1.596 * vval;
+        dest[(i2<<2)+1] = yval - 0.813 * vval - 0.391 * uval;
+        dest[(i2<<2)+2] = yval + 2.018 * uval;
+        dest[(i2<<2)+3] = 0xff;
+
+        yval = 1.164 * (y[yoffset + x2 + 1] - 16);
+        dest[((i2+1)<<2)+0] = yval + 1.596 * vval;
+        dest[((i2+1)<<2)+1] = yval - 0.813 * vval - 0.391 * uval;
+        dest[((i2+1)<<2)+2] = yval + 2.018 * uval;
+        dest[((i2+1)<<2)+3] = 0xff;
+
+        xpos++;
+        if (xpos === w2) {
+            xpos = 0;
+            ypos++;
+            yoffset += stridey;
+            uoffset = ((ypos >> 1) * strideu);
+            voffset = ((ypos >> 1) * stridev);
+        }
+    }
+};
+
 HeifImage.prototype.display = function(image_data, callback) {
     // Defer color conversion.
-    var w = this.get_width();
-    var h = this.get_height();
-
     setTimeout(function() {
         this._ensureImage();
         if (!this.img) {
@@ -64,52 +113,7 @@ HeifImage.prototype.display = function(image_data, callback) {
             return;
         }
 
-        var yval;
-        var uval;
-        var vval;
-        var xpos = 0;
-        var ypos = 0;
-        var w2 = w >> 1;
-        var maxi = w2*h;
-        var yoffset = 0;
-        var uoffset = 0;
-        var voffset = 0;
-        var x2;
-        var i2;
-        var y = this.data;
-        var u = this.data.subarray(w * h, w * h + (w * h / 4));
-        var v = this.data.subarray(w * h + (w * h / 4), w * h + (w * h / 2));
-        var stridey = w;
-        var strideu = w / 2;
-        var stridev = w / 2;
-        var dest = image_data.data;
-        for (var i=0; i<maxi; i++) {
-            i2 = i << 1;
-            x2 = (xpos << 1);
-            yval = 1.164 * (y[yoffset + x2] - 16);
-
-            uval = u[uoffset + xpos] - 128;
-            vval = v[voffset + xpos] - 128;
-            dest[(i2<<2)+0] = yval + 1.596 * vval;
-            dest[(i2<<2)+1] = yval - 0.813 * vval - 0.391 * uval;
-            dest[(i2<<2)+2] = yval + 2.018 * uval;
-            dest[(i2<<2)+3] = 0xff;
-
-            yval = 1.164 * (y[yoffset + x2 + 1] - 16);
-            dest[((i2+1)<<2)+0] = yval + 1.596 * vval;
-            dest[((i2+1)<<2)+1] = yval - 0.813 * vval - 0.391 * uval;
-            dest[((i2+1)<<2)+2] = yval + 2.018 * uval;
-            dest[((i2+1)<<2)+3] = 0xff;
-
-            xpos++;
-            if (xpos === w2) {
-                xpos = 0;
-                ypos++;
-                yoffset += stridey;
-                uoffset = ((ypos >> 1) * strideu);
-                voffset = ((ypos >> 1) * stridev);
-            }
-        }
+        this._convert(image_data);
         callback(image_data);
     }.bind(this), 0);
 };
@@ -152,10 +156,331 @@ HeifDecoder.prototype.decode = function(buffer) {
     return result;
 };
 
+
+// --- Web Worker API
+//
+// A HeifWorker runs the decoder in a Web Worker that loads libheif.js itself,
+// so decoding and color conversion do not block the page. Results are sent
+// back as transferable ImageBitmaps or drawn directly into an OffscreenCanvas.
+//
+//   var worker = new libheif.HeifWorker();
+//   worker.decode(buffer, function(images) {
+//       images[0].display(canvas, function(ok) { ... });
+//   });
+
+// URL of this script, used as the default worker script.
+var currentScriptUrl = (typeof document !== "undefined" &&
+    document.currentScript) ? document.currentScript.src : null;
+
+// Image in a file decoded by a HeifWorker. Width, height and the primary flag
+// are known without decoding the image. The image belongs to one call of
+// HeifWorker.decode(); after the next call, it can no longer be decoded.
+var HeifWorkerImage = function(worker, generation, index, info) {
+    this.worker = worker;
+    this.generation = generation;
+    this.index = index;
+    this.width = info.width;
+    this.height = info.height;
+    this.primary = info.is_primary;
+};
+
+HeifWorkerImage.prototype.get_width = function() {
+    return this.width;
+};
+
+HeifWorkerImage.prototype.get_height = function() {
+    return this.height;
+};
+
+HeifWorkerImage.prototype.is_primary = function() {
+    return this.primary;
+};
+
+HeifWorkerImage.prototype.free = function() {
+    this.worker._call({"cmd": "free", "generation": this.generation,
+        "index": this.index}, [], function() {});
+};
+
+// Decode the image and pass it to "callback" as an ImageBitmap. Browsers
+// without createImageBitmap in workers receive an ImageData instead. The
+// callback receives null if decoding failed or the image belongs to a file
+// that was replaced by a later HeifWorker.decode().
+HeifWorkerImage.prototype.get_image_bitmap = function(callback) {
+    this.worker._call({"cmd": "bitmap", "generation": this.generation,
+        "index": this.index}, [],
+        function(result) {
+            if (!result) {
+                callback(null);
+            } else if (result.bitmap) {
+                callback(result.bitmap);
+            } else {
+                callback(new ImageData(new Uint8ClampedArray(result.pixels),
+                    result.width, result.height));
+            }
+        });
+};
+
+// Decode the image and draw it into "canvas", which is resized to the image
+// size. An HTMLCanvasElement that supports transferControlToOffscreen (or an
+// OffscreenCanvas) is handed over to the worker on first use and drawn there;
+// it can afterwards only be drawn to through this worker. Other canvases are
+// drawn on the main thread from an ImageBitmap. The callback receives true on
+// success, and false for images of a file that was replaced by a later
+// HeifWorker.decode().
+HeifWorkerImage.prototype.display = function(canvas, callback) {
+    var canvas_id = this.worker._attachCanvas(canvas);
+    if (canvas_id !== null) {
+        this.worker._call({"cmd": "draw", "generation": this.generation,
+            "index": this.index, "canvas": canvas_id}, [], function(result) {
+                callback(!!result);
+            });
+        return;
+    }
+
+    this.get_image_bitmap(function(image) {
+        if (!image) {
+            callback(false);
+            return;
+        }
+
+        canvas.width = image.width;
+        canvas.height = image.height;
+        var ctx = canvas.getContext("2d");
+        if (image instanceof ImageData) {
+            ctx.putImageData(image, 0, 0);
+        } else {
+            ctx.drawImage(image, 0, 0);
+            image.close();
+        }
+        callback(true);
+    });
+};
+
+var HeifWorker = function(script_url) {
+    this.worker = new Worker(script_url || currentScriptUrl);
+    this.worker.addEventListener("message", this._onMessage.bind(this));
+    this.next_id = 1;
+    this.callbacks = {};
+    this.canvases = [];
+};
+
+HeifWorker.prototype._call = function(message, transfer, callback) {
+    var id = this.next_id++;
+    this.callbacks[id] = callback;
+    message["libheif_worker"] = id;
+    this.worker.postMessage(message, transfer);
+};
+
+HeifWorker.prototype._onMessage = function(event) {
+    var message = event.data;
+    if (!message || !message["libheif_worker"]) {
+        return;
+    }
+
+    var id = message["libheif_worker"];
+    var callback = this.callbacks[id];
+    delete this.callbacks[id];
+    if (callback) {
+        callback(message["result"]);
+    }
+};
+
+// Return the ID of the OffscreenCanvas of "canvas" in the worker, or null if
+// the canvas cannot be drawn to from the worker.
+HeifWorker.prototype._attachCanvas = function(canvas) {
+    var i;
+    for (i = 0; i < this.canvases.length; i++) {
+        if (this.canvases[i] === canvas) {
+            return i;
+        }
+    }
+
+    var offscreen;
+    if (typeof OffscreenCanvas !== "undefined" &&
+        canvas instanceof OffscreenCanvas) {
+        offscreen = canvas;
+    } else if (canvas.transferControlToOffscreen) {
+        offscreen = canvas.transferControlToOffscreen();
+    } else {
+        return null;
+    }
+
+    var canvas_id = this.canvases.length;
+    this.canvases.push(canvas);
+    this.worker.postMessage({"libheif_worker": -1, "cmd": "canvas",
+        "canvas": canvas_id, "offscreen": offscreen}, [offscreen]);
+    return canvas_id;
+};
+
+// Parse the file in "buffer" (an ArrayBuffer, which is transferred to the
+// worker) and pass the list of HeifWorkerImages to "callback". Images of a
+// previously decoded file are released, and HeifWorkerImages returned for it
+// fail from now on.
+HeifWorker.prototype.decode = function(buffer, callback) {
+    this._call({"cmd": "decode", "buffer": buffer}, [buffer],
+        function(file) {
+            var result = [];
+            for (var i = 0; i < file.images.length; i++) {
+                result.push(new HeifWorkerImage(this, file.generation, i,
+                    file.images[i]));
+            }
+            callback(result);
+        }.bind(this));
+};
+
+HeifWorker.prototype.terminate = function() {
+    this.worker.terminate();
+    this.worker = null;
+};
+
+// Worker side of the HeifWorker protocol. Messages that do not belong to it
+// are ignored, so libheif.js can also be imported into other workers.
+var HeifWorkerServer = function(scope) {
+    this.scope = scope;
+    this.decoder = new HeifDecoder();
+    this.images = [];
+    // Incremented for each decoded file, so that requests for images of an
+    // earlier file can be told apart from those for the current one.
+    this.generation = 0;
+    this.canvases = {};
+    scope.addEventListener("message", this._onMessage.bind(this));
+};
+
+HeifWorkerServer.prototype._onMessage = function(event) {
+    var message = event.data;
+    if (!message || !message["libheif_worker"]) {
+        return;
+    }
+
+    var id = message["libheif_worker"];
+    switch (message["cmd"]) {
+        case "canvas":
+            this.canvases[message["canvas"]] = message["offscreen"];
+            break;
+        case "decode":
+            this._reply(id, this._decode(message["buffer"]));
+            break;
+        case "bitmap":
+            this._bitmap(id, this._getImage(message));
+            break;
+        case "draw":
+            this._reply(id, this._draw(this._getImage(message),
+                this.canvases[message["canvas"]]));
+            break;
+        case "free":
+            var image = this._getImage(message);
+            if (image) {
+                image.free();
+            }
+            this._reply(id, true);
+            break;
+        default:
+            console.log("Unknown worker command", message["cmd"]);
+            this._reply(id, null);
+            break;
+    }
+};
+
+HeifWorkerServer.prototype._reply = function(id, result, transfer) {
+    this.scope.postMessage({"libheif_worker": id, "result": result},
+        transfer || []);
+};
+
+// Return the image addressed by "message", null if it belongs to an earlier
+// file.
+HeifWorkerServer.prototype._getImage = function(message) {
+    if (message["generation"] !== this.generation) {
+        return null;
+    }
+
+    return this.images[message["index"]] || null;
+};
+
+HeifWorkerServer.prototype._decode = function(buffer) {
+    var i;
+    for (i = 0; i < this.images.length; i++) {
+        this.images[i].free();
+    }
+
+    this.generation++;
+    this.images = this.decoder.decode(buffer);
+
+    var infos = [];
+    for (i = 0; i < this.images.length; i++) {
+        var handle = this.images[i].handle;
+        infos.push({
+            "width": libheif.heif_image_handle_get_width(handle),
+            "height": libheif.heif_image_handle_get_height(handle),
+            "is_primary": !!libheif.heif_image_handle_is_primary_image(handle)
+        });
+    }
+    return {"generation": this.generation, "images": infos};
+};
+
+// Decode "image" into a new ImageData, null if decoding failed.
+HeifWorkerServer.prototype._getImageData = function(image) {
+    if (!image || !image.handle) {
+        return null;
+    }
+
+    image._ensureImage();
+    if (!image.img) {
+        return null;
+    }
+
+    var image_data = new ImageData(image.img.width, image.img.height);
+    image._convert(image_data);
+
+    // Keep only the converted image, the YCbCr data is not needed again.
+    image.img = null;
+    image.data = null;
+    return image_data;
+};
+
+HeifWorkerServer.prototype._bitmap = function(id, image) {
+    var image_data = this._getImageData(image);
+    if (!image_data) {
+        this._reply(id, null);
+        return;
+    }
+
+    if (typeof this.scope.createImageBitmap !== "function") {
+        var pixels = image_data.data.buffer;
+        this._reply(id, {"pixels": pixels, "width": image_data.width,
+            "height": image_data.height}, [pixels]);
+        return;
+    }
+
+    this.scope.createImageBitmap(image_data).then(function(bitmap) {
+        this._reply(id, {"bitmap": bitmap}, [bitmap]);
+    }.bind(this), function(error) {
+        console.log("Could not create ImageBitmap", error);
+        this._reply(id, null);
+    }.bind(this));
+};
+
+HeifWorkerServer.prototype._draw = function(image, canvas) {
+    if (!canvas) {
+        return false;
+    }
+
+    var image_data = this._getImageData(image);
+    if (!image_data) {
+        return false;
+    }
+
+    canvas.width = image_data.width;
+    canvas.height = image_data.height;
+    canvas.getContext("2d").putImageData(image_data, 0, 0);
+    return true;
+};
+
 var libheif = {
     // Expose high-level API.
     /** @expose */
     HeifDecoder: HeifDecoder,
+    /** @expose */
+    HeifWorker: HeifWorker,
 
     // Expose low-level API.
     /** @expose */
@@ -231,6 +556,12 @@ function createNamedFunction(name, body) {
 
 var root = this;
 
+// Serve HeifWorker requests when loaded in a Web Worker.
+if (typeof WorkerGlobalScope !== "undefined" &&
+    root instanceof WorkerGlobalScope) {
+    new HeifWorkerServer(root);
+}
+
 if (typeof exports !== 'undefined') {
     if (typeof module !== 'undefined' && module.exports) {
         /** @expose */
@@ -36,6 +36,7 @@
 #include <memory>
 #include <limits>
 #include <istream>
+#include <streambuf>
 #include <string>
 
 #include "error.h"
@@ -43,6 +44,40 @@
 
 namespace heif {
 
+  // Seekable, read-only stream buffer on a memory block that is not copied.
+  class MemoryStreamBuffer : public std::streambuf
+  {
+  public:
+    MemoryStreamBuffer(const void* data, size_t size) {
+      char* begin = const_cast<char*>(static_cast<const char*>(data));
+      setg(begin, begin, begin + size);
+    }
+
+  protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which = std::ios_base::in) override {
+      char* pos;
+      switch (dir) {
+      case std::ios_base::beg: pos = eback() + off; break;
+      case std::ios_base::end: pos = egptr() + off; break;
+      default: pos = gptr() + off; break;
+      }
+
+      if (pos < eback() || pos > egptr()) {
+        return pos_type(off_type(-1));
+      }
+
+      setg(eback(), pos, egptr());
+      return pos_type(pos - eback());
+    }
+
+    pos_type seekpos(pos_type pos,
+                     std::ios_base::openmode which = std::ios_base::in) override {
+      return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+  };
+
+
   class BitstreamRange
   {
   public:
@@ -138,6 +173,8 @@ namespace heif {
 
     std::istream* get_istream() { return m_istr; }
 
+    uint64_t get_remaining_bytes() const { return m_remaining; }
+
   protected:
     void construct(std::istream* istr, uint64_t length, BitstreamRange* parent) {
       m_remaining = length;
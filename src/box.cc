@@ -231,14 +231,8 @@ Error BoxHeader::parse_full_box_header(BitstreamRange& range)
 }
 
 
-Error Box::read(BitstreamRange& range, std::shared_ptr<heif::Box>* result)
+std::shared_ptr<Box> Box::create(const BoxHeader& hdr)
 {
-  BoxHeader hdr;
-  hdr.parse(range);
-  if (range.error()) {
-    return range.get_error();
-  }
-
   std::shared_ptr<Box> box;
 
   switch (hdr.get_short_type()) {
@@ -306,10 +300,18 @@ Error Box::read(BitstreamRange& range, std::shared_ptr<heif::Box>* result)
     box = std::make_shared<Box_iref>(hdr);
     break;
 
+  case fourcc("colr"):
+    box = std::make_shared<Box_colr>(hdr);
+    break;
+
   case fourcc("hvcC"):
     box = std::make_shared<Box_hvcC>(hdr);
     break;
 
+  case fourcc("av1C"):
+    box = std::make_shared<Box_av1C>(hdr);
+    break;
+
   case fourcc("idat"):
     box = std::make_shared<Box_idat>(hdr);
     break;
@@ -331,10 +333,26 @@ Error Box::read(BitstreamRange& range, std::shared_ptr<heif::Box>* result)
     break;
 
   default:
-    box = std::make_shared<Box>(hdr);
     break;
   }
 
+  return box;
+}
+
+
+Error Box::read(BitstreamRange& range, std::shared_ptr<heif::Box>* result)
+{
+  BoxHeader hdr;
+  hdr.parse(range);
+  if (range.error()) {
+    return range.get_error();
+  }
+
+  std::shared_ptr<Box> box = create(hdr);
+  if (!box) {
+    box = std::make_shared<Box>(hdr);
+  }
+
   if (hdr.get_box_size() < hdr.get_header_size()) {
     std::stringstream sstr;
     sstr << "Box size (" << hdr.get_box_size() << " bytes) smaller than header size ("
@@ -361,6 +379,167 @@ Error Box::read(BitstreamRange& range, std::shared_ptr<heif::Box>* result)
 }
 
 
+// Boxes whose content consists of child boxes, after an optional full-box header and
+// entry count. When visiting, their children are reported individually instead of
+// parsing the container as a whole.
+static const struct {
+  uint32_t type;
+  bool full_box;
+  int entry_count_size;  // in bytes, -1: depends on the box version
+} container_boxes[] = {
+  { fourcc("meta"), true,  0 },
+  { fourcc("iinf"), true, -1 },
+  { fourcc("iprp"), false, 0 },
+  { fourcc("ipco"), false, 0 },
+  { fourcc("dinf"), false, 0 },
+  { fourcc("dref"), true,  4 },
+  { fourcc("moov"), false, 0 },
+  { fourcc("trak"), false, 0 },
+  { fourcc("edts"), false, 0 },
+  { fourcc("mdia"), false, 0 },
+  { fourcc("minf"), false, 0 },
+  { fourcc("stbl"), false, 0 },
+  { fourcc("mvex"), false, 0 },
+  { fourcc("moof"), false, 0 },
+  { fourcc("traf"), false, 0 },
+  { fourcc("mfra"), false, 0 },
+  { fourcc("udta"), false, 0 },
+  { fourcc("sinf"), false, 0 },
+  { fourcc("schi"), false, 0 }
+};
+
+static const int MAX_BOX_NESTING_LEVEL = 32;
+
+
+Error Box::visit(BitstreamRange& range, BoxVisitor& visitor)
+{
+  bool stop = false;
+  return visit_children(range, visitor, 0, stop);
+}
+
+
+Error Box::visit_children(BitstreamRange& range, BoxVisitor& visitor, int depth, bool& stop)
+{
+  if (depth > MAX_BOX_NESTING_LEVEL) {
+    std::stringstream sstr;
+    sstr << "Maximum box nesting level " << MAX_BOX_NESTING_LEVEL << " exceeded.";
+
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 sstr.str());
+  }
+
+  std::istream* istr = range.get_istream();
+
+  while (!range.eof() && !range.error() && !stop) {
+    uint64_t offset = static_cast<uint64_t>(istr->tellg());
+
+    BoxHeader hdr;
+    hdr.parse(range);
+    if (range.error()) {
+      return range.get_error();
+    }
+
+    uint64_t content_size;
+    if (hdr.get_box_size() == size_until_end_of_file) {
+      content_size = range.get_remaining_bytes();
+    }
+    else if (hdr.get_box_size() < hdr.get_header_size()) {
+      std::stringstream sstr;
+      sstr << "Box size (" << hdr.get_box_size() << " bytes) smaller than header size ("
+           << hdr.get_header_size() << " bytes)";
+
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size,
+                   sstr.str());
+    }
+    else {
+      content_size = hdr.get_box_size() - hdr.get_header_size();
+    }
+
+    BitstreamRange boxrange(istr, content_size, &range);
+
+    bool is_container = false;
+    for (const auto& container : container_boxes) {
+      if (container.type != hdr.get_short_type()) {
+        continue;
+      }
+
+      is_container = true;
+
+      std::ostringstream fields;
+
+      if (container.full_box) {
+        hdr.parse_full_box_header(boxrange);
+        fields << "version: " << ((int)hdr.get_version()) << "\n"
+               << "flags: " << std::hex << hdr.get_flags() << std::dec << "\n";
+      }
+
+      int entry_count_size = container.entry_count_size;
+      if (entry_count_size < 0) {
+        entry_count_size = (hdr.get_version() > 0) ? 4 : 2;
+      }
+
+      if (entry_count_size > 0) {
+        uint32_t entry_count = (entry_count_size == 2) ? boxrange.read16() : boxrange.read32();
+        fields << "entry count: " << entry_count << "\n";
+      }
+
+      if (boxrange.error()) {
+        return boxrange.get_error();
+      }
+
+      BoxVisitor::Action action = visitor.begin_box(hdr, offset, depth, fields.str());
+      if (action == BoxVisitor::Stop) {
+        stop = true;
+      }
+      else if (action == BoxVisitor::Continue) {
+        Error err = visit_children(boxrange, visitor, depth+1, stop);
+        if (err) {
+          return err;
+        }
+      }
+
+      if (!stop) {
+        visitor.end_box(hdr, offset, depth);
+      }
+
+      break;
+    }
+
+    if (!is_container) {
+      std::shared_ptr<Box> box = create(hdr);
+      std::string fields;
+
+      if (box) {
+        Error err = box->parse(boxrange);
+        if (err) {
+          return err;
+        }
+
+        Indent indent;
+        fields = box->dump(indent);
+
+        // remove the type and size lines of the header, these are reported separately
+        for (int i=0;i<2;i++) {
+          size_t pos = fields.find('\n');
+          fields.erase(0, pos == std::string::npos ? pos : pos+1);
+        }
+      }
+
+      const BoxHeader& box_header = (box ? *box : hdr);
+      if (visitor.begin_box(box_header, offset, depth, fields) == BoxVisitor::Stop) {
+        stop = true;
+      }
+    }
+
+    boxrange.skip_to_end_of_box();
+  }
+
+  return range.get_error();
+}
+
+
 std::string Box::dump(Indent& indent ) const
 {
   std::ostringstream sstr;
@@ -749,7 +928,7 @@ std::string Box_iloc::dump(Indent& indent) const
 
 Error Box_iloc::read_data(const Item& item, std::istream& istr,
                           const std::shared_ptr<Box_idat>& idat,
-                          std::vector<uint8_t>* dest) const
+                          std::vector<uint8_t>* dest)
 {
   istr.clear();
 
@@ -1158,18 +1337,73 @@ std::string Box_imir::dump(Indent& indent) const
 }
 
 
+Error Box_colr::parse(BitstreamRange& range)
+{
+  m_color_type = range.read32();
+
+  if (m_color_type == fourcc("nclx")) {
+    m_colour_primaries = range.read16();
+    m_transfer_characteristics = range.read16();
+    m_matrix_coefficients = range.read16();
+    m_full_range_flag = (range.read8() & 0x80) != 0;
+  }
+  else if (m_color_type == fourcc("rICC") ||
+           m_color_type == fourcc("prof")) {
+    uint64_t size = range.get_remaining_bytes();
+
+    if (size > (uint64_t)MAX_MEMORY_BLOCK_SIZE) {
+      std::stringstream sstr;
+      sstr << "ICC profile size exceeds security limit of "
+           << MAX_MEMORY_BLOCK_SIZE << " bytes";
+
+      return Error(heif_error_Memory_allocation_error,
+                   heif_suberror_Security_limit_exceeded,
+                   sstr.str());
+    }
+
+    if (range.read(size)) {
+      m_icc_profile.resize(size);
+      range.get_istream()->read((char*)m_icc_profile.data(), size);
+    }
+  }
+
+  return range.get_error();
+}
+
+
+std::string Box_colr::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+
+  sstr << indent << "colour_type: " << to_fourcc(m_color_type) << "\n";
+
+  if (is_nclx()) {
+    sstr << indent << "colour_primaries: " << m_colour_primaries << "\n"
+         << indent << "transfer_characteristics: " << m_transfer_characteristics << "\n"
+         << indent << "matrix_coefficients: " << m_matrix_coefficients << "\n"
+         << indent << "full_range_flag: " << m_full_range_flag << "\n";
+  }
+  else {
+    sstr << indent << "ICC profile size: " << m_icc_profile.size() << " bytes\n";
+  }
+
+  return sstr.str();
+}
+
+
 Error Box_clap::parse(BitstreamRange& range)
 {
   //parse_full_box_header(range);
 
-  m_clean_aperture_width.numerator   = range.read32();
-  m_clean_aperture_width.denominator = range.read32();
-  m_clean_aperture_height.numerator   = range.read32();
-  m_clean_aperture_height.denominator = range.read32();
-  m_horizontal_offset.numerator   = range.read32();
-  m_horizontal_offset.denominator = range.read32();
-  m_vertical_offset.numerator   = range.read32();
-  m_vertical_offset.denominator = range.read32();
+  m_aperture.clean_aperture_width.numerator   = range.read32();
+  m_aperture.clean_aperture_width.denominator = range.read32();
+  m_aperture.clean_aperture_height.numerator   = range.read32();
+  m_aperture.clean_aperture_height.denominator = range.read32();
+  m_aperture.horizontal_offset.numerator   = range.read32();
+  m_aperture.horizontal_offset.denominator = range.read32();
+  m_aperture.vertical_offset.numerator   = range.read32();
+  m_aperture.vertical_offset.denominator = range.read32();
 
   return range.get_error();
 }
@@ -1180,68 +1414,68 @@ std::string Box_clap::dump(Indent& indent) const
   std::ostringstream sstr;
   sstr << Box::dump(indent);
 
-  sstr << indent << "clean_aperture: " << m_clean_aperture_width.numerator
-       << "/" << m_clean_aperture_width.denominator << " x "
-       << m_clean_aperture_height.numerator << "/"
-       << m_clean_aperture_height.denominator << "\n";
-  sstr << indent << "offset: " << m_horizontal_offset.numerator << "/"
-       << m_horizontal_offset.denominator << " ; "
-       << m_vertical_offset.numerator << "/"
-       << m_vertical_offset.denominator << "\n";
+  sstr << indent << "clean_aperture: " << m_aperture.clean_aperture_width.numerator
+       << "/" << m_aperture.clean_aperture_width.denominator << " x "
+       << m_aperture.clean_aperture_height.numerator << "/"
+       << m_aperture.clean_aperture_height.denominator << "\n";
+  sstr << indent << "offset: " << m_aperture.horizontal_offset.numerator << "/"
+       << m_aperture.horizontal_offset.denominator << " ; "
+       << m_aperture.vertical_offset.numerator << "/"
+       << m_aperture.vertical_offset.denominator << "\n";
 
   return sstr.str();
 }
 
 
-int Box_clap::left_rounded(int image_width) const
+int CleanAperture::left_rounded(int image_width) const
 {
   // pcX = horizOff + (width  - 1)/2
   // pcX ± (cleanApertureWidth - 1)/2
 
   // left = horizOff + (width-1)/2 - (clapWidth-1)/2
 
-  Fraction pcX  = m_horizontal_offset + Fraction(image_width-1, 2);
-  Fraction left = pcX - (m_clean_aperture_width-1)/2;
+  Fraction pcX  = horizontal_offset + Fraction(image_width-1, 2);
+  Fraction left = pcX - (clean_aperture_width-1)/2;
 
   return left.round();
 }
 
-int Box_clap::right_rounded(int image_width) const
+int CleanAperture::right_rounded(int image_width) const
 {
-  Fraction pcX  = m_horizontal_offset + Fraction(image_width-1, 2);
-  Fraction right = pcX + (m_clean_aperture_width-1)/2;
+  Fraction pcX  = horizontal_offset + Fraction(image_width-1, 2);
+  Fraction right = pcX + (clean_aperture_width-1)/2;
 
   return right.round();
 }
 
-int Box_clap::top_rounded(int image_height) const
+int CleanAperture::top_rounded(int image_height) const
 {
-  Fraction pcY  = m_vertical_offset + Fraction(image_height-1, 2);
-  Fraction top = pcY - (m_clean_aperture_height-1)/2;
+  Fraction pcY  = vertical_offset + Fraction(image_height-1, 2);
+  Fraction top = pcY - (clean_aperture_height-1)/2;
 
   return top.round();
 }
 
-int Box_clap::bottom_rounded(int image_height) const
+int CleanAperture::bottom_rounded(int image_height) const
 {
-  Fraction pcY  = m_vertical_offset + Fraction(image_height-1, 2);
-  Fraction bottom = pcY + (m_clean_aperture_height-1)/2;
+  Fraction pcY  = vertical_offset + Fraction(image_height-1, 2);
+  Fraction bottom = pcY + (clean_aperture_height-1)/2;
 
   return bottom.round();
 }
 
-int Box_clap::get_width_rounded() const
+int CleanAperture::get_width_rounded() const
 {
-  int left  = (Fraction(0,1)-(m_clean_aperture_width-1)/2).round();
-  int right = (  (m_clean_aperture_width-1)/2).round();
+  int left  = (Fraction(0,1)-(clean_aperture_width-1)/2).round();
+  int right = (  (clean_aperture_width-1)/2).round();
 
   return right+1-left;
 }
 
-int Box_clap::get_height_rounded() const
+int CleanAperture::get_height_rounded() const
 {
-  int top    = (Fraction(0,1)-(m_clean_aperture_height-1)/2).round();
-  int bottom = ( (m_clean_aperture_height-1)/2).round();
+  int top    = (Fraction(0,1)-(clean_aperture_height-1)/2).round();
+  int bottom = ( (clean_aperture_height-1)/2).round();
 
   return bottom+1-top;
 }
@@ -1506,6 +1740,95 @@ bool Box_hvcC::get_headers(std::vector<uint8_t>* dest) const
 }
 
 
+Error Box_av1C::parse(BitstreamRange& range)
+{
+  uint8_t byte = range.read8();
+  if ((byte & 0x80) == 0) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Unspecified,
+                 "av1C marker bit not set");
+  }
+
+  m_version = byte & 0x7F;
+  if (m_version != 1) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_data_version,
+                 "Unsupported av1C version");
+  }
+
+  byte = range.read8();
+  m_seq_profile = (byte >> 5) & 0x07;
+  m_seq_level_idx_0 = byte & 0x1F;
+
+  byte = range.read8();
+  m_seq_tier_0 = (byte >> 7) & 1;
+  m_high_bitdepth = (byte >> 6) & 1;
+  m_twelve_bit = (byte >> 5) & 1;
+  m_monochrome = (byte >> 4) & 1;
+  m_chroma_subsampling_x = (byte >> 3) & 1;
+  m_chroma_subsampling_y = (byte >> 2) & 1;
+  m_chroma_sample_position = byte & 0x03;
+
+  byte = range.read8();
+  m_initial_presentation_delay_present = (byte >> 4) & 1;
+  m_initial_presentation_delay_minus_one = byte & 0x0F;
+
+  if (range.error()) {
+    return range.get_error();
+  }
+
+  uint64_t nBytes = range.get_remaining_bytes();
+  if (nBytes > 0) {
+    if (nBytes > static_cast<uint64_t>(MAX_MEMORY_BLOCK_SIZE)) {
+      return Error(heif_error_Memory_allocation_error,
+                   heif_suberror_Security_limit_exceeded);
+    }
+
+    m_config_OBUs.resize(static_cast<size_t>(nBytes));
+    if (range.read(nBytes)) {
+      range.get_istream()->read((char*)m_config_OBUs.data(), static_cast<std::streamsize>(nBytes));
+    }
+  }
+
+  return range.get_error();
+}
+
+
+std::string Box_av1C::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+
+  sstr << indent << "version: " << ((int)m_version) << "\n"
+       << indent << "seq_profile: " << ((int)m_seq_profile) << "\n"
+       << indent << "seq_level_idx_0: " << ((int)m_seq_level_idx_0) << "\n"
+       << indent << "seq_tier_0: " << ((int)m_seq_tier_0) << "\n"
+       << indent << "high_bitdepth: " << ((int)m_high_bitdepth) << "\n"
+       << indent << "twelve_bit: " << ((int)m_twelve_bit) << "\n"
+       << indent << "monochrome: " << ((int)m_monochrome) << "\n"
+       << indent << "chroma_subsampling_x: " << ((int)m_chroma_subsampling_x) << "\n"
+       << indent << "chroma_subsampling_y: " << ((int)m_chroma_subsampling_y) << "\n"
+       << indent << "chroma_sample_position: " << ((int)m_chroma_sample_position) << "\n";
+
+  if (m_initial_presentation_delay_present) {
+    sstr << indent << "initial_presentation_delay: "
+         << ((int)m_initial_presentation_delay_minus_one + 1) << "\n";
+  }
+
+  sstr << indent << "config OBUs: " << m_config_OBUs.size() << " bytes\n";
+
+  return sstr.str();
+}
+
+
+bool Box_av1C::get_headers(std::vector<uint8_t>* dest) const
+{
+  dest->insert(dest->end(), m_config_OBUs.begin(), m_config_OBUs.end());
+
+  return true;
+}
+
+
 Error Box_idat::parse(BitstreamRange& range)
 {
   //parse_full_box_header(range);
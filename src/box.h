@@ -34,6 +34,7 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <array>
 #include <limits>
 #include <istream>
 
@@ -124,6 +125,27 @@ namespace heif {
 
 
 
+  // Receives the boxes found by Box::visit() in file order.
+  class BoxVisitor {
+  public:
+    virtual ~BoxVisitor() { }
+
+    enum Action {
+      Continue,      // also visit the children of container boxes
+      SkipChildren,
+      Stop
+    };
+
+    // 'fields' are the parsed contents of the box as "name: value" lines. It is empty
+    // for box types that are not parsed.
+    virtual Action begin_box(const BoxHeader& hdr, uint64_t offset, int depth,
+                             const std::string& fields) = 0;
+
+    // Called for container boxes after their children have been visited.
+    virtual void end_box(const BoxHeader& hdr, uint64_t offset, int depth) { }
+  };
+
+
   class Box : public BoxHeader {
   public:
     Box(const BoxHeader& hdr) : BoxHeader(hdr) { }
@@ -131,6 +153,10 @@ namespace heif {
 
     static Error read(BitstreamRange& range, std::shared_ptr<heif::Box>* box);
 
+    // Report all boxes in 'range' to the visitor without building the box tree.
+    // Only one box is held in memory at a time.
+    static Error visit(BitstreamRange& range, BoxVisitor& visitor);
+
     virtual Error write(std::ostream& ostr) const { return Error::Ok; }
 
     virtual std::string dump(Indent&) const;
@@ -143,6 +169,11 @@ namespace heif {
   protected:
     virtual Error parse(BitstreamRange& range);
 
+    // Returns nullptr for box types that we do not parse.
+    static std::shared_ptr<Box> create(const BoxHeader& hdr);
+
+    static Error visit_children(BitstreamRange& range, BoxVisitor& visitor, int depth, bool& stop);
+
     std::vector<std::shared_ptr<Box>> m_children;
 
     const static int READ_CHILDREN_ALL = -1;
@@ -242,9 +273,9 @@ namespace heif {
 
     const std::vector<Item>& get_items() const { return m_items; }
 
-    Error read_data(const Item& item, std::istream& istr,
-                    const std::shared_ptr<class Box_idat>&,
-                    std::vector<uint8_t>* dest) const;
+    static Error read_data(const Item& item, std::istream& istr,
+                           const std::shared_ptr<class Box_idat>&,
+                           std::vector<uint8_t>* dest);
     //Error read_all_data(std::istream& istr, std::vector<uint8_t>* dest) const;
 
   protected:
@@ -429,12 +460,9 @@ namespace heif {
   };
 
 
-  class Box_clap : public Box {
+  // Values of a 'clap' box. They are kept without the box when the box tree is released.
+  class CleanAperture {
   public:
-  Box_clap(const BoxHeader& hdr) : Box(hdr) { }
-
-    std::string dump(Indent&) const override;
-
     int left_rounded(int image_width) const;  // first column
     int right_rounded(int image_width) const; // last column that is part of the cropped image
     int top_rounded(int image_height) const;   // first row
@@ -443,14 +471,61 @@ namespace heif {
     int get_width_rounded() const;
     int get_height_rounded() const;
 
+    Fraction clean_aperture_width;
+    Fraction clean_aperture_height;
+    Fraction horizontal_offset;
+    Fraction vertical_offset;
+  };
+
+
+  class Box_clap : public Box {
+  public:
+  Box_clap(const BoxHeader& hdr) : Box(hdr) { }
+
+    std::string dump(Indent&) const override;
+
+    const CleanAperture& get_clean_aperture() const { return m_aperture; }
+
   protected:
     Error parse(BitstreamRange& range) override;
 
   private:
-    Fraction m_clean_aperture_width;
-    Fraction m_clean_aperture_height;
-    Fraction m_horizontal_offset;
-    Fraction m_vertical_offset;
+    CleanAperture m_aperture;
+  };
+
+
+  class Box_colr : public Box {
+  public:
+  Box_colr(const BoxHeader& hdr) : Box(hdr) { }
+
+    std::string dump(Indent&) const override;
+
+    // 'nclx', 'rICC' (restricted ICC) or 'prof' (unrestricted ICC)
+    uint32_t get_color_type() const { return m_color_type; }
+
+    bool is_nclx() const { return m_color_type == fourcc("nclx"); }
+
+    uint16_t get_colour_primaries() const { return m_colour_primaries; }
+    uint16_t get_transfer_characteristics() const { return m_transfer_characteristics; }
+    uint16_t get_matrix_coefficients() const { return m_matrix_coefficients; }
+    bool get_full_range_flag() const { return m_full_range_flag; }
+
+    const std::vector<uint8_t>& get_icc_profile() const { return m_icc_profile; }
+
+  protected:
+    Error parse(BitstreamRange& range) override;
+
+  private:
+    uint32_t m_color_type = 0;
+
+    // nclx
+    uint16_t m_colour_primaries = 2;
+    uint16_t m_transfer_characteristics = 2;
+    uint16_t m_matrix_coefficients = 2;
+    bool m_full_range_flag = false;
+
+    // rICC / prof
+    std::vector<uint8_t> m_icc_profile;
   };
 
 
@@ -531,6 +606,37 @@ namespace heif {
   };
 
 
+  class Box_av1C : public Box {
+  public:
+    Box_av1C(const BoxHeader& hdr) : Box(hdr) { }
+
+    std::string dump(Indent&) const override;
+
+    // Appends the configuration OBUs (usually the sequence header).
+    bool get_headers(std::vector<uint8_t>* dest) const;
+
+  protected:
+    Error parse(BitstreamRange& range) override;
+
+  private:
+    uint8_t m_version = 0;
+    uint8_t m_seq_profile = 0;
+    uint8_t m_seq_level_idx_0 = 0;
+    uint8_t m_seq_tier_0 = 0;
+    uint8_t m_high_bitdepth = 0;
+    uint8_t m_twelve_bit = 0;
+    uint8_t m_monochrome = 0;
+    uint8_t m_chroma_subsampling_x = 0;
+    uint8_t m_chroma_subsampling_y = 0;
+    uint8_t m_chroma_sample_position = 0;
+
+    uint8_t m_initial_presentation_delay_present = 0;
+    uint8_t m_initial_presentation_delay_minus_one = 0;
+
+    std::vector<uint8_t> m_config_OBUs;
+  };
+
+
   class Box_idat : public Box {
   public:
   Box_idat(const BoxHeader& hdr) : Box(hdr) { }
@@ -55,6 +55,8 @@ const char* heif::Error::get_error_string(heif_error_code err)
   case heif_error_Usage_error: return "Usage error";
   case heif_error_Memory_allocation_error: return "Memory allocation error";
   case heif_error_Decoder_plugin_error: return "Decoder plugin generated an error";
+  case heif_error_Color_profile_does_not_exist: return "Color profile does not exist";
+  case heif_error_Encoding_error: return "Error during encoding or writing output file";
   }
 
   assert(false);
@@ -85,6 +87,7 @@ const char* heif::Error::get_error_string(heif_suberror_code err)
   case heif_suberror_No_iprp_box: return "No 'iprp' box";
   case heif_suberror_No_iref_box: return "No 'iref' box";
   case heif_suberror_No_infe_box: return "No 'infe' box";
+  case heif_suberror_No_av1C_box: return "No 'av1C' box";
   case heif_suberror_No_pict_handler: return "Not a 'pict' handler";
   case heif_suberror_Ipma_box_references_nonexisting_property: return "'ipma' box references a non-existing property";
   case heif_suberror_No_properties_assigned_to_item: return "No properties assigned to item";
@@ -106,6 +109,7 @@ const char* heif::Error::get_error_string(heif_suberror_code err)
   case heif_suberror_Nonexisting_image_channel_referenced: return "Non-existing image channel referenced";
   case heif_suberror_Unsupported_plugin_version: return "The version of the passed plugin is not supported";
   case heif_suberror_Index_out_of_range: return "Index out of range";
+  case heif_suberror_Invalid_parameter_value: return "Invalid parameter value";
 
     // --- Unsupported_feature ---
 
@@ -113,6 +117,11 @@ const char* heif::Error::get_error_string(heif_suberror_code err)
   case heif_suberror_Unsupported_image_type: return "Unsupported image type";
   case heif_suberror_Unsupported_data_version: return "Unsupported data version";
   case heif_suberror_Unsupported_color_conversion: return "Unsupported color conversion";
+  case heif_suberror_Unsupported_bit_depth: return "Unsupported bit depth";
+
+    // --- Encoding_error ---
+
+  case heif_suberror_Cannot_write_output_data: return "Cannot write output data";
   }
 
   assert(false);
@@ -219,6 +219,9 @@ EMSCRIPTEN_BINDINGS(libheif) {
   emscripten::function("heif_js_decode_image",
       &heif_js_decode_image, emscripten::allow_raw_pointers());
   EXPORT_HEIF_FUNCTION(heif_image_handle_release);
+  EXPORT_HEIF_FUNCTION(heif_image_handle_is_primary_image);
+  EXPORT_HEIF_FUNCTION(heif_image_handle_get_width);
+  EXPORT_HEIF_FUNCTION(heif_image_handle_get_height);
 
   emscripten::class_<Error>("Error")
     .constructor<>()
@@ -276,6 +279,8 @@ EMSCRIPTEN_BINDINGS(libheif) {
     .value("heif_error_Usage_error", heif_error_Usage_error)
     .value("heif_error_Memory_allocation_error", heif_error_Memory_allocation_error)
     .value("heif_error_Decoder_plugin_error", heif_error_Decoder_plugin_error)
+    .value("heif_error_Color_profile_does_not_exist", heif_error_Color_profile_does_not_exist)
+    .value("heif_error_Encoding_error", heif_error_Encoding_error)
     ;
   emscripten::enum_<heif_suberror_code>("heif_suberror_code")
     .value("heif_suberror_Unspecified", heif_suberror_Unspecified)
@@ -304,22 +309,27 @@ EMSCRIPTEN_BINDINGS(libheif) {
     .value("heif_suberror_Auxiliary_image_type_unspecified",heif_suberror_Auxiliary_image_type_unspecified)
     .value("heif_suberror_No_or_invalid_primary_image",heif_suberror_No_or_invalid_primary_image)
     .value("heif_suberror_No_infe_box",heif_suberror_No_infe_box)
+    .value("heif_suberror_No_av1C_box",heif_suberror_No_av1C_box)
     .value("heif_suberror_Security_limit_exceeded",heif_suberror_Security_limit_exceeded)
     .value("heif_suberror_Nonexisting_image_referenced",heif_suberror_Nonexisting_image_referenced)
     .value("heif_suberror_Null_pointer_argument",heif_suberror_Null_pointer_argument)
     .value("heif_suberror_Nonexisting_image_channel_referenced",heif_suberror_Nonexisting_image_channel_referenced)
     .value("heif_suberror_Unsupported_plugin_version",heif_suberror_Unsupported_plugin_version)
     .value("heif_suberror_Index_out_of_range",heif_suberror_Index_out_of_range)
+    .value("heif_suberror_Invalid_parameter_value",heif_suberror_Invalid_parameter_value)
     .value("heif_suberror_Unsupported_codec",heif_suberror_Unsupported_codec)
     .value("heif_suberror_Unsupported_image_type",heif_suberror_Unsupported_image_type)
     .value("heif_suberror_Unsupported_data_version",heif_suberror_Unsupported_data_version)
     .value("heif_suberror_Unsupported_color_conversion",heif_suberror_Unsupported_color_conversion)
+    .value("heif_suberror_Unsupported_bit_depth",heif_suberror_Unsupported_bit_depth)
+    .value("heif_suberror_Cannot_write_output_data",heif_suberror_Cannot_write_output_data)
     ;
   emscripten::enum_<heif_compression_format>("heif_compression_format")
     .value("heif_compression_undefined", heif_compression_undefined)
     .value("heif_compression_HEVC", heif_compression_HEVC)
     .value("heif_compression_AVC", heif_compression_AVC)
     .value("heif_compression_JPEG", heif_compression_JPEG)
+    .value("heif_compression_AV1", heif_compression_AV1)
     ;
   emscripten::enum_<heif_chroma>("heif_chroma")
     .value("heif_chroma_undefined", heif_chroma_undefined)
@@ -26,13 +26,16 @@
 #include "heif_image.h"
 #include "heif_api_structs.h"
 #include "heif_context.h"
+#include "heif_file_append.h"
 #include "error.h"
+#include "box.h"
 
 #if defined(__EMSCRIPTEN__)
 #include "heif-emscripten.h"
 #endif
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -83,22 +86,111 @@ void heif_context_free(heif_context* ctx)
   delete ctx;
 }
 
+heif_reading_options* heif_reading_options_alloc()
+{
+  auto options = new heif_reading_options;
+
+  options->compact_item_table = false;
+  options->io_recorder = nullptr;
+
+  return options;
+}
+
+
+void heif_reading_options_free(heif_reading_options* options)
+{
+  delete options;
+}
+
+
+struct heif_io_recorder* heif_io_recorder_alloc()
+{
+  auto recorder = new heif_io_recorder;
+  recorder->recorder = std::make_shared<IORecorder>();
+  return recorder;
+}
+
+
+void heif_io_recorder_free(struct heif_io_recorder* recorder)
+{
+  delete recorder;
+}
+
+
+void heif_io_recorder_clear(struct heif_io_recorder* recorder)
+{
+  recorder->recorder->clear();
+}
+
+
+int heif_io_recorder_get_number_of_reads(const struct heif_io_recorder* recorder)
+{
+  return static_cast<int>(recorder->recorder->get_reads().size());
+}
+
+
+int heif_io_recorder_get_reads(const struct heif_io_recorder* recorder,
+                               struct heif_io_read* reads, int size)
+{
+  if (reads == nullptr || size <= 0) {
+    return 0;
+  }
+
+  std::vector<heif_io_read> recorded = recorder->recorder->get_reads();
+
+  int n = std::min(size, static_cast<int>(recorded.size()));
+  for (int i = 0; i < n; i++) {
+    reads[i] = recorded[i];
+  }
+
+  return n;
+}
+
+
+struct heif_error heif_io_recorder_write_trace(const struct heif_io_recorder* recorder,
+                                               const char* filename)
+{
+  Error err = recorder->recorder->write_trace(filename);
+  if (err) {
+    return err.error_struct(nullptr);
+  }
+
+  struct heif_error ok = { heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess };
+  return ok;
+}
+
+
 heif_error heif_context_read_from_file(heif_context* ctx, const char* filename,
-                                       const struct heif_reading_options*)
+                                       const struct heif_reading_options* options)
 {
-  Error err = ctx->context->read_from_file(filename);
+  Error err = ctx->context->read_from_file(filename, options);
   return err.error_struct(ctx->context.get());
 }
 
 heif_error heif_context_read_from_memory(heif_context* ctx, const void* mem, size_t size,
-                                         const struct heif_reading_options*)
+                                         const struct heif_reading_options* options)
 {
-  Error err = ctx->context->read_from_memory(mem, size);
+  Error err = ctx->context->read_from_memory(mem, size, options);
+  return err.error_struct(ctx->context.get());
+}
+
+heif_error heif_context_read_from_memory_without_copy(heif_context* ctx, const void* mem, size_t size,
+                                                      const struct heif_reading_options* options)
+{
+  Error err = ctx->context->read_from_memory(mem, size, options, false);
   return err.error_struct(ctx->context.get());
 }
 
 // TODO: heif_error heif_context_read_from_file_descriptor(heif_context*, int fd);
 
+void heif_context_set_slow_decode_callback(struct heif_context* ctx,
+                                           uint32_t threshold_us,
+                                           heif_slow_decode_callback callback,
+                                           void* userdata)
+{
+  ctx->context->set_slow_decode_callback(threshold_us, callback, userdata);
+}
+
 void heif_context_debug_dump_boxes(struct heif_context* ctx, int fd) {
   if (!ctx) {
     return;
@@ -110,6 +202,131 @@ void heif_context_debug_dump_boxes(struct heif_context* ctx, int fd) {
   (void) written;
 }
 
+
+namespace {
+  class CallbackBoxVisitor : public BoxVisitor
+  {
+  public:
+    CallbackBoxVisitor(const heif_box_visitor* visitor, void* userdata)
+      : m_visitor(visitor), m_userdata(userdata) { }
+
+    Action begin_box(const BoxHeader& hdr, uint64_t offset, int depth,
+                     const std::string& fields) override {
+      heif_box_info info;
+      fill_box_info(info, hdr, offset, depth, fields.c_str());
+
+      switch (m_visitor->begin_box(&info, m_userdata)) {
+      case heif_box_visitor_skip_children:
+        return SkipChildren;
+      case heif_box_visitor_stop:
+        return Stop;
+      default:
+        return Continue;
+      }
+    }
+
+    void end_box(const BoxHeader& hdr, uint64_t offset, int depth) override {
+      if (m_visitor->end_box) {
+        heif_box_info info;
+        fill_box_info(info, hdr, offset, depth, "");
+
+        m_visitor->end_box(&info, m_userdata);
+      }
+    }
+
+  private:
+    static void fill_box_info(heif_box_info& info, const BoxHeader& hdr,
+                              uint64_t offset, int depth, const char* fields) {
+      info.type = hdr.get_short_type();
+
+      memset(info.uuid_type, 0, 16);
+      if (info.type == fourcc("uuid")) {
+        std::vector<uint8_t> uuid = hdr.get_type();
+        memcpy(info.uuid_type, uuid.data(), std::min(uuid.size(), size_t(16)));
+      }
+
+      info.offset = offset;
+      info.size = hdr.get_box_size();
+      info.header_size = hdr.get_header_size();
+      info.depth = depth;
+      info.fields = fields;
+    }
+
+    const heif_box_visitor* m_visitor;
+    void* m_userdata;
+  };
+}
+
+
+static struct heif_error visit_boxes(std::istream& istr, uint64_t size,
+                                     const struct heif_box_visitor* visitor, void* userdata)
+{
+  if (!visitor || !visitor->begin_box) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Null_pointer_argument);
+    return err.error_struct(nullptr);
+  }
+
+  if (visitor->version != 1) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Unsupported_plugin_version);
+    return err.error_struct(nullptr);
+  }
+
+  CallbackBoxVisitor callback_visitor(visitor, userdata);
+
+  BitstreamRange range(&istr, size);
+  Error err = Box::visit(range, callback_visitor);
+  if (err) {
+    return err.error_struct(nullptr);
+  }
+
+  struct heif_error ok = { heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess };
+  return ok;
+}
+
+
+struct heif_error heif_visit_boxes_from_file(const char* filename,
+                                             const struct heif_box_visitor* visitor,
+                                             void* userdata)
+{
+  if (!filename) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Null_pointer_argument);
+    return err.error_struct(nullptr);
+  }
+
+  std::ifstream istr(filename, std::ios_base::binary);
+  if (!istr) {
+    Error err(heif_error_Input_does_not_exist);
+    return err.error_struct(nullptr);
+  }
+
+  istr.seekg(0, std::ios_base::end);
+  uint64_t size = static_cast<uint64_t>(istr.tellg());
+  istr.seekg(0, std::ios_base::beg);
+
+  return visit_boxes(istr, size, visitor, userdata);
+}
+
+
+struct heif_error heif_visit_boxes_from_memory(const void* mem, size_t size,
+                                               const struct heif_box_visitor* visitor,
+                                               void* userdata)
+{
+  if (!mem && size > 0) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Null_pointer_argument);
+    return err.error_struct(nullptr);
+  }
+
+  MemoryStreamBuffer buffer(mem, size);
+  std::istream istr(&buffer);
+
+  return visit_boxes(istr, size, visitor, userdata);
+}
+
+
 heif_error heif_context_get_primary_image_handle(heif_context* ctx, heif_image_handle** img)
 {
   if (!img) {
@@ -143,7 +360,7 @@ struct heif_error heif_context_get_primary_image_ID(struct heif_context* ctx, he
                  heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
   }
 
-  std::shared_ptr<HeifContext::Image> primary = ctx->context->get_primary_image();
+  const auto& primary = ctx->context->get_primary_image();
   if (!primary) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_or_invalid_primary_image).error_struct(ctx->context.get());
@@ -157,7 +374,7 @@ struct heif_error heif_context_get_primary_image_ID(struct heif_context* ctx, he
 
 int heif_context_is_top_level_image_ID(struct heif_context* ctx, heif_image_id id)
 {
-  const std::vector<std::shared_ptr<HeifContext::Image>> images = ctx->context->get_top_level_images();
+  const auto& images = ctx->context->get_top_level_images();
 
   for (const auto& img : images) {
     if (img->get_id() == id) {
@@ -184,7 +401,7 @@ int heif_context_get_list_of_top_level_image_IDs(struct heif_context* ctx, heif_
 
   // fill in ID values into output array
 
-  const std::vector<std::shared_ptr<HeifContext::Image>> imgs = ctx->context->get_top_level_images();
+  const auto& imgs = ctx->context->get_top_level_images();
   int n = std::min(size,(int)imgs.size());
   for (int i=0;i<n;i++) {
     ID_array[i] = imgs[i]->get_id();
@@ -202,7 +419,7 @@ heif_error heif_context_get_image_handle(heif_context* ctx, int image_idx, heif_
     return err.error_struct(ctx->context.get());
   }
 
-  const std::vector<std::shared_ptr<HeifContext::Image>> images = ctx->context->get_top_level_images();
+  const auto& images = ctx->context->get_top_level_images();
 
   if (image_idx<0 || (size_t)image_idx >= images.size()) {
     Error err(heif_error_Usage_error, heif_suberror_Nonexisting_image_referenced);
@@ -227,7 +444,7 @@ struct heif_error heif_context_get_image_handle_for_ID(struct heif_context* ctx,
     return err.error_struct(ctx->context.get());
   }
 
-  const std::vector<std::shared_ptr<HeifContext::Image>> images = ctx->context->get_top_level_images();
+  const auto& images = ctx->context->get_top_level_images();
 
   std::shared_ptr<HeifContext::Image> image;
   for (auto& img : images) {
@@ -250,6 +467,66 @@ struct heif_error heif_context_get_image_handle_for_ID(struct heif_context* ctx,
 }
 
 
+const struct heif_image_handle* heif_context_borrow_primary_image_handle(struct heif_context* ctx)
+{
+  const auto& primary = ctx->context->get_primary_image();
+  if (!primary) {
+    return nullptr;
+  }
+
+  return primary->get_borrowed_handle();
+}
+
+
+const struct heif_image_handle* heif_context_borrow_image_handle(struct heif_context* ctx,
+                                                                 int image_idx)
+{
+  const auto& images = ctx->context->get_top_level_images();
+
+  if (image_idx<0 || (size_t)image_idx >= images.size()) {
+    return nullptr;
+  }
+
+  return images[image_idx]->get_borrowed_handle();
+}
+
+
+const struct heif_image_handle* heif_context_borrow_image_handle_for_ID(struct heif_context* ctx,
+                                                                        heif_image_id id)
+{
+  for (const auto& img : ctx->context->get_top_level_images()) {
+    if (img->get_id() == id) {
+      return img->get_borrowed_handle();
+    }
+  }
+
+  return nullptr;
+}
+
+
+const struct heif_image_handle* heif_image_handle_borrow_thumbnail(const struct heif_image_handle* handle,
+                                                                   int thumbnail_idx)
+{
+  const auto& thumbnails = handle->image->get_thumbnails();
+  if (thumbnail_idx<0 || (size_t)thumbnail_idx >= thumbnails.size()) {
+    return nullptr;
+  }
+
+  return thumbnails[thumbnail_idx]->get_borrowed_handle();
+}
+
+
+const struct heif_image_handle* heif_image_handle_borrow_depth_channel_handle(const struct heif_image_handle* handle)
+{
+  const auto& depth = handle->image->get_depth_channel();
+  if (!depth) {
+    return nullptr;
+  }
+
+  return depth->get_borrowed_handle();
+}
+
+
 int heif_image_handle_is_primary_image(const struct heif_image_handle* handle)
 {
   return handle->image->is_primary();
@@ -271,7 +548,7 @@ heif_error heif_image_handle_get_thumbnail(const struct heif_image_handle* handl
                  heif_suberror_Null_pointer_argument).error_struct(handle->image.get());
   }
 
-  auto thumbnails = handle->image->get_thumbnails();
+  const auto& thumbnails = handle->image->get_thumbnails();
   if (thumbnail_idx<0 || (size_t)thumbnail_idx >= thumbnails.size()) {
     Error err(heif_error_Usage_error, heif_suberror_Nonexisting_image_referenced);
     return err.error_struct(handle->image.get());
@@ -353,11 +630,115 @@ struct heif_error heif_image_handle_get_depth_channel_handle(const struct heif_i
 }
 
 
+enum heif_color_profile_type heif_image_handle_get_color_profile_type(const struct heif_image_handle* handle)
+{
+  auto profile = handle->image->get_color_profile();
+  if (!profile) {
+    return heif_color_profile_type_not_present;
+  }
+  else if (profile->has_icc_profile()) {
+    return static_cast<heif_color_profile_type>(profile->get_icc_profile_type());
+  }
+  else if (profile->has_nclx()) {
+    return heif_color_profile_type_nclx;
+  }
+  else {
+    return heif_color_profile_type_not_present;
+  }
+}
+
+
+size_t heif_image_handle_get_raw_color_profile_size(const struct heif_image_handle* handle)
+{
+  auto profile = handle->image->get_color_profile();
+  if (profile && profile->has_icc_profile()) {
+    return profile->get_icc_profile().size();
+  }
+  else {
+    return 0;
+  }
+}
+
+
+struct heif_error heif_image_handle_get_raw_color_profile(const struct heif_image_handle* handle,
+                                                          void* out_data)
+{
+  if (out_data == nullptr) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Null_pointer_argument);
+    return err.error_struct(handle->image.get());
+  }
+
+  auto profile = handle->image->get_color_profile();
+  if (!profile || !profile->has_icc_profile()) {
+    Error err(heif_error_Color_profile_does_not_exist,
+              heif_suberror_Unspecified);
+    return err.error_struct(handle->image.get());
+  }
+
+  const std::vector<uint8_t>& data = profile->get_icc_profile();
+  if (!data.empty()) {
+    memcpy(out_data, data.data(), data.size());
+  }
+
+  return Error::Ok.error_struct(handle->image.get());
+}
+
+
+struct heif_error heif_image_handle_get_nclx_color_profile(const struct heif_image_handle* handle,
+                                                           struct heif_color_profile_nclx** out_data)
+{
+  if (out_data == nullptr) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Null_pointer_argument);
+    return err.error_struct(handle->image.get());
+  }
+
+  auto profile = handle->image->get_color_profile();
+  if (!profile || !profile->has_nclx()) {
+    *out_data = nullptr;
+
+    Error err(heif_error_Color_profile_does_not_exist,
+              heif_suberror_Unspecified);
+    return err.error_struct(handle->image.get());
+  }
+
+  auto nclx = new heif_color_profile_nclx;
+  nclx->version = 1;
+  nclx->color_primaries = profile->get_colour_primaries();
+  nclx->transfer_characteristics = profile->get_transfer_characteristics();
+  nclx->matrix_coefficients = profile->get_matrix_coefficients();
+  nclx->full_range_flag = profile->get_full_range_flag();
+
+  *out_data = nclx;
+
+  return Error::Ok.error_struct(handle->image.get());
+}
+
+
+void heif_nclx_color_profile_free(struct heif_color_profile_nclx* nclx_profile)
+{
+  delete nclx_profile;
+}
+
+
 heif_decoding_options* heif_decoding_options_alloc()
 {
   auto options = new heif_decoding_options;
 
   options->ignore_transformations = false;
+  options->collect_statistics = false;
+  options->statistics_preview_downscale = 0;
+  options->dithering = heif_dithering_none;
+  options->tone_mapping = heif_tone_mapping_none;
+  options->input_transfer_characteristics = heif_transfer_characteristic_unspecified;
+  options->tone_mapping_source_peak_luminance = 1000.0f;
+  options->tone_mapping_target_peak_luminance = 100.0f;
+  options->convert_to_sRGB = false;
+  options->decoder_threads = 0;
+  options->file_backed_canvas_min_pixels = 0;
+  options->file_backed_canvas_directory = nullptr;
+  options->tile_threads = 0;
 
   return options;
 }
@@ -392,6 +773,255 @@ struct heif_error heif_decode_image(const struct heif_image_handle* in_handle,
 }
 
 
+heif_interleaved_layout* heif_interleaved_layout_alloc()
+{
+  auto layout = new heif_interleaved_layout;
+
+  layout->channel_order = heif_channel_order_RGBA;
+  layout->premultiplied_alpha = false;
+  layout->padding_value = 0xFF;
+
+  return layout;
+}
+
+
+void heif_interleaved_layout_free(heif_interleaved_layout* layout)
+{
+  delete layout;
+}
+
+
+static bool channel_order_has_alpha(heif_channel_order order)
+{
+  switch (order) {
+  case heif_channel_order_RGBA:
+  case heif_channel_order_BGRA:
+  case heif_channel_order_ARGB:
+  case heif_channel_order_ABGR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+
+struct heif_error heif_decode_image_interleaved(const struct heif_image_handle* in_handle,
+                                               const struct heif_decoding_options* options,
+                                               const struct heif_interleaved_layout* layout,
+                                               uint8_t* out_data,
+                                               int out_stride,
+                                               size_t out_size)
+{
+  if (layout == nullptr || out_data == nullptr) {
+    Error err(heif_error_Usage_error, heif_suberror_Null_pointer_argument);
+    return err.error_struct(in_handle->image.get());
+  }
+
+  // The output buffer has no place for statistics. Do not compute them for the
+  // intermediate image.
+  heif_decoding_options decoding_options;
+  if (options && options->collect_statistics) {
+    decoding_options = *options;
+    decoding_options.collect_statistics = false;
+    options = &decoding_options;
+  }
+
+  std::shared_ptr<HeifPixelImage> img;
+
+  Error err = in_handle->image->decode_image(img,
+                                             heif_colorspace_undefined,
+                                             heif_chroma_undefined,
+                                             options,
+                                             channel_order_has_alpha(layout->channel_order));
+  if (err) {
+    return err.error_struct(in_handle->image.get());
+  }
+
+  if (out_stride <= 0 ||
+      out_size < static_cast<size_t>(out_stride) * img->get_height()) {
+    err = Error(heif_error_Usage_error, heif_suberror_Invalid_parameter_value,
+                "Output buffer too small");
+    return err.error_struct(in_handle->image.get());
+  }
+
+  err = img->convert_to_interleaved(out_data, out_stride, *layout, options);
+  if (err) {
+    return err.error_struct(in_handle->image.get());
+  }
+
+  return Error::Ok.error_struct(in_handle->image.get());
+}
+
+
+static void set_default_tensor_options(heif_tensor_options& options)
+{
+  options.width = 0;
+  options.height = 0;
+  options.layout = heif_tensor_layout_NCHW;
+
+  for (int c=0;c<3;c++) {
+    options.mean[c] = 0.0f;
+    options.std[c] = 1.0f;
+  }
+}
+
+
+heif_tensor_options* heif_tensor_options_alloc()
+{
+  auto options = new heif_tensor_options;
+
+  set_default_tensor_options(*options);
+
+  return options;
+}
+
+
+void heif_tensor_options_free(heif_tensor_options* options)
+{
+  delete options;
+}
+
+
+struct heif_error heif_decode_images_to_tensor(const struct heif_image_handle* const* handles,
+                                               int num_images,
+                                               const struct heif_decoding_options* decoding_options,
+                                               const struct heif_tensor_options* tensor_options,
+                                               float* out_tensor,
+                                               size_t out_tensor_size)
+{
+  if (handles == nullptr || out_tensor == nullptr || num_images <= 0 || handles[0] == nullptr) {
+    Error err(heif_error_Usage_error, heif_suberror_Null_pointer_argument);
+    return err.error_struct(nullptr);
+  }
+
+  ErrorBuffer* error_buffer = handles[0]->image.get();
+
+  heif_tensor_options default_options;
+  if (tensor_options == nullptr) {
+    set_default_tensor_options(default_options);
+    tensor_options = &default_options;
+  }
+
+  int width = tensor_options->width;
+  int height = tensor_options->height;
+  if (width == 0 || height == 0) {
+    width = handles[0]->image->get_width();
+    height = handles[0]->image->get_height();
+  }
+
+  if (width <= 0 || height <= 0) {
+    Error err(heif_error_Usage_error, heif_suberror_Invalid_parameter_value,
+              "Invalid tensor size");
+    return err.error_struct(error_buffer);
+  }
+
+  float scale[3], offset[3];
+  for (int c=0;c<3;c++) {
+    if (tensor_options->std[c] == 0.0f) {
+      Error err(heif_error_Usage_error, heif_suberror_Invalid_parameter_value,
+                "Standard deviation must not be zero");
+      return err.error_struct(error_buffer);
+    }
+
+    scale[c] = 1.0f / (255.0f * tensor_options->std[c]);
+    offset[c] = -tensor_options->mean[c] / tensor_options->std[c];
+  }
+
+  const size_t image_size = static_cast<size_t>(width) * height * 3;
+  if (out_tensor_size / num_images < image_size) {
+    Error err(heif_error_Usage_error, heif_suberror_Invalid_parameter_value,
+              "Output tensor too small");
+    return err.error_struct(error_buffer);
+  }
+
+
+  for (int i=0;i<num_images;i++) {
+    if (handles[i] == nullptr) {
+      Error err(heif_error_Usage_error, heif_suberror_Null_pointer_argument);
+      return err.error_struct(error_buffer);
+    }
+
+    std::shared_ptr<HeifPixelImage> img;
+
+    // Tensors have no alpha channel.
+    Error err = handles[i]->image->decode_image(img,
+                                                heif_colorspace_undefined,
+                                                heif_chroma_undefined,
+                                                decoding_options,
+                                                false);
+    if (err) {
+      return err.error_struct(handles[i]->image.get());
+    }
+
+    err = img->convert_to_tensor(out_tensor + i*image_size, width, height,
+                                 tensor_options->layout, scale, offset);
+    if (err) {
+      return err.error_struct(handles[i]->image.get());
+    }
+  }
+
+  return Error::Ok.error_struct(error_buffer);
+}
+
+
+struct heif_error heif_image_handle_get_grid_layout(const struct heif_image_handle* handle,
+                                                    struct heif_grid_layout** out_layout)
+{
+  if (handle == nullptr || out_layout == nullptr) {
+    Error err(heif_error_Usage_error, heif_suberror_Null_pointer_argument);
+    return err.error_struct(nullptr);
+  }
+
+  std::unique_ptr<heif_grid_layout> layout(new heif_grid_layout);
+
+  Error err = handle->image->get_grid_layout(layout.get());
+  if (err) {
+    return err.error_struct(handle->image.get());
+  }
+
+  *out_layout = layout.release();
+
+  return Error::Ok.error_struct(handle->image.get());
+}
+
+
+void heif_grid_layout_release(const struct heif_grid_layout* layout)
+{
+  delete layout;
+}
+
+
+struct heif_error heif_decode_grid_tiles(const struct heif_image_handle* handle,
+                                         enum heif_colorspace colorspace,
+                                         enum heif_chroma chroma,
+                                         const struct heif_decoding_options* options,
+                                         heif_decoded_tile_callback callback,
+                                         void* userdata)
+{
+  if (handle == nullptr || callback == nullptr) {
+    Error err(heif_error_Usage_error, heif_suberror_Null_pointer_argument);
+    return err.error_struct(nullptr);
+  }
+
+  Error err = handle->image->decode_grid_tiles(colorspace, chroma, options,
+                                               [&](const heif_decoded_tile& tile,
+                                                   std::shared_ptr<HeifPixelImage> image) {
+    heif_image* out_img = new heif_image;
+    out_img->image = std::move(image);
+
+    heif_error callback_err = callback(&tile, out_img, userdata);
+    if (callback_err.code != heif_error_Ok) {
+      return Error(callback_err.code, callback_err.subcode,
+                   callback_err.message ? callback_err.message : "");
+    }
+
+    return Error::Ok;
+  });
+
+  return err.error_struct(handle->image.get());
+}
+
+
 struct heif_error heif_image_create(int width, int height,
                                     heif_colorspace colorspace,
                                     heif_chroma chroma,
@@ -415,7 +1045,9 @@ void heif_image_release(const struct heif_image* img)
 
 void heif_image_handle_release(const struct heif_image_handle* handle)
 {
-  delete handle;
+  if (handle && !handle->is_borrowed) {
+    delete handle;
+  }
 }
 
 
@@ -441,6 +1073,12 @@ int heif_image_get_height(const struct heif_image* img,enum heif_channel channel
 }
 
 
+int heif_image_get_bits_per_pixel(const struct heif_image* img,enum heif_channel channel)
+{
+  return img->image->get_bits_per_pixel(channel);
+}
+
+
 struct heif_error heif_image_add_plane(struct heif_image* image,
                                        heif_channel channel, int width, int height, int bit_depth)
 {
@@ -478,14 +1116,153 @@ uint8_t* heif_image_get_plane(struct heif_image* image,
 }
 
 
+int heif_image_has_statistics(const struct heif_image* image)
+{
+  return image->image->get_statistics() != nullptr;
+}
+
+
+struct heif_error heif_image_get_channel_statistics(const struct heif_image* image,
+                                                    enum heif_channel channel,
+                                                    struct heif_channel_statistics* out_statistics)
+{
+  if (out_statistics == nullptr) {
+    Error err(heif_error_Usage_error, heif_suberror_Null_pointer_argument);
+    return err.error_struct(image->image.get());
+  }
+
+  auto stats = image->image->get_statistics();
+  if (!stats || !stats->has_channel(channel)) {
+    Error err(heif_error_Usage_error, heif_suberror_Nonexisting_image_channel_referenced,
+              "No statistics available for this channel");
+    return err.error_struct(image->image.get());
+  }
+
+  stats->get_channel_statistics(channel, out_statistics);
+
+  return Error::Ok.error_struct(image->image.get());
+}
+
+
+struct heif_error heif_image_get_luma_preview(const struct heif_image* image,
+                                              struct heif_image** out_preview)
+{
+  if (out_preview == nullptr) {
+    Error err(heif_error_Usage_error, heif_suberror_Null_pointer_argument);
+    return err.error_struct(image->image.get());
+  }
+
+  auto stats = image->image->get_statistics();
+  std::shared_ptr<HeifPixelImage> preview;
+  if (stats) {
+    preview = stats->get_luma_preview();
+  }
+
+  if (!preview) {
+    Error err(heif_error_Usage_error, heif_suberror_Nonexisting_image_channel_referenced,
+              "No luma preview available");
+    return err.error_struct(image->image.get());
+  }
+
+  *out_preview = new heif_image;
+  (*out_preview)->image = preview;
+
+  return Error::Ok.error_struct(image->image.get());
+}
+
+
+heif_scaling_options* heif_scaling_options_alloc()
+{
+  auto options = new heif_scaling_options;
+
+  options->filter = heif_scaling_filter_nearest_neighbor;
+  options->linear_light = false;
+
+  return options;
+}
+
+
+void heif_scaling_options_free(heif_scaling_options* options)
+{
+  delete options;
+}
+
+
+heif_appended_item* heif_appended_item_alloc()
+{
+  auto item = new heif_appended_item;
+
+  item->item_type = 0;
+  item->hidden = false;
+  item->data = nullptr;
+  item->data_size = 0;
+  item->properties = nullptr;
+  item->properties_size = 0;
+  item->reference_type = 0;
+  item->reference_target = 0;
+
+  return item;
+}
+
+
+void heif_appended_item_free(heif_appended_item* item)
+{
+  delete item;
+}
+
+
+struct heif_error heif_file_append_item(const char* filename,
+                                        const struct heif_appended_item* item,
+                                        heif_image_id* out_item_ID)
+{
+  if (filename == nullptr || item == nullptr) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Null_pointer_argument);
+    return err.error_struct(nullptr);
+  }
+
+  AppendedItem appended_item;
+  appended_item.item_type = item->item_type;
+  appended_item.hidden = (item->hidden != 0);
+  appended_item.data = item->data;
+  appended_item.data_size = item->data_size;
+  appended_item.properties = item->properties;
+  appended_item.properties_size = item->properties_size;
+  appended_item.reference_type = item->reference_type;
+  appended_item.reference_target = item->reference_target;
+
+  Error err = append_item_to_file(filename, appended_item, out_item_ID);
+  if (err) {
+    return err.error_struct(nullptr);
+  }
+
+  struct heif_error ok = { heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess };
+  return ok;
+}
+
+
 struct heif_error heif_image_scale_image(const struct heif_image* input,
                                          struct heif_image** output,
                                          int width, int height,
                                          const struct heif_scaling_options* options)
 {
+  if (width <= 0 || height <= 0) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Invalid_parameter_value,
+              "Invalid output size");
+    return err.error_struct(input->image.get());
+  }
+
   std::shared_ptr<HeifPixelImage> out_img;
 
-  Error err = input->image->scale_nearest_neighbor(out_img, width, height);
+  Error err;
+  if (options && options->filter == heif_scaling_filter_box) {
+    err = input->image->scale_box(out_img, width, height, options->linear_light);
+  }
+  else {
+    err = input->image->scale_nearest_neighbor(out_img, width, height);
+  }
+
   if (err) {
     return err.error_struct(input->image.get());
   }
@@ -506,7 +1283,7 @@ int heif_image_handle_get_number_of_metadata_blocks(const struct heif_image_hand
 const char* heif_image_handle_get_metadata_type(const struct heif_image_handle* handle,
                                                 int metadata_index)
 {
-  auto metadata = handle->image->get_metadata();
+  const auto& metadata = handle->image->get_metadata();
 
   if (metadata_index >= (int)metadata.size() ||
       metadata_index < 0) {
@@ -520,7 +1297,7 @@ const char* heif_image_handle_get_metadata_type(const struct heif_image_handle*
 size_t heif_image_handle_get_metadata_size(const struct heif_image_handle* handle,
                                            int metadata_index)
 {
-  auto metadata = handle->image->get_metadata();
+  const auto& metadata = handle->image->get_metadata();
 
   if (metadata_index >= (int)metadata.size() ||
       metadata_index < 0) {
@@ -542,7 +1319,7 @@ struct heif_error heif_image_handle_get_metadata(const struct heif_image_handle*
     return err.error_struct(handle->image.get());
   }
 
-  auto metadata = handle->image->get_metadata();
+  const auto& metadata = handle->image->get_metadata();
 
   if (metadata_index >= (int)metadata.size() ||
       metadata_index < 0) {
@@ -562,7 +1339,8 @@ struct heif_error heif_image_handle_get_metadata(const struct heif_image_handle*
 
 struct heif_error heif_register_decoder(heif_context* heif, const heif_decoder_plugin* decoder_plugin)
 {
-  if (decoder_plugin && decoder_plugin->plugin_api_version != 1) {
+  if (decoder_plugin &&
+      (decoder_plugin->plugin_api_version < 1 || decoder_plugin->plugin_api_version > 2)) {
     Error err(heif_error_Usage_error, heif_suberror_Unsupported_plugin_version);
     return err.error_struct(heif->context.get());
   }
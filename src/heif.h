@@ -92,7 +92,13 @@ enum heif_error_code {
   heif_error_Memory_allocation_error = 6,
 
   // The decoder plugin generated an error
-  heif_error_Decoder_plugin_error = 7
+  heif_error_Decoder_plugin_error = 7,
+
+  // The image does not have a color profile of the requested type.
+  heif_error_Color_profile_does_not_exist = 8,
+
+  // Output data could not be written.
+  heif_error_Encoding_error = 9
 };
 
 
@@ -164,6 +170,8 @@ enum heif_suberror_code {
 
   heif_suberror_No_infe_box = 125,
 
+  heif_suberror_No_av1C_box = 126,
+
 
   // --- Memory_allocation_error ---
 
@@ -189,6 +197,9 @@ enum heif_suberror_code {
 
   heif_suberror_Index_out_of_range = 2004,
 
+  // A parameter passed to a function or in an option structure has an invalid value.
+  heif_suberror_Invalid_parameter_value = 2005,
+
 
   // --- Unsupported_feature ---
 
@@ -201,7 +212,15 @@ enum heif_suberror_code {
   heif_suberror_Unsupported_data_version = 3002,
 
   // The conversion of the source image to the requested chroma / colorspace is not supported.
-  heif_suberror_Unsupported_color_conversion = 3003
+  heif_suberror_Unsupported_color_conversion = 3003,
+
+  // The bit depth of the image is not supported by the requested operation.
+  heif_suberror_Unsupported_bit_depth = 3004,
+
+
+  // --- Encoding_error ---
+
+  heif_suberror_Cannot_write_output_data = 5000
 };
 
 
@@ -238,21 +257,97 @@ LIBHEIF_API
 void heif_context_free(struct heif_context*);
 
 
-struct heif_reading_options;
+struct heif_io_recorder;
+
+struct heif_reading_options
+{
+  // Keep only a compact table of the items (data locations, properties, references and
+  // codec headers) after the file has been read and release the box tree. This reduces
+  // the memory of contexts that are kept open for a long time.
+  // Files read from disk are closed and opened again by name when image data is decoded.
+  // Decoding fails if the file has been replaced or modified in the meantime.
+  // heif_context_debug_dump_boxes() has no output for such contexts.
+  uint8_t compact_item_table;
+
+  // Record all reads from the input into this recorder, while reading the file and
+  // later when decoding images. NULL by default.
+  struct heif_io_recorder* io_recorder;
+};
+
+// Allocate reading options and fill with default values.
+// Note: you should always get the reading options through this function since the
+// option structure may grow in size in future versions.
+LIBHEIF_API
+struct heif_reading_options* heif_reading_options_alloc();
+
+LIBHEIF_API
+void heif_reading_options_free(struct heif_reading_options*);
 
 // Read a HEIF file from a named disk file.
-// The heif_reading_options should currently be set to NULL.
+// The heif_reading_options may be NULL.
 LIBHEIF_API
 struct heif_error heif_context_read_from_file(struct heif_context*, const char* filename,
                                               const struct heif_reading_options*);
 
 // Read a HEIF file stored completely in memory.
-// The heif_reading_options should currently be set to NULL.
+// The heif_reading_options may be NULL.
 LIBHEIF_API
 struct heif_error heif_context_read_from_memory(struct heif_context*,
                                                 const void* mem, size_t size,
                                                 const struct heif_reading_options*);
 
+// Like heif_context_read_from_memory(), but the data is not copied. It has to remain
+// valid and unchanged until the context is freed. Note that image handles keep their
+// context alive.
+LIBHEIF_API
+struct heif_error heif_context_read_from_memory_without_copy(struct heif_context*,
+                                                             const void* mem, size_t size,
+                                                             const struct heif_reading_options*);
+
+// --- I/O access recording
+
+// Records the byte ranges that are read from the input, for example to tune block sizes
+// and prefetching of a cache in front of remote storage.
+
+enum heif_io_stage {
+  heif_io_stage_open = 0,        // parsing the file structure when reading the file
+  heif_io_stage_image_data = 1,  // compressed image data, read when decoding
+  heif_io_stage_metadata = 2     // metadata blocks (Exif)
+};
+
+struct heif_io_read {
+  uint64_t offset;
+  uint64_t length;
+  enum heif_io_stage stage;
+  heif_image_id item_id;  // 0 for heif_io_stage_open
+};
+
+// Consecutive reads of the same stage and item are merged into a single range.
+// The recorder may be used by several contexts and may be freed before them.
+LIBHEIF_API
+struct heif_io_recorder* heif_io_recorder_alloc(void);
+
+LIBHEIF_API
+void heif_io_recorder_free(struct heif_io_recorder*);
+
+LIBHEIF_API
+void heif_io_recorder_clear(struct heif_io_recorder*);
+
+LIBHEIF_API
+int heif_io_recorder_get_number_of_reads(const struct heif_io_recorder*);
+
+// Fills in the first 'size' reads in order. Returns the number of reads filled in.
+LIBHEIF_API
+int heif_io_recorder_get_reads(const struct heif_io_recorder*,
+                               struct heif_io_read* reads, int size);
+
+// Write a text trace with one "<offset> <length> <stage> <item ID>" line per read,
+// as read by the heif-io-replay example.
+LIBHEIF_API
+struct heif_error heif_io_recorder_write_trace(const struct heif_io_recorder*,
+                                               const char* filename);
+
+
 // Number of top-level image in the HEIF file. This does not include the thumbnails or the
 // tile images that are composed to an image grid. You can get access to the thumbnails via
 // the main image handle.
@@ -290,6 +385,23 @@ struct heif_error heif_context_get_image_handle_for_ID(struct heif_context* ctx,
                                                        heif_image_id id,
                                                        struct heif_image_handle**);
 
+// --- borrowed image handles
+// These handles are owned by the context and stay valid until the context is freed.
+// Getting them does not allocate memory. They do not keep the context alive and
+// passing them to heif_image_handle_release() has no effect.
+// NULL is returned if the image does not exist.
+
+LIBHEIF_API
+const struct heif_image_handle* heif_context_borrow_primary_image_handle(struct heif_context* ctx);
+
+LIBHEIF_API
+const struct heif_image_handle* heif_context_borrow_image_handle(struct heif_context* ctx,
+                                                                 int idx);
+
+LIBHEIF_API
+const struct heif_image_handle* heif_context_borrow_image_handle_for_ID(struct heif_context* ctx,
+                                                                        heif_image_id id);
+
 // Print information about the boxes of a HEIF file to file descriptor.
 // This is for debugging and informational purposes only. You should not rely on
 // the output having a specific format. At best, you should not use this at all.
@@ -297,6 +409,60 @@ LIBHEIF_API
 void heif_context_debug_dump_boxes(struct heif_context* ctx, int fd);
 
 
+// ========================= box visitor =========================
+// The box visitor walks through the box hierarchy of a file and reports each box while it
+// is read. It does not build the box tree and does not require the file to be a decodable
+// HEIF file. Memory usage is independent of the file size.
+
+struct heif_box_info
+{
+  uint32_t type;          // four-character code, e.g. 0x6d657461 for 'meta'
+  uint8_t uuid_type[16];  // extended type, only for boxes of type 'uuid'
+
+  uint64_t offset;        // file position of the box header
+  uint64_t size;          // including the header. 0 if the box extends to the end of the file.
+  uint32_t header_size;   // including version and flags of full boxes
+
+  int depth;              // 0 for top-level boxes
+
+  // Parsed content of the box as "name: value" lines. Empty for box types that libheif
+  // does not parse. Only valid during the callback.
+  const char* fields;
+};
+
+enum heif_box_visitor_action
+{
+  heif_box_visitor_continue = 0,   // also visit the children of container boxes
+  heif_box_visitor_skip_children = 1,
+  heif_box_visitor_stop = 2
+};
+
+struct heif_box_visitor
+{
+  // Set to 1.
+  int version;
+
+  // --- version 1 functions ---
+
+  // Called for each box in file order.
+  enum heif_box_visitor_action (*begin_box)(const struct heif_box_info* box, void* userdata);
+
+  // Optional, may be NULL. Called for container boxes after their children have been visited.
+  void (*end_box)(const struct heif_box_info* box, void* userdata);
+};
+
+LIBHEIF_API
+struct heif_error heif_visit_boxes_from_file(const char* filename,
+                                             const struct heif_box_visitor* visitor,
+                                             void* userdata);
+
+// The memory is read in place and not copied.
+LIBHEIF_API
+struct heif_error heif_visit_boxes_from_memory(const void* mem, size_t size,
+                                               const struct heif_box_visitor* visitor,
+                                               void* userdata);
+
+
 // ========================= heif_image_handle =========================
 
 // An heif_image_handle is a handle to a logical image in the HEIF file.
@@ -305,7 +471,7 @@ void heif_context_debug_dump_boxes(struct heif_context* ctx, int fd);
 // associated with an image.
 
 // Once you obtained an heif_image_handle, you can already release the heif_context,
-// since it is internally ref-counted.
+// since it is internally ref-counted. This does not apply to borrowed handles.
 
 // Release image handle.
 LIBHEIF_API
@@ -334,6 +500,10 @@ struct heif_error heif_image_handle_get_depth_channel_handle(const struct heif_i
                                                              int depth_channel_idx,
                                                              struct heif_image_handle** out_depth_handle);
 
+// Borrowed handle of the depth channel, or NULL if there is none.
+LIBHEIF_API
+const struct heif_image_handle* heif_image_handle_borrow_depth_channel_handle(const struct heif_image_handle* handle);
+
 
 enum heif_depth_representation_type {
   heif_depth_representation_type_uniform_inverse_Z = 0,
@@ -378,6 +548,51 @@ int heif_image_handle_get_depth_channel_representation_info(const struct heif_im
 
 
 
+// --- color profiles
+
+enum heif_color_profile_type {
+  heif_color_profile_type_not_present = 0,
+  heif_color_profile_type_nclx = 0x6E636C78, // 'nclx'
+  heif_color_profile_type_rICC = 0x72494343, // 'rICC'
+  heif_color_profile_type_prof = 0x70726F66  // 'prof'
+};
+
+// Returns the type of the color profile of the image. If the image has both an ICC
+// profile and nclx parameters, the type of the ICC profile is returned.
+LIBHEIF_API
+enum heif_color_profile_type heif_image_handle_get_color_profile_type(const struct heif_image_handle* handle);
+
+// Size of the ICC profile in bytes, or 0 if the image has no ICC profile.
+LIBHEIF_API
+size_t heif_image_handle_get_raw_color_profile_size(const struct heif_image_handle* handle);
+
+// Copy the ICC profile into 'out_data', which must hold
+// heif_image_handle_get_raw_color_profile_size() bytes.
+LIBHEIF_API
+struct heif_error heif_image_handle_get_raw_color_profile(const struct heif_image_handle* handle,
+                                                          void* out_data);
+
+struct heif_color_profile_nclx {
+  uint8_t version;
+
+  // version 1 fields, using the code points of ITU-T H.273
+
+  uint16_t color_primaries;
+  uint16_t transfer_characteristics;
+  uint16_t matrix_coefficients;
+  uint8_t full_range_flag;
+};
+
+// Get the nclx parameters of the image. The returned structure has to be freed with
+// heif_nclx_color_profile_free().
+LIBHEIF_API
+struct heif_error heif_image_handle_get_nclx_color_profile(const struct heif_image_handle* handle,
+                                                           struct heif_color_profile_nclx** out_data);
+
+LIBHEIF_API
+void heif_nclx_color_profile_free(struct heif_color_profile_nclx* nclx_profile);
+
+
 // List the number of thumbnails assigned to this image handle. Usually 0 or 1.
 LIBHEIF_API
 int heif_image_handle_get_number_of_thumbnails(const struct heif_image_handle* handle);
@@ -388,6 +603,11 @@ struct heif_error heif_image_handle_get_thumbnail(const struct heif_image_handle
                                                   int thumbnail_idx,
                                                   struct heif_image_handle** out_thumbnail_handle);
 
+// Borrowed handle of a thumbnail image, or NULL if 'thumbnail_idx' is out of range.
+LIBHEIF_API
+const struct heif_image_handle* heif_image_handle_borrow_thumbnail(const struct heif_image_handle* main_image_handle,
+                                                                   int thumbnail_idx);
+
 // How many metadata blocks are attached to an image. Usually, the only metadata is
 // an "Exif" block.
 LIBHEIF_API
@@ -429,7 +649,8 @@ enum heif_compression_format {
   heif_compression_undefined = 0,
   heif_compression_HEVC = 1,
   heif_compression_AVC = 2,
-  heif_compression_JPEG = 3
+  heif_compression_JPEG = 3,
+  heif_compression_AV1 = 4
 };
 
 
@@ -463,9 +684,90 @@ enum heif_channel {
 };
 
 
+// Transfer characteristics, using the code points of ITU-T H.273.
+enum heif_transfer_characteristics {
+  heif_transfer_characteristic_ITU_R_BT_709 = 1,
+  heif_transfer_characteristic_unspecified = 2,
+  heif_transfer_characteristic_IEC_61966_2_1 = 13, // sRGB
+  heif_transfer_characteristic_ITU_R_BT_2100_0_PQ = 16,
+  heif_transfer_characteristic_ITU_R_BT_2100_0_HLG = 18
+};
+
+// Tone mapping operators for converting HDR (PQ or HLG) images to SDR.
+enum heif_tone_mapping_operator {
+  heif_tone_mapping_none = 0,
+
+  // John Hable's filmic curve ("Uncharted 2")
+  heif_tone_mapping_hable = 1,
+
+  // EETF of ITU-R BT.2390
+  heif_tone_mapping_bt2390_eetf = 2
+};
+
+// Dithering applied when converting images with more than 8 bits per sample to 8-bit RGB.
+enum heif_dithering_mode {
+  // round to the nearest value
+  heif_dithering_none = 0,
+
+  // ordered dithering with an 8x8 Bayer matrix
+  heif_dithering_ordered_bayer = 1,
+
+  // ordered dithering with a 16x16 blue-noise threshold matrix
+  heif_dithering_blue_noise = 2
+};
+
 struct heif_decoding_options
 {
   uint8_t ignore_transformations;
+
+  // Collect statistics (histograms, mean, min/max) of the decoded image. They are computed
+  // in the final conversion or grid assembly pass and can be queried with
+  // heif_image_get_channel_statistics().
+  uint8_t collect_statistics;
+
+  // When collecting statistics, also compute a luma preview image that is downscaled
+  // by this factor. 0 = no preview.
+  uint8_t statistics_preview_downscale;
+
+  // Dithering used when reducing high bit-depth images to 8 bits per sample.
+  enum heif_dithering_mode dithering;
+
+  // Tone mapping used when converting high bit-depth PQ or HLG images to 8-bit RGB.
+  // The output uses the sRGB transfer curve. The color primaries are only converted
+  // when 'convert_to_sRGB' is set.
+  enum heif_tone_mapping_operator tone_mapping;
+
+  // Transfer characteristics of the decoded image. Tone mapping is only applied for
+  // PQ and HLG input. If unspecified, the nclx color profile of the image is used.
+  enum heif_transfer_characteristics input_transfer_characteristics;
+
+  // Peak luminance (cd/m^2) of the HDR input (default 1000) and of the SDR output (default 100).
+  float tone_mapping_source_peak_luminance;
+  float tone_mapping_target_peak_luminance;
+
+  // Transform 8-bit RGB output from the color profile of the image (ICC or nclx) to sRGB.
+  // Images without a color profile are assumed to be sRGB already.
+  uint8_t convert_to_sRGB;
+
+  // Number of threads that the decoder plugin may use for each coded image
+  // (0 = default of the decoder). Only used by plugins that support it.
+  int decoder_threads;
+
+  // Grid images with at least this number of pixels are assembled in memory-mapped
+  // temporary files instead of heap memory (0 = never). The operating system can page
+  // out the parts of the image that are not in use, so that images larger than the
+  // available memory can be decoded. The color converted and transformed output image
+  // is stored the same way. Where memory mapping is not available, the heap is used.
+  // Each image plane is still limited to 2 GB.
+  uint64_t file_backed_canvas_min_pixels;
+
+  // Directory for the temporary files. NULL uses $TMPDIR or /tmp.
+  const char* file_backed_canvas_directory;
+
+  // Number of threads used to decode the tiles of grid images (0 or 1 = decode the
+  // tiles one after the other). Each thread also copies its tiles into the output image,
+  // with rotations and mirroring of the grid image already applied.
+  int tile_threads;
 };
 
 // Allocate decoding options and fill with default values.
@@ -482,6 +784,10 @@ void heif_decoding_options_free(struct heif_decoding_options*);
 //
 // If colorspace or chroma is set to heif_colorspace_undefined or heif_chroma_undefined,
 // respectively, the original colorspace is taken.
+// When requesting heif_colorspace_monochrome, only the luma plane is decoded. The chroma
+// planes are discarded right after decoding and no color conversion is carried out.
+// The alpha image is only decoded if the output keeps the alpha channel. It is skipped
+// for heif_chroma_interleaved_24bit and planar RGB output.
 // Decoding options may be NULL. If you want to supply options, always use
 // heif_decoding_options_alloc() to get the structure.
 LIBHEIF_API
@@ -491,6 +797,262 @@ struct heif_error heif_decode_image(const struct heif_image_handle* in_handle,
                                     enum heif_chroma chroma,
                                     const struct heif_decoding_options* options);
 
+// --- slow decode reporting
+
+// Stages of a decode. Each stage time is summed over all decoded items (tiles,
+// alpha planes).
+enum heif_decode_stage {
+  heif_decode_stage_read_data = 0,         // reading the compressed data from the file
+  heif_decode_stage_decode = 1,            // decoder plugin
+  heif_decode_stage_grid_assembly = 2,     // copying tiles into the full image
+  heif_decode_stage_transformations = 3,   // rotation, mirroring, cropping
+  heif_decode_stage_color_conversion = 4,
+  heif_decode_stage_statistics = 5
+};
+
+struct heif_decode_timing {
+  int version;
+
+  // version 1 fields
+
+  heif_image_id image_id;
+  uint32_t item_type;  // four character code, e.g. 'hvc1' or 'grid'
+
+  // output image, after transformations and color conversion
+  int width, height;
+  enum heif_colorspace colorspace;
+  enum heif_chroma chroma;
+
+  // image as delivered by the decoder, before the color conversion
+  enum heif_colorspace decoded_colorspace;
+  enum heif_chroma decoded_chroma;
+  int decoded_bit_depth;
+
+  uint64_t total_us;
+  uint64_t stage_us[16];  // indexed by heif_decode_stage, unused entries are 0
+
+  // Items passed through the decoder plugin (tiles and alpha planes included).
+  int number_of_decoded_items;
+  uint64_t compressed_data_size;
+  heif_image_id slowest_item_id;
+  uint64_t slowest_item_us;
+
+  // 0 if the image is not a grid
+  int number_of_tiles;
+  int tile_width, tile_height;
+
+  uint8_t has_alpha;
+
+  // Four character codes ('irot', 'imir', 'clap') of the applied transformations,
+  // in the order of application.
+  int number_of_transformations;
+  uint32_t transformations[8];
+};
+
+typedef void (*heif_slow_decode_callback)(const struct heif_decode_timing* timing, void* userdata);
+
+// Call 'callback' after every heif_decode_image() (and the other image decoding
+// functions) of this context that takes at least 'threshold_us' microseconds.
+// The timing structure is only valid during the callback. The callback may be called
+// from any thread that decodes an image. Pass a NULL callback to disable reporting.
+// Timing is only recorded while a callback is set. Recording does not allocate memory.
+LIBHEIF_API
+void heif_context_set_slow_decode_callback(struct heif_context*,
+                                           uint32_t threshold_us,
+                                           heif_slow_decode_callback callback,
+                                           void* userdata);
+
+
+// --- decoding into caller-supplied interleaved buffers
+
+// Order of the channels in each pixel of an interleaved 8-bit output buffer.
+// 'X' is a padding byte that is filled with heif_interleaved_layout.padding_value.
+enum heif_channel_order {
+  heif_channel_order_RGB  = 0,
+  heif_channel_order_BGR  = 1,
+  heif_channel_order_RGBA = 2,
+  heif_channel_order_BGRA = 3,
+  heif_channel_order_ARGB = 4,
+  heif_channel_order_ABGR = 5,
+  heif_channel_order_RGBX = 6,
+  heif_channel_order_BGRX = 7,
+  heif_channel_order_XRGB = 8,
+  heif_channel_order_XBGR = 9
+};
+
+struct heif_interleaved_layout
+{
+  enum heif_channel_order channel_order;
+
+  // Multiply the color values with alpha (only for channel orders with alpha).
+  uint8_t premultiplied_alpha;
+
+  // Value written into the padding byte of the *X* channel orders.
+  uint8_t padding_value;
+};
+
+// Allocate an interleaved layout description and fill with default values (RGBA).
+// Note: you should always get the layout through this function since the
+// structure may grow in size in future versions.
+LIBHEIF_API
+struct heif_interleaved_layout* heif_interleaved_layout_alloc();
+
+LIBHEIF_API
+void heif_interleaved_layout_free(struct heif_interleaved_layout*);
+
+// Decode an image and write it with the given channel order directly into 'out_data'.
+// The buffer must hold heif_image_handle_get_height() rows of 'out_stride' bytes each.
+// 'out_size' is the size of the buffer in bytes.
+// Decoding options may be NULL. 'collect_statistics' is ignored, since there is no
+// heif_image to return them with. Use heif_decode_image() when statistics are needed.
+LIBHEIF_API
+struct heif_error heif_decode_image_interleaved(const struct heif_image_handle* in_handle,
+                                               const struct heif_decoding_options* options,
+                                               const struct heif_interleaved_layout* layout,
+                                               uint8_t* out_data,
+                                               int out_stride,
+                                               size_t out_size);
+
+
+// --- decoding into float32 tensors (e.g. as input for neural networks)
+
+enum heif_tensor_layout {
+  // planar: all R values, then all G values, then all B values
+  heif_tensor_layout_NCHW = 0,
+
+  // interleaved: R,G,B triplets for each pixel
+  heif_tensor_layout_NHWC = 1
+};
+
+struct heif_tensor_options
+{
+  // Size of the output tensor. The image is resized (bilinear) to this size.
+  // When set to 0, the size of the (first) image is used.
+  int width;
+  int height;
+
+  enum heif_tensor_layout layout;
+
+  // Per-channel (R,G,B) normalization: output = (value/255 - mean) / std.
+  // Values of high bit-depth images are scaled to the same range first.
+  // Default is mean=0, std=1, which gives values in the range [0,1].
+  float mean[3];
+  float std[3];
+};
+
+// Allocate tensor options and fill with default values.
+// Note: you should always get the tensor options through this function since the
+// option structure may grow in size in future versions.
+LIBHEIF_API
+struct heif_tensor_options* heif_tensor_options_alloc();
+
+LIBHEIF_API
+void heif_tensor_options_free(struct heif_tensor_options*);
+
+// Decode a batch of images into a single float32 RGB tensor of size
+// num_images x 3 x height x width (NCHW) or num_images x height x width x 3 (NHWC).
+// Color conversion, resizing and normalization are done in a single pass over the
+// decoded image, without intermediate RGB images. The YCbCr matrix and the range are
+// taken from the nclx color profile (limited-range BT.601 if there is none), also for
+// monochrome images. Images with more than 16 bits per sample are rejected with
+// heif_suberror_Unsupported_bit_depth.
+// 'out_tensor_size' is the number of floats available in 'out_tensor'.
+// Both option structures may be NULL.
+LIBHEIF_API
+struct heif_error heif_decode_images_to_tensor(const struct heif_image_handle* const* handles,
+                                               int num_images,
+                                               const struct heif_decoding_options* decoding_options,
+                                               const struct heif_tensor_options* tensor_options,
+                                               float* out_tensor,
+                                               size_t out_tensor_size);
+
+
+// --- decoding grid images tile by tile
+
+// A geometric transformation of the assembled grid image, as stored in the file.
+struct heif_grid_transformation
+{
+  uint32_t type;  // four character code: 'irot', 'imir' or 'clap'
+
+  // 'irot': counter-clockwise rotation in degrees (0, 90, 180, 270)
+  int rotation_ccw;
+
+  // 'imir': if set, left and right are swapped, otherwise top and bottom
+  uint8_t mirror_horizontal;
+
+  // 'clap': cropped area (inclusive) in the image as it is after the preceding
+  // transformations
+  int crop_left, crop_top, crop_right, crop_bottom;
+};
+
+struct heif_grid_layout
+{
+  int version;
+
+  // version 1 fields
+
+  int rows, columns;
+
+  // Size of each tile. Tiles in the last column and row may extend beyond the image.
+  int tile_width, tile_height;
+
+  // Size of the assembled image, before transformations.
+  int width, height;
+
+  // Transformations of the assembled image, in the order of application.
+  // These are not applied to the decoded tiles.
+  int number_of_transformations;
+  struct heif_grid_transformation transformations[8];
+};
+
+// Get the tile layout of a 'grid' image. Returns heif_suberror_Unsupported_image_type
+// if the image is not a grid. Release the layout with heif_grid_layout_release().
+LIBHEIF_API
+struct heif_error heif_image_handle_get_grid_layout(const struct heif_image_handle* handle,
+                                                    struct heif_grid_layout** out_layout);
+
+LIBHEIF_API
+void heif_grid_layout_release(const struct heif_grid_layout*);
+
+struct heif_decoded_tile
+{
+  int version;
+
+  // version 1 fields
+
+  int tile_index;  // row * columns + column
+  int row, column;
+
+  // Position of the top left corner of the tile in the assembled image
+  // (before transformations) and size of the tile.
+  int x, y;
+  int width, height;
+};
+
+// Called once for each tile. The callee takes ownership of 'image' and has to release
+// it with heif_image_release(). Returning an error stops decoding; the error is then
+// returned by heif_decode_grid_tiles().
+typedef struct heif_error (*heif_decoded_tile_callback)(const struct heif_decoded_tile* tile,
+                                                        struct heif_image* image,
+                                                        void* userdata);
+
+// Decode the tiles of a 'grid' image without assembling the full image. Each tile is
+// converted to the given colorspace and chroma and passed to 'callback'. The grid
+// transformations (see heif_grid_layout) and the alpha channel are not applied.
+//
+// With 'options->tile_threads' > 1, tiles are decoded in parallel and are passed to
+// the callback in no particular order. The callback is then called from the decoding
+// threads, but never concurrently.
+// Decoding options may be NULL.
+LIBHEIF_API
+struct heif_error heif_decode_grid_tiles(const struct heif_image_handle* handle,
+                                         enum heif_colorspace colorspace,
+                                         enum heif_chroma chroma,
+                                         const struct heif_decoding_options* options,
+                                         heif_decoded_tile_callback callback,
+                                         void* userdata);
+
+
 // Get the colorspace format of the image.
 LIBHEIF_API
 enum heif_colorspace heif_image_get_colorspace(const struct heif_image*);
@@ -534,9 +1096,65 @@ uint8_t* heif_image_get_plane(struct heif_image*,
                               int* out_stride);
 
 
-struct heif_scaling_options;
+// --- image statistics (see heif_decoding_options.collect_statistics)
+
+struct heif_channel_statistics
+{
+  uint32_t histogram[256];
+
+  int min;
+  int max;
+  double mean;
+};
+
+// Returns whether statistics have been collected while decoding this image.
+// Statistics are only collected for 8-bit channels. Images without any 8-bit channel
+// have no statistics.
+LIBHEIF_API
+int heif_image_has_statistics(const struct heif_image*);
+
+// Get the statistics of an 8-bit channel. For interleaved RGB images, statistics are
+// available for the R, G, B (and Alpha) channels.
+LIBHEIF_API
+struct heif_error heif_image_get_channel_statistics(const struct heif_image*,
+                                                    enum heif_channel channel,
+                                                    struct heif_channel_statistics* out_statistics);
+
+// Get the downscaled monochrome preview generated during decoding
+// (see heif_decoding_options.statistics_preview_downscale).
+// The preview has to be released with heif_image_release().
+LIBHEIF_API
+struct heif_error heif_image_get_luma_preview(const struct heif_image*,
+                                              struct heif_image** out_preview);
+
+
+enum heif_scaling_filter {
+  heif_scaling_filter_nearest_neighbor = 0,
+
+  // area averaging, for high quality downscaling (e.g. thumbnails)
+  heif_scaling_filter_box = 1
+};
+
+struct heif_scaling_options
+{
+  enum heif_scaling_filter filter;
+
+  // Average the color samples in linear light instead of on the gamma encoded values.
+  // This preserves the brightness of fine high-contrast detail. The sRGB transfer curve
+  // is assumed. Only used with heif_scaling_filter_box and RGB or monochrome images.
+  uint8_t linear_light;
+};
+
+// Allocate scaling options and fill with default values (nearest neighbor).
+// Note: you should always get the scaling options through this function since the
+// option structure may grow in size in future versions.
+LIBHEIF_API
+struct heif_scaling_options* heif_scaling_options_alloc();
+
+LIBHEIF_API
+void heif_scaling_options_free(struct heif_scaling_options*);
 
-// Currently, heif_scaling_options is not defined yet. Pass a NULL pointer.
+// Scale the image to width x height. Pass NULL options for nearest neighbor scaling.
 LIBHEIF_API
 struct heif_error heif_image_scale_image(const struct heif_image* input,
                                          struct heif_image** output,
@@ -548,6 +1166,54 @@ LIBHEIF_API
 void heif_image_release(const struct heif_image*);
 
 
+// --- appending items to existing files
+
+struct heif_appended_item
+{
+  uint32_t item_type;  // four character code, e.g. 'hvc1' or 'Exif'
+
+  // Hidden items are not shown as images, e.g. metadata.
+  uint8_t hidden;
+
+  // Coded item data. For 'hvc1' items, this is the bitstream without the headers
+  // from the 'hvcC' property.
+  const uint8_t* data;
+  size_t data_size;
+
+  // Complete property boxes, e.g. 'hvcC' and 'ispe', that are associated with the
+  // new item. May be NULL.
+  const uint8_t* properties;
+  size_t properties_size;
+
+  // Reference from the new item to an existing item, e.g. 'thmb' for a thumbnail of
+  // the image 'reference_target' or 'cdsc' for metadata. 0 for no reference.
+  uint32_t reference_type;
+  heif_image_id reference_target;
+};
+
+// Allocate an item description with no data and no reference.
+// Note: you should always get the item description through this function since the
+// structure may grow in size in future versions.
+LIBHEIF_API
+struct heif_appended_item* heif_appended_item_alloc();
+
+LIBHEIF_API
+void heif_appended_item_free(struct heif_appended_item*);
+
+// Add an item to a file without rewriting the existing image data.
+// The item data is appended to the end of the file. An updated copy of the 'meta' box is
+// written into free space left by earlier appends, or appended after the data together
+// with some free space for later appends. The old 'meta' box is then changed into a
+// 'free' box. Existing data stays at its position, so only the new data and the 'meta'
+// box are written. Repeated appends reuse the freed 'meta' boxes, so the file only grows
+// by the item data most of the time.
+// The ID of the new item is returned in 'out_item_ID' (may be NULL).
+LIBHEIF_API
+struct heif_error heif_file_append_item(const char* filename,
+                                        const struct heif_appended_item* item,
+                                        heif_image_id* out_item_ID);
+
+
 
 
 // ====================================================================================================
@@ -608,7 +1274,15 @@ struct heif_decoder_plugin
   struct heif_error (*decode_image)(void* decoder, struct heif_image** out_img);
 
 
-  // --- version 2 functions will follow below ... ---
+  // --- version 2 functions ---
+
+  // Set the number of threads the decoder may use for decoding an image (0 = decoder default).
+  // This is called after new_decoder() and before any data is pushed.
+  // May be NULL if the decoder does not support threading.
+  void (*set_decoder_threads)(void* decoder, int nThreads);
+
+
+  // --- version 3 functions will follow below ... ---
 
 
 
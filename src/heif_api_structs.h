@@ -23,6 +23,7 @@
 
 #include "heif_image.h"
 #include "heif_context.h"
+#include "heif_io_recorder.h"
 
 #include <memory>
 
@@ -30,6 +31,9 @@ struct heif_image_handle
 {
   std::shared_ptr<heif::HeifContext::Image> image;
   std::shared_ptr<heif::HeifContext> context;
+
+  // Borrowed handles are owned by their image and are not deleted on release.
+  bool is_borrowed = false;
 };
 
 
@@ -44,4 +48,10 @@ struct heif_context
   std::shared_ptr<heif::HeifContext> context;
 };
 
+
+struct heif_io_recorder
+{
+  std::shared_ptr<heif::IORecorder> recorder;
+};
+
 #endif
@@ -0,0 +1,585 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2017 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "heif_colorprofile.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+using namespace heif;
+
+
+void ColorProfile::set_nclx(uint16_t colour_primaries, uint16_t transfer_characteristics,
+                            uint16_t matrix_coefficients, bool full_range_flag)
+{
+  m_has_nclx = true;
+  m_colour_primaries = colour_primaries;
+  m_transfer_characteristics = transfer_characteristics;
+  m_matrix_coefficients = matrix_coefficients;
+  m_full_range_flag = full_range_flag;
+}
+
+
+namespace heif {
+
+  // Tone reproduction curve from encoded values to linear light, in the form of the
+  // most general ICC parametric curve (function type 4):
+  //   y = (a*x + b)^g + e   for x >= d
+  //   y = c*x + f           for x <  d
+  // Sampled curves are stored as a table instead.
+  struct ToneCurve
+  {
+    double g=1, a=1, b=0, c=0, d=0, e=0, f=0;
+
+    std::vector<double> table;
+
+    double eval(double x) const
+    {
+      if (!table.empty()) {
+        double pos = x * static_cast<double>(table.size() - 1);
+        size_t idx = std::min(static_cast<size_t>(pos), table.size() - 2);
+        double frac = pos - static_cast<double>(idx);
+        return table[idx] * (1 - frac) + table[idx+1] * frac;
+      }
+
+      if (x >= d) {
+        return pow(std::max(0.0, a*x + b), g) + e;
+      }
+      else {
+        return c*x + f;
+      }
+    }
+  };
+
+
+  // An RGB color space, given by its tone curves and the matrix from linear RGB to the
+  // XYZ values of its white point (D50 for ICC profiles, D65 for nclx parameters).
+  class RGBSpace
+  {
+  public:
+    ToneCurve trc[3];
+    double to_XYZ[3][3];
+    bool XYZ_is_D50 = false;
+  };
+}
+
+
+static ToneCurve srgb_curve()
+{
+  ToneCurve curve;
+  curve.g = 2.4;
+  curve.a = 1/1.055;
+  curve.b = 0.055/1.055;
+  curve.c = 1/12.92;
+  curve.d = 0.04045;
+  return curve;
+}
+
+
+static ToneCurve gamma_curve(double gamma)
+{
+  ToneCurve curve;
+  curve.g = gamma;
+  return curve;
+}
+
+
+// XYZ (D65) -> linear sRGB
+static const double XYZ_D65_to_sRGB[3][3] = {
+  {  3.2404542, -1.5371385, -0.4985314 },
+  { -0.9692660,  1.8760108,  0.0415560 },
+  {  0.0556434, -0.2040259,  1.0572252 }
+};
+
+// XYZ (D50, ICC PCS) -> linear sRGB, including the Bradford adaptation from D50 to D65
+static const double XYZ_D50_to_sRGB[3][3] = {
+  {  3.1338561, -1.6168667, -0.4906146 },
+  { -0.9787684,  1.9161415,  0.0334540 },
+  {  0.0719453, -0.2289914,  1.4052427 }
+};
+
+
+static bool invert_3x3(const double m[3][3], double out[3][3])
+{
+  double det = (m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1]) -
+                m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0]) +
+                m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]));
+
+  if (fabs(det) < 1e-12) {
+    return false;
+  }
+
+  out[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) / det;
+  out[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) / det;
+  out[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) / det;
+  out[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) / det;
+  out[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) / det;
+  out[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) / det;
+  out[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) / det;
+  out[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) / det;
+  out[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) / det;
+
+  return true;
+}
+
+
+// --- nclx (ISO/IEC 23001-8) color spaces
+
+static bool get_nclx_color_space(const ColorProfile& profile, RGBSpace& space)
+{
+  // chromaticities of R,G,B (x,y). Only primaries with a D65 white point are supported.
+
+  double xy[3][2];
+
+  switch (profile.get_colour_primaries()) {
+  case 1: // BT.709, sRGB
+  case 2: // unspecified
+    {
+      const double p[3][2] = { {0.640, 0.330}, {0.300, 0.600}, {0.150, 0.060} };
+      std::copy(&p[0][0], &p[0][0]+6, &xy[0][0]);
+    }
+    break;
+  case 5: // BT.601 625 lines
+    {
+      const double p[3][2] = { {0.640, 0.330}, {0.290, 0.600}, {0.150, 0.060} };
+      std::copy(&p[0][0], &p[0][0]+6, &xy[0][0]);
+    }
+    break;
+  case 6: // BT.601 525 lines
+  case 7:
+    {
+      const double p[3][2] = { {0.630, 0.340}, {0.310, 0.595}, {0.155, 0.070} };
+      std::copy(&p[0][0], &p[0][0]+6, &xy[0][0]);
+    }
+    break;
+  case 9: // BT.2020
+    {
+      const double p[3][2] = { {0.708, 0.292}, {0.170, 0.797}, {0.131, 0.046} };
+      std::copy(&p[0][0], &p[0][0]+6, &xy[0][0]);
+    }
+    break;
+  case 12: // Display P3
+    {
+      const double p[3][2] = { {0.680, 0.320}, {0.265, 0.690}, {0.150, 0.060} };
+      std::copy(&p[0][0], &p[0][0]+6, &xy[0][0]);
+    }
+    break;
+  default:
+    return false;
+  }
+
+
+  // Camera and display images are display-referred. We therefore decode the BT.709
+  // family of transfer functions with the sRGB curve instead of the inverse camera OETF.
+
+  ToneCurve curve;
+
+  switch (profile.get_transfer_characteristics()) {
+  case 1:  // BT.709
+  case 2:  // unspecified
+  case 6:  // BT.601
+  case 13: // sRGB
+  case 14: // BT.2020 10 bit
+  case 15: // BT.2020 12 bit
+    curve = srgb_curve();
+    break;
+  case 4:
+    curve = gamma_curve(2.2);
+    break;
+  case 5:
+    curve = gamma_curve(2.8);
+    break;
+  case 8:
+    curve = gamma_curve(1.0);
+    break;
+  default:
+    // PQ and HLG are handled by tone mapping
+    return false;
+  }
+
+  for (int c=0;c<3;c++) {
+    space.trc[c] = curve;
+  }
+
+
+  // --- RGB -> XYZ matrix, scaled such that RGB=(1,1,1) maps to the white point
+
+  const double white_x = 0.3127, white_y = 0.3290;
+  const double W[3] = { white_x / white_y, 1.0, (1 - white_x - white_y) / white_y };
+
+  double P[3][3];
+  for (int c=0;c<3;c++) {
+    P[0][c] = xy[c][0] / xy[c][1];
+    P[1][c] = 1.0;
+    P[2][c] = (1 - xy[c][0] - xy[c][1]) / xy[c][1];
+  }
+
+  double P_inv[3][3];
+  if (!invert_3x3(P, P_inv)) {
+    return false;
+  }
+
+  for (int c=0;c<3;c++) {
+    double S = P_inv[c][0]*W[0] + P_inv[c][1]*W[1] + P_inv[c][2]*W[2];
+    for (int r=0;r<3;r++) {
+      space.to_XYZ[r][c] = P[r][c] * S;
+    }
+  }
+
+  space.XYZ_is_D50 = false;
+
+  return true;
+}
+
+
+// --- ICC profiles (matrix/TRC only)
+
+static uint32_t read_be32(const uint8_t* p)
+{
+  return ((static_cast<uint32_t>(p[0]) << 24) |
+          (static_cast<uint32_t>(p[1]) << 16) |
+          (static_cast<uint32_t>(p[2]) <<  8) |
+          (static_cast<uint32_t>(p[3])));
+}
+
+static uint16_t read_be16(const uint8_t* p)
+{
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static double read_s15Fixed16(const uint8_t* p)
+{
+  return static_cast<int32_t>(read_be32(p)) / 65536.0;
+}
+
+
+static bool find_icc_tag(const std::vector<uint8_t>& icc, uint32_t signature,
+                         const uint8_t** out_data, uint32_t* out_size)
+{
+  uint32_t nTags = read_be32(icc.data() + 128);
+  if (nTags > (icc.size() - 132) / 12) {
+    return false;
+  }
+
+  for (uint32_t i=0;i<nTags;i++) {
+    const uint8_t* entry = icc.data() + 132 + 12*i;
+    if (read_be32(entry) == signature) {
+      uint32_t offset = read_be32(entry+4);
+      uint32_t size = read_be32(entry+8);
+
+      if (offset > icc.size() || size > icc.size() - offset || size < 12) {
+        return false;
+      }
+
+      *out_data = icc.data() + offset;
+      *out_size = size;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static bool parse_icc_curve(const uint8_t* data, uint32_t size, ToneCurve& curve)
+{
+  uint32_t type = read_be32(data);
+
+  if (type == 0x63757276) { // 'curv'
+    uint32_t count = read_be32(data+8);
+    if (count > (size - 12) / 2) {
+      return false;
+    }
+
+    if (count == 0) {
+      curve = gamma_curve(1.0);
+    }
+    else if (count == 1) {
+      curve = gamma_curve(read_be16(data+12) / 256.0);
+    }
+    else {
+      curve.table.resize(count);
+      for (uint32_t i=0;i<count;i++) {
+        curve.table[i] = read_be16(data + 12 + 2*i) / 65535.0;
+      }
+    }
+
+    return true;
+  }
+  else if (type == 0x70617261) { // 'para'
+    static const int nParams[5] = { 1,3,4,5,7 };
+
+    uint16_t function_type = read_be16(data+8);
+    if (function_type > 4 ||
+        size < 12 + 4 * static_cast<uint32_t>(nParams[function_type])) {
+      return false;
+    }
+
+    double p[7];
+    for (int i=0;i<nParams[function_type];i++) {
+      p[i] = read_s15Fixed16(data + 12 + 4*i);
+    }
+
+    curve = ToneCurve();
+    curve.g = p[0];
+
+    if (function_type >= 1) {
+      if (p[1] == 0) {
+        return false;
+      }
+
+      curve.a = p[1];
+      curve.b = p[2];
+      curve.d = -p[2] / p[1];
+    }
+
+    if (function_type == 2) {
+      curve.e = p[3];
+      curve.f = p[3];
+    }
+    else if (function_type >= 3) {
+      curve.c = p[3];
+      curve.d = p[4];
+    }
+
+    if (function_type == 4) {
+      curve.e = p[5];
+      curve.f = p[6];
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+
+static bool get_icc_color_space(const std::vector<uint8_t>& icc, RGBSpace& space)
+{
+  if (icc.size() < 132 ||
+      read_be32(icc.data() + 16) != 0x52474220 || // 'RGB '
+      read_be32(icc.data() + 20) != 0x58595A20 || // 'XYZ '
+      read_be32(icc.data() + 36) != 0x61637370) { // 'acsp'
+    return false;
+  }
+
+  const uint32_t colorant_tags[3] = { 0x7258595A, 0x6758595A, 0x6258595A }; // rXYZ,gXYZ,bXYZ
+  const uint32_t trc_tags[3]      = { 0x72545243, 0x67545243, 0x62545243 }; // rTRC,gTRC,bTRC
+
+  for (int c=0;c<3;c++) {
+    const uint8_t* data;
+    uint32_t size;
+
+    if (!find_icc_tag(icc, colorant_tags[c], &data, &size) ||
+        size < 20 ||
+        read_be32(data) != 0x58595A20) { // 'XYZ '
+      return false;
+    }
+
+    for (int r=0;r<3;r++) {
+      space.to_XYZ[r][c] = read_s15Fixed16(data + 8 + 4*r);
+    }
+
+    if (!find_icc_tag(icc, trc_tags[c], &data, &size) ||
+        !parse_icc_curve(data, size, space.trc[c])) {
+      return false;
+    }
+  }
+
+  space.XYZ_is_D50 = true;
+
+  return true;
+}
+
+
+// --- 3D LUT
+
+bool ColorTransformLUT::build(const RGBSpace& source)
+{
+  double M[3][3];
+  const double (*to_sRGB)[3] = (source.XYZ_is_D50 ? XYZ_D50_to_sRGB : XYZ_D65_to_sRGB);
+
+  for (int r=0;r<3;r++)
+    for (int c=0;c<3;c++) {
+      M[r][c] = (to_sRGB[r][0] * source.to_XYZ[0][c] +
+                 to_sRGB[r][1] * source.to_XYZ[1][c] +
+                 to_sRGB[r][2] * source.to_XYZ[2][c]);
+    }
+
+  const ToneCurve out_curve = srgb_curve();
+
+  // sRGB OETF is the inverse of its curve
+  auto encode = [&out_curve](double l) {
+    l = std::max(0.0, std::min(1.0, l));
+    if (l <= out_curve.c * out_curve.d) {
+      return l / out_curve.c;
+    }
+    return (pow(l, 1/out_curve.g) - out_curve.b) / out_curve.a;
+  };
+
+  const int G = cGridSize;
+  m_table.resize(G*G*G*3);
+
+  bool changes_values = false;
+
+  for (int ir=0;ir<G;ir++)
+    for (int ig=0;ig<G;ig++)
+      for (int ib=0;ib<G;ib++) {
+        const int in[3] = { ir,ig,ib };
+
+        double lin[3];
+        for (int c=0;c<3;c++) {
+          lin[c] = source.trc[c].eval(in[c] / static_cast<double>(G-1));
+        }
+
+        uint16_t* entry = &m_table[((ir*G + ig)*G + ib)*3];
+
+        for (int c=0;c<3;c++) {
+          double v = encode(M[c][0]*lin[0] + M[c][1]*lin[1] + M[c][2]*lin[2]);
+          entry[c] = static_cast<uint16_t>(v * 255 * 256 + 0.5);
+
+          int expected = (in[c] * 255 * 256 + (G-1)/2) / (G-1);
+          if (abs(entry[c] - expected) > 128) {
+            changes_values = true;
+          }
+        }
+      }
+
+  for (int v=0;v<256;v++) {
+    int pos = (v * (G-1) * 256 + 127) / 255;
+    int idx = std::min(pos >> 8, G-2);
+
+    m_index[v] = static_cast<uint8_t>(idx);
+    m_frac[v] = static_cast<uint16_t>(pos - idx*256);
+  }
+
+  return changes_values;
+}
+
+
+void ColorTransformLUT::apply_RGB_row(uint8_t* r, uint8_t* g, uint8_t* b,
+                                      int n, int pixel_stride) const
+{
+  const int G = cGridSize;
+  const int dR = G*G*3;
+  const int dG = G*3;
+  const int dB = 3;
+
+  const uint16_t* table = m_table.data();
+
+  for (int x=0;x<n;x++) {
+    const int i = x*pixel_stride;
+
+    const int fr = m_frac[r[i]];
+    const int fg = m_frac[g[i]];
+    const int fb = m_frac[b[i]];
+
+    const uint16_t* p = table + (m_index[r[i]]*G*G + m_index[g[i]]*G + m_index[b[i]])*3;
+
+    int out[3];
+    for (int c=0;c<3;c++) {
+      int c00 = p[c]       + (((p[c+dB]       - p[c])       * fb) >> 8);
+      int c01 = p[c+dG]    + (((p[c+dG+dB]    - p[c+dG])    * fb) >> 8);
+      int c10 = p[c+dR]    + (((p[c+dR+dB]    - p[c+dR])    * fb) >> 8);
+      int c11 = p[c+dR+dG] + (((p[c+dR+dG+dB] - p[c+dR+dG]) * fb) >> 8);
+
+      int c0 = c00 + (((c01 - c00) * fg) >> 8);
+      int c1 = c10 + (((c11 - c10) * fg) >> 8);
+
+      int v = c0 + (((c1 - c0) * fr) >> 8);
+      out[c] = std::max(0, std::min(255, (v + 128) >> 8));
+    }
+
+    r[i] = static_cast<uint8_t>(out[0]);
+    g[i] = static_cast<uint8_t>(out[1]);
+    b[i] = static_cast<uint8_t>(out[2]);
+  }
+}
+
+
+// --- cache of transforms, keyed by the ICC profile data or the nclx parameters
+
+static const size_t cMaxCachedTransforms = 16;
+
+static std::mutex transform_cache_mutex;
+static std::map<std::vector<uint8_t>, std::shared_ptr<const ColorTransformLUT>> transform_cache;
+
+
+std::shared_ptr<const ColorTransformLUT> ColorTransformLUT::get_transform_to_sRGB(const ColorProfile& profile)
+{
+  std::vector<uint8_t> key;
+
+  if (profile.has_icc_profile()) {
+    key.push_back('i');
+    key.insert(key.end(), profile.get_icc_profile().begin(), profile.get_icc_profile().end());
+  }
+  else if (profile.has_nclx()) {
+    key.push_back('n');
+    for (uint16_t v : { profile.get_colour_primaries(), profile.get_transfer_characteristics() }) {
+      key.push_back(static_cast<uint8_t>(v >> 8));
+      key.push_back(static_cast<uint8_t>(v & 0xFF));
+    }
+  }
+  else {
+    return nullptr;
+  }
+
+
+  std::lock_guard<std::mutex> lock(transform_cache_mutex);
+
+  auto iter = transform_cache.find(key);
+  if (iter != transform_cache.end()) {
+    return iter->second;
+  }
+
+
+  RGBSpace space;
+  bool supported;
+  if (profile.has_icc_profile()) {
+    supported = get_icc_color_space(profile.get_icc_profile(), space);
+  }
+  else {
+    supported = get_nclx_color_space(profile, space);
+  }
+
+  std::shared_ptr<ColorTransformLUT> transform;
+  if (supported) {
+    transform = std::make_shared<ColorTransformLUT>();
+    if (!transform->build(space)) {
+      transform.reset();
+    }
+  }
+
+
+  // Unsupported and identity transforms are cached as well, so that we do not parse
+  // the profile again for every image.
+
+  if (transform_cache.size() >= cMaxCachedTransforms) {
+    transform_cache.clear();
+  }
+
+  transform_cache[key] = transform;
+
+  return transform;
+}
@@ -0,0 +1,105 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2017 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_HEIF_COLORPROFILE_H
+#define LIBHEIF_HEIF_COLORPROFILE_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+
+namespace heif {
+
+class RGBSpace;
+
+
+// Color information of an image, collected from its 'colr' properties.
+// An image may have both nclx parameters and an ICC profile.
+class ColorProfile
+{
+ public:
+  bool has_nclx() const { return m_has_nclx; }
+
+  void set_nclx(uint16_t colour_primaries, uint16_t transfer_characteristics,
+                uint16_t matrix_coefficients, bool full_range_flag);
+
+  uint16_t get_colour_primaries() const { return m_colour_primaries; }
+  uint16_t get_transfer_characteristics() const { return m_transfer_characteristics; }
+  uint16_t get_matrix_coefficients() const { return m_matrix_coefficients; }
+  bool get_full_range_flag() const { return m_full_range_flag; }
+
+
+  // 'type' is the colr type fourcc, 'rICC' or 'prof'.
+  void set_icc_profile(uint32_t type, const std::vector<uint8_t>& data) {
+    m_icc_type = type;
+    m_icc_profile = data;
+  }
+
+  bool has_icc_profile() const { return m_icc_type != 0; }
+
+  uint32_t get_icc_profile_type() const { return m_icc_type; }
+  const std::vector<uint8_t>& get_icc_profile() const { return m_icc_profile; }
+
+ private:
+  bool m_has_nclx = false;
+  uint16_t m_colour_primaries = 2;
+  uint16_t m_transfer_characteristics = 2;
+  uint16_t m_matrix_coefficients = 2;
+  bool m_full_range_flag = false;
+
+  uint32_t m_icc_type = 0;
+  std::vector<uint8_t> m_icc_profile;
+};
+
+
+// Converts 8-bit RGB values to sRGB through a 17x17x17 3D lookup table with trilinear
+// interpolation. The table is computed once per color profile and shared between images.
+class ColorTransformLUT
+{
+ public:
+  // Returns the transform from 'profile' to sRGB, or nullptr if the profile is already
+  // sRGB or cannot be handled. ICC profiles take precedence over nclx parameters.
+  // Only matrix/TRC ICC profiles (as used by cameras and phones) are supported.
+  static std::shared_ptr<const ColorTransformLUT> get_transform_to_sRGB(const ColorProfile& profile);
+
+  void apply_RGB_row(uint8_t* r, uint8_t* g, uint8_t* b, int n, int pixel_stride) const;
+
+  // Use get_transform_to_sRGB() instead.
+  ColorTransformLUT() { }
+
+ private:
+  // Returns false if the transform does not change any input value.
+  bool build(const RGBSpace& source);
+
+  static const int cGridSize = 17;
+
+  // cGridSize^3 RGB entries in 8.8 fixed point, red index varying slowest
+  std::vector<uint16_t> m_table;
+
+  // position of each 8-bit input value in the grid
+  uint8_t m_index[256];
+  uint16_t m_frac[256];  // 0..256
+};
+
+}
+
+#endif
@@ -25,8 +25,12 @@
 #include <assert.h>
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <limits>
+#include <mutex>
+#include <thread>
 #include <utility>
 #include <math.h>
 
@@ -39,6 +43,10 @@
 #include "heif_decoder_libde265.h"
 #endif
 
+#if HAVE_DAV1D
+#include "heif_decoder_dav1d.h"
+#endif
+
 
 using namespace heif;
 
@@ -79,6 +87,15 @@ static uint32_t readvec(const std::vector<uint8_t>& data,int& ptr,int len)
 }
 
 
+// Convert a full-range 16 bit RGB color to a limited-range 16 bit luma value (BT.601).
+static uint16_t rgb_to_luma_16bit(uint16_t r, uint16_t g, uint16_t b)
+{
+  float y = 0.299f * r + 0.587f * g + 0.114f * b;
+
+  return static_cast<uint16_t>((16<<8) + y * 219.0f / 255.0f + 0.5f);
+}
+
+
 class ImageGrid
 {
 public:
@@ -280,37 +297,125 @@ void ImageOverlay::get_offset(size_t image_index, int32_t* x, int32_t* y) const
 
 
 
+DecodeTiming::DecodeTiming()
+{
+  memset(&m_info, 0, sizeof(m_info));
+  m_info.version = 1;
+}
+
+
+uint64_t DecodeTiming::now_us()
+{
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+
+void DecodeTiming::add_decoded_item(heif_image_id id, size_t compressed_data_size, uint64_t us)
+{
+  m_info.number_of_decoded_items++;
+  m_info.compressed_data_size += compressed_data_size;
+
+  if (m_info.number_of_decoded_items == 1 || us > m_info.slowest_item_us) {
+    m_info.slowest_item_id = id;
+    m_info.slowest_item_us = us;
+  }
+}
+
+
+void DecodeTiming::merge(const DecodeTiming& other)
+{
+  const int number_of_stages = sizeof(m_info.stage_us) / sizeof(m_info.stage_us[0]);
+
+  for (int i=0;i<number_of_stages;i++) {
+    m_info.stage_us[i] += other.m_info.stage_us[i];
+  }
+
+  if (other.m_info.number_of_decoded_items > 0 &&
+      (m_info.number_of_decoded_items == 0 || other.m_info.slowest_item_us > m_info.slowest_item_us)) {
+    m_info.slowest_item_id = other.m_info.slowest_item_id;
+    m_info.slowest_item_us = other.m_info.slowest_item_us;
+  }
+
+  m_info.number_of_decoded_items += other.m_info.number_of_decoded_items;
+  m_info.compressed_data_size += other.m_info.compressed_data_size;
+}
+
+
+void DecodeTiming::add_transformation(uint32_t type)
+{
+  const int max_transformations = sizeof(m_info.transformations) / sizeof(m_info.transformations[0]);
+
+  if (m_info.number_of_transformations < max_transformations) {
+    m_info.transformations[m_info.number_of_transformations++] = type;
+  }
+}
+
+
 HeifContext::HeifContext()
 {
 #if HAVE_LIBDE265
   register_decoder(get_decoder_plugin_libde265());
 #endif
+
+#if HAVE_DAV1D
+  register_decoder(get_decoder_plugin_dav1d());
+#endif
 }
 
 HeifContext::~HeifContext()
 {
 }
 
-Error HeifContext::read_from_file(const char* input_filename)
+Error HeifContext::read_from_file(const char* input_filename,
+                                  const struct heif_reading_options* options)
 {
   m_heif_file = std::make_shared<HeifFile>();
+  if (options && options->io_recorder) {
+    m_heif_file->set_io_recorder(options->io_recorder->recorder);
+  }
+
   Error err = m_heif_file->read_from_file(input_filename);
   if (err) {
     return err;
   }
 
-  return interpret_heif_file();
+  err = interpret_heif_file();
+  if (err) {
+    return err;
+  }
+
+  if (options && options->compact_item_table) {
+    m_heif_file->compact();
+  }
+
+  return Error::Ok;
 }
 
-Error HeifContext::read_from_memory(const void* data, size_t size)
+Error HeifContext::read_from_memory(const void* data, size_t size,
+                                    const struct heif_reading_options* options,
+                                    bool copy)
 {
   m_heif_file = std::make_shared<HeifFile>();
-  Error err = m_heif_file->read_from_memory(data,size);
+  if (options && options->io_recorder) {
+    m_heif_file->set_io_recorder(options->io_recorder->recorder);
+  }
+
+  Error err = m_heif_file->read_from_memory(data, size, copy);
+  if (err) {
+    return err;
+  }
+
+  err = interpret_heif_file();
   if (err) {
     return err;
   }
 
-  return interpret_heif_file();
+  if (options && options->compact_item_table) {
+    m_heif_file->compact();
+  }
+
+  return Error::Ok;
 }
 
 std::string HeifContext::debug_dump_boxes() const
@@ -343,6 +448,7 @@ const struct heif_decoder_plugin* HeifContext::get_decoder(uint32_t type) const
 static bool item_type_is_image(const std::string& item_type)
 {
   return (item_type=="hvc1" ||
+          item_type=="av01" ||
           item_type=="grid" ||
           item_type=="iden" ||
           item_type=="iovl");
@@ -534,17 +640,11 @@ Error HeifContext::interpret_heif_file()
   std::vector<heif_image_id> image_IDs = m_heif_file->get_item_IDs();
 
   for (heif_image_id id : image_IDs) {
-    auto infe_box = m_heif_file->get_infe_box(id);
-    if (!infe_box) {
-      // TODO(farindk): Should we return an error instead of skipping the invalid id?
-      continue;
-    }
-
-    if (item_type_is_image(infe_box->get_item_type())) {
+    if (item_type_is_image(m_heif_file->get_item_type(id))) {
       auto image = std::make_shared<Image>(this, id);
       m_all_images.insert(std::make_pair(id, image));
 
-      if (!infe_box->is_hidden_item()) {
+      if (!m_heif_file->is_hidden_item(id)) {
         if (id==m_heif_file->get_primary_image_ID()) {
           image->set_primary(true);
           m_primary_image = image;
@@ -565,19 +665,18 @@ Error HeifContext::interpret_heif_file()
 
   // --- remove thumbnails from top-level images and assign to their respective image
 
-  auto iref_box = m_heif_file->get_iref_box();
-  if (iref_box) {
+  if (m_heif_file->has_references()) {
     // m_top_level_images.clear();
 
     for (auto& pair : m_all_images) {
       auto& image = pair.second;
 
-      uint32_t type = iref_box->get_reference_type(image->get_id());
+      uint32_t type = m_heif_file->get_reference_type(image->get_id());
 
       if (type==fourcc("thmb")) {
         // --- this is a thumbnail image, attach to the main image
 
-        std::vector<heif_image_id> refs = iref_box->get_references(image->get_id());
+        std::vector<heif_image_id> refs = m_heif_file->get_references(image->get_id());
         if (refs.size() != 1) {
           return Error(heif_error_Invalid_input,
                        heif_suberror_Unspecified,
@@ -630,7 +729,7 @@ Error HeifContext::interpret_heif_file()
                        sstr.str());
         }
 
-        std::vector<heif_image_id> refs = iref_box->get_references(image->get_id());
+        std::vector<heif_image_id> refs = m_heif_file->get_references(image->get_id());
         if (refs.size() != 1) {
           return Error(heif_error_Invalid_input,
                        heif_suberror_Unspecified,
@@ -641,7 +740,8 @@ Error HeifContext::interpret_heif_file()
         // alpha channel
 
         if (auxC_property->get_aux_type() == "urn:mpeg:avc:2015:auxid:1" ||
-            auxC_property->get_aux_type() == "urn:mpeg:hevc:2015:auxid:1") {
+            auxC_property->get_aux_type() == "urn:mpeg:hevc:2015:auxid:1" ||
+            auxC_property->get_aux_type() == "urn:mpeg:mpegB:cicp:systems:auxiliary:alpha") {
           image->set_is_alpha_channel_of(refs[0]);
 
           auto master_iter = m_all_images.find(refs[0]);
@@ -679,11 +779,13 @@ Error HeifContext::interpret_heif_file()
   }
 
 
-  // --- read through properties for each image and extract image resolutions
+  // --- read through properties for each image and extract image resolutions and color profiles
 
   for (auto& pair : m_all_images) {
     auto& image = pair.second;
 
+    image->set_color_profile(read_color_profile(pair.first));
+
     std::vector<Box_ipco::Property> properties;
 
     Error err = m_heif_file->get_properties(pair.first, properties);
@@ -720,8 +822,9 @@ Error HeifContext::interpret_heif_file()
       if (ispe_read) {
         auto clap = std::dynamic_pointer_cast<Box_clap>(prop.property);
         if (clap) {
-          image->set_resolution( clap->get_width_rounded(),
-                                 clap->get_height_rounded() );
+          const CleanAperture& aperture = clap->get_clean_aperture();
+          image->set_resolution( aperture.get_width_rounded(),
+                                 aperture.get_height_rounded() );
         }
 
         auto irot = std::dynamic_pointer_cast<Box_irot>(prop.property);
@@ -757,10 +860,10 @@ Error HeifContext::interpret_heif_file()
 
       // --- assign metadata to the image
 
-      if (iref_box) {
-        uint32_t type = iref_box->get_reference_type(id);
+      if (m_heif_file->has_references()) {
+        uint32_t type = m_heif_file->get_reference_type(id);
         if (type == fourcc("cdsc")) {
-          std::vector<uint32_t> refs = iref_box->get_references(id);
+          std::vector<uint32_t> refs = m_heif_file->get_references(id);
           if (refs.size() != 1) {
             return Error(heif_error_Invalid_input,
                          heif_suberror_Unspecified,
@@ -789,22 +892,85 @@ HeifContext::Image::Image(HeifContext* context, heif_image_id id)
   : m_heif_context(context),
     m_id(id)
 {
+  // The borrowed handle points back to this image and its context without owning them
+  // (aliasing shared_ptrs without control block), so that copying it needs no refcounting.
+  m_borrowed_handle.reset(new heif_image_handle);
+  m_borrowed_handle->image = std::shared_ptr<Image>(std::shared_ptr<Image>(), this);
+  m_borrowed_handle->context = std::shared_ptr<HeifContext>(std::shared_ptr<HeifContext>(), context);
+  m_borrowed_handle->is_borrowed = true;
 }
 
 HeifContext::Image::~Image()
 {
 }
 
+// Whether the alpha plane is part of the output of Image::decode_image(). Only RGBA output
+// and output in the decoded format (including monochrome) keep it.
+static bool output_has_alpha(heif_colorspace colorspace, heif_chroma chroma)
+{
+  if (chroma == heif_chroma_interleaved_24bit) {
+    return false;
+  }
+
+  if (colorspace == heif_colorspace_RGB && chroma == heif_chroma_444) {
+    return false;
+  }
+
+  return true;
+}
+
+
 Error HeifContext::Image::decode_image(std::shared_ptr<HeifPixelImage>& img,
                                        heif_colorspace colorspace,
                                        heif_chroma chroma,
-                                       const struct heif_decoding_options* options) const
+                                       const struct heif_decoding_options* options,
+                                       bool decode_alpha) const
 {
-  Error err = m_heif_context->decode_image(m_id, img, options);
+  // A request for a monochrome image only needs the luma plane. Pass this down so that
+  // chroma planes are never assembled or transformed.
+  // YCbCr with monochrome chroma keeps the YCbCr colorspace and goes through the conversion.
+  heif_colorspace decode_colorspace = heif_colorspace_undefined;
+  if (colorspace == heif_colorspace_monochrome ||
+      (colorspace == heif_colorspace_undefined &&
+       chroma == heif_chroma_monochrome)) {
+    decode_colorspace = heif_colorspace_monochrome;
+  }
+
+  // Statistics are collected in the final pass over the image. If no color conversion
+  // takes place afterwards, this may be the grid assembly.
+  const bool collect_statistics = (options && options->collect_statistics);
+  const bool keep_decoded_format = ((colorspace == heif_colorspace_undefined ||
+                                     colorspace == heif_colorspace_monochrome) &&
+                                    (chroma == heif_chroma_undefined ||
+                                     chroma == heif_chroma_monochrome));
+
+  // Timing is only recorded when somebody is interested in slow decodes.
+  DecodeTiming timing_record;
+  DecodeTiming* timing = (m_heif_context->m_slow_decode_callback ? &timing_record : nullptr);
+  uint64_t start_time = (timing ? DecodeTiming::now_us() : 0);
+
+  // The alpha image is not decoded at all if the color conversion would drop it.
+  decode_alpha = decode_alpha && output_has_alpha(colorspace, chroma);
+
+  Error err = m_heif_context->decode_image(m_id, img, decode_colorspace, options,
+                                           collect_statistics && keep_decoded_format,
+                                           timing, decode_alpha);
   if (err) {
     return err;
   }
 
+  // The color conversion needs the matrix and range of the profile.
+  img->set_color_profile(m_color_profile);
+
+  if (timing) {
+    heif_decode_timing& info = timing->info();
+    info.decoded_colorspace = img->get_colorspace();
+    info.decoded_chroma = img->get_chroma_format();
+    info.decoded_bit_depth = img->get_bits_per_pixel(img->has_channel(heif_channel_Y) ?
+                                                     heif_channel_Y : heif_channel_R);
+    info.has_alpha = img->has_channel(heif_channel_Alpha);
+  }
+
   heif_chroma target_chroma = (chroma == heif_chroma_undefined ?
                                img->get_chroma_format() :
                                chroma);
@@ -816,45 +982,197 @@ Error HeifContext::Image::decode_image(std::shared_ptr<HeifPixelImage>& img,
   bool different_colorspace = (target_colorspace != img->get_colorspace());
 
   if (different_chroma || different_colorspace) {
-    img = img->convert_colorspace(target_colorspace, target_chroma);
+    ScopedStageTimer stage_timer(timing, heif_decode_stage_color_conversion);
+
+    img = img->convert_colorspace(target_colorspace, target_chroma, options);
     if (!img) {
       return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
     }
   }
 
+  if (collect_statistics && !img->get_statistics()) {
+    ScopedStageTimer stage_timer(timing, heif_decode_stage_statistics);
+
+    img->compute_statistics(options->statistics_preview_downscale);
+  }
+
+  if (timing) {
+    heif_decode_timing& info = timing->info();
+    info.total_us = DecodeTiming::now_us() - start_time;
+
+    if (info.total_us >= m_heif_context->m_slow_decode_threshold_us) {
+      std::string type = m_heif_context->m_heif_file->get_item_type(m_id);
+      type.resize(4, ' ');
+
+      info.image_id = m_id;
+      info.item_type = fourcc(type.c_str());
+      info.width = img->get_width();
+      info.height = img->get_height();
+      info.colorspace = img->get_colorspace();
+      info.chroma = img->get_chroma_format();
+
+      m_heif_context->m_slow_decode_callback(&info, m_heif_context->m_slow_decode_userdata);
+    }
+  }
+
   return err;
 }
 
 
+Error HeifContext::Image::get_grid_layout(struct heif_grid_layout* layout) const
+{
+  return m_heif_context->get_grid_layout(m_id, layout);
+}
+
+
+Error HeifContext::Image::decode_grid_tiles(heif_colorspace colorspace,
+                                            heif_chroma chroma,
+                                            const struct heif_decoding_options* options,
+                                            const GridTileCallback& callback) const
+{
+  return m_heif_context->decode_grid_tiles(m_id, colorspace, chroma, options, callback);
+}
+
+
+bool HeifContext::has_transformations(heif_image_id ID,
+                                      const struct heif_decoding_options* options) const
+{
+  if (options && options->ignore_transformations) {
+    return false;
+  }
+
+  std::vector<ItemTransformation> transformations;
+  Error error = m_heif_file->get_transformations(ID, transformations);
+  if (error) {
+    return false;
+  }
+
+  return !transformations.empty();
+}
+
+
+std::shared_ptr<const ColorProfile> HeifContext::read_color_profile(heif_image_id ID) const
+{
+  std::vector<Box_ipco::Property> properties;
+  Error error = m_heif_file->get_properties(ID, properties);
+  if (error) {
+    return nullptr;
+  }
+
+  std::shared_ptr<ColorProfile> profile;
+
+  for (const auto& property : properties) {
+    auto colr = std::dynamic_pointer_cast<Box_colr>(property.property);
+    if (colr) {
+      if (!profile) {
+        profile = std::make_shared<ColorProfile>();
+      }
+
+      if (colr->is_nclx()) {
+        profile->set_nclx(colr->get_colour_primaries(),
+                          colr->get_transfer_characteristics(),
+                          colr->get_matrix_coefficients(),
+                          colr->get_full_range_flag());
+      }
+      else {
+        profile->set_icc_profile(colr->get_color_type(), colr->get_icc_profile());
+      }
+    }
+  }
+
+  if (!profile && m_heif_file->get_item_type(ID) == "grid") {
+    if (m_heif_file->has_references()) {
+      std::vector<heif_image_id> tiles = m_heif_file->get_references(ID);
+      if (!tiles.empty() && tiles[0] != ID) {
+        return read_color_profile(tiles[0]);
+      }
+    }
+  }
+
+  return profile;
+}
+
+
+// Cropped area (inclusive) of a 'clap' property, clipped to the image.
+static Error get_clap_rect(const CleanAperture& clap, int img_width, int img_height,
+                           int* left, int* top, int* right, int* bottom)
+{
+  assert(img_width >= 0);
+  assert(img_height >= 0);
+
+  *left = clap.left_rounded(img_width);
+  *right = clap.right_rounded(img_width);
+  *top = clap.top_rounded(img_height);
+  *bottom = clap.bottom_rounded(img_height);
+
+  if (*left < 0) { *left = 0; }
+  if (*top  < 0) { *top  = 0; }
+
+  if (*right >= img_width) { *right = img_width-1; }
+  if (*bottom >= img_height) { *bottom = img_height-1; }
+
+  if (*left >= *right ||
+      *top >= *bottom) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_clean_aperture);
+  }
+
+  return Error::Ok;
+}
+
+
 Error HeifContext::decode_image(heif_image_id ID,
                                 std::shared_ptr<HeifPixelImage>& img,
-                                const struct heif_decoding_options* options) const
+                                heif_colorspace target_colorspace,
+                                const struct heif_decoding_options* options,
+                                bool collect_statistics,
+                                DecodeTiming* timing,
+                                bool decode_alpha) const
 {
   std::string image_type = m_heif_file->get_item_type(ID);
 
   Error error;
 
+  // Number of leading transformations that were already applied while decoding.
+  int fused_transformations = 0;
+
 
   // --- decode image, depending on its type
 
-  if (image_type == "hvc1") {
-    const struct heif_decoder_plugin* decoder_plugin = get_decoder(heif_compression_HEVC);
+  if (image_type == "hvc1" ||
+      image_type == "av01") {
+    heif_compression_format format = (image_type == "av01" ?
+                                      heif_compression_AV1 : heif_compression_HEVC);
+
+    const struct heif_decoder_plugin* decoder_plugin = get_decoder(format);
     if (!decoder_plugin) {
       return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_codec);
     }
 
     std::vector<uint8_t> data;
-    error = m_heif_file->get_compressed_image_data(ID, &data);
-    if (error) {
-      return error;
+    {
+      ScopedStageTimer stage_timer(timing, heif_decode_stage_read_data);
+
+      error = m_heif_file->get_compressed_image_data(ID, &data);
+      if (error) {
+        return error;
+      }
     }
 
+    uint64_t decode_start_time = (timing ? DecodeTiming::now_us() : 0);
+
     void* decoder;
     struct heif_error err = decoder_plugin->new_decoder(&decoder);
     if (err.code != heif_error_Ok) {
       return Error(err.code, err.subcode, err.message);
     }
 
+    if (decoder_plugin->plugin_api_version >= 2 &&
+        decoder_plugin->set_decoder_threads &&
+        options && options->decoder_threads > 0) {
+      decoder_plugin->set_decoder_threads(decoder, options->decoder_threads);
+    }
+
     err = decoder_plugin->push_data(decoder, data.data(), data.size());
     if (err.code != heif_error_Ok) {
       decoder_plugin->free_decoder(decoder);
@@ -881,6 +1199,16 @@ Error HeifContext::decode_image(heif_image_id ID,
 
     decoder_plugin->free_decoder(decoder);
 
+    if (timing) {
+      uint64_t decode_time = DecodeTiming::now_us() - decode_start_time;
+      timing->add_stage_time(heif_decode_stage_decode, decode_time);
+      timing->add_decoded_item(ID, data.size(), decode_time);
+    }
+
+    if (target_colorspace == heif_colorspace_monochrome) {
+      img->drop_chroma_planes();
+    }
+
 #if 0
     FILE* fh = fopen("out.bin", "wb");
     fwrite(data.data(), 1, data.size(), fh);
@@ -889,30 +1217,53 @@ Error HeifContext::decode_image(heif_image_id ID,
   }
   else if (image_type == "grid") {
     std::vector<uint8_t> data;
-    error = m_heif_file->get_compressed_image_data(ID, &data);
-    if (error) {
-      return error;
+    {
+      ScopedStageTimer stage_timer(timing, heif_decode_stage_read_data);
+
+      error = m_heif_file->get_compressed_image_data(ID, &data);
+      if (error) {
+        return error;
+      }
     }
 
-    error = decode_full_grid_image(ID, img, data);
+    // Statistics can only be collected while assembling the grid if the image is not
+    // modified afterwards.
+    bool has_alpha = (decode_alpha &&
+                      m_all_images.find(ID) != m_all_images.end() &&
+                      m_all_images.find(ID)->second->get_alpha_channel());
+
+    // Rotations and mirroring are applied while assembling the grid. This is not possible
+    // when an (untransformed) alpha plane is attached afterwards.
+    bool fuse_transformations = (!has_alpha &&
+                                 (!options || options->ignore_transformations == false));
+
+    error = decode_full_grid_image(ID, img, data, target_colorspace, options,
+                                   collect_statistics && !has_alpha &&
+                                   !has_transformations(ID, options),
+                                   timing,
+                                   fuse_transformations ? &fused_transformations : nullptr);
     if (error) {
       return error;
     }
   }
   else if (image_type == "iden") {
-    error = decode_derived_image(ID, img);
+    error = decode_derived_image(ID, img, target_colorspace, timing);
     if (error) {
       return error;
     }
   }
   else if (image_type == "iovl") {
     std::vector<uint8_t> data;
-    error = m_heif_file->get_compressed_image_data(ID, &data);
-    if (error) {
-      return error;
+    {
+      ScopedStageTimer stage_timer(timing, heif_decode_stage_read_data);
+
+      error = m_heif_file->get_compressed_image_data(ID, &data);
+      if (error) {
+        return error;
+      }
     }
 
-    error = decode_overlay_image(ID, img, data);
+    error = decode_overlay_image(ID, img, data, target_colorspace, timing);
     if (error) {
       return error;
     }
@@ -931,13 +1282,15 @@ Error HeifContext::decode_image(heif_image_id ID,
   // channel, then the alpha images should be associated with their respective tiles.
   // However, the tile images are not part of the m_all_images list.
   // Fix this, when we have a test image available.
-  if (m_all_images.find(ID) != m_all_images.end()) {
+  if (decode_alpha && m_all_images.find(ID) != m_all_images.end()) {
     const auto imginfo = m_all_images.find(ID)->second;
 
     std::shared_ptr<Image> alpha_image = imginfo->get_alpha_channel();
     if (alpha_image) {
+      // The alpha image is a monochrome image. Its chroma planes (if any) are never used.
       std::shared_ptr<HeifPixelImage> alpha;
-      Error err = alpha_image->decode_image(alpha);
+      Error err = decode_image(alpha_image->get_id(), alpha, heif_colorspace_monochrome, options,
+                               false, timing);
       if (err) {
         return err;
       }
@@ -953,16 +1306,25 @@ Error HeifContext::decode_image(heif_image_id ID,
   // --- apply image transformations
 
   if (!options || options->ignore_transformations == false) {
-    std::vector<Box_ipco::Property> properties;
-    auto ipco_box = m_heif_file->get_ipco_box();
-    auto ipma_box = m_heif_file->get_ipma_box();
-    error = ipco_box->get_properties_for_item_ID(ID, ipma_box, properties);
+    ScopedStageTimer stage_timer(timing, heif_decode_stage_transformations);
+
+    std::vector<ItemTransformation> transformations;
+    error = m_heif_file->get_transformations(ID, transformations);
+
+    int transformation_index = 0;
+
+    for (const auto& transformation : transformations) {
+      if (timing) {
+        timing->add_transformation(transformation.type);
+      }
+
+      if (transformation.type == fourcc("irot")) {
+        if (transformation_index++ < fused_transformations) {
+          continue;
+        }
 
-    for (const auto& property : properties) {
-      auto rot = std::dynamic_pointer_cast<Box_irot>(property.property);
-      if (rot) {
         std::shared_ptr<HeifPixelImage> rotated_img;
-        error = img->rotate_ccw(rot->get_rotation(), rotated_img);
+        error = img->rotate_ccw(transformation.rotation_ccw, rotated_img);
         if (error) {
           return error;
         }
@@ -971,39 +1333,26 @@ Error HeifContext::decode_image(heif_image_id ID,
       }
 
 
-      auto mirror = std::dynamic_pointer_cast<Box_imir>(property.property);
-      if (mirror) {
-        error = img->mirror_inplace(mirror->get_mirror_axis() == Box_imir::MirrorAxis::Horizontal);
+      if (transformation.type == fourcc("imir")) {
+        if (transformation_index++ < fused_transformations) {
+          continue;
+        }
+
+        error = img->mirror_inplace(transformation.mirror_horizontal);
         if (error) {
           return error;
         }
       }
 
 
-      auto clap = std::dynamic_pointer_cast<Box_clap>(property.property);
-      if (clap) {
-        std::shared_ptr<HeifPixelImage> clap_img;
-
-        int img_width = img->get_width();
-        int img_height = img->get_height();
-        assert(img_width >= 0);
-        assert(img_height >= 0);
-
-        int left = clap->left_rounded(img_width);
-        int right = clap->right_rounded(img_width);
-        int top = clap->top_rounded(img_height);
-        int bottom = clap->bottom_rounded(img_height);
-
-        if (left < 0) { left = 0; }
-        if (top  < 0) { top  = 0; }
+      if (transformation.type == fourcc("clap")) {
+        transformation_index++;
 
-        if (right >= img_width) { right = img_width-1; }
-        if (bottom >= img_height) { bottom = img_height-1; }
-
-        if (left >= right ||
-            top >= bottom) {
-          return Error(heif_error_Invalid_input,
-                       heif_suberror_Invalid_clean_aperture);
+        int left, top, right, bottom;
+        error = get_clap_rect(transformation.clean_aperture, img->get_width(), img->get_height(),
+                              &left, &top, &right, &bottom);
+        if (error) {
+          return error;
         }
 
         std::shared_ptr<HeifPixelImage> cropped_img;
@@ -1021,26 +1370,106 @@ Error HeifContext::decode_image(heif_image_id ID,
 }
 
 
+// Maps the pixel positions of an image plane to their positions after a sequence of
+// rotations and mirrorings, as carried out by HeifPixelImage::rotate_ccw() and
+// HeifPixelImage::mirror_inplace().
+class PlaneTransform
+{
+public:
+  PlaneTransform(int width, int height) : m_width(width), m_height(height) { }
+
+  void rotate_ccw(int angle_degrees);
+
+  void mirror(bool horizontal);
+
+  // size of the transformed plane
+  int get_width() const { return m_width; }
+  int get_height() const { return m_height; }
+
+  bool is_identity() const {
+    return m_xx==1 && m_xy==0 && m_x0==0 && m_yx==0 && m_yy==1 && m_y0==0;
+  }
+
+  void map(int x, int y, int* out_x, int* out_y) const {
+    *out_x = m_xx*x + m_xy*y + m_x0;
+    *out_y = m_yx*x + m_yy*y + m_y0;
+  }
+
+  // Distance in the transformed plane between two horizontally adjacent input pixels.
+  ptrdiff_t get_pixel_step(int out_stride) const {
+    return m_xx + m_yx*static_cast<ptrdiff_t>(out_stride);
+  }
+
+private:
+  int m_width, m_height;
+
+  int m_xx=1, m_xy=0, m_x0=0;
+  int m_yx=0, m_yy=1, m_y0=0;
+};
+
+
+void PlaneTransform::rotate_ccw(int angle_degrees)
+{
+  const int xx=m_xx, xy=m_xy, x0=m_x0;
+  const int yx=m_yx, yy=m_yy, y0=m_y0;
+
+  if (angle_degrees==90) {
+    // (x,y) -> (y, w-1-x)
+    m_xx = yx;  m_xy = yy;  m_x0 = y0;
+    m_yx = -xx; m_yy = -xy; m_y0 = m_width-1-x0;
+    std::swap(m_width, m_height);
+  }
+  else if (angle_degrees==180) {
+    // (x,y) -> (w-1-x, h-1-y)
+    m_xx = -xx; m_xy = -xy; m_x0 = m_width-1-x0;
+    m_yx = -yx; m_yy = -yy; m_y0 = m_height-1-y0;
+  }
+  else if (angle_degrees==270) {
+    // (x,y) -> (h-1-y, x)
+    m_xx = -yx; m_xy = -yy; m_x0 = m_height-1-y0;
+    m_yx = xx;  m_yy = xy;  m_y0 = x0;
+    std::swap(m_width, m_height);
+  }
+}
+
+
+void PlaneTransform::mirror(bool horizontal)
+{
+  if (horizontal) {
+    m_xx = -m_xx; m_xy = -m_xy; m_x0 = m_width-1-m_x0;
+  }
+  else {
+    m_yx = -m_yx; m_yy = -m_yy; m_y0 = m_height-1-m_y0;
+  }
+}
+
+
 // TODO: this function only works with YCbCr images, chroma 4:2:0, and 8 bpp at the moment
 // It will crash badly if we get anything else.
 Error HeifContext::decode_full_grid_image(heif_image_id ID,
                                           std::shared_ptr<HeifPixelImage>& img,
-                                          const std::vector<uint8_t>& grid_data) const
+                                          const std::vector<uint8_t>& grid_data,
+                                          heif_colorspace target_colorspace,
+                                          const struct heif_decoding_options* options,
+                                          bool collect_statistics,
+                                          DecodeTiming* timing,
+                                          int* fused_transformations) const
 {
   ImageGrid grid;
-  grid.parse(grid_data);
+  Error err = grid.parse(grid_data);
+  if (err) {
+    return err;
+  }
   // std::cout << grid.dump();
 
 
-  auto iref_box = m_heif_file->get_iref_box();
-
-  if (!iref_box) {
+  if (!m_heif_file->has_references()) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_iref_box,
                  "No iref box available, but needed for grid image");
   }
 
-  std::vector<heif_image_id> image_references = iref_box->get_references(ID);
+  std::vector<heif_image_id> image_references = m_heif_file->get_references(ID);
 
   if ((int)image_references.size() != grid.get_rows() * grid.get_columns()) {
     std::stringstream sstr;
@@ -1053,99 +1482,480 @@ Error HeifContext::decode_full_grid_image(heif_image_id ID,
                  sstr.str());
   }
 
+  // All tiles have the same size. Their positions are known before they are decoded.
+  int tile_width = 0, tile_height = 0;
+  err = get_image_size(image_references[0], &tile_width, &tile_height);
+  if (err) {
+    return err;
+  }
+
+  const int w = grid.get_width();
+  const int h = grid.get_height();
+  const int bpp = 8; // TODO: how do we know ?
+
+  const bool luma_only = (target_colorspace == heif_colorspace_monochrome);
+
+  std::vector<heif_channel> channels = { heif_channel_Y };
+  std::vector<PlaneTransform> plane_transforms = { PlaneTransform(w,h) };
+  if (!luma_only) {
+    channels.push_back(heif_channel_Cb);
+    channels.push_back(heif_channel_Cr);
+    plane_transforms.push_back(PlaneTransform(w/2,h/2));
+    plane_transforms.push_back(PlaneTransform(w/2,h/2));
+  }
+
+
+  // --- compose the leading rotations and mirrorings, which are written directly into the
+  //     transformed output image
+
+  if (fused_transformations) {
+    *fused_transformations = 0;
+
+    std::vector<ItemTransformation> transformations;
+    err = m_heif_file->get_transformations(ID, transformations);
+    if (err) {
+      return err;
+    }
+
+    for (const auto& transformation : transformations) {
+      if (transformation.type == fourcc("clap")) {
+        break;
+      }
+
+      for (auto& transform : plane_transforms) {
+        if (transformation.type == fourcc("irot")) {
+          transform.rotate_ccw(transformation.rotation_ccw);
+        }
+        else {
+          transform.mirror(transformation.mirror_horizontal);
+        }
+      }
+
+      (*fused_transformations)++;
+    }
+  }
+
+
   // --- generate image of full output size
 
-  int w = grid.get_width();
-  int h = grid.get_height();
-  int bpp = 8; // TODO: how do we know ?
+  const int out_w = plane_transforms[0].get_width();
+  const int out_h = plane_transforms[0].get_height();
+
+  // Image planes are addressed with 'int' offsets. The largest plane derived from the
+  // canvas is the interleaved RGBA output with 4 bytes per pixel.
+  if (static_cast<int64_t>(w) * h * 4 > std::numeric_limits<int>::max()) {
+    std::stringstream sstr;
+    sstr << "Grid image of " << w << "x" << h << " pixels is too large";
+
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 sstr.str());
+  }
 
   img = std::make_shared<HeifPixelImage>();
-  img->create(w,h,
-              heif_colorspace_YCbCr, // TODO: how do we know ?
-              heif_chroma_420); // TODO: how do we know ?
 
-  img->add_plane(heif_channel_Y,  w,h, bpp);
-  img->add_plane(heif_channel_Cb, w/2,h/2, bpp);
-  img->add_plane(heif_channel_Cr, w/2,h/2, bpp);
+  if (options && options->file_backed_canvas_min_pixels > 0 &&
+      static_cast<uint64_t>(w) * static_cast<uint64_t>(h) >= options->file_backed_canvas_min_pixels) {
+    const char* directory = options->file_backed_canvas_directory;
+    img->set_file_backed(directory ? directory : "");
+  }
+
+  img->create(out_w,out_h,
+              luma_only ? heif_colorspace_monochrome : heif_colorspace_YCbCr, // TODO: how do we know ?
+              luma_only ? heif_chroma_monochrome : heif_chroma_420); // TODO: how do we know ?
+
+  for (size_t i=0;i<channels.size();i++) {
+    img->add_plane(channels[i],
+                   plane_transforms[i].get_width(), plane_transforms[i].get_height(), bpp);
+  }
+
+  const int number_of_tiles = grid.get_rows() * grid.get_columns();
+
+  int number_of_threads = (options ? options->tile_threads : 0);
+  number_of_threads = std::max(1, std::min(number_of_threads, number_of_tiles));
+
+  // Statistics are collected in image order. With several threads or a rotated or mirrored
+  // output, they are computed after decoding instead.
+  std::shared_ptr<ImageStatistics> stats;
+  if (collect_statistics && number_of_threads == 1 && plane_transforms[0].is_identity()) {
+    stats = std::make_shared<ImageStatistics>(out_w,out_h, options->statistics_preview_downscale);
+  }
+
+  if (timing) {
+    heif_decode_timing& info = timing->info();
+    info.number_of_tiles = number_of_tiles;
+    info.tile_width = tile_width;
+    info.tile_height = tile_height;
+  }
+
+
+  // --- decode the tiles and copy them into the output image
+
+  auto copy_tile = [&](const HeifPixelImage& tile_img, int x0, int y0) {
+    for (size_t i=0;i<channels.size();i++) {
+      heif_channel channel = channels[i];
+      const PlaneTransform& transform = plane_transforms[i];
+
+      int tile_stride;
+      const uint8_t* tile_data = tile_img.get_plane(channel, &tile_stride);
+
+      int out_stride;
+      uint8_t* out_data = img->get_plane(channel, &out_stride);
+
+      int copy_width  = std::min(tile_width, w - x0);
+      int copy_height = std::min(tile_height, h - y0);
+
+      int xs=x0, ys=y0;
+
+      if (channel != heif_channel_Y) {
+        copy_width /= 2;
+        copy_height /= 2;
+        xs /= 2;
+        ys /= 2;
+      }
+
+      if (copy_width <= 0 || copy_height <= 0) {
+        continue;
+      }
+
+      const ptrdiff_t pixel_step = transform.get_pixel_step(out_stride);
+
+      for (int py=0;py<copy_height;py++) {
+        const uint8_t* src = tile_data + static_cast<ptrdiff_t>(py)*tile_stride;
+
+        if (transform.is_identity()) {
+          memcpy(out_data + xs + static_cast<ptrdiff_t>(ys+py)*out_stride, src, copy_width);
+
+          if (stats) {
+            stats->add_row(channel, xs, ys+py, src, copy_width);
+          }
+        }
+        else {
+          int out_x, out_y;
+          transform.map(xs, ys+py, &out_x, &out_y);
+
+          uint8_t* dst = out_data + static_cast<ptrdiff_t>(out_y)*out_stride + out_x;
+          for (int px=0;px<copy_width;px++) {
+            dst[px*pixel_step] = src[px];
+          }
+        }
+      }
+    }
+  };
+
+  std::atomic<int> next_tile(0);
+  std::atomic<bool> failed(false);
+  std::mutex error_mutex;
+  Error first_error = Error::Ok;
 
-  int y0=0;
-  int reference_idx = 0;
+  std::mutex timing_mutex;
 
-  for (int y=0;y<grid.get_rows();y++) {
-    int x0=0;
-    int tile_height=0;
+  auto decode_tiles = [&]() {
+    // Stage times are recorded on the stack of each thread and added up when it is done.
+    DecodeTiming local_timing;
+    DecodeTiming* thread_timing = (timing ? &local_timing : nullptr);
 
-    for (int x=0;x<grid.get_columns();x++) {
+    while (!failed) {
+      int tile_index = next_tile++;
+      if (tile_index >= number_of_tiles) {
+        break;
+      }
 
       std::shared_ptr<HeifPixelImage> tile_img;
+      Error tile_err = decode_image(image_references[tile_index], tile_img, target_colorspace,
+                                    options, false, thread_timing);
+
+      if (!tile_err &&
+          (tile_img->get_width() != tile_width ||
+           tile_img->get_height() != tile_height)) {
+        tile_err = Error(heif_error_Invalid_input,
+                         heif_suberror_Invalid_grid_data,
+                         "Grid tiles have different sizes");
+      }
+
+      if (tile_err) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed) {
+          first_error = tile_err;
+          failed = true;
+        }
+        break;
+      }
+
+      ScopedStageTimer stage_timer(thread_timing, heif_decode_stage_grid_assembly);
+
+      copy_tile(*tile_img,
+                (tile_index % grid.get_columns()) * tile_width,
+                (tile_index / grid.get_columns()) * tile_height);
+    }
+
+    if (timing) {
+      std::lock_guard<std::mutex> lock(timing_mutex);
+      timing->merge(local_timing);
+    }
+  };
+
+  // The calling thread decodes tiles as well.
+  std::vector<std::thread> threads;
+  for (int i = 1; i < number_of_threads; i++) {
+    threads.emplace_back(decode_tiles);
+  }
+
+  decode_tiles();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  if (first_error) {
+    return first_error;
+  }
+
+  if (stats) {
+    img->set_statistics(stats);
+  }
 
-      Error err = decode_image(image_references[reference_idx], tile_img);
-      if (err != Error::Ok) {
+  return Error::Ok;
+}
+
+
+Error HeifContext::get_image_size(heif_image_id ID, int* width, int* height) const
+{
+  uint32_t ispe_width, ispe_height;
+  Error err = m_heif_file->get_ispe_size(ID, &ispe_width, &ispe_height);
+  if (err) {
+    return err;
+  }
+
+  *width = static_cast<int>(ispe_width);
+  *height = static_cast<int>(ispe_height);
+
+  if (*width <= 0 || *height <= 0) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_grid_data,
+                 "Grid tile without image size");
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::get_grid_layout(heif_image_id ID, struct heif_grid_layout* layout) const
+{
+  if (m_heif_file->get_item_type(ID) != "grid") {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unsupported_image_type,
+                 "Image is not a grid image");
+  }
+
+  std::vector<uint8_t> grid_data;
+  Error err = m_heif_file->get_compressed_image_data(ID, &grid_data);
+  if (err) {
+    return err;
+  }
+
+  ImageGrid grid;
+  err = grid.parse(grid_data);
+  if (err) {
+    return err;
+  }
+
+  std::vector<heif_image_id> image_references = m_heif_file->get_references(ID);
+  if ((int)image_references.size() != grid.get_rows() * grid.get_columns()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Missing_grid_images);
+  }
+
+  memset(layout, 0, sizeof(*layout));
+  layout->version = 1;
+  layout->rows = grid.get_rows();
+  layout->columns = grid.get_columns();
+  layout->width = static_cast<int>(grid.get_width());
+  layout->height = static_cast<int>(grid.get_height());
+
+
+  // --- tile size (all tiles have the same size)
+
+  err = get_image_size(image_references[0], &layout->tile_width, &layout->tile_height);
+  if (err) {
+    return err;
+  }
+
+
+  // --- transformations of the assembled image, in the same order as in decode_image()
+
+  std::vector<ItemTransformation> item_transformations;
+  err = m_heif_file->get_transformations(ID, item_transformations);
+  if (err) {
+    return err;
+  }
+
+  int width = layout->width;
+  int height = layout->height;
+
+  for (const auto& item_transformation : item_transformations) {
+    if (layout->number_of_transformations == 8) {
+      break;
+    }
+
+    heif_grid_transformation& transformation =
+      layout->transformations[layout->number_of_transformations];
+
+    transformation.type = item_transformation.type;
+
+    if (item_transformation.type == fourcc("irot")) {
+      transformation.rotation_ccw = item_transformation.rotation_ccw;
+      if (item_transformation.rotation_ccw == 90 || item_transformation.rotation_ccw == 270) {
+        std::swap(width, height);
+      }
+    }
+    else if (item_transformation.type == fourcc("imir")) {
+      transformation.mirror_horizontal = item_transformation.mirror_horizontal;
+    }
+    else {
+      err = get_clap_rect(item_transformation.clean_aperture, width, height,
+                          &transformation.crop_left, &transformation.crop_top,
+                          &transformation.crop_right, &transformation.crop_bottom);
+      if (err) {
         return err;
       }
 
+      width = transformation.crop_right - transformation.crop_left + 1;
+      height = transformation.crop_bottom - transformation.crop_top + 1;
+    }
 
-      // --- copy tile into output image
+    layout->number_of_transformations++;
+  }
 
-      int src_width  = tile_img->get_width();
-      int src_height = tile_img->get_height();
-      assert(src_width >= 0);
-      assert(src_height >= 0);
+  return Error::Ok;
+}
 
-      tile_height = src_height;
 
-      for (heif_channel channel : { heif_channel_Y, heif_channel_Cb, heif_channel_Cr }) {
-        int tile_stride;
-        uint8_t* tile_data = tile_img->get_plane(channel, &tile_stride);
+Error HeifContext::decode_grid_tiles(heif_image_id ID,
+                                     heif_colorspace colorspace,
+                                     heif_chroma chroma,
+                                     const struct heif_decoding_options* options,
+                                     const GridTileCallback& callback) const
+{
+  heif_grid_layout layout;
+  Error err = get_grid_layout(ID, &layout);
+  if (err) {
+    return err;
+  }
 
-        int out_stride;
-        uint8_t* out_data = img->get_plane(channel, &out_stride);
+  std::vector<heif_image_id> image_references = m_heif_file->get_references(ID);
+  const int number_of_tiles = layout.rows * layout.columns;
 
-        int copy_width  = std::min(src_width, w - x0);
-        int copy_height = std::min(src_height, h - y0);
+  // Same luma-only selection as in Image::decode_image().
+  heif_colorspace decode_colorspace = heif_colorspace_undefined;
+  if (colorspace == heif_colorspace_monochrome ||
+      (colorspace == heif_colorspace_undefined &&
+       chroma == heif_chroma_monochrome)) {
+    decode_colorspace = heif_colorspace_monochrome;
+  }
 
-        int xs=x0, ys=y0;
+  // The tiles share the color profile of the grid image.
+  std::shared_ptr<const ColorProfile> profile;
+  auto image_iter = m_all_images.find(ID);
+  if (image_iter != m_all_images.end()) {
+    profile = image_iter->second->get_color_profile();
+  }
 
-        if (channel != heif_channel_Y) {
-          copy_width /= 2;
-          copy_height /= 2;
-          xs /= 2;
-          ys /= 2;
-        }
+  std::atomic<int> next_tile(0);
+  std::atomic<bool> failed(false);
+  std::mutex callback_mutex;
+  Error first_error = Error::Ok;
+
+  // Tiles are handed out one at a time, so that each thread holds at most one decoded tile.
+  auto decode_tiles = [&]() {
+    while (!failed) {
+      int tile_index = next_tile++;
+      if (tile_index >= number_of_tiles) {
+        return;
+      }
 
-        for (int py=0;py<copy_height;py++) {
-          memcpy(out_data + xs + (ys+py)*out_stride,
-                 tile_data + py*tile_stride,
-                 copy_width);
+      std::shared_ptr<HeifPixelImage> tile_img;
+      Error tile_err = decode_image(image_references[tile_index], tile_img, decode_colorspace,
+                                    options, false, nullptr);
+
+      if (!tile_err) {
+        tile_img->set_color_profile(profile);
+
+        heif_chroma target_chroma = (chroma == heif_chroma_undefined ?
+                                     tile_img->get_chroma_format() : chroma);
+        heif_colorspace target_colorspace = (colorspace == heif_colorspace_undefined ?
+                                             tile_img->get_colorspace() : colorspace);
+
+        if (target_chroma != tile_img->get_chroma_format() ||
+            target_colorspace != tile_img->get_colorspace()) {
+          tile_img = tile_img->convert_colorspace(target_colorspace, target_chroma, options);
+          if (!tile_img) {
+            tile_err = Error(heif_error_Unsupported_feature,
+                             heif_suberror_Unsupported_color_conversion);
+          }
         }
       }
 
-      x0 += src_width;
+      std::lock_guard<std::mutex> lock(callback_mutex);
+
+      if (failed) {
+        return;
+      }
 
-      reference_idx++;
+      if (!tile_err) {
+        heif_decoded_tile tile;
+        tile.version = 1;
+        tile.tile_index = tile_index;
+        tile.row = tile_index / layout.columns;
+        tile.column = tile_index % layout.columns;
+        tile.x = tile.column * layout.tile_width;
+        tile.y = tile.row * layout.tile_height;
+        tile.width = tile_img->get_width();
+        tile.height = tile_img->get_height();
+
+        tile_err = callback(tile, std::move(tile_img));
+      }
+
+      if (tile_err) {
+        first_error = tile_err;
+        failed = true;
+      }
     }
+  };
+
+  int number_of_threads = (options ? options->tile_threads : 0);
+  number_of_threads = std::max(1, std::min(number_of_threads, number_of_tiles));
 
-    y0 += tile_height;
+  // The calling thread decodes tiles as well.
+  std::vector<std::thread> threads;
+  for (int i = 1; i < number_of_threads; i++) {
+    threads.emplace_back(decode_tiles);
   }
 
-  return Error::Ok;
+  decode_tiles();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  return first_error;
 }
 
 
 Error HeifContext::decode_derived_image(heif_image_id ID,
-                                        std::shared_ptr<HeifPixelImage>& img) const
+                                        std::shared_ptr<HeifPixelImage>& img,
+                                        heif_colorspace target_colorspace,
+                                        DecodeTiming* timing) const
 {
   // find the ID of the image this image is derived from
 
-  auto iref_box = m_heif_file->get_iref_box();
-
-  if (!iref_box) {
+  if (!m_heif_file->has_references()) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_iref_box,
                  "No iref box available, but needed for iden image");
   }
 
-  std::vector<heif_image_id> image_references = iref_box->get_references(ID);
+  std::vector<heif_image_id> image_references = m_heif_file->get_references(ID);
 
   if ((int)image_references.size() != 1) {
     return Error(heif_error_Invalid_input,
@@ -1157,26 +1967,26 @@ Error HeifContext::decode_derived_image(heif_image_id ID,
   heif_image_id reference_image_id = image_references[0];
 
 
-  Error error = decode_image(reference_image_id, img);
+  Error error = decode_image(reference_image_id, img, target_colorspace, nullptr, false, timing);
   return error;
 }
 
 
 Error HeifContext::decode_overlay_image(heif_image_id ID,
                                         std::shared_ptr<HeifPixelImage>& img,
-                                        const std::vector<uint8_t>& overlay_data) const
+                                        const std::vector<uint8_t>& overlay_data,
+                                        heif_colorspace target_colorspace,
+                                        DecodeTiming* timing) const
 {
   // find the IDs this image is composed of
 
-  auto iref_box = m_heif_file->get_iref_box();
-
-  if (!iref_box) {
+  if (!m_heif_file->has_references()) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_iref_box,
                  "No iref box available, but needed for iovl image");
   }
 
-  std::vector<heif_image_id> image_references = iref_box->get_references(ID);
+  std::vector<heif_image_id> image_references = m_heif_file->get_references(ID);
 
   /* TODO: probably, it is valid that an iovl image has no references ?
 
@@ -1201,19 +2011,37 @@ Error HeifContext::decode_overlay_image(heif_image_id ID,
   int w = overlay.get_canvas_width();
   int h = overlay.get_canvas_height();
 
-  // TODO: seems we always have to compose this in RGB since the background color is an RGB value
-  img = std::make_shared<HeifPixelImage>();
-  img->create(w,h,
-              heif_colorspace_RGB,
-              heif_chroma_444);
-  img->add_plane(heif_channel_R,w,h,8); // TODO: other bit depths
-  img->add_plane(heif_channel_G,w,h,8); // TODO: other bit depths
-  img->add_plane(heif_channel_B,w,h,8); // TODO: other bit depths
+  const bool luma_only = (target_colorspace == heif_colorspace_monochrome);
 
   uint16_t bkg_color[4];
   overlay.get_background_color(bkg_color);
 
-  Error err = img->fill_RGB_16bit(bkg_color[0], bkg_color[1], bkg_color[2], bkg_color[3]);
+  img = std::make_shared<HeifPixelImage>();
+
+  Error err;
+
+  if (luma_only) {
+    // Compose only the luma plane. The RGB background color is converted to its luma value.
+    img->create(w,h,
+                heif_colorspace_monochrome,
+                heif_chroma_monochrome);
+    img->add_plane(heif_channel_Y,w,h,8); // TODO: other bit depths
+
+    err = img->fill_plane_16bit(heif_channel_Y,
+                                rgb_to_luma_16bit(bkg_color[0], bkg_color[1], bkg_color[2]));
+  }
+  else {
+    // TODO: seems we always have to compose this in RGB since the background color is an RGB value
+    img->create(w,h,
+                heif_colorspace_RGB,
+                heif_chroma_444);
+    img->add_plane(heif_channel_R,w,h,8); // TODO: other bit depths
+    img->add_plane(heif_channel_G,w,h,8); // TODO: other bit depths
+    img->add_plane(heif_channel_B,w,h,8); // TODO: other bit depths
+
+    err = img->fill_RGB_16bit(bkg_color[0], bkg_color[1], bkg_color[2], bkg_color[3]);
+  }
+
   if (err) {
     return err;
   }
@@ -1221,14 +2049,16 @@ Error HeifContext::decode_overlay_image(heif_image_id ID,
 
   for (size_t i=0;i<image_references.size();i++) {
     std::shared_ptr<HeifPixelImage> overlay_img;
-    err = decode_image(image_references[i], overlay_img);
+    err = decode_image(image_references[i], overlay_img, target_colorspace, nullptr, false, timing);
     if (err != Error::Ok) {
       return err;
     }
 
-    overlay_img = overlay_img->convert_colorspace(heif_colorspace_RGB, heif_chroma_444);
-    if (!overlay_img) {
-      return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+    if (!luma_only) {
+      overlay_img = overlay_img->convert_colorspace(heif_colorspace_RGB, heif_chroma_444);
+      if (!overlay_img) {
+        return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+      }
     }
 
     int32_t dx,dy;
@@ -21,6 +21,7 @@
 #ifndef LIBHEIF_HEIF_CONTEXT_H
 #define LIBHEIF_HEIF_CONTEXT_H
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <set>
@@ -33,6 +34,59 @@ namespace heif {
 
   class HeifFile;
   class HeifPixelImage;
+  class ColorProfile;
+
+
+  // Stage times and structure of a single decode, reported to the slow decode callback.
+  // The record lives on the stack of the top-level decode call, so recording does not
+  // allocate.
+  class DecodeTiming
+  {
+  public:
+    DecodeTiming();
+
+    static uint64_t now_us();
+
+    void add_stage_time(heif_decode_stage stage, uint64_t us) { m_info.stage_us[stage] += us; }
+
+    void add_decoded_item(heif_image_id id, size_t compressed_data_size, uint64_t us);
+
+    void add_transformation(uint32_t type);
+
+    // Add the stage times and decoded items of another record, e.g. of a decoding thread.
+    void merge(const DecodeTiming& other);
+
+    heif_decode_timing& info() { return m_info; }
+
+  private:
+    heif_decode_timing m_info;
+  };
+
+
+  // Adds the time until the end of the scope to a stage. Does nothing if 'timing' is null.
+  class ScopedStageTimer
+  {
+  public:
+    ScopedStageTimer(DecodeTiming* timing, heif_decode_stage stage)
+      : m_timing(timing), m_stage(stage),
+        m_start(timing ? DecodeTiming::now_us() : 0) { }
+
+    ~ScopedStageTimer() {
+      if (m_timing) {
+        m_timing->add_stage_time(m_stage, DecodeTiming::now_us() - m_start);
+      }
+    }
+
+  private:
+    DecodeTiming* m_timing;
+    heif_decode_stage m_stage;
+    uint64_t m_start;
+  };
+
+
+  // Receives a decoded grid tile. Returning an error stops decoding.
+  typedef std::function<Error(const heif_decoded_tile& tile,
+                              std::shared_ptr<HeifPixelImage> image)> GridTileCallback;
 
 
   class ImageMetadata
@@ -51,8 +105,11 @@ namespace heif {
     HeifContext();
     ~HeifContext();
 
-    Error read_from_file(const char* input_filename);
-    Error read_from_memory(const void* data, size_t size);
+    Error read_from_file(const char* input_filename,
+                         const struct heif_reading_options* options = nullptr);
+    Error read_from_memory(const void* data, size_t size,
+                           const struct heif_reading_options* options = nullptr,
+                           bool copy = true);
 
 
     class Image : public ErrorBuffer {
@@ -71,10 +128,23 @@ namespace heif {
 
       bool is_primary() const { return m_is_primary; }
 
+      // If 'decode_alpha' is false, or the alpha plane would be dropped when converting to
+      // 'colorspace' and 'chroma', the alpha image is not decoded.
       Error decode_image(std::shared_ptr<HeifPixelImage>& img,
                          heif_colorspace colorspace = heif_colorspace_undefined,
                          heif_chroma chroma = heif_chroma_undefined,
-                         const struct heif_decoding_options* options = nullptr) const;
+                         const struct heif_decoding_options* options = nullptr,
+                         bool decode_alpha = true) const;
+
+
+      // --- grid images
+
+      Error get_grid_layout(struct heif_grid_layout* layout) const;
+
+      Error decode_grid_tiles(heif_colorspace colorspace,
+                              heif_chroma chroma,
+                              const struct heif_decoding_options* options,
+                              const GridTileCallback& callback) const;
 
 
       // -- thumbnails
@@ -83,7 +153,7 @@ namespace heif {
       void add_thumbnail(std::shared_ptr<Image> img) { m_thumbnails.push_back(img); }
 
       bool is_thumbnail() const { return m_is_thumbnail; }
-      std::vector<std::shared_ptr<Image>> get_thumbnails() const { return m_thumbnails; }
+      const std::vector<std::shared_ptr<Image>>& get_thumbnails() const { return m_thumbnails; }
 
 
       // --- alpha channel
@@ -92,7 +162,7 @@ namespace heif {
       void set_alpha_channel(std::shared_ptr<Image> img) { m_alpha_channel=img; }
 
       bool is_alpha_channel() const { return m_is_alpha_channel; }
-      std::shared_ptr<Image> get_alpha_channel() const { return m_alpha_channel; }
+      const std::shared_ptr<Image>& get_alpha_channel() const { return m_alpha_channel; }
 
 
       // --- depth channel
@@ -101,7 +171,7 @@ namespace heif {
       void set_depth_channel(std::shared_ptr<Image> img) { m_depth_channel=img; }
 
       bool is_depth_channel() const { return m_is_depth_channel; }
-      std::shared_ptr<Image> get_depth_channel() const { return m_depth_channel; }
+      const std::shared_ptr<Image>& get_depth_channel() const { return m_depth_channel; }
 
 
       void set_depth_representation_info(struct heif_depth_representation_info& info) {
@@ -118,13 +188,26 @@ namespace heif {
       }
 
 
+      // --- color profile
+
+      void set_color_profile(std::shared_ptr<const ColorProfile> profile) { m_color_profile = profile; }
+
+      const std::shared_ptr<const ColorProfile>& get_color_profile() const { return m_color_profile; }
+
+
       // --- metadata
 
       void add_metadata(std::shared_ptr<ImageMetadata> metadata) {
         m_metadata.push_back(metadata);
       }
 
-      std::vector<std::shared_ptr<ImageMetadata>> get_metadata() const { return m_metadata; }
+      const std::vector<std::shared_ptr<ImageMetadata>>& get_metadata() const { return m_metadata; }
+
+
+      // --- C API
+
+      // Handle that is owned by this image and does not hold references.
+      const struct heif_image_handle* get_borrowed_handle() const { return m_borrowed_handle.get(); }
 
     private:
       HeifContext* m_heif_context;
@@ -149,18 +232,39 @@ namespace heif {
       bool m_has_depth_representation_info = false;
       struct heif_depth_representation_info m_depth_representation_info;
 
+      std::shared_ptr<const ColorProfile> m_color_profile;
+
       std::vector<std::shared_ptr<ImageMetadata>> m_metadata;
+
+      std::unique_ptr<struct heif_image_handle> m_borrowed_handle;
     };
 
 
-    std::vector<std::shared_ptr<Image>> get_top_level_images() { return m_top_level_images; }
+    const std::vector<std::shared_ptr<Image>>& get_top_level_images() const { return m_top_level_images; }
 
-    std::shared_ptr<Image> get_primary_image() { return m_primary_image; }
+    const std::shared_ptr<Image>& get_primary_image() const { return m_primary_image; }
 
     void register_decoder(const heif_decoder_plugin* decoder_plugin);
 
+    void set_slow_decode_callback(uint32_t threshold_us,
+                                  heif_slow_decode_callback callback, void* userdata) {
+      m_slow_decode_threshold_us = threshold_us;
+      m_slow_decode_callback = callback;
+      m_slow_decode_userdata = userdata;
+    }
+
+    // If 'target_colorspace' is heif_colorspace_monochrome, only the luma plane is decoded
+    // and processed. Chroma planes are dropped right after decoding.
+    // If 'collect_statistics' is set, the decoded image is the final output image and
+    // statistics are collected during grid assembly where possible.
+    // Stage times are added to 'timing', if not null.
+    // If 'decode_alpha' is false, the alpha image is neither read nor decoded.
     Error decode_image(heif_image_id ID, std::shared_ptr<HeifPixelImage>& img,
-                       const struct heif_decoding_options* options = nullptr) const;
+                       heif_colorspace target_colorspace = heif_colorspace_undefined,
+                       const struct heif_decoding_options* options = nullptr,
+                       bool collect_statistics = false,
+                       DecodeTiming* timing = nullptr,
+                       bool decode_alpha = true) const;
 
     std::string debug_dump_boxes() const;
 
@@ -178,20 +282,56 @@ namespace heif {
 
     std::shared_ptr<HeifFile> m_heif_file;
 
+    uint32_t m_slow_decode_threshold_us = 0;
+    heif_slow_decode_callback m_slow_decode_callback = nullptr;
+    void* m_slow_decode_userdata = nullptr;
+
     Error interpret_heif_file();
 
     void remove_top_level_image(std::shared_ptr<Image> image);
 
+    bool has_transformations(heif_image_id ID, const struct heif_decoding_options* options) const;
+
+    // Collect the 'colr' properties of an item. Grid images without own color information
+    // use the profile of their first tile. Returns nullptr if there is no color information.
+    std::shared_ptr<const ColorProfile> read_color_profile(heif_image_id ID) const;
+
+    // Image size from the 'ispe' property, before transformations.
+    Error get_image_size(heif_image_id ID, int* width, int* height) const;
+
+    Error get_grid_layout(heif_image_id ID, struct heif_grid_layout* layout) const;
+
+    // Decode the grid tiles separately. Each tile is converted to 'colorspace' and 'chroma'.
+    // With more than one tile thread, 'callback' is called from the worker threads, but
+    // never concurrently. Decoding stops at the first error of a tile or the callback.
+    Error decode_grid_tiles(heif_image_id ID,
+                            heif_colorspace colorspace,
+                            heif_chroma chroma,
+                            const struct heif_decoding_options* options,
+                            const GridTileCallback& callback) const;
+
+    // If 'fused_transformations' is not null, the leading rotations and mirrorings of the
+    // grid image are applied while copying the tiles and their number is returned.
+    // With more than one tile thread, tiles are decoded and copied in parallel.
     Error decode_full_grid_image(heif_image_id ID,
                                  std::shared_ptr<HeifPixelImage>& img,
-                                 const std::vector<uint8_t>& grid_data) const;
+                                 const std::vector<uint8_t>& grid_data,
+                                 heif_colorspace target_colorspace,
+                                 const struct heif_decoding_options* options,
+                                 bool collect_statistics,
+                                 DecodeTiming* timing,
+                                 int* fused_transformations) const;
 
     Error decode_derived_image(heif_image_id ID,
-                               std::shared_ptr<HeifPixelImage>& img) const;
+                               std::shared_ptr<HeifPixelImage>& img,
+                               heif_colorspace target_colorspace,
+                               DecodeTiming* timing) const;
 
     Error decode_overlay_image(heif_image_id ID,
                                std::shared_ptr<HeifPixelImage>& img,
-                               const std::vector<uint8_t>& overlay_data) const;
+                               const std::vector<uint8_t>& overlay_data,
+                               heif_colorspace target_colorspace,
+                               DecodeTiming* timing) const;
   };
 }
 
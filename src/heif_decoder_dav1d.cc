@@ -0,0 +1,285 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2017 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "heif.h"
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <vector>
+
+#include <dav1d/dav1d.h>
+#include <dav1d/version.h>
+
+
+struct dav1d_plugin_decoder
+{
+  std::vector<uint8_t> data;
+
+  int nThreads = 0;
+};
+
+static const char kSuccess[] = "Success";
+static const char kEmptyString[] = "";
+
+static const int DAV1D_PLUGIN_PRIORITY = 100;
+
+#define MAX_PLUGIN_NAME_LENGTH 80
+
+static char plugin_name[MAX_PLUGIN_NAME_LENGTH];
+
+
+static const char* dav1d_plugin_get_name()
+{
+  strcpy(plugin_name, "dav1d AV1 decoder");
+
+  const char* version = dav1d_version();
+
+  if (strlen(version) + 10 < MAX_PLUGIN_NAME_LENGTH) {
+    strcat(plugin_name,", version ");
+    strcat(plugin_name,version);
+  }
+
+  return plugin_name;
+}
+
+
+static int dav1d_plugin_does_support_format(uint32_t format)
+{
+  if (format == heif_compression_AV1) {
+    return DAV1D_PLUGIN_PRIORITY;
+  }
+  else {
+    return 0;
+  }
+}
+
+
+static struct heif_error dav1d_plugin_new_decoder(void** dec)
+{
+  struct dav1d_plugin_decoder* decoder = new dav1d_plugin_decoder();
+  struct heif_error err = { heif_error_Ok, heif_suberror_Unspecified, kSuccess };
+
+  *dec = decoder;
+  return err;
+}
+
+
+static void dav1d_plugin_free_decoder(void* decoder_raw)
+{
+  struct dav1d_plugin_decoder* decoder = (struct dav1d_plugin_decoder*)decoder_raw;
+
+  delete decoder;
+}
+
+
+static void dav1d_plugin_set_decoder_threads(void* decoder_raw, int nThreads)
+{
+  struct dav1d_plugin_decoder* decoder = (struct dav1d_plugin_decoder*)decoder_raw;
+
+  decoder->nThreads = nThreads;
+}
+
+
+static struct heif_error dav1d_plugin_push_data(void* decoder_raw, const void* data, size_t size)
+{
+  struct dav1d_plugin_decoder* decoder = (struct dav1d_plugin_decoder*)decoder_raw;
+
+  const uint8_t* cdata = (const uint8_t*)data;
+  decoder->data.insert(decoder->data.end(), cdata, cdata + size);
+
+  struct heif_error err = { heif_error_Ok, heif_suberror_Unspecified, kSuccess };
+  return err;
+}
+
+
+static struct heif_error convert_dav1d_picture_to_heif_image(const Dav1dPicture* picture,
+                                                             struct heif_image** image)
+{
+  heif_chroma chroma;
+  heif_colorspace colorspace = heif_colorspace_YCbCr;
+  int shift_x = 0, shift_y = 0;
+
+  switch (picture->p.layout) {
+  case DAV1D_PIXEL_LAYOUT_I400:
+    chroma = heif_chroma_monochrome;
+    colorspace = heif_colorspace_monochrome;
+    break;
+  case DAV1D_PIXEL_LAYOUT_I420:
+    chroma = heif_chroma_420;
+    shift_x = shift_y = 1;
+    break;
+  case DAV1D_PIXEL_LAYOUT_I422:
+    chroma = heif_chroma_422;
+    shift_x = 1;
+    break;
+  default:
+    chroma = heif_chroma_444;
+    break;
+  }
+
+  struct heif_image* out_img;
+  struct heif_error err = heif_image_create(picture->p.w, picture->p.h,
+                                            colorspace, chroma, &out_img);
+  if (err.code != heif_error_Ok) {
+    return err;
+  }
+
+  // --- transfer data from Dav1dPicture to HeifPixelImage
+
+  heif_channel channel2plane[3] = {
+    heif_channel_Y,
+    heif_channel_Cb,
+    heif_channel_Cr
+  };
+
+  int nPlanes = (chroma == heif_chroma_monochrome ? 1 : 3);
+  int bytes_per_pixel = (picture->p.bpc + 7) / 8;
+
+  for (int c=0;c<nPlanes;c++) {
+    int w = picture->p.w;
+    int h = picture->p.h;
+    if (c > 0) {
+      w = (w + shift_x) >> shift_x;
+      h = (h + shift_y) >> shift_y;
+    }
+
+    err = heif_image_add_plane(out_img, channel2plane[c], w,h, picture->p.bpc);
+    if (err.code != heif_error_Ok) {
+      heif_image_release(out_img);
+      return err;
+    }
+
+    // luma and chroma planes have separate strides
+    ptrdiff_t stride = picture->stride[c > 0 ? 1 : 0];
+    const uint8_t* data = static_cast<const uint8_t*>(picture->data[c]);
+
+    int dst_stride;
+    uint8_t* dst_mem = heif_image_get_plane(out_img, channel2plane[c], &dst_stride);
+
+    for (int y=0;y<h;y++) {
+      memcpy(dst_mem + y*dst_stride, data + y*stride, w * bytes_per_pixel);
+    }
+  }
+
+  *image = out_img;
+  return err;
+}
+
+
+static struct heif_error dav1d_plugin_decode_image(void* decoder_raw, struct heif_image** out_img)
+{
+  struct dav1d_plugin_decoder* decoder = (struct dav1d_plugin_decoder*)decoder_raw;
+
+  struct heif_error decode_error = { heif_error_Decoder_plugin_error,
+                                     heif_suberror_Unspecified,
+                                     kEmptyString };
+
+  Dav1dSettings settings;
+  dav1d_default_settings(&settings);
+
+  // A still image is a single frame. Threads are used for tile and in-loop filter parallelism.
+  if (decoder->nThreads > 0) {
+#if DAV1D_API_VERSION_MAJOR >= 6
+    settings.n_threads = decoder->nThreads;
+    settings.max_frame_delay = 1;
+#else
+    settings.n_tile_threads = decoder->nThreads;
+    settings.n_frame_threads = 1;
+#endif
+  }
+
+  Dav1dContext* ctx = nullptr;
+  if (dav1d_open(&ctx, &settings) < 0) {
+    return decode_error;
+  }
+
+  Dav1dData data;
+  uint8_t* buffer = dav1d_data_create(&data, decoder->data.size());
+  if (!buffer) {
+    dav1d_close(&ctx);
+
+    struct heif_error err = { heif_error_Memory_allocation_error,
+                              heif_suberror_Unspecified,
+                              kEmptyString };
+    return err;
+  }
+
+  memcpy(buffer, decoder->data.data(), decoder->data.size());
+
+  Dav1dPicture picture;
+  memset(&picture, 0, sizeof(Dav1dPicture));
+
+  bool have_picture = false;
+
+  do {
+    int res = dav1d_send_data(ctx, &data);
+    if (res < 0 && res != DAV1D_ERR(EAGAIN)) {
+      break;
+    }
+
+    res = dav1d_get_picture(ctx, &picture);
+    if (res == 0) {
+      have_picture = true;
+      break;
+    }
+    else if (res != DAV1D_ERR(EAGAIN)) {
+      break;
+    }
+  } while (data.sz > 0);
+
+  if (!have_picture) {
+    // all data has been sent, drain the decoder
+    if (dav1d_get_picture(ctx, &picture) == 0) {
+      have_picture = true;
+    }
+  }
+
+  dav1d_data_unref(&data);
+
+  struct heif_error err = decode_error;
+  if (have_picture) {
+    err = convert_dav1d_picture_to_heif_image(&picture, out_img);
+    dav1d_picture_unref(&picture);
+  }
+
+  dav1d_close(&ctx);
+
+  return err;
+}
+
+
+static const struct heif_decoder_plugin decoder_dav1d
+{
+  .plugin_api_version = 2,
+  .get_plugin_name = dav1d_plugin_get_name,
+  .does_support_format = dav1d_plugin_does_support_format,
+  .new_decoder = dav1d_plugin_new_decoder,
+  .free_decoder = dav1d_plugin_free_decoder,
+  .push_data = dav1d_plugin_push_data,
+  .decode_image = dav1d_plugin_decode_image,
+  .set_decoder_threads = dav1d_plugin_set_decoder_threads
+};
+
+const struct heif_decoder_plugin* get_decoder_plugin_dav1d() {
+  return &decoder_dav1d;
+}
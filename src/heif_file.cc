@@ -30,9 +30,53 @@
 #include <sstream>
 #include <utility>
 
+#include <limits.h>
+#include <stdlib.h>
+#if defined(HAVE_UNISTD_H)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace heif;
 
 
+// The path does not depend on the working directory, so the file can be opened again
+// after a chdir().
+static std::string absolute_path(const char* filename)
+{
+#if defined(HAVE_UNISTD_H)
+  char path[PATH_MAX];
+  if (realpath(filename, path)) {
+    return path;
+  }
+#endif
+
+  return filename;
+}
+
+
+// Changes when the file is replaced or modified. Empty if it cannot be determined.
+static std::string file_identity(const std::string& filename)
+{
+#if defined(HAVE_UNISTD_H)
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0) {
+    std::stringstream sstr;
+    sstr << st.st_dev << ":" << st.st_ino << ":" << st.st_size << ":" << st.st_mtime;
+#if defined(__linux__)
+    // Files rewritten within the same second differ only in the nanoseconds.
+    sstr << "." << st.st_mtim.tv_nsec;
+#endif
+    return sstr.str();
+  }
+#else
+  (void)filename;
+#endif
+
+  return std::string();
+}
+
+
 HeifFile::HeifFile()
 {
 }
@@ -48,7 +92,7 @@ std::vector<heif_image_id> HeifFile::get_item_IDs() const
   std::vector<heif_image_id> IDs;
 
   for (const auto& image : m_images) {
-    IDs.push_back(image.second.m_infe_box->get_item_ID());
+    IDs.push_back(image.first);
   }
 
   return IDs;
@@ -58,8 +102,21 @@ std::vector<heif_image_id> HeifFile::get_item_IDs() const
 Error HeifFile::read_from_file(const char* input_filename)
 {
   m_input_stream = std::unique_ptr<std::istream>(new std::ifstream(input_filename));
+  m_input_filename = absolute_path(input_filename);
+  m_input_file_identity = file_identity(m_input_filename);
 
+  // Limit the range to the file size, so that files are parsed exactly like memory input.
   uint64_t maxSize = std::numeric_limits<uint64_t>::max();
+  if (*m_input_stream) {
+    m_input_stream->seekg(0, std::ios_base::end);
+    maxSize = static_cast<uint64_t>(m_input_stream->tellg());
+    m_input_stream->seekg(0, std::ios_base::beg);
+  }
+
+  if (m_io_recorder && *m_input_stream) {
+    start_io_recording(maxSize);
+  }
+
   heif::BitstreamRange range(m_input_stream.get(), maxSize);
 
 
@@ -69,13 +126,63 @@ Error HeifFile::read_from_file(const char* input_filename)
 
 
 
-Error HeifFile::read_from_memory(const void* data, size_t size)
+// Reads from memory that is owned by the caller. Seeking moves within the get area,
+// which is the whole memory block.
+class MemoryStreamBuffer : public std::streambuf
 {
-  // TODO: Work on passed memory directly instead of creating a copy here.
-  // Note: we cannot use basic_streambuf for this, because it does not support seeking
-  std::string s(static_cast<const char*>(data), size);
+ public:
+  MemoryStreamBuffer(const void* data, size_t size)
+  {
+    char* begin = const_cast<char*>(static_cast<const char*>(data));
+    setg(begin, begin, begin + size);
+  }
 
-  m_input_stream = std::unique_ptr<std::istream>(new std::istringstream(std::move(s)));
+ protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override
+  {
+    if (!(which & std::ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+
+    off_type position = off;
+    if (dir == std::ios_base::cur) {
+      position += gptr() - eback();
+    }
+    else if (dir == std::ios_base::end) {
+      position += egptr() - eback();
+    }
+
+    if (position < 0 || position > egptr() - eback()) {
+      return pos_type(off_type(-1));
+    }
+
+    setg(eback(), eback() + position, egptr());
+    return pos_type(position);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+  {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
+
+Error HeifFile::read_from_memory(const void* data, size_t size, bool copy)
+{
+  if (copy) {
+    std::string s(static_cast<const char*>(data), size);
+
+    m_input_stream = std::unique_ptr<std::istream>(new std::istringstream(std::move(s)));
+  }
+  else {
+    m_memory_buffer.reset(new MemoryStreamBuffer(data, size));
+    m_input_stream = std::unique_ptr<std::istream>(new std::istream(m_memory_buffer.get()));
+  }
+
+  if (m_io_recorder) {
+    start_io_recording(size);
+  }
 
   heif::BitstreamRange range(m_input_stream.get(), size);
 
@@ -84,8 +191,22 @@ Error HeifFile::read_from_memory(const void* data, size_t size)
 }
 
 
+void HeifFile::start_io_recording(uint64_t file_size)
+{
+  m_io_recorder->set_file_size(file_size);
+
+  m_source_stream = std::move(m_input_stream);
+  m_recording_buffer.reset(new RecordingStreamBuffer(m_source_stream->rdbuf(), m_io_recorder));
+  m_input_stream.reset(new std::istream(m_recording_buffer.get()));
+}
+
+
 std::string HeifFile::debug_dump_boxes() const
 {
+  if (m_compact) {
+    return "Box tree not available: file was opened in compact mode.\n";
+  }
+
   std::stringstream sstr;
 
   bool first=true;
@@ -112,10 +233,13 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
 {
   // --- read all top-level boxes
 
+  std::shared_ptr<Box_ftyp> ftyp_box;
+  std::shared_ptr<Box_meta> meta_box;
+
   for (;;) {
     std::shared_ptr<Box> box;
     Error error = Box::read(range, &box);
-    if (error != Error::Ok || range.error() || range.eof()) {
+    if (error != Error::Ok || range.error()) {
       break;
     }
 
@@ -125,11 +249,16 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
     // extract relevant boxes (ftyp, meta)
 
     if (box->get_short_type() == fourcc("meta")) {
-      m_meta_box = std::dynamic_pointer_cast<Box_meta>(box);
+      meta_box = std::dynamic_pointer_cast<Box_meta>(box);
     }
 
     if (box->get_short_type() == fourcc("ftyp")) {
-      m_ftyp_box = std::dynamic_pointer_cast<Box_ftyp>(box);
+      ftyp_box = std::dynamic_pointer_cast<Box_ftyp>(box);
+    }
+
+    // The last box may end exactly at the end of the input.
+    if (range.eof()) {
+      break;
     }
   }
 
@@ -137,27 +266,28 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
 
   // --- check whether this is a HEIF file and its structural format
 
-  if (!m_ftyp_box) {
+  if (!ftyp_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_ftyp_box);
   }
 
-  if (!m_ftyp_box->has_compatible_brand(fourcc("heic"))) {
+  if (!ftyp_box->has_compatible_brand(fourcc("heic")) &&
+      !ftyp_box->has_compatible_brand(fourcc("avif"))) {
     std::stringstream sstr;
-    sstr << "File does not support the 'heic' brand.\n";
+    sstr << "File supports neither the 'heic' nor the 'avif' brand.\n";
 
     return Error(heif_error_Unsupported_filetype,
                  heif_suberror_Unspecified,
                  sstr.str());
   }
 
-  if (!m_meta_box) {
+  if (!meta_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_meta_box);
   }
 
 
-  auto hdlr_box = std::dynamic_pointer_cast<Box_hdlr>(m_meta_box->get_child_box(fourcc("hdlr")));
+  auto hdlr_box = std::dynamic_pointer_cast<Box_hdlr>(meta_box->get_child_box(fourcc("hdlr")));
   if (!hdlr_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_hdlr_box);
@@ -171,41 +301,41 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
 
   // --- find mandatory boxes needed for image decoding
 
-  auto pitm_box = std::dynamic_pointer_cast<Box_pitm>(m_meta_box->get_child_box(fourcc("pitm")));
+  auto pitm_box = std::dynamic_pointer_cast<Box_pitm>(meta_box->get_child_box(fourcc("pitm")));
   if (!pitm_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_pitm_box);
   }
 
-  std::shared_ptr<Box> iprp_box = m_meta_box->get_child_box(fourcc("iprp"));
+  std::shared_ptr<Box> iprp_box = meta_box->get_child_box(fourcc("iprp"));
   if (!iprp_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_iprp_box);
   }
 
-  m_ipco_box = std::dynamic_pointer_cast<Box_ipco>(iprp_box->get_child_box(fourcc("ipco")));
-  if (!m_ipco_box) {
+  auto ipco_box = std::dynamic_pointer_cast<Box_ipco>(iprp_box->get_child_box(fourcc("ipco")));
+  if (!ipco_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_ipco_box);
   }
 
-  m_ipma_box = std::dynamic_pointer_cast<Box_ipma>(iprp_box->get_child_box(fourcc("ipma")));
-  if (!m_ipma_box) {
+  auto ipma_box = std::dynamic_pointer_cast<Box_ipma>(iprp_box->get_child_box(fourcc("ipma")));
+  if (!ipma_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_ipma_box);
   }
 
-  m_iloc_box = std::dynamic_pointer_cast<Box_iloc>(m_meta_box->get_child_box(fourcc("iloc")));
-  if (!m_iloc_box) {
+  auto iloc_box = std::dynamic_pointer_cast<Box_iloc>(meta_box->get_child_box(fourcc("iloc")));
+  if (!iloc_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_iloc_box);
   }
 
-  m_idat_box = std::dynamic_pointer_cast<Box_idat>(m_meta_box->get_child_box(fourcc("idat")));
+  m_idat_box = std::dynamic_pointer_cast<Box_idat>(meta_box->get_child_box(fourcc("idat")));
 
-  m_iref_box = std::dynamic_pointer_cast<Box_iref>(m_meta_box->get_child_box(fourcc("iref")));
+  auto iref_box = std::dynamic_pointer_cast<Box_iref>(meta_box->get_child_box(fourcc("iref")));
 
-  std::shared_ptr<Box> iinf_box = m_meta_box->get_child_box(fourcc("iinf"));
+  std::shared_ptr<Box> iinf_box = meta_box->get_child_box(fourcc("iinf"));
   if (!iinf_box) {
     return Error(heif_error_Invalid_input,
                  heif_suberror_No_iinf_box);
@@ -227,11 +357,38 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
     }
 
     Image img;
-    img.m_infe_box = infe_box;
+    img.m_item_type = infe_box->get_item_type();
+    img.m_hidden = infe_box->is_hidden_item();
 
     m_images.insert( std::make_pair(infe_box->get_item_ID(), img) );
   }
 
+
+  // --- collect locations, references and properties of all items
+
+  for (const auto& item : iloc_box->get_items()) {
+    auto iter = m_images.find(item.item_ID);
+    if (iter != m_images.end()) {
+      iter->second.m_has_location = true;
+      iter->second.m_location = item;
+    }
+  }
+
+  m_has_iref = (iref_box != nullptr);
+
+  for (auto& pair : m_images) {
+    Image& img = pair.second;
+
+    if (iref_box) {
+      img.m_reference_type = iref_box->get_reference_type(pair.first);
+      img.m_references = iref_box->get_references(pair.first);
+    }
+
+    img.m_properties_error = ipco_box->get_properties_for_item_ID(pair.first, ipma_box,
+                                                                  img.m_properties);
+    resolve_properties(img);
+  }
+
   return Error::Ok;
 }
 
@@ -264,77 +421,213 @@ std::string HeifFile::get_item_type(heif_image_id ID) const
     return "";
   }
 
-  return img->m_infe_box->get_item_type();
+  return img->m_item_type;
 }
 
 
-Error HeifFile::get_properties(heif_image_id imageID,
-                               std::vector<Box_ipco::Property>& properties) const
+bool HeifFile::is_hidden_item(heif_image_id ID) const
 {
-  if (!m_ipco_box) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_No_ipco_box);
-  } else if (!m_ipma_box) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_No_ipma_box);
+  const Image* img;
+  if (!get_image_info(ID, &img)) {
+    return false;
   }
 
-  return m_ipco_box->get_properties_for_item_ID(imageID, m_ipma_box, properties);
+  return img->m_hidden;
 }
 
 
-Error HeifFile::get_compressed_image_data(heif_image_id ID, std::vector<uint8_t>* data) const {
+uint32_t HeifFile::get_reference_type(heif_image_id ID) const
+{
+  const Image* img;
+  if (!get_image_info(ID, &img)) {
+    return 0;
+  }
 
-  if (!image_exists(ID)) {
+  return img->m_reference_type;
+}
+
+
+std::vector<heif_image_id> HeifFile::get_references(heif_image_id ID) const
+{
+  const Image* img;
+  if (!get_image_info(ID, &img)) {
+    return std::vector<heif_image_id>();
+  }
+
+  return img->m_references;
+}
+
+
+Error HeifFile::get_image_properties_info(heif_image_id ID, const Image** image) const
+{
+  if (!get_image_info(ID, image)) {
     return Error(heif_error_Usage_error,
                  heif_suberror_Nonexisting_image_referenced);
   }
 
-  const Image* image;
-  if (!get_image_info(ID, &image)) {
+  return (*image)->m_properties_error;
+}
+
+
+Error HeifFile::get_properties(heif_image_id imageID,
+                               std::vector<Box_ipco::Property>& properties) const
+{
+  const Image* img;
+  Error err = get_image_properties_info(imageID, &img);
+  if (err) {
+    return err;
+  }
+
+  if (m_compact) {
     return Error(heif_error_Usage_error,
-                 heif_suberror_Nonexisting_image_referenced);
+                 heif_suberror_Unspecified,
+                 "Property boxes are not available in compact mode");
   }
 
+  properties = img->m_properties;
+  return Error::Ok;
+}
 
-  std::string item_type = image->m_infe_box->get_item_type();
 
-  // --- get coded image data pointers
+void HeifFile::resolve_properties(Image& image)
+{
+  for (const auto& property : image.m_properties) {
+    auto ispe = std::dynamic_pointer_cast<Box_ispe>(property.property);
+    if (ispe) {
+      image.m_ispe_width = ispe->get_width();
+      image.m_ispe_height = ispe->get_height();
+    }
 
-  auto items = m_iloc_box->get_items();
-  const Box_iloc::Item* item = nullptr;
-  for (const auto& i : items) {
-    if (i.item_ID == ID) {
-      item = &i;
-      break;
+    ItemTransformation transformation;
+
+    auto rot = std::dynamic_pointer_cast<Box_irot>(property.property);
+    auto mirror = std::dynamic_pointer_cast<Box_imir>(property.property);
+    auto clap = std::dynamic_pointer_cast<Box_clap>(property.property);
+
+    if (rot) {
+      transformation.type = fourcc("irot");
+      transformation.rotation_ccw = rot->get_rotation();
+    }
+    else if (mirror) {
+      transformation.type = fourcc("imir");
+      transformation.mirror_horizontal = (mirror->get_mirror_axis() == Box_imir::MirrorAxis::Horizontal);
     }
+    else if (clap) {
+      transformation.type = fourcc("clap");
+      transformation.clean_aperture = clap->get_clean_aperture();
+    }
+    else {
+      continue;
+    }
+
+    image.m_transformations.push_back(transformation);
   }
-  if (!item) {
-    std::stringstream sstr;
-    sstr << "Item with ID " << ID << " has no compressed data";
+}
 
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_No_item_data,
-                 sstr.str());
+
+Error HeifFile::get_ispe_size(heif_image_id ID, uint32_t* width, uint32_t* height) const
+{
+  const Image* img;
+  Error err = get_image_properties_info(ID, &img);
+  if (err) {
+    return err;
   }
 
-  Error error = Error(heif_error_Unsupported_feature,
-                      heif_suberror_Unsupported_codec);
-  if (item_type == "hvc1") {
-    // --- --- --- HEVC
+  *width = img->m_ispe_width;
+  *height = img->m_ispe_height;
+  return Error::Ok;
+}
 
-    // --- get properties for this image
 
-    std::vector<Box_ipco::Property> properties;
-    Error err = m_ipco_box->get_properties_for_item_ID(ID, m_ipma_box, properties);
-    if (err) {
-      return err;
+Error HeifFile::get_transformations(heif_image_id ID,
+                                    std::vector<ItemTransformation>& transformations) const
+{
+  const Image* img;
+  Error err = get_image_properties_info(ID, &img);
+  if (err) {
+    return err;
+  }
+
+  transformations = img->m_transformations;
+  return Error::Ok;
+}
+
+
+void HeifFile::compact()
+{
+  m_top_level_boxes.clear();
+
+  // Only plain values remain of the properties. The decoder configuration is
+  // converted into the headers that are prepended to the image data.
+  for (auto& pair : m_images) {
+    Image& img = pair.second;
+
+    if (img.m_item_type == "hvc1" || img.m_item_type == "av01") {
+      img.m_codec_headers_error = get_codec_headers(img, &img.m_codec_headers);
     }
 
-    // --- get codec configuration
+    std::vector<Box_ipco::Property>().swap(img.m_properties);
+  }
+
+  // Files on disk are opened again when needed. Memory input has to be kept.
+  if (!m_input_filename.empty()) {
+    m_input_stream.reset();
+    m_recording_buffer.reset();
+    m_source_stream.reset();
+  }
+
+  m_compact = true;
+}
+
+
+Error HeifFile::read_item_data(const Box_iloc::Item& item, heif_io_stage stage,
+                               std::vector<uint8_t>* data) const
+{
+  if (m_input_stream) {
+    std::lock_guard<std::mutex> lock(m_read_mutex);
+
+    if (!m_recording_buffer) {
+      return Box_iloc::read_data(item, *m_input_stream, m_idat_box, data);
+    }
+
+    m_recording_buffer->set_stage(stage, item.item_ID);
+    Error err = Box_iloc::read_data(item, *m_input_stream, m_idat_box, data);
+    m_recording_buffer->set_stage(heif_io_stage_open, 0);
+    return err;
+  }
+
+  if (file_identity(m_input_filename) != m_input_file_identity) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Unspecified,
+                 "Input file was changed after it was opened");
+  }
+
+  std::ifstream istr(m_input_filename, std::ios_base::binary);
+  if (!istr) {
+    return Error(heif_error_Input_does_not_exist);
+  }
+
+  if (m_io_recorder) {
+    RecordingStreamBuffer buffer(istr.rdbuf(), m_io_recorder, stage, item.item_ID);
+    std::istream recorded_istr(&buffer);
+    return Box_iloc::read_data(item, recorded_istr, m_idat_box, data);
+  }
+
+  return Box_iloc::read_data(item, istr, m_idat_box, data);
+}
+
+
+Error HeifFile::get_codec_headers(const Image& image, std::vector<uint8_t>* data)
+{
+  if (image.m_properties_error) {
+    return image.m_properties_error;
+  }
+
+  if (image.m_item_type == "hvc1") {
+    // --- --- --- HEVC
 
     std::shared_ptr<Box_hvcC> hvcC_box;
-    for (auto& prop : properties) {
+    for (auto& prop : image.m_properties) {
       if (prop.property->get_short_type() == fourcc("hvcC")) {
         hvcC_box = std::dynamic_pointer_cast<Box_hvcC>(prop.property);
         if (hvcC_box) {
@@ -350,12 +643,84 @@ Error HeifFile::get_compressed_image_data(heif_image_id ID, std::vector<uint8_t>
       return Error(heif_error_Invalid_input,
                    heif_suberror_No_item_data);
     }
+  }
+  else {
+    // --- --- --- AV1
+
+    std::shared_ptr<Box_av1C> av1C_box;
+    for (auto& prop : image.m_properties) {
+      av1C_box = std::dynamic_pointer_cast<Box_av1C>(prop.property);
+      if (av1C_box) {
+        break;
+      }
+    }
+
+    if (!av1C_box) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_av1C_box);
+    } else if (!av1C_box->get_headers(data)) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_item_data);
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifFile::get_compressed_image_data(heif_image_id ID, std::vector<uint8_t>* data) const {
+
+  if (!image_exists(ID)) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_image_referenced);
+  }
+
+  const Image* image;
+  if (!get_image_info(ID, &image)) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_image_referenced);
+  }
+
+
+  std::string item_type = image->m_item_type;
+
+  // --- get coded image data pointers
+
+  const Box_iloc::Item* item = (image->m_has_location ? &image->m_location : nullptr);
+  if (!item) {
+    std::stringstream sstr;
+    sstr << "Item with ID " << ID << " has no compressed data";
+
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_item_data,
+                 sstr.str());
+  }
+
+  Error error = Error(heif_error_Unsupported_feature,
+                      heif_suberror_Unsupported_codec);
+  if (item_type == "hvc1" || item_type == "av01") {
+    // --- get the decoder configuration, followed by the coded image data
+
+    if (m_compact) {
+      if (image->m_codec_headers_error) {
+        return image->m_codec_headers_error;
+      }
+
+      data->insert(data->end(), image->m_codec_headers.begin(), image->m_codec_headers.end());
+    }
+    else {
+      error = get_codec_headers(*image, data);
+      if (error) {
+        return error;
+      }
+    }
 
-    error = m_iloc_box->read_data(*item, *m_input_stream.get(), m_idat_box, data);
+    error = read_item_data(*item, heif_io_stage_image_data, data);
   } else if (item_type == "grid" ||
-             item_type == "iovl" ||
-             item_type == "Exif") {
-    error = m_iloc_box->read_data(*item, *m_input_stream.get(), m_idat_box, data);
+             item_type == "iovl") {
+    error = read_item_data(*item, heif_io_stage_image_data, data);
+  } else if (item_type == "Exif") {
+    error = read_item_data(*item, heif_io_stage_metadata, data);
   }
 
   if (error != Error::Ok) {
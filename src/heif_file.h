@@ -22,9 +22,11 @@
 #define LIBHEIF_HEIF_FILE_H
 
 #include "box.h"
+#include "heif_io_recorder.h"
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <map>
 #include <vector>
@@ -35,13 +37,26 @@ namespace heif {
   class HeifImage;
 
 
+  // An 'irot', 'imir' or 'clap' property of an item.
+  struct ItemTransformation {
+    uint32_t type = 0;               // 'irot', 'imir' or 'clap'
+    int rotation_ccw = 0;            // 'irot', in degrees
+    bool mirror_horizontal = false;  // 'imir'
+    CleanAperture clean_aperture;    // 'clap'
+  };
+
+
   class HeifFile {
   public:
     HeifFile();
     ~HeifFile();
 
+    // Log all reads from the input to 'recorder'. Has to be set before the file is read.
+    void set_io_recorder(std::shared_ptr<IORecorder> recorder) { m_io_recorder = recorder; }
+
     Error read_from_file(const char* input_filename);
-    Error read_from_memory(const void* data, size_t size);
+    // If 'copy' is false, the data is read in place and has to outlive the HeifFile.
+    Error read_from_memory(const void* data, size_t size, bool copy = true);
 
     int get_num_images() const { return static_cast<int>(m_images.size()); }
 
@@ -57,55 +72,111 @@ namespace heif {
 
 
 
-    std::shared_ptr<Box_infe> get_infe_box(heif_image_id imageID) {
-      auto iter = m_images.find(imageID);
-      if (iter == m_images.end()) {
-        return nullptr;
-      }
+    bool is_hidden_item(heif_image_id ID) const;
 
-      return iter->second.m_infe_box;
-    }
+    // Returns false if the file has no 'iref' box.
+    bool has_references() const { return m_has_iref; }
 
-    std::shared_ptr<Box_iref> get_iref_box() { return m_iref_box; }
-
-    std::shared_ptr<Box_ipco> get_ipco_box() { return m_ipco_box; }
-
-    std::shared_ptr<Box_ipma> get_ipma_box() { return m_ipma_box; }
+    // Type and target IDs of the first reference from item 'ID', 0 and empty if there is none.
+    uint32_t get_reference_type(heif_image_id ID) const;
+    std::vector<heif_image_id> get_references(heif_image_id ID) const;
 
+    // The property boxes are not available in compact mode.
     Error get_properties(heif_image_id imageID,
                          std::vector<Box_ipco::Property>& properties) const;
 
+    // The following values are resolved from the properties when the file is read, and
+    // remain available in compact mode. Everything else, like 'auxC' and 'colr', is only
+    // read by HeifContext::interpret_heif_file() before the properties are released.
+
+    // Size from the 'ispe' property, 0x0 if the item has none.
+    Error get_ispe_size(heif_image_id ID, uint32_t* width, uint32_t* height) const;
+
+    // 'irot', 'imir' and 'clap' properties, in the order in which they are applied.
+    Error get_transformations(heif_image_id ID,
+                              std::vector<ItemTransformation>& transformations) const;
+
+    // Release the box tree and the property boxes, and keep only the item table with the
+    // resolved property values and decoder configurations. For files read from disk, the
+    // file is also closed and opened again (by name) whenever image data is read.
+    void compact();
+
+    bool is_compact() const { return m_compact; }
+
     std::string debug_dump_boxes() const;
 
   private:
+    // When I/O is recorded, 'm_input_stream' reads through 'm_recording_buffer' from 'm_source_stream'.
+    std::unique_ptr<std::istream> m_source_stream;
+    std::unique_ptr<RecordingStreamBuffer> m_recording_buffer;
     std::unique_ptr<std::istream> m_input_stream;
 
-    std::vector<std::shared_ptr<Box> > m_top_level_boxes;
+    // Stream buffer of 'm_input_stream' for memory input that is not copied.
+    std::unique_ptr<std::streambuf> m_memory_buffer;
+
+    // Absolute path of an input file, and its device, inode, size and modification time.
+    // In compact mode, the file is opened again by this path, and only if it is unchanged.
+    std::string m_input_filename;
+    std::string m_input_file_identity;
+
+    // Serializes the access to 'm_input_stream' when items are decoded in parallel.
+    mutable std::mutex m_read_mutex;
 
-    std::shared_ptr<Box_ftyp> m_ftyp_box;
-    std::shared_ptr<Box_meta> m_meta_box;
+    std::shared_ptr<IORecorder> m_io_recorder;
+
+    std::vector<std::shared_ptr<Box> > m_top_level_boxes;
 
-    std::shared_ptr<Box_ipco> m_ipco_box;
-    std::shared_ptr<Box_ipma> m_ipma_box;
-    std::shared_ptr<Box_iloc> m_iloc_box;
     std::shared_ptr<Box_idat> m_idat_box;
-    std::shared_ptr<Box_iref> m_iref_box;
 
+    // Everything needed from the box tree to access an item. The property boxes are
+    // shared with the 'ipco' box and released in compact mode.
     struct Image {
-      std::shared_ptr<Box_infe> m_infe_box;
+      std::string m_item_type;
+      bool m_hidden = false;
+
+      bool m_has_location = false;
+      Box_iloc::Item m_location;
+
+      uint32_t m_reference_type = 0;
+      std::vector<heif_image_id> m_references;
+
+      std::vector<Box_ipco::Property> m_properties;
+      Error m_properties_error;
+
+      // Values resolved from the property boxes.
+      uint32_t m_ispe_width = 0;
+      uint32_t m_ispe_height = 0;
+      std::vector<ItemTransformation> m_transformations;
+
+      // Decoder configuration from 'hvcC' or 'av1C', only stored in compact mode.
+      std::vector<uint8_t> m_codec_headers;
+      Error m_codec_headers_error;
     };
 
     std::map<heif_image_id, Image> m_images;  // map from image ID to info structure
 
-    // list of image items (does not include hidden images or Exif data)
-    std::vector<heif_image_id> m_valid_image_IDs;
-
     heif_image_id m_primary_image_ID;
 
+    bool m_has_iref = false;
+    bool m_compact = false;
+
 
     Error parse_heif_file(BitstreamRange& bitstream);
 
     bool get_image_info(heif_image_id ID, const Image** image) const;
+
+    // Like get_image_info(), but fails if the properties of the item could not be read.
+    Error get_image_properties_info(heif_image_id ID, const Image** image) const;
+
+    static void resolve_properties(Image& image);
+
+    // Decoder configuration headers of an 'hvc1' or 'av01' item.
+    static Error get_codec_headers(const Image& image, std::vector<uint8_t>* data);
+
+    void start_io_recording(uint64_t file_size);
+
+    Error read_item_data(const Box_iloc::Item& item, heif_io_stage stage,
+                         std::vector<uint8_t>* data) const;
   };
 
 }
@@ -0,0 +1,902 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2017 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "heif_file_append.h"
+#include "box.h"
+#include "heif_file.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace heif;
+
+
+namespace {
+
+  // --- reading and writing big-endian values in memory
+
+  uint32_t get32(const uint8_t* p)
+  {
+    return ((static_cast<uint32_t>(p[0]) << 24) |
+            (static_cast<uint32_t>(p[1]) << 16) |
+            (static_cast<uint32_t>(p[2]) << 8) |
+            (static_cast<uint32_t>(p[3])));
+  }
+
+  uint64_t get64(const uint8_t* p)
+  {
+    return (static_cast<uint64_t>(get32(p)) << 32) | get32(p + 4);
+  }
+
+  // Write the lower 'nBytes' bytes of 'value'.
+  void put(std::vector<uint8_t>& out, uint64_t value, int nBytes)
+  {
+    for (int i = nBytes - 1; i >= 0; i--) {
+      out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  void append(std::vector<uint8_t>& out, const uint8_t* data, uint64_t size)
+  {
+    out.insert(out.end(), data, data + size);
+  }
+
+  void append(std::vector<uint8_t>& out, const std::vector<uint8_t>& data)
+  {
+    out.insert(out.end(), data.begin(), data.end());
+  }
+
+
+  std::vector<uint8_t> box_header(uint32_t type, uint64_t payload_size)
+  {
+    std::vector<uint8_t> header;
+
+    if (payload_size + 8 <= 0xFFFFFFFF) {
+      put(header, payload_size + 8, 4);
+      put(header, type, 4);
+    }
+    else {
+      put(header, 1, 4);
+      put(header, type, 4);
+      put(header, payload_size + 16, 8);
+    }
+
+    return header;
+  }
+
+  std::vector<uint8_t> make_box(uint32_t type, const std::vector<uint8_t>& payload)
+  {
+    std::vector<uint8_t> box = box_header(type, payload.size());
+    append(box, payload);
+    return box;
+  }
+
+  std::vector<uint8_t> make_full_box(uint32_t type, uint8_t version, uint32_t flags,
+                                     const std::vector<uint8_t>& payload)
+  {
+    std::vector<uint8_t> content;
+    put(content, version, 1);
+    put(content, flags, 3);
+    append(content, payload);
+    return make_box(type, content);
+  }
+
+
+  // --- splitting memory into boxes without parsing their content
+
+  struct RawBox {
+    uint32_t type;
+    const uint8_t* data;  // start of the box header
+    uint64_t size;
+    uint32_t header_size;
+
+    const uint8_t* payload() const { return data + header_size; }
+    uint64_t payload_size() const { return size - header_size; }
+  };
+
+  Error scan_boxes(const uint8_t* data, uint64_t size, std::vector<RawBox>* boxes)
+  {
+    uint64_t pos = 0;
+    while (pos < size) {
+      if (size - pos < 8) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_Invalid_box_size);
+      }
+
+      RawBox box;
+      box.data = data + pos;
+      box.size = get32(box.data);
+      box.type = get32(box.data + 4);
+      box.header_size = 8;
+
+      if (box.size == 1) {
+        if (size - pos < 16) {
+          return Error(heif_error_Invalid_input,
+                       heif_suberror_Invalid_box_size);
+        }
+
+        box.size = get64(box.data + 8);
+        box.header_size = 16;
+      }
+      else if (box.size == 0) {
+        box.size = size - pos;
+      }
+
+      if (box.size < box.header_size || box.size > size - pos) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_Invalid_box_size);
+      }
+
+      boxes->push_back(box);
+      pos += box.size;
+    }
+
+    return Error::Ok;
+  }
+
+
+  // --- free space in the file that can hold a new 'meta' box
+
+  struct FreeRegion {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // Whether a box of 'size' bytes fits into a free region. The remaining space has to be
+  // large enough for the header of a 'free' box.
+  bool fits_into(uint64_t region_size, uint64_t size)
+  {
+    if (size > region_size) {
+      return false;
+    }
+
+    uint64_t remainder = region_size - size;
+    return (remainder == 0 ||
+            remainder >= (remainder > 0xFFFFFFFF ? 16U : 8U));
+  }
+
+
+  // --- building the changed boxes of the new 'meta' box
+
+  std::vector<uint8_t> build_infe(const AppendedItem& item, heif_image_id ID)
+  {
+    std::vector<uint8_t> payload;
+    put(payload, ID, ID > 0xFFFF ? 4 : 2);
+    put(payload, 0, 2);  // item_protection_index
+    put(payload, item.item_type, 4);
+    put(payload, 0, 1);  // empty item_name
+
+    return make_full_box(fourcc("infe"), ID > 0xFFFF ? 3 : 2, item.hidden ? 1 : 0, payload);
+  }
+
+
+  Error build_iinf(const RawBox& iinf, const AppendedItem& item, heif_image_id ID,
+                   std::vector<uint8_t>* out)
+  {
+    const uint8_t* p = iinf.payload();
+    uint64_t size = iinf.payload_size();
+
+    uint8_t version = (size >= 4 ? p[0] : 0);
+    uint64_t count_size = (version == 0 ? 2 : 4);
+    if (size < 4 + count_size) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    uint64_t count = (version == 0 ? (get32(p + 4) >> 16) : get32(p + 4)) + 1;
+    uint8_t new_version = (count > 0xFFFF ? 1 : version);
+
+    std::vector<uint8_t> payload;
+    put(payload, count, new_version == 0 ? 2 : 4);
+    append(payload, p + 4 + count_size, size - 4 - count_size);
+    append(payload, build_infe(item, ID));
+
+    *out = make_full_box(fourcc("iinf"), new_version, 0, payload);
+    return Error::Ok;
+  }
+
+
+  int bytes_needed(uint64_t max_value)
+  {
+    if (max_value == 0) {
+      return 0;
+    }
+
+    return (max_value <= 0xFFFFFFFF ? 4 : 8);
+  }
+
+  std::vector<uint8_t> build_iloc(std::vector<Box_iloc::Item> items)
+  {
+    uint64_t max_offset = 0, max_length = 0, max_base_offset = 0, max_index = 0;
+    heif_image_id max_ID = 0;
+    bool has_construction_method = false;
+
+    for (const auto& item : items) {
+      max_ID = std::max(max_ID, item.item_ID);
+      max_base_offset = std::max(max_base_offset, item.base_offset);
+      has_construction_method |= (item.construction_method != 0);
+
+      for (const auto& extent : item.extents) {
+        max_offset = std::max(max_offset, extent.offset);
+        max_length = std::max(max_length, extent.length);
+        max_index = std::max(max_index, extent.index);
+      }
+    }
+
+    // Extent indices are only read for version 2.
+    uint8_t version = 0;
+    if (max_ID > 0xFFFF || max_index > 0 || items.size() > 0xFFFF) {
+      version = 2;
+    }
+    else if (has_construction_method) {
+      version = 1;
+    }
+
+    int offset_size = std::max(bytes_needed(max_offset), 4);
+    int length_size = std::max(bytes_needed(max_length), 4);
+    int base_offset_size = bytes_needed(max_base_offset);
+    int index_size = (version == 2 ? bytes_needed(max_index) : 0);
+
+    std::vector<uint8_t> payload;
+    put(payload, static_cast<uint64_t>((offset_size << 4) | length_size), 1);
+    put(payload, static_cast<uint64_t>((base_offset_size << 4) | index_size), 1);
+    put(payload, items.size(), version < 2 ? 2 : 4);
+
+    for (const auto& item : items) {
+      put(payload, item.item_ID, version < 2 ? 2 : 4);
+      if (version >= 1) {
+        put(payload, item.construction_method, 2);
+      }
+      put(payload, item.data_reference_index, 2);
+      put(payload, item.base_offset, base_offset_size);
+
+      put(payload, item.extents.size(), 2);
+      for (const auto& extent : item.extents) {
+        put(payload, extent.index, index_size);
+        put(payload, extent.offset, offset_size);
+        put(payload, extent.length, length_size);
+      }
+    }
+
+    return make_full_box(fourcc("iloc"), version, 0, payload);
+  }
+
+
+  std::vector<uint8_t> build_reference(const AppendedItem& item, heif_image_id ID,
+                                       uint8_t iref_version)
+  {
+    int ID_size = (iref_version == 0 ? 2 : 4);
+
+    std::vector<uint8_t> payload;
+    put(payload, ID, ID_size);
+    put(payload, 1, 2);
+    put(payload, item.reference_target, ID_size);
+
+    return make_box(item.reference_type, payload);
+  }
+
+  Error build_iref(const RawBox* iref, const AppendedItem& item, heif_image_id ID,
+                   std::vector<uint8_t>* out)
+  {
+    bool large_IDs = (ID > 0xFFFF || item.reference_target > 0xFFFF);
+
+    if (!iref) {
+      uint8_t version = (large_IDs ? 1 : 0);
+      *out = make_full_box(fourcc("iref"), version, 0, build_reference(item, ID, version));
+      return Error::Ok;
+    }
+
+    if (iref->payload_size() < 4) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    uint8_t version = iref->payload()[0];
+    if (version == 0 && large_IDs) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Unsupported_data_version,
+                   "Item IDs do not fit into the existing 'iref' box");
+    }
+
+    std::vector<uint8_t> payload(iref->payload(), iref->payload() + iref->payload_size());
+    append(payload, build_reference(item, ID, version));
+
+    *out = make_box(fourcc("iref"), payload);
+    return Error::Ok;
+  }
+
+
+  bool is_essential_property(uint32_t type)
+  {
+    return (type == fourcc("hvcC") ||
+            type == fourcc("av1C") ||
+            type == fourcc("clap") ||
+            type == fourcc("irot") ||
+            type == fourcc("imir"));
+  }
+
+  struct Association {
+    bool essential;
+    uint16_t index;
+  };
+
+  struct AssociationEntry {
+    heif_image_id item_ID;
+    std::vector<Association> associations;
+  };
+
+  Error build_ipma(const RawBox& ipma, heif_image_id ID,
+                   const std::vector<Association>& associations,
+                   std::vector<uint8_t>* out)
+  {
+    const uint8_t* p = ipma.payload();
+    uint64_t size = ipma.payload_size();
+    if (size < 8) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    uint8_t version = p[0];
+    uint32_t flags = get32(p) & 0xFFFFFF;
+    uint32_t entry_count = get32(p + 4);
+
+    // --- parse the existing entries
+
+    std::vector<AssociationEntry> entries;
+    uint64_t pos = 8;
+    for (uint32_t i = 0; i < entry_count; i++) {
+      AssociationEntry entry;
+
+      int ID_size = (version < 1 ? 2 : 4);
+      if (size - pos < static_cast<uint64_t>(ID_size + 1)) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_End_of_data);
+      }
+
+      entry.item_ID = (ID_size == 2 ? get32(p + pos) >> 16 : get32(p + pos));
+      pos += static_cast<uint64_t>(ID_size);
+
+      int count = p[pos++];
+      int association_size = ((flags & 1) ? 2 : 1);
+      if (size - pos < static_cast<uint64_t>(count * association_size)) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_End_of_data);
+      }
+
+      for (int k = 0; k < count; k++) {
+        Association association;
+        if (association_size == 2) {
+          uint16_t value = static_cast<uint16_t>((p[pos] << 8) | p[pos + 1]);
+          association.essential = !!(value & 0x8000);
+          association.index = static_cast<uint16_t>(value & 0x7FFF);
+        }
+        else {
+          association.essential = !!(p[pos] & 0x80);
+          association.index = static_cast<uint16_t>(p[pos] & 0x7F);
+        }
+
+        entry.associations.push_back(association);
+        pos += static_cast<uint64_t>(association_size);
+      }
+
+      entries.push_back(entry);
+    }
+
+    AssociationEntry new_entry;
+    new_entry.item_ID = ID;
+    new_entry.associations = associations;
+    entries.push_back(new_entry);
+
+    // --- write the entries with field sizes that fit all values
+
+    for (const auto& association : associations) {
+      if (association.index > 0x7F) {
+        flags |= 1;
+      }
+    }
+
+    if (ID > 0xFFFF) {
+      version = std::max(version, static_cast<uint8_t>(1));
+    }
+
+    std::vector<uint8_t> payload;
+    put(payload, entries.size(), 4);
+    for (const auto& entry : entries) {
+      put(payload, entry.item_ID, version < 1 ? 2 : 4);
+      put(payload, entry.associations.size(), 1);
+
+      for (const auto& association : entry.associations) {
+        if (flags & 1) {
+          put(payload, (association.essential ? 0x8000U : 0U) | association.index, 2);
+        }
+        else {
+          put(payload, (association.essential ? 0x80U : 0U) | association.index, 1);
+        }
+      }
+    }
+
+    *out = make_full_box(fourcc("ipma"), version, flags, payload);
+    return Error::Ok;
+  }
+
+
+  Error build_iprp(const RawBox& iprp, const AppendedItem& item, heif_image_id ID,
+                   std::vector<uint8_t>* out)
+  {
+    std::vector<RawBox> children;
+    Error err = scan_boxes(iprp.payload(), iprp.payload_size(), &children);
+    if (err) {
+      return err;
+    }
+
+    std::vector<RawBox> new_properties;
+    if (item.properties_size > 0) {
+      err = scan_boxes(item.properties, item.properties_size, &new_properties);
+      if (err) {
+        return Error(heif_error_Usage_error,
+                     heif_suberror_Invalid_parameter_value,
+                     "Invalid property boxes");
+      }
+    }
+
+    if (new_properties.size() > 255) {
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Invalid_parameter_value,
+                   "Too many properties");
+    }
+
+    const RawBox* ipco = nullptr;
+    const RawBox* ipma = nullptr;
+    for (const auto& child : children) {
+      if (child.type == fourcc("ipco") && !ipco) {
+        ipco = &child;
+      }
+      else if (child.type == fourcc("ipma") && !ipma) {
+        ipma = &child;
+      }
+    }
+
+    if (!ipco) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_ipco_box);
+    }
+
+    if (!ipma) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_ipma_box);
+    }
+
+    std::vector<RawBox> properties;
+    err = scan_boxes(ipco->payload(), ipco->payload_size(), &properties);
+    if (err) {
+      return err;
+    }
+
+    if (properties.size() + new_properties.size() > 0x7FFF) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Security_limit_exceeded,
+                   "Too many properties");
+    }
+
+    // Property indices are 1-based.
+    std::vector<Association> associations;
+    for (size_t i = 0; i < new_properties.size(); i++) {
+      Association association;
+      association.essential = is_essential_property(new_properties[i].type);
+      association.index = static_cast<uint16_t>(properties.size() + i + 1);
+      associations.push_back(association);
+    }
+
+    std::vector<uint8_t> payload;
+    for (const auto& child : children) {
+      if (&child == ipco) {
+        std::vector<uint8_t> ipco_payload(ipco->payload(), ipco->payload() + ipco->payload_size());
+        append(ipco_payload, item.properties, item.properties_size);
+        append(payload, make_box(fourcc("ipco"), ipco_payload));
+      }
+      else if (&child == ipma) {
+        std::vector<uint8_t> ipma_box;
+        err = build_ipma(*ipma, ID, associations, &ipma_box);
+        if (err) {
+          return err;
+        }
+        append(payload, ipma_box);
+      }
+      else {
+        append(payload, child.data, child.size);
+      }
+    }
+
+    *out = make_box(fourcc("iprp"), payload);
+    return Error::Ok;
+  }
+
+
+  // Build a new 'meta' box from the complete box in 'meta' with the item added.
+  Error build_meta(const std::vector<uint8_t>& meta, const AppendedItem& item,
+                   uint64_t data_offset,
+                   std::vector<uint8_t>* out, heif_image_id* out_ID)
+  {
+    // --- parse the box to get the item table
+
+    std::istringstream istr(std::string(meta.begin(), meta.end()));
+    BitstreamRange range(&istr, meta.size());
+
+    std::shared_ptr<Box> meta_box;
+    Error err = Box::read(range, &meta_box);
+    if (err) {
+      return err;
+    }
+
+    auto iloc_box = std::dynamic_pointer_cast<Box_iloc>(meta_box->get_child_box(fourcc("iloc")));
+    if (!iloc_box) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_iloc_box);
+    }
+
+    auto iinf_box = meta_box->get_child_box(fourcc("iinf"));
+    if (!iinf_box) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_iinf_box);
+    }
+
+    std::set<heif_image_id> IDs;
+    for (const auto& infe : iinf_box->get_child_boxes(fourcc("infe"))) {
+      IDs.insert(std::static_pointer_cast<Box_infe>(infe)->get_item_ID());
+    }
+    for (const auto& location : iloc_box->get_items()) {
+      IDs.insert(location.item_ID);
+    }
+
+    if (item.reference_type && IDs.find(item.reference_target) == IDs.end()) {
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Nonexisting_image_referenced);
+    }
+
+    heif_image_id ID = (IDs.empty() ? 1 : *IDs.rbegin() + 1);
+    if (ID == 0) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Security_limit_exceeded,
+                   "No unused item ID");
+    }
+
+    std::vector<Box_iloc::Item> locations = iloc_box->get_items();
+
+    Box_iloc::Item location;
+    location.item_ID = ID;
+    location.data_reference_index = 0;
+
+    Box_iloc::Extent extent;
+    extent.offset = data_offset;
+    extent.length = item.data_size;
+    location.extents.push_back(extent);
+
+    locations.push_back(location);
+
+    // --- copy all children, replacing those that change
+
+    std::vector<RawBox> header;
+    err = scan_boxes(meta.data(), meta.size(), &header);
+    if (err) {
+      return err;
+    }
+
+    const RawBox& old_meta = header[0];
+    if (old_meta.payload_size() < 4) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    std::vector<RawBox> children;
+    err = scan_boxes(old_meta.payload() + 4, old_meta.payload_size() - 4, &children);
+    if (err) {
+      return err;
+    }
+
+    const RawBox* iref = nullptr;
+    for (const auto& child : children) {
+      if (child.type == fourcc("iref")) {
+        iref = &child;
+      }
+    }
+
+    std::vector<uint8_t> payload;
+    bool have_iprp = false;
+    for (const auto& child : children) {
+      std::vector<uint8_t> box;
+
+      if (child.type == fourcc("iinf")) {
+        err = build_iinf(child, item, ID, &box);
+      }
+      else if (child.type == fourcc("iloc")) {
+        box = build_iloc(locations);
+      }
+      else if (child.type == fourcc("iref") && item.reference_type) {
+        err = build_iref(&child, item, ID, &box);
+      }
+      else if (child.type == fourcc("iprp") && !have_iprp) {
+        err = build_iprp(child, item, ID, &box);
+        have_iprp = true;
+      }
+      else {
+        box.assign(child.data, child.data + child.size);
+      }
+
+      if (err) {
+        return err;
+      }
+
+      append(payload, box);
+    }
+
+    if (!have_iprp) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_iprp_box);
+    }
+
+    if (!iref && item.reference_type) {
+      std::vector<uint8_t> box;
+      err = build_iref(nullptr, item, ID, &box);
+      if (err) {
+        return err;
+      }
+      append(payload, box);
+    }
+
+    const uint8_t* full_box_header = old_meta.payload();
+    *out = make_full_box(fourcc("meta"), full_box_header[0],
+                         get32(full_box_header) & 0xFFFFFF, payload);
+    *out_ID = ID;
+    return Error::Ok;
+  }
+}
+
+
+Error heif::append_item_to_file(const char* filename, const AppendedItem& item,
+                                heif_image_id* out_item_ID)
+{
+  if (item.data == nullptr || (item.properties == nullptr && item.properties_size > 0)) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument);
+  }
+
+  if (item.data_size == 0 || item.item_type == 0) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value);
+  }
+
+  std::fstream file(filename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+  if (!file) {
+    return Error(heif_error_Input_does_not_exist);
+  }
+
+  file.seekg(0, std::ios_base::end);
+  uint64_t file_size = static_cast<uint64_t>(file.tellg());
+
+
+  // --- find the 'meta' box (the last one, like HeifFile), a box extending to the end of file
+  //     and the free space left by earlier appends (consecutive 'free' and 'skip' boxes)
+
+  uint64_t meta_offset = 0, meta_size = 0;
+  bool has_meta = false;
+  bool open_ended = false;
+  uint64_t last_box_offset = 0;
+
+  std::vector<FreeRegion> free_regions;
+  bool previous_box_free = false;
+
+  uint64_t pos = 0;
+  while (pos < file_size) {
+    uint8_t header[16];
+    uint64_t header_size = std::min<uint64_t>(16, file_size - pos);
+    file.seekg(static_cast<std::streamoff>(pos));
+    if (header_size < 8 || !file.read(reinterpret_cast<char*>(header),
+                                      static_cast<std::streamsize>(header_size))) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    uint64_t size = get32(header);
+    if (size == 1) {
+      if (header_size < 16) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_Invalid_box_size);
+      }
+      size = get64(header + 8);
+    }
+    else if (size == 0) {
+      size = file_size - pos;
+      open_ended = true;
+    }
+
+    if (size < 8 || size > file_size - pos) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    uint32_t type = get32(header + 4);
+    if (type == fourcc("meta")) {
+      has_meta = true;
+      meta_offset = pos;
+      meta_size = size;
+    }
+
+    bool is_free = (type == fourcc("free") || type == fourcc("skip")) && !open_ended;
+    if (is_free && previous_box_free) {
+      free_regions.back().size += size;
+    }
+    else if (is_free) {
+      FreeRegion region;
+      region.offset = pos;
+      region.size = size;
+      free_regions.push_back(region);
+    }
+    previous_box_free = is_free;
+
+    last_box_offset = pos;
+    pos += size;
+  }
+
+  if (!has_meta) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_meta_box);
+  }
+
+  std::vector<uint8_t> meta(meta_size);
+  file.seekg(static_cast<std::streamoff>(meta_offset));
+  if (!file.read(reinterpret_cast<char*>(meta.data()), static_cast<std::streamsize>(meta_size))) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_End_of_data);
+  }
+
+  if (open_ended) {
+    // The box size has to be set, otherwise the box would include the appended data.
+    if (file_size - last_box_offset > 0xFFFFFFFF) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Invalid_box_size,
+                   "Cannot terminate box that extends to the end of the file");
+    }
+
+    std::vector<uint8_t> size;
+    put(size, file_size - last_box_offset, 4);
+    if (last_box_offset == meta_offset) {
+      std::copy(size.begin(), size.end(), meta.begin());
+    }
+
+    file.seekp(static_cast<std::streamoff>(last_box_offset));
+    file.write(reinterpret_cast<const char*>(size.data()), 4);
+  }
+
+
+  // --- build the new 'meta' box for the item data appended to the end of the file
+
+  std::vector<uint8_t> mdat_header = box_header(fourcc("mdat"), item.data_size);
+  uint64_t data_offset = file_size + mdat_header.size();
+
+  std::vector<uint8_t> new_meta;
+  heif_image_id ID;
+  Error err = build_meta(meta, item, data_offset, &new_meta, &ID);
+  if (err) {
+    return err;
+  }
+
+
+  // --- place the new 'meta' box into the smallest free region that can hold it.
+  //     Otherwise, it is appended after the item data, followed by a 'free' box with room
+  //     for later appends. This way, repeated appends alternate between two regions that
+  //     are large enough, instead of adding a new 'meta' box to the file every time.
+
+  const FreeRegion* reused_region = nullptr;
+  for (const auto& region : free_regions) {
+    if (fits_into(region.size, new_meta.size()) &&
+        (!reused_region || region.size < reused_region->size)) {
+      reused_region = &region;
+    }
+  }
+
+  std::vector<uint8_t> padding;
+  uint64_t new_meta_offset;
+  uint64_t free_space;
+
+  if (reused_region) {
+    new_meta_offset = reused_region->offset;
+    free_space = reused_region->size - new_meta.size();
+  }
+  else {
+    new_meta_offset = data_offset + item.data_size;
+    free_space = std::max<uint64_t>(new_meta.size() / 2, 256);
+  }
+
+  std::vector<uint8_t> free_header;
+  if (free_space > 0) {
+    free_header = box_header(fourcc("free"), free_space - (free_space > 0xFFFFFFFF ? 16 : 8));
+  }
+
+  if (!reused_region) {
+    padding.resize(free_space - free_header.size());
+  }
+
+  file.seekp(0, std::ios_base::end);
+  file.write(reinterpret_cast<const char*>(mdat_header.data()),
+             static_cast<std::streamsize>(mdat_header.size()));
+  file.write(reinterpret_cast<const char*>(item.data),
+             static_cast<std::streamsize>(item.data_size));
+
+  file.seekp(static_cast<std::streamoff>(new_meta_offset));
+  file.write(reinterpret_cast<const char*>(new_meta.data()),
+             static_cast<std::streamsize>(new_meta.size()));
+  file.write(reinterpret_cast<const char*>(free_header.data()),
+             static_cast<std::streamsize>(free_header.size()));
+  file.write(reinterpret_cast<const char*>(padding.data()),
+             static_cast<std::streamsize>(padding.size()));
+  file.flush();
+
+  if (!file) {
+    return Error(heif_error_Encoding_error,
+                 heif_suberror_Cannot_write_output_data);
+  }
+
+
+  // --- release the old 'meta' box. A new 'meta' box in front of it only takes effect now.
+
+  std::vector<uint8_t> free_type;
+  put(free_type, fourcc("free"), 4);
+
+  std::vector<uint8_t> meta_type;
+  put(meta_type, fourcc("meta"), 4);
+
+  file.seekp(static_cast<std::streamoff>(meta_offset + 4));
+  file.write(reinterpret_cast<const char*>(free_type.data()), 4);
+  file.flush();
+
+  if (!file) {
+    return Error(heif_error_Encoding_error,
+                 heif_suberror_Cannot_write_output_data);
+  }
+
+
+  // --- read the file back. If the new item cannot be found, the old 'meta' box is
+  //     restored and the new one is released again.
+
+  HeifFile written_file;
+  Error read_err = written_file.read_from_file(filename);
+  if (read_err || !written_file.image_exists(ID)) {
+    file.seekp(static_cast<std::streamoff>(new_meta_offset + 4));
+    file.write(reinterpret_cast<const char*>(free_type.data()), 4);
+    file.seekp(static_cast<std::streamoff>(meta_offset + 4));
+    file.write(reinterpret_cast<const char*>(meta_type.data()), 4);
+    file.flush();
+
+    return Error(heif_error_Encoding_error,
+                 heif_suberror_Cannot_write_output_data,
+                 "Appended 'meta' box cannot be read back");
+  }
+
+  if (out_item_ID) {
+    *out_item_ID = ID;
+  }
+
+  return Error::Ok;
+}
@@ -0,0 +1,61 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2017 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_HEIF_FILE_APPEND_H
+#define LIBHEIF_HEIF_FILE_APPEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error.h"
+
+
+namespace heif {
+
+  struct AppendedItem {
+    uint32_t item_type = 0;
+    bool hidden = false;
+
+    const uint8_t* data = nullptr;
+    size_t data_size = 0;
+
+    // Complete property boxes that are associated with the new item.
+    const uint8_t* properties = nullptr;
+    size_t properties_size = 0;
+
+    // Reference from the new item to an existing item, no reference if 0.
+    uint32_t reference_type = 0;
+    heif_image_id reference_target = 0;
+  };
+
+
+  // Add an item to an existing file without moving any of the existing data.
+  //
+  // The item data is appended in a new 'mdat' box, followed by a copy of the 'meta'
+  // box that includes the new item. The old 'meta' box is then turned into a 'free'
+  // box. Since the position of all other boxes is unchanged, the existing 'iloc'
+  // entries stay valid. If the operation is interrupted before the old 'meta' box is
+  // released, the file still contains a complete 'meta' box.
+  Error append_item_to_file(const char* filename, const AppendedItem& item,
+                            heif_image_id* out_item_ID);
+
+}
+
+#endif
@@ -22,13 +22,140 @@
 #include "heif_image.h"
 
 #include <assert.h>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
-
+#if defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#endif
+#if defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 
 using namespace heif;
 
 
+PlaneMemory::PlaneMemory(PlaneMemory&& other)
+{
+  *this = std::move(other);
+}
+
+
+PlaneMemory& PlaneMemory::operator=(PlaneMemory&& other)
+{
+  if (this != &other) {
+    release();
+
+    m_heap = std::move(other.m_heap);
+    m_data = other.m_data;
+    m_size = other.m_size;
+    m_mapped = other.m_mapped;
+
+    other.m_heap.clear();
+    other.m_data = nullptr;
+    other.m_size = 0;
+    other.m_mapped = false;
+  }
+
+  return *this;
+}
+
+
+PlaneMemory::~PlaneMemory()
+{
+  release();
+}
+
+
+void PlaneMemory::release()
+{
+#if defined(HAVE_SYS_MMAN_H)
+  if (m_mapped) {
+    munmap(m_data, m_size);
+  }
+#endif
+
+  m_heap.clear();
+  m_heap.shrink_to_fit();
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = false;
+}
+
+
+void PlaneMemory::allocate(size_t size)
+{
+  release();
+
+  m_heap.resize(size);
+  m_data = m_heap.data();
+  m_size = size;
+}
+
+
+bool PlaneMemory::map_temporary_file(size_t size, const std::string& directory)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+  if (size == 0) {
+    return false;
+  }
+
+  std::string path = directory;
+  if (path.empty()) {
+    const char* tmpdir = getenv("TMPDIR");
+    path = (tmpdir && *tmpdir) ? tmpdir : "/tmp";
+  }
+  path += "/libheif-canvas-XXXXXX";
+
+  std::vector<char> path_template(path.begin(), path.end());
+  path_template.push_back(0);
+
+  int fd = mkstemp(path_template.data());
+  if (fd < 0) {
+    return false;
+  }
+
+  // Nobody else needs the file, it is deleted when it is unmapped.
+  unlink(path_template.data());
+
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+#if defined(MADV_HUGEPAGE)
+  // Large pages reduce the TLB pressure on huge canvases. This only has an effect
+  // if the file system supports them (e.g. tmpfs with huge pages enabled).
+  madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+  release();
+
+  m_data = static_cast<uint8_t*>(data);
+  m_size = size;
+  m_mapped = true;
+  return true;
+#else
+  (void)size;
+  (void)directory;
+  return false;
+#endif
+}
+
+
 HeifPixelImage::HeifPixelImage()
 {
 }
@@ -57,12 +184,29 @@ void HeifPixelImage::add_plane(heif_channel channel, int width, int height, int
   int bytes_per_pixel = (bit_depth+7)/8;
   plane.stride = width * bytes_per_pixel;
 
-  plane.mem.resize(width * height * bytes_per_pixel);
+  size_t size = static_cast<size_t>(width) * height * bytes_per_pixel;
+  if (!m_file_backed || !plane.mem.map_temporary_file(size, m_file_backing_directory)) {
+    plane.mem.allocate(size);
+  }
 
   m_planes.insert(std::make_pair(channel, std::move(plane)));
 }
 
 
+void HeifPixelImage::set_file_backed(const std::string& directory)
+{
+  m_file_backed = true;
+  m_file_backing_directory = directory;
+}
+
+
+void HeifPixelImage::copy_storage_mode_from(const HeifPixelImage& image)
+{
+  m_file_backed = image.m_file_backed;
+  m_file_backing_directory = image.m_file_backing_directory;
+}
+
+
 bool HeifPixelImage::has_channel(heif_channel channel) const
 {
   return (m_planes.find(channel) != m_planes.end());
@@ -150,81 +294,129 @@ void HeifPixelImage::transfer_plane_from_image_as(std::shared_ptr<HeifPixelImage
 {
   // TODO: check that dst_channel does not exist yet
 
-  ImagePlane plane = source->m_planes[src_channel];
+  ImagePlane plane = std::move(source->m_planes[src_channel]);
   source->m_planes.erase(src_channel);
 
-  m_planes.insert( std::make_pair(dst_channel, plane) );
+  m_planes.insert( std::make_pair(dst_channel, std::move(plane)) );
 }
 
 
-std::shared_ptr<HeifPixelImage> HeifPixelImage::convert_colorspace(heif_colorspace target_colorspace,
-                                                                   heif_chroma target_chroma) const
+void HeifPixelImage::drop_chroma_planes()
 {
-  std::shared_ptr<HeifPixelImage> out_img;
+  if (m_colorspace != heif_colorspace_YCbCr) {
+    return;
+  }
 
-  if (target_colorspace != get_colorspace()) {
+  m_planes.erase(heif_channel_Cb);
+  m_planes.erase(heif_channel_Cr);
+
+  m_colorspace = heif_colorspace_monochrome;
+  m_chroma = heif_chroma_monochrome;
+}
 
-    // YCbCr -> RGB
 
-    if (get_colorspace() == heif_colorspace_YCbCr &&
-        target_colorspace == heif_colorspace_RGB) {
+std::shared_ptr<const ColorTransformLUT> HeifPixelImage::get_transform_to_sRGB(const struct heif_decoding_options* options,
+                                                                              std::shared_ptr<const ColorProfile>& out_profile) const
+{
+  out_profile = m_color_profile;
 
-      // 4:2:0 input -> 4:4:4 planes
+  if (!options || !options->convert_to_sRGB || !m_color_profile) {
+    return nullptr;
+  }
 
-      if (get_chroma_format() == heif_chroma_420 &&
-          target_chroma == heif_chroma_444) {
-        out_img = convert_YCbCr420_to_RGB();
-      }
+  auto profile = m_color_profile;
+
+  // Tone mapped HDR output is already sRGB encoded, only the primaries remain to be converted.
+  if (!profile->has_icc_profile() &&
+      get_HDR_transfer_characteristics(options) != heif_transfer_characteristic_unspecified) {
+    auto sRGB_encoded = std::make_shared<ColorProfile>(*profile);
+    sRGB_encoded->set_nclx(profile->get_colour_primaries(),
+                           heif_transfer_characteristic_IEC_61966_2_1,
+                           profile->get_matrix_coefficients(),
+                           profile->get_full_range_flag());
+    profile = sRGB_encoded;
+  }
 
-      // 4:2:0 input -> RGB 24bit
+  auto sRGB = std::make_shared<ColorProfile>();
+  sRGB->set_nclx(1, heif_transfer_characteristic_IEC_61966_2_1, 0, true);
+  out_profile = sRGB;
 
-      if (get_chroma_format() == heif_chroma_420 &&
-          target_chroma == heif_chroma_interleaved_24bit) {
-        out_img = convert_YCbCr420_to_RGB24();
-      }
+  return ColorTransformLUT::get_transform_to_sRGB(*profile);
+}
 
-      // 4:2:0 input -> RGBA 32bit
 
-      if (get_chroma_format() == heif_chroma_420 &&
-          target_chroma == heif_chroma_interleaved_32bit) {
-        out_img = convert_YCbCr420_to_RGB32();
-      }
+std::shared_ptr<HeifPixelImage> HeifPixelImage::convert_colorspace(heif_colorspace target_colorspace,
+                                                                   heif_chroma target_chroma,
+                                                                   const struct heif_decoding_options* options) const
+{
+  std::shared_ptr<HeifPixelImage> out_img;
 
+  std::shared_ptr<ImageStatistics> stats;
+  if (options && options->collect_statistics) {
+    stats = std::make_shared<ImageStatistics>(m_width, m_height,
+                                              options->statistics_preview_downscale);
+  }
 
-      // greyscale -> RGB 24bit
 
-      if (get_chroma_format() == heif_chroma_monochrome &&
-          target_chroma == heif_chroma_interleaved_24bit) {
-        out_img = convert_mono_to_RGB(3);
-      }
+  // --- transform to sRGB
 
-      // greyscale -> RGB 32bit
+  std::shared_ptr<const ColorProfile> out_profile = m_color_profile;
+  std::shared_ptr<const ColorTransformLUT> color_transform;
 
-      if (get_chroma_format() == heif_chroma_monochrome &&
-          target_chroma == heif_chroma_interleaved_32bit) {
-        out_img = convert_mono_to_RGB(4);
-      }
-    }
+  if (target_colorspace == heif_colorspace_RGB) {
+    color_transform = get_transform_to_sRGB(options, out_profile);
   }
 
+  RowPostprocessing post;
+  post.color_transform = color_transform.get();
+  post.stats = stats.get();
 
-  if (target_colorspace == get_colorspace() &&
-      target_colorspace == heif_colorspace_RGB) {
-    if (get_chroma_format() == heif_chroma_444 &&
-        target_chroma == heif_chroma_interleaved_24bit) {
-      out_img = convert_RGB_to_RGB24();
-    }
+  // --- YCbCr, monochrome or planar RGB -> 8-bit RGB
+
+  if (target_colorspace == heif_colorspace_RGB &&
+      (target_chroma != get_chroma_format() ||
+       get_colorspace() != heif_colorspace_RGB ||
+       get_bits_per_pixel(heif_channel_R) > 8)) {
+    out_img = convert_to_RGB8(target_chroma, options, post);
   }
 
 
   if (!out_img) {
     // TODO: unsupported conversion
   }
+  else {
+    out_img->set_color_profile(out_profile);
+
+    if (stats) {
+      out_img->set_statistics(stats);
+    }
+  }
 
   return out_img;
 }
 
 
+void RowPostprocessing::process_RGB_row(int y, uint8_t* r, uint8_t* g, uint8_t* b,
+                                        int n, int pixel_stride) const
+{
+  if (color_transform) {
+    color_transform->apply_RGB_row(r,g,b, n, pixel_stride);
+  }
+
+  if (stats) {
+    stats->add_RGB_row(0, y, r,g,b, n, pixel_stride);
+  }
+}
+
+
+void RowPostprocessing::process_alpha_row(int y, const uint8_t* a, int n, int pixel_stride) const
+{
+  if (stats) {
+    stats->add_row(heif_channel_Alpha, 0, y, a, n, pixel_stride);
+  }
+}
+
+
 static inline uint8_t clip(float fx)
 {
   int x = static_cast<int>(fx);
@@ -234,239 +426,742 @@ static inline uint8_t clip(float fx)
 }
 
 
-std::shared_ptr<HeifPixelImage> HeifPixelImage::convert_YCbCr420_to_RGB() const
+// --- HDR to SDR tone mapping
+
+// SMPTE ST 2084 (PQ) constants
+static const double pq_m1 = 2610.0 / 16384;
+static const double pq_m2 = 2523.0 / 4096 * 128;
+static const double pq_c1 = 3424.0 / 4096;
+static const double pq_c2 = 2413.0 / 4096 * 32;
+static const double pq_c3 = 2392.0 / 4096 * 32;
+
+// PQ code value [0;1] -> luminance in cd/m^2
+static double pq_eotf(double e)
 {
-  if (get_bits_per_pixel(heif_channel_Y) != 8 ||
-      get_bits_per_pixel(heif_channel_Cb) != 8 ||
-      get_bits_per_pixel(heif_channel_Cr) != 8) {
-    return nullptr;
+  double p = pow(e, 1.0/pq_m2);
+  return 10000.0 * pow(std::max(p - pq_c1, 0.0) / (pq_c2 - pq_c3*p), 1.0/pq_m1);
+}
+
+// luminance in cd/m^2 -> PQ code value [0;1]
+static double pq_inverse_eotf(double L)
+{
+  double p = pow(std::max(L, 0.0) / 10000.0, pq_m1);
+  return pow((pq_c1 + pq_c2*p) / (1.0 + pq_c3*p), pq_m2);
+}
+
+// HLG code value [0;1] -> normalized scene light [0;1]
+static double hlg_inverse_oetf(double e)
+{
+  const double a = 0.17883277;
+  const double b = 1.0 - 4.0*a;
+  const double c = 0.5 - a*log(4.0*a);
+
+  if (e <= 0.5) {
+    return e*e / 3.0;
   }
+  else {
+    return (exp((e-c)/a) + b) / 12.0;
+  }
+}
 
-  auto outimg = std::make_shared<HeifPixelImage>();
+static double srgb_oetf(double l)
+{
+  if (l <= 0.0031308) {
+    return 12.92 * l;
+  }
+  else {
+    return 1.055 * pow(l, 1.0/2.4) - 0.055;
+  }
+}
+
+static double srgb_eotf(double e)
+{
+  if (e <= 0.04045) {
+    return e / 12.92;
+  }
+  else {
+    return pow((e + 0.055) / 1.055, 2.4);
+  }
+}
+
+static double hable_curve(double x)
+{
+  const double A=0.15, B=0.50, C=0.10, D=0.20, E=0.02, F=0.30;
+  return (x*(A*x + C*B) + D*E) / (x*(A*x + B) + D*F) - E/F;
+}
+
+// ITU-R BT.2390 EETF (without black level lift), computed in the PQ domain.
+static double bt2390_eetf(double L, double source_peak, double target_peak)
+{
+  const double source_max = pq_inverse_eotf(source_peak);
+
+  double e1 = pq_inverse_eotf(L) / source_max;
+  double max_lum = pq_inverse_eotf(target_peak) / source_max;
+  double ks = 1.5 * max_lum - 0.5;
+
+  double e2 = e1;
+  if (e1 > ks) {
+    double t = (e1 - ks) / (1.0 - ks);
+    double t2 = t*t;
+    double t3 = t2*t;
+
+    e2 = (2*t3 - 3*t2 + 1) * ks + (t3 - 2*t2 + t) * (1.0 - ks) + (-2*t3 + 3*t2) * max_lum;
+  }
+
+  return pq_eotf(std::min(e2, 1.0) * source_max);
+}
 
-  int bpp = 8; // TODO: how do we specify the output BPPs ?
 
-  outimg->create(m_width, m_height, heif_colorspace_RGB, heif_chroma_444);
+heif_transfer_characteristics HeifPixelImage::get_HDR_transfer_characteristics(const struct heif_decoding_options* options) const
+{
+  if (!options || options->tone_mapping == heif_tone_mapping_none) {
+    return heif_transfer_characteristic_unspecified;
+  }
 
-  outimg->add_plane(heif_channel_R, m_width, m_height, bpp);
-  outimg->add_plane(heif_channel_G, m_width, m_height, bpp);
-  outimg->add_plane(heif_channel_B, m_width, m_height, bpp);
+  heif_transfer_characteristics transfer = options->input_transfer_characteristics;
+  if (transfer == heif_transfer_characteristic_unspecified &&
+      m_color_profile && m_color_profile->has_nclx()) {
+    transfer = static_cast<heif_transfer_characteristics>(m_color_profile->get_transfer_characteristics());
+  }
 
-  const uint8_t *in_y,*in_cb,*in_cr;
-  int in_y_stride=0, in_cb_stride=0, in_cr_stride=0;
+  if (transfer != heif_transfer_characteristic_ITU_R_BT_2100_0_PQ &&
+      transfer != heif_transfer_characteristic_ITU_R_BT_2100_0_HLG) {
+    return heif_transfer_characteristic_unspecified;
+  }
 
-  uint8_t *out_r,*out_g,*out_b;
-  int out_r_stride=0, out_g_stride=0, out_b_stride=0;
+  return transfer;
+}
 
-  in_y  = get_plane(heif_channel_Y,  &in_y_stride);
-  in_cb = get_plane(heif_channel_Cb, &in_cb_stride);
-  in_cr = get_plane(heif_channel_Cr, &in_cr_stride);
-  out_r = outimg->get_plane(heif_channel_R, &out_r_stride);
-  out_g = outimg->get_plane(heif_channel_G, &out_g_stride);
-  out_b = outimg->get_plane(heif_channel_B, &out_b_stride);
 
-  int x,y;
-  for (y=0;y<m_height;y++) {
-    for (x=0;x<m_width;x++) {
-      float yv = static_cast<float>(in_y [y  *in_y_stride  + x] - 16);
-      float uv = static_cast<float>(in_cb[y/2*in_cb_stride + x/2] - 128);
-      float vv = static_cast<float>(in_cr[y/2*in_cr_stride + x/2] - 128);
+// Fill 'lut' with the mapping from input code values (0 .. 2^bit_depth-1) to 8-bit output
+// values in 8.8 fixed point. Without tone mapping, this is a linear scaling.
+// 'tone_mapping' is heif_tone_mapping_none for input that is not PQ or HLG coded.
+static void build_output_lut(std::vector<uint16_t>& lut, int bit_depth,
+                             heif_tone_mapping_operator tone_mapping,
+                             heif_transfer_characteristics transfer,
+                             double source_peak, double target_peak)
+{
+  const int maxval = (1 << bit_depth) - 1;
+  lut.resize(maxval+1);
 
-      float y_val = 1.164f * yv;
-      out_r[y*out_r_stride + x] = clip(y_val + 1.596f * vv);
-      out_g[y*out_g_stride + x] = clip(y_val - 0.813f * vv - 0.391f * uv);
-      out_b[y*out_b_stride + x] = clip(y_val + 2.018f * uv);
+  if (tone_mapping == heif_tone_mapping_none) {
+    for (int i=0;i<=maxval;i++) {
+      lut[i] = static_cast<uint16_t>((static_cast<uint32_t>(i) * 255 * 256 + maxval/2) / maxval);
     }
+
+    return;
   }
 
-  return outimg;
+  for (int i=0;i<=maxval;i++) {
+    double e = i / static_cast<double>(maxval);
+
+    // display light in cd/m^2
+
+    double L;
+    if (transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_PQ) {
+      L = pq_eotf(e);
+    }
+    else {
+      // HLG OOTF, applied per channel with the system gamma for a 1000 cd/m^2 display
+      L = source_peak * pow(hlg_inverse_oetf(e), 1.2);
+    }
+
+
+    // tone mapped, relative to the target peak luminance
+
+    double out;
+    if (tone_mapping == heif_tone_mapping_hable) {
+      out = hable_curve(L / target_peak) / hable_curve(source_peak / target_peak);
+    }
+    else {
+      out = bt2390_eetf(L, source_peak, target_peak) / target_peak;
+    }
+
+    out = std::max(0.0, std::min(1.0, out));
+
+    lut[i] = static_cast<uint16_t>(srgb_oetf(out) * 255 * 256 + 0.5);
+  }
 }
 
 
+// --- cache of output LUTs, keyed by everything that the curve depends on
+
+static const size_t cMaxCachedOutputLUTs = 16;
 
-std::shared_ptr<HeifPixelImage> HeifPixelImage::convert_YCbCr420_to_RGB24() const
+static std::shared_ptr<const std::vector<uint16_t>> get_output_lut(int bit_depth,
+    const struct heif_decoding_options* options,
+    heif_transfer_characteristics transfer)
 {
-  if (get_bits_per_pixel(heif_channel_Y) != 8 ||
-      get_bits_per_pixel(heif_channel_Cb) != 8 ||
-      get_bits_per_pixel(heif_channel_Cr) != 8) {
-    return nullptr;
+  static std::mutex lut_mutex;
+  static std::map<std::tuple<int,int,int,float,float>,
+                  std::shared_ptr<const std::vector<uint16_t>>> lut_cache;
+
+  heif_tone_mapping_operator tone_mapping = heif_tone_mapping_none;
+  float source_peak = 0, target_peak = 0;
+
+  if (options && options->tone_mapping != heif_tone_mapping_none &&
+      (transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_PQ ||
+       transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_HLG)) {
+    tone_mapping = options->tone_mapping;
+    source_peak = options->tone_mapping_source_peak_luminance;
+    target_peak = options->tone_mapping_target_peak_luminance;
+  }
+  else {
+    transfer = heif_transfer_characteristic_unspecified;
   }
 
-  auto outimg = std::make_shared<HeifPixelImage>();
+  auto key = std::make_tuple(bit_depth, static_cast<int>(transfer), static_cast<int>(tone_mapping),
+                             source_peak, target_peak);
+
+  std::lock_guard<std::mutex> lock(lut_mutex);
 
-  outimg->create(m_width, m_height, heif_colorspace_RGB, heif_chroma_interleaved_24bit);
+  auto iter = lut_cache.find(key);
+  if (iter != lut_cache.end()) {
+    return iter->second;
+  }
+
+  auto lut = std::make_shared<std::vector<uint16_t>>();
+  build_output_lut(*lut, bit_depth, tone_mapping, transfer, source_peak, target_peak);
+
+  // The peak luminances are free parameters, so the number of entries is limited.
+  if (lut_cache.size() >= cMaxCachedOutputLUTs) {
+    lut_cache.clear();
+  }
 
-  outimg->add_plane(heif_channel_interleaved, m_width, m_height, 24);
+  lut_cache[key] = lut;
 
-  const uint8_t *in_y,*in_cb,*in_cr;
-  int in_y_stride=0, in_cb_stride=0, in_cr_stride=0;
+  return lut;
+}
 
-  uint8_t *out_p;
-  int out_p_stride=0;
 
-  in_y  = get_plane(heif_channel_Y,  &in_y_stride);
-  in_cb = get_plane(heif_channel_Cb, &in_cb_stride);
-  in_cr = get_plane(heif_channel_Cr, &in_cr_stride);
-  out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+// 8x8 Bayer matrix, values 0..63
+static const uint8_t bayer_8x8[64] = {
+   0, 32,  8, 40,  2, 34, 10, 42,
+  48, 16, 56, 24, 50, 18, 58, 26,
+  12, 44,  4, 36, 14, 46,  6, 38,
+  60, 28, 52, 20, 62, 30, 54, 22,
+   3, 35, 11, 43,  1, 33,  9, 41,
+  51, 19, 59, 27, 49, 17, 57, 25,
+  15, 47,  7, 39, 13, 45,  5, 37,
+  63, 31, 55, 23, 61, 29, 53, 21
+};
+
+// 16x16 blue-noise threshold matrix (generated with the void-and-cluster method), values 0..255
+static const uint8_t blue_noise_16x16[256] = {
+  120,  61, 134, 223,  84,  33, 168,  12, 113, 225,  63, 246, 185, 233,  88, 169,
+   23, 206, 181,  17, 109, 214,  58, 140, 201,  24, 161,  93,  34, 133,  14, 221,
+  144,  73, 250,  49, 158, 187,  81, 251, 100,  51, 142, 210, 172,  57, 191, 106,
+   42, 167, 101, 126, 220,   3, 121,  40, 170, 231,  82,   8, 114, 254,  80, 232,
+  212,  11, 195,  31,  72, 239, 152, 196,  16, 127, 188, 222,  45, 157,  26, 128,
+  154,  87, 235, 143, 179,  94,  54, 108, 237,  65,  29, 105, 139, 207, 184,  66,
+  248,  47, 115,  62, 209,  20, 164, 217,  79, 146, 178, 243,  69,  90,   0, 118,
+   30, 190, 173,   6, 131, 255,  41, 136,  10, 204,  43, 159,  22, 229, 162, 218,
+   77, 148,  99, 226,  74, 182, 117, 192,  86, 247, 119,  97, 197, 130,  53, 103,
+  242,  19, 198,  44, 155,  96,  59, 230,  28, 165,  60,   5, 240,  39, 175, 202,
+  137,  64, 122, 238,  25, 211,   1, 149, 104, 224, 135, 183, 151,  71, 112,   9,
+   91, 213, 166,  85, 186, 111, 249, 174,  48,  75, 208,  32,  89, 205, 236, 160,
+   37, 252,  18,  55, 138,  38,  78, 123, 194,  13, 107, 253, 124,  15,  56, 189,
+   76, 145, 110, 228, 203, 163, 219,  21, 241, 141, 171,  50, 156, 227, 102, 129,
+    2, 199, 176,  68,   7,  98,  52, 150,  92,  36, 215,  83, 200,  27, 177, 216,
+  244,  95,  35, 153, 245, 125, 193, 234,  70, 180, 132,   4, 116,  67, 147,  46
+};
+
+
+namespace {
+  enum class InputKind {
+    YCbCr,
+    Monochrome,
+    RGB
+  };
+
+  // Compile-time description of the input planes of a conversion kernel.
+  template <typename T, InputKind k, int sx, int sy>
+  struct InputFormat
+  {
+    typedef T sample_type;
+
+    static const InputKind kind = k;
+    static const int shift_x = sx;  // chroma subsampling
+    static const int shift_y = sy;
+  };
+
+  // The optional fourth output channel of interleaved output.
+  enum class ExtraChannel {
+    None,
+    Alpha,
+    PremultipliedAlpha,
+    Padding
+  };
+
+  // Compile-time description of the 8-bit RGB output of a conversion kernel.
+  // For interleaved output, the channels are at fixed byte positions within each pixel.
+  template <int ps, int r, int g, int b, int x, ExtraChannel e>
+  struct OutputFormat
+  {
+    static const int pixel_stride = ps;  // 1 for separate R,G,B planes
+    static const int offset_r = r;
+    static const int offset_g = g;
+    static const int offset_b = b;
+    static const int offset_x = x;  // fourth channel (alpha or padding)
+    static const ExtraChannel extra = e;
+  };
+
+  typedef OutputFormat<1, 0,0,0,0, ExtraChannel::None> PlanarOutput;
+
+  struct ConversionSource
+  {
+    int width, height;
+    int bit_depth;
+
+    // Y,Cb,Cr or R,G,B (only Y for monochrome images). Strides are in samples.
+    const void* planes[3];
+    int strides[3];
+
+    // Optional alpha plane, which may have a different bit depth. Stride is in bytes.
+    const uint8_t* alpha;
+    int alpha_stride;
+    int alpha_bit_depth;
+
+    // YCbCr -> RGB matrix:
+    //   R = scale_y*(Y-offset_y) + cr_r*Cr'
+    //   G = scale_y*(Y-offset_y) - cb_g*Cb' - cr_g*Cr'
+    //   B = scale_y*(Y-offset_y) + cb_b*Cb'
+    // with Cb' = Cb-offset_c, Cr' = Cr-offset_c
+    float offset_y, offset_c;
+    float scale_y;
+    float cr_r, cb_g, cr_g, cb_b;
+
+    // Maps RGB code values (0 .. 2^bit_depth-1) to 8.8 fixed point output values.
+    const uint16_t* lut;
+
+    // Square matrix of dithering thresholds in units of 1/256 of an output quantization
+    // step, with (1 << dither_log2_size) entries per row.
+    const uint8_t* dither;
+    int dither_mask;
+    int dither_log2_size;
+  };
+
+  struct RGB8Target
+  {
+    // Separate R,G,B planes. Interleaved output only uses planes[0], which points to
+    // the first pixel.
+    uint8_t* planes[3];
+    int strides[3];
+
+    uint8_t padding_value;
+  };
+
+  // Output layout of a conversion, resolved to a kernel once per image.
+  struct RGB8Layout
+  {
+    bool planar;  // separate R,G,B planes
+
+    // Interleaved output only
+    heif_channel_order channel_order;
+    bool premultiplied_alpha;
+  };
+}
 
-  int x,y;
-  for (y=0;y<m_height;y++) {
-    for (x=0;x<m_width;x++) {
-      float yv = static_cast<float>(in_y [y  *in_y_stride  + x] - 16);
-      float uv = static_cast<float>(in_cb[y/2*in_cb_stride + x/2] - 128);
-      float vv = static_cast<float>(in_cr[y/2*in_cr_stride + x/2] - 128);
 
-      float y_val = 1.164f * yv;
-      out_p[y*out_p_stride + 3*x + 0] = clip(y_val + 1.596f * vv);
-      out_p[y*out_p_stride + 3*x + 1] = clip(y_val - 0.813f * vv - 0.391f * uv);
-      out_p[y*out_p_stride + 3*x + 2] = clip(y_val + 2.018f * uv);
+// Set up the YCbCr -> RGB matrix from the nclx matrix coefficients and range.
+// Without color information, we assume limited-range BT.601.
+static void set_YCbCr_matrix(ConversionSource& src, const ColorProfile* profile)
+{
+  float Kr = 0.299f, Kb = 0.114f;
+  bool full_range = false;
+
+  if (profile && profile->has_nclx()) {
+    switch (profile->get_matrix_coefficients()) {
+    case 1: // BT.709
+      Kr = 0.2126f; Kb = 0.0722f;
+      break;
+    case 9: // BT.2020 (non-constant luminance)
+    case 10:
+      Kr = 0.2627f; Kb = 0.0593f;
+      break;
+    default: // BT.601
+      break;
     }
+
+    full_range = profile->get_full_range_flag();
   }
 
-  return outimg;
+  const float Kg = 1.0f - Kr - Kb;
+  const float shift = static_cast<float>(1 << (std::max(src.bit_depth, 8) - 8));
+
+  float chroma_scale;
+  if (full_range) {
+    src.offset_y = 0;
+    src.scale_y = 1.0f;
+    chroma_scale = 1.0f;
+  }
+  else {
+    src.offset_y = 16 * shift;
+    src.scale_y = 255.0f / 219.0f;
+    chroma_scale = 255.0f / 224.0f;
+  }
+
+  src.offset_c = 128 * shift;
+  src.cr_r = 2 * (1 - Kr) * chroma_scale;
+  src.cb_b = 2 * (1 - Kb) * chroma_scale;
+  src.cb_g = 2 * Kb * (1 - Kb) / Kg * chroma_scale;
+  src.cr_g = 2 * Kr * (1 - Kr) / Kg * chroma_scale;
 }
 
 
-std::shared_ptr<HeifPixelImage> HeifPixelImage::convert_YCbCr420_to_RGB32() const
+static void write_alpha_row(const ConversionSource& src, int y, uint8_t* out, int pixel_stride)
 {
-  if (get_bits_per_pixel(heif_channel_Y) != 8 ||
-      get_bits_per_pixel(heif_channel_Cb) != 8 ||
-      get_bits_per_pixel(heif_channel_Cr) != 8) {
-    return nullptr;
+  if (!src.alpha) {
+    for (int x=0;x<src.width;x++) {
+      out[x*pixel_stride] = 0xFF;
+    }
   }
+  else if (src.alpha_bit_depth <= 8) {
+    const uint8_t* in_a = src.alpha + y*src.alpha_stride;
+    for (int x=0;x<src.width;x++) {
+      out[x*pixel_stride] = in_a[x];
+    }
+  }
+  else {
+    const uint16_t* in_a = reinterpret_cast<const uint16_t*>(src.alpha + y*src.alpha_stride);
+    const int alpha_max = (1 << src.alpha_bit_depth) - 1;
 
-  auto outimg = std::make_shared<HeifPixelImage>();
-
-  outimg->create(m_width, m_height, heif_colorspace_RGB, heif_chroma_interleaved_32bit);
+    for (int x=0;x<src.width;x++) {
+      out[x*pixel_stride] = static_cast<uint8_t>((in_a[x] * 255 + alpha_max/2) / alpha_max);
+    }
+  }
+}
 
-  outimg->add_plane(heif_channel_interleaved, m_width, m_height, 32);
 
-  const bool with_alpha = has_channel(heif_channel_Alpha);
+// Conversion of YCbCr, monochrome or planar RGB input of any bit depth to 8-bit RGB.
+// All format decisions are template parameters, so that the branches in the inner
+// loop are resolved at compile time.
+template <class In, class Out>
+static void convert_to_RGB8_kernel(const ConversionSource& src,
+                                   const RGB8Target& dst,
+                                   const RowPostprocessing& post)
+{
+  typedef typename In::sample_type T;
 
-  const uint8_t *in_y,*in_cb,*in_cr,*in_a = nullptr;
-  int in_y_stride=0, in_cb_stride=0, in_cr_stride=0, in_a_stride=0;
+  const int maxval = (1 << src.bit_depth) - 1;
+  const int ps = Out::pixel_stride;
+  const uint16_t* lut = src.lut;
 
-  uint8_t *out_p;
-  int out_p_stride=0;
+  for (int y=0;y<src.height;y++) {
+    const T* in0 = static_cast<const T*>(src.planes[0]) + y*src.strides[0];
+    const T* in1 = nullptr;
+    const T* in2 = nullptr;
 
-  in_y  = get_plane(heif_channel_Y,  &in_y_stride);
-  in_cb = get_plane(heif_channel_Cb, &in_cb_stride);
-  in_cr = get_plane(heif_channel_Cr, &in_cr_stride);
-  if (with_alpha) {
-    in_a = get_plane(heif_channel_Alpha, &in_a_stride);
-  }
+    if (In::kind != InputKind::Monochrome) {
+      const int cy = (y >> In::shift_y);
+      in1 = static_cast<const T*>(src.planes[1]) + cy*src.strides[1];
+      in2 = static_cast<const T*>(src.planes[2]) + cy*src.strides[2];
+    }
 
-  out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+    // Interleaved channels are addressed from one row pointer with constant offsets.
+    uint8_t* out = dst.planes[0] + y*dst.strides[0];
+    uint8_t* out_r = out + Out::offset_r;
+    uint8_t* out_g = (ps == 1 ? dst.planes[1] + y*dst.strides[1] : out + Out::offset_g);
+    uint8_t* out_b = (ps == 1 ? dst.planes[2] + y*dst.strides[2] : out + Out::offset_b);
 
-  int x,y;
-  for (y=0;y<m_height;y++) {
-    for (x=0;x<m_width;x++) {
-      float yv = static_cast<float>(in_y [y  *in_y_stride  + x] - 16);
-      float uv = static_cast<float>(in_cb[y/2*in_cb_stride + x/2] - 128);
-      float vv = static_cast<float>(in_cr[y/2*in_cr_stride + x/2] - 128);
+    const uint8_t* dither_row = src.dither + ((y & src.dither_mask) << src.dither_log2_size);
 
-      float y_val = 1.164f * yv;
-      out_p[y*out_p_stride + 4*x + 0] = clip(y_val + 1.596f * vv);
-      out_p[y*out_p_stride + 4*x + 1] = clip(y_val - 0.813f * vv - 0.391f * uv);
-      out_p[y*out_p_stride + 4*x + 2] = clip(y_val + 2.018f * uv);
+    for (int x=0;x<src.width;x++) {
+      int r,g,b;
 
-      if (with_alpha) {
-        out_p[y*out_p_stride + 4*x + 3] = in_a[y*in_a_stride + x];
+      if (In::kind == InputKind::Monochrome) {
+        // limited range luma is expanded to full range, as in convert_to_tensor()
+        r = static_cast<int>(src.scale_y * (static_cast<float>(in0[x]) - src.offset_y) + 0.5f);
+        r = std::max(0, std::min(maxval, r));
+        g = b = r;
+      }
+      else if (In::kind == InputKind::RGB) {
+        r = in0[x];
+        g = in1[x];
+        b = in2[x];
       }
       else {
-        out_p[y*out_p_stride + 4*x + 3] = 0xFF;
+        float yv = src.scale_y * (static_cast<float>(in0[x]) - src.offset_y);
+        float cb = static_cast<float>(in1[x >> In::shift_x]) - src.offset_c;
+        float cr = static_cast<float>(in2[x >> In::shift_x]) - src.offset_c;
+
+        r = static_cast<int>(yv + src.cr_r * cr + 0.5f);
+        g = static_cast<int>(yv - src.cb_g * cb - src.cr_g * cr + 0.5f);
+        b = static_cast<int>(yv + src.cb_b * cb + 0.5f);
+
+        r = std::max(0, std::min(maxval, r));
+        g = std::max(0, std::min(maxval, g));
+        b = std::max(0, std::min(maxval, b));
+      }
+
+      const int threshold = dither_row[x & src.dither_mask];
+
+      out_r[x*ps] = static_cast<uint8_t>(std::min(255, (lut[r] + threshold) >> 8));
+      out_g[x*ps] = static_cast<uint8_t>(std::min(255, (lut[g] + threshold) >> 8));
+      out_b[x*ps] = static_cast<uint8_t>(std::min(255, (lut[b] + threshold) >> 8));
+    }
+
+    post.process_RGB_row(y, out_r, out_g, out_b, src.width, ps);
+
+
+    // --- fourth channel
+
+    if (Out::extra == ExtraChannel::Padding) {
+      uint8_t* out_x = out + Out::offset_x;
+      for (int x=0;x<src.width;x++) {
+        out_x[x*ps] = dst.padding_value;
+      }
+    }
+    else if (Out::extra != ExtraChannel::None) {
+      uint8_t* out_a = out + Out::offset_x;
+      write_alpha_row(src, y, out_a, ps);
+      post.process_alpha_row(y, out_a, src.width, ps);
+
+      if (Out::extra == ExtraChannel::PremultipliedAlpha) {
+        for (int x=0;x<src.width;x++) {
+          const int a = out_a[x*ps];
+          out_r[x*ps] = static_cast<uint8_t>((out_r[x*ps] * a + 127) / 255);
+          out_g[x*ps] = static_cast<uint8_t>((out_g[x*ps] * a + 127) / 255);
+          out_b[x*ps] = static_cast<uint8_t>((out_b[x*ps] * a + 127) / 255);
+        }
       }
     }
   }
+}
 
-  return outimg;
+
+// --- kernel selection
+
+typedef void (*RGB8Kernel)(const ConversionSource&, const RGB8Target&, const RowPostprocessing&);
+
+template <class In, int r, int g, int b, int a>
+static RGB8Kernel select_RGB8_alpha_kernel(bool premultiplied)
+{
+  if (premultiplied) {
+    return convert_to_RGB8_kernel<In, OutputFormat<4, r,g,b,a, ExtraChannel::PremultipliedAlpha>>;
+  }
+  else {
+    return convert_to_RGB8_kernel<In, OutputFormat<4, r,g,b,a, ExtraChannel::Alpha>>;
+  }
 }
 
 
-std::shared_ptr<HeifPixelImage> HeifPixelImage::convert_RGB_to_RGB24() const
+template <class In>
+static RGB8Kernel select_RGB8_kernel(const RGB8Layout& layout)
 {
-  if (get_bits_per_pixel(heif_channel_R) != 8 ||
-      get_bits_per_pixel(heif_channel_G) != 8 ||
-      get_bits_per_pixel(heif_channel_B) != 8) {
-    return nullptr;
+  if (layout.planar) {
+    return convert_to_RGB8_kernel<In, PlanarOutput>;
   }
 
-  auto outimg = std::make_shared<HeifPixelImage>();
+  const bool pre = layout.premultiplied_alpha;
+
+  switch (layout.channel_order) {
+  case heif_channel_order_RGB:
+    return convert_to_RGB8_kernel<In, OutputFormat<3, 0,1,2,0, ExtraChannel::None>>;
+  case heif_channel_order_BGR:
+    return convert_to_RGB8_kernel<In, OutputFormat<3, 2,1,0,0, ExtraChannel::None>>;
+  case heif_channel_order_RGBA:
+    return select_RGB8_alpha_kernel<In, 0,1,2,3>(pre);
+  case heif_channel_order_BGRA:
+    return select_RGB8_alpha_kernel<In, 2,1,0,3>(pre);
+  case heif_channel_order_ARGB:
+    return select_RGB8_alpha_kernel<In, 1,2,3,0>(pre);
+  case heif_channel_order_ABGR:
+    return select_RGB8_alpha_kernel<In, 3,2,1,0>(pre);
+  case heif_channel_order_RGBX:
+    return convert_to_RGB8_kernel<In, OutputFormat<4, 0,1,2,3, ExtraChannel::Padding>>;
+  case heif_channel_order_BGRX:
+    return convert_to_RGB8_kernel<In, OutputFormat<4, 2,1,0,3, ExtraChannel::Padding>>;
+  case heif_channel_order_XRGB:
+    return convert_to_RGB8_kernel<In, OutputFormat<4, 1,2,3,0, ExtraChannel::Padding>>;
+  case heif_channel_order_XBGR:
+    return convert_to_RGB8_kernel<In, OutputFormat<4, 3,2,1,0, ExtraChannel::Padding>>;
+  }
+
+  return nullptr;
+}
 
-  outimg->create(m_width, m_height, heif_colorspace_RGB, heif_chroma_interleaved_24bit);
 
-  outimg->add_plane(heif_channel_interleaved, m_width, m_height, 24);
+static const struct {
+  heif_chroma input_chroma;
+  InputKind kind;
+  bool high_bit_depth;
+  RGB8Kernel (*select)(const RGB8Layout& layout);
+} RGB8_input_formats[] = {
+  { heif_chroma_420, InputKind::YCbCr, false, select_RGB8_kernel<InputFormat<uint8_t,  InputKind::YCbCr,1,1>> },
+  { heif_chroma_422, InputKind::YCbCr, false, select_RGB8_kernel<InputFormat<uint8_t,  InputKind::YCbCr,1,0>> },
+  { heif_chroma_444, InputKind::YCbCr, false, select_RGB8_kernel<InputFormat<uint8_t,  InputKind::YCbCr,0,0>> },
+  { heif_chroma_420, InputKind::YCbCr, true,  select_RGB8_kernel<InputFormat<uint16_t, InputKind::YCbCr,1,1>> },
+  { heif_chroma_422, InputKind::YCbCr, true,  select_RGB8_kernel<InputFormat<uint16_t, InputKind::YCbCr,1,0>> },
+  { heif_chroma_444, InputKind::YCbCr, true,  select_RGB8_kernel<InputFormat<uint16_t, InputKind::YCbCr,0,0>> },
+  { heif_chroma_monochrome, InputKind::Monochrome, false, select_RGB8_kernel<InputFormat<uint8_t,  InputKind::Monochrome,0,0>> },
+  { heif_chroma_monochrome, InputKind::Monochrome, true,  select_RGB8_kernel<InputFormat<uint16_t, InputKind::Monochrome,0,0>> },
+  { heif_chroma_444, InputKind::RGB, false, select_RGB8_kernel<InputFormat<uint8_t,  InputKind::RGB,0,0>> },
+  { heif_chroma_444, InputKind::RGB, true,  select_RGB8_kernel<InputFormat<uint16_t, InputKind::RGB,0,0>> }
+};
+
+
+// Describe the planes of 'img', select the kernel for the input format and the requested
+// output and run it. Returns false if the input format is not supported.
+static bool convert_to_RGB8_target(const HeifPixelImage& img,
+                                   const RGB8Target& dst, const RGB8Layout& layout,
+                                   const struct heif_decoding_options* options,
+                                   heif_transfer_characteristics hdr_transfer,
+                                   const RowPostprocessing& post)
+{
+  InputKind kind;
+  heif_channel channels[3];
 
-  const uint8_t *in_r,*in_g,*in_b;
-  int in_r_stride=0, in_g_stride=0, in_b_stride=0;
+  if (img.get_chroma_format() == heif_chroma_monochrome) {
+    kind = InputKind::Monochrome;
+    channels[0] = heif_channel_Y;
+  }
+  else if (img.get_colorspace() == heif_colorspace_RGB &&
+           img.get_chroma_format() == heif_chroma_444) {
+    kind = InputKind::RGB;
+    channels[0] = heif_channel_R;
+    channels[1] = heif_channel_G;
+    channels[2] = heif_channel_B;
+  }
+  else if (img.get_colorspace() == heif_colorspace_YCbCr) {
+    kind = InputKind::YCbCr;
+    channels[0] = heif_channel_Y;
+    channels[1] = heif_channel_Cb;
+    channels[2] = heif_channel_Cr;
+  }
+  else {
+    return false;
+  }
 
-  uint8_t *out_p;
-  int out_p_stride=0;
+  const int nPlanes = (kind == InputKind::Monochrome ? 1 : 3);
 
-  in_r = get_plane(heif_channel_R, &in_r_stride);
-  in_g = get_plane(heif_channel_G, &in_g_stride);
-  in_b = get_plane(heif_channel_B, &in_b_stride);
-  out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+  ConversionSource src;
+  src.width = img.get_width();
+  src.height = img.get_height();
+  src.bit_depth = img.get_bits_per_pixel(channels[0]);
 
-  int x,y;
-  for (y=0;y<m_height;y++) {
-    for (x=0;x<m_width;x++) {
-      out_p[y*out_p_stride + 3*x + 0] = in_r[x + y*in_r_stride];
-      out_p[y*out_p_stride + 3*x + 1] = in_g[x + y*in_r_stride];
-      out_p[y*out_p_stride + 3*x + 2] = in_b[x + y*in_r_stride];
-    }
+  if (src.bit_depth < 1 || src.bit_depth > 16) {
+    return false;
   }
 
-  return outimg;
-}
+  const bool high_bit_depth = (src.bit_depth > 8);
 
+  for (int c=0;c<nPlanes;c++) {
+    if (img.get_bits_per_pixel(channels[c]) != src.bit_depth) {
+      return false;
+    }
 
-std::shared_ptr<HeifPixelImage> HeifPixelImage::convert_mono_to_RGB(int bpp) const
-{
-  if (get_bits_per_pixel(heif_channel_Y) != 8) {
-    return nullptr;
+    int stride = 0;
+    src.planes[c] = img.get_plane(channels[c], &stride);
+    src.strides[c] = (high_bit_depth ? stride/2 : stride);
   }
 
-  auto outimg = std::make_shared<HeifPixelImage>();
+  src.alpha_stride = 0;
+  src.alpha = img.get_plane(heif_channel_Alpha, &src.alpha_stride);
+  src.alpha_bit_depth = (src.alpha ? img.get_bits_per_pixel(heif_channel_Alpha) : 8);
+
+  set_YCbCr_matrix(src, img.get_color_profile().get());
+
+
+  // --- select kernel
+
+  RGB8Kernel kernel = nullptr;
+  for (const auto& format : RGB8_input_formats) {
+    if (format.kind == kind &&
+        format.input_chroma == img.get_chroma_format() &&
+        format.high_bit_depth == high_bit_depth) {
+      kernel = format.select(layout);
+      break;
+    }
+  }
 
-  if (bpp==3) {
-    outimg->create(m_width, m_height, heif_colorspace_RGB, heif_chroma_interleaved_24bit);
-  } else {
-    outimg->create(m_width, m_height, heif_colorspace_RGB, heif_chroma_interleaved_32bit);
+  if (!kernel) {
+    return false;
   }
 
-  outimg->add_plane(heif_channel_interleaved, m_width, m_height, bpp*8);
 
-  const uint8_t *in_y;
-  int in_y_stride=0;
+  // --- transfer curve from input code values to 8.8 fixed point output values
 
-  uint8_t *out_p;
-  int out_p_stride=0;
+  std::shared_ptr<const std::vector<uint16_t>> lut = get_output_lut(src.bit_depth, options,
+                                                                    hdr_transfer);
 
-  in_y = get_plane(heif_channel_Y, &in_y_stride);
-  out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+  src.lut = lut->data();
 
-  int x,y;
-  for (y=0;y<m_height;y++) {
-    if (bpp==3) {
-      for (x=0;x<m_width;x++) {
-        uint8_t v = in_y[x + y*in_y_stride];
-        out_p[y*out_p_stride + 3*x + 0] = v;
-        out_p[y*out_p_stride + 3*x + 1] = v;
-        out_p[y*out_p_stride + 3*x + 2] = v;
-      }
+
+  // --- dithering (only for high bit-depth input, 8-bit input is converted exactly)
+
+  uint8_t dither[256];
+
+  heif_dithering_mode dithering = (options && high_bit_depth ?
+                                   options->dithering : heif_dithering_none);
+
+  if (dithering == heif_dithering_ordered_bayer) {
+    for (int i=0;i<64;i++) {
+      dither[i] = static_cast<uint8_t>(bayer_8x8[i] * 4 + 2);
     }
-    else {
-      // TODO: monochrome with alpha channel
-
-      for (x=0;x<m_width;x++) {
-        uint8_t v = in_y[x + y*in_y_stride];
-        out_p[y*out_p_stride + 4*x + 0] = v;
-        out_p[y*out_p_stride + 4*x + 1] = v;
-        out_p[y*out_p_stride + 4*x + 2] = v;
-        out_p[y*out_p_stride + 4*x + 3] = 0xFF;
-      }
+
+    src.dither_log2_size = 3;
+  }
+  else if (dithering == heif_dithering_blue_noise) {
+    memcpy(dither, blue_noise_16x16, 256);
+    src.dither_log2_size = 4;
+  }
+  else {
+    dither[0] = 128;
+    src.dither_log2_size = 0;
+  }
+
+  src.dither = dither;
+  src.dither_mask = (1 << src.dither_log2_size) - 1;
+
+
+  kernel(src, dst, post);
+
+  return true;
+}
+
+
+std::shared_ptr<HeifPixelImage> HeifPixelImage::convert_to_RGB8(heif_chroma target_chroma,
+                                                               const struct heif_decoding_options* options,
+                                                               const RowPostprocessing& post) const
+{
+  auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->create(m_width, m_height, heif_colorspace_RGB, target_chroma);
+  outimg->copy_storage_mode_from(*this);
+
+  RGB8Target dst;
+  dst.padding_value = 0xFF;
+
+  RGB8Layout layout;
+  layout.planar = false;
+  layout.premultiplied_alpha = false;
+
+  if (target_chroma == heif_chroma_444) {
+    const heif_channel rgb[3] = { heif_channel_R, heif_channel_G, heif_channel_B };
+    for (int c=0;c<3;c++) {
+      outimg->add_plane(rgb[c], m_width, m_height, 8);
+      dst.planes[c] = outimg->get_plane(rgb[c], &dst.strides[c]);
     }
+
+    layout.planar = true;
+    layout.channel_order = heif_channel_order_RGB;
+  }
+  else if (target_chroma == heif_chroma_interleaved_24bit ||
+           target_chroma == heif_chroma_interleaved_32bit) {
+    const bool rgba = (target_chroma == heif_chroma_interleaved_32bit);
+
+    outimg->add_plane(heif_channel_interleaved, m_width, m_height, rgba ? 32 : 24);
+    dst.planes[0] = outimg->get_plane(heif_channel_interleaved, &dst.strides[0]);
+
+    layout.channel_order = (rgba ? heif_channel_order_RGBA : heif_channel_order_RGB);
+  }
+  else {
+    return nullptr;
+  }
+
+  if (!convert_to_RGB8_target(*this, dst, layout,
+                              options, get_HDR_transfer_characteristics(options), post)) {
+    return nullptr;
   }
 
   return outimg;
@@ -492,6 +1187,7 @@ Error HeifPixelImage::rotate_ccw(int angle_degrees,
 
   out_img = std::make_shared<HeifPixelImage>();
   out_img->create(out_width, out_height, m_colorspace, m_chroma);
+  out_img->copy_storage_mode_from(*this);
 
 
   // --- rotate all channels
@@ -591,6 +1287,7 @@ Error HeifPixelImage::crop(int left,int right,int top,int bottom,
 {
   out_img = std::make_shared<HeifPixelImage>();
   out_img->create(right-left+1, bottom-top+1, m_colorspace, m_chroma);
+  out_img->copy_storage_mode_from(*this);
 
 
   // --- crop all channels
@@ -686,13 +1383,37 @@ Error HeifPixelImage::fill_RGB_16bit(uint16_t r, uint16_t g, uint16_t b, uint16_
 }
 
 
-Error HeifPixelImage::overlay(std::shared_ptr<HeifPixelImage>& overlay, int dx,int dy)
+Error HeifPixelImage::fill_plane_16bit(heif_channel channel, uint16_t value)
 {
-  std::set<enum heif_channel> channels = overlay->get_channel_set();
+  const auto plane_iter = m_planes.find(channel);
+  if (plane_iter == m_planes.end()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_image_channel_referenced);
+  }
 
-  for (heif_channel channel : channels) {
-    int in_stride=0;
-    const uint8_t* in_p;
+  ImagePlane& plane = plane_iter->second;
+
+  if (plane.bit_depth != 8) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unspecified,
+                 "Can currently only fill images with 8 bits per pixel");
+  }
+
+  uint8_t val8 = static_cast<uint8_t>(value>>8);
+
+  memset(plane.mem.data(), val8, plane.stride*plane.height);
+
+  return Error::Ok;
+}
+
+
+Error HeifPixelImage::overlay(std::shared_ptr<HeifPixelImage>& overlay, int dx,int dy)
+{
+  std::set<enum heif_channel> channels = overlay->get_channel_set();
+
+  for (heif_channel channel : channels) {
+    int in_stride=0;
+    const uint8_t* in_p;
 
     int out_stride=0;
     uint8_t* out_p;
@@ -772,6 +1493,7 @@ Error HeifPixelImage::scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& ou
 {
   out_img = std::make_shared<HeifPixelImage>();
   out_img->create(width, height, m_colorspace, m_chroma);
+  out_img->set_color_profile(m_color_profile);
 
 
   // --- scale all channels
@@ -824,3 +1546,785 @@ Error HeifPixelImage::scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& ou
 
   return Error::Ok;
 }
+
+
+namespace {
+  // Input samples contributing to one output sample of the box filter.
+  // The weights sum up to 1<<cBoxFilterWeightBits.
+  struct BoxFilterTaps
+  {
+    int first;
+    std::vector<uint32_t> weights;
+  };
+
+  // Mapping of the samples of one bit depth into the 16-bit intermediate representation
+  // used for resampling, and back. In linear-light mode, the intermediate values are
+  // linear light (sRGB transfer curve), otherwise they are the rescaled code values.
+  struct ResamplingTables
+  {
+    std::vector<uint16_t> to_intermediate;    // 2^bit_depth entries
+    std::vector<uint16_t> from_intermediate;  // 65536 entries
+  };
+}
+
+static const int cBoxFilterWeightBits = 14;
+
+
+static std::vector<BoxFilterTaps> compute_box_filter_taps(int out_size, int in_size)
+{
+  std::vector<BoxFilterTaps> taps(out_size);
+
+  const double scale = in_size / static_cast<double>(out_size);
+  const uint32_t one = 1 << cBoxFilterWeightBits;
+
+  for (int i=0;i<out_size;i++) {
+    double start = i * scale;
+    double end = (i+1) * scale;
+
+    int first = static_cast<int>(start);
+    int last = std::min(in_size-1, static_cast<int>(ceil(end))-1);
+
+    BoxFilterTaps& tap = taps[i];
+    tap.first = first;
+
+    // The weights are the differences of the rounded cumulative coverage. They sum up to
+    // exactly 1.0 and never become negative. For very large downscaling factors, where
+    // each single weight would round to zero, every few samples get a weight of one unit.
+    double covered = 0;
+    uint32_t assigned = 0;
+
+    for (int k=first;k<=last;k++) {
+      double coverage = std::min(end, k+1.0) - std::max(start, static_cast<double>(k));
+      covered += std::max(0.0, coverage / scale);
+
+      uint32_t target = std::min(one, static_cast<uint32_t>(covered * one + 0.5));
+      tap.weights.push_back(target - assigned);
+      assigned = target;
+    }
+
+    tap.weights.back() += one - assigned;
+  }
+
+  return taps;
+}
+
+
+static std::shared_ptr<const ResamplingTables> get_resampling_tables(int bit_depth, bool linear_light)
+{
+  static std::mutex tables_mutex;
+  static std::map<std::pair<int,bool>, std::shared_ptr<const ResamplingTables>> tables_cache;
+
+  std::lock_guard<std::mutex> lock(tables_mutex);
+
+  auto key = std::make_pair(bit_depth, linear_light);
+  auto iter = tables_cache.find(key);
+  if (iter != tables_cache.end()) {
+    return iter->second;
+  }
+
+  auto tables = std::make_shared<ResamplingTables>();
+
+  const int maxval = (1 << bit_depth) - 1;
+
+  tables->to_intermediate.resize(maxval+1);
+  for (int i=0;i<=maxval;i++) {
+    double v = i / static_cast<double>(maxval);
+    if (linear_light) {
+      v = srgb_eotf(v);
+    }
+
+    tables->to_intermediate[i] = static_cast<uint16_t>(v * 0xFFFF + 0.5);
+  }
+
+  tables->from_intermediate.resize(0x10000);
+  for (int i=0;i<=0xFFFF;i++) {
+    double v = i / static_cast<double>(0xFFFF);
+    if (linear_light) {
+      v = srgb_oetf(v);
+    }
+
+    tables->from_intermediate[i] = static_cast<uint16_t>(v * maxval + 0.5);
+  }
+
+  tables_cache[key] = tables;
+
+  return tables;
+}
+
+
+// Resample a plane with 'nc' interleaved components per pixel. Input rows are filtered
+// horizontally into 16-bit intermediate rows when the vertical filter first needs them.
+// Only as many rows as the vertical filter covers are kept, in a ring buffer. Each
+// component is mapped to and from the intermediate representation with its own pair
+// of tables.
+template <typename T>
+static void scale_plane_box(const T* in, int in_stride, int in_w, int in_h,
+                            T* out, int out_stride, int out_w, int out_h,
+                            int nc, const ResamplingTables* const* tables)
+{
+  const std::vector<BoxFilterTaps> htaps = compute_box_filter_taps(out_w, in_w);
+  const std::vector<BoxFilterTaps> vtaps = compute_box_filter_taps(out_h, in_h);
+
+  const uint32_t round = 1 << (cBoxFilterWeightBits-1);
+
+  const int in_row_size = in_w * nc;
+  const int out_row_size = out_w * nc;
+
+
+  // --- horizontal pass, into the ring buffer
+
+  size_t ring_rows = 1;
+  for (const BoxFilterTaps& tap : vtaps) {
+    ring_rows = std::max(ring_rows, tap.weights.size());
+  }
+
+  std::vector<uint16_t> hbuf(ring_rows * out_row_size);
+  std::vector<uint16_t> row(in_row_size);
+
+  auto filter_row = [&](int y) {
+    const T* src = in + static_cast<ptrdiff_t>(y)*in_stride;
+
+    for (int c=0;c<nc;c++) {
+      const uint16_t* to_intermediate = tables[c]->to_intermediate.data();
+      for (int i=c;i<in_row_size;i+=nc) {
+        row[i] = to_intermediate[src[i]];
+      }
+    }
+
+    uint16_t* dst = &hbuf[(y % ring_rows) * out_row_size];
+
+    for (int x=0;x<out_w;x++) {
+      const BoxFilterTaps& tap = htaps[x];
+      const uint16_t* p = &row[tap.first * nc];
+      const size_t nTaps = tap.weights.size();
+
+      for (int c=0;c<nc;c++) {
+        uint32_t sum = 0;
+        for (size_t k=0;k<nTaps;k++) {
+          sum += p[k*nc + c] * tap.weights[k];
+        }
+
+        dst[x*nc + c] = static_cast<uint16_t>((sum + round) >> cBoxFilterWeightBits);
+      }
+    }
+  };
+
+
+  // --- vertical pass
+  //     The taps of successive output rows start at increasing input rows, so the rows that
+  //     a tap needs have not yet been overwritten in the ring buffer.
+
+  std::vector<uint32_t> acc(out_row_size);
+  int next_in_row = 0;
+
+  for (int y=0;y<out_h;y++) {
+    const BoxFilterTaps& tap = vtaps[y];
+
+    const int end_row = tap.first + static_cast<int>(tap.weights.size());
+    while (next_in_row < end_row) {
+      filter_row(next_in_row++);
+    }
+
+    std::fill(acc.begin(), acc.end(), round);
+
+    for (size_t k=0;k<tap.weights.size();k++) {
+      const uint16_t* src = &hbuf[((tap.first + k) % ring_rows) * out_row_size];
+      const uint32_t w = tap.weights[k];
+
+      for (int i=0;i<out_row_size;i++) {
+        acc[i] += src[i] * w;
+      }
+    }
+
+    T* dst = out + y*out_stride;
+
+    for (int c=0;c<nc;c++) {
+      const uint16_t* from_intermediate = tables[c]->from_intermediate.data();
+      for (int i=c;i<out_row_size;i+=nc) {
+        dst[i] = static_cast<T>(from_intermediate[acc[i] >> cBoxFilterWeightBits]);
+      }
+    }
+  }
+}
+
+
+Error HeifPixelImage::scale_box(std::shared_ptr<HeifPixelImage>& out_img,
+                                int width,int height, bool linear_light) const
+{
+  out_img = std::make_shared<HeifPixelImage>();
+  out_img->create(width, height, m_colorspace, m_chroma);
+  out_img->set_color_profile(m_color_profile);
+
+  for (const auto& plane_pair : m_planes) {
+    heif_channel channel = plane_pair.first;
+    const ImagePlane& plane = plane_pair.second;
+
+    // number of interleaved components and their bit depth
+
+    int nc = 1;
+    int bit_depth = plane.bit_depth;
+    if (channel == heif_channel_interleaved) {
+      nc = plane.bit_depth / 8;
+      bit_depth = 8;
+    }
+
+    if (bit_depth > 16 || nc < 1 || nc > 4) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Unsupported_bit_depth);
+    }
+
+
+    // Only color samples are converted to linear light. Alpha, depth and the chroma
+    // components of YCbCr images are resampled as they are.
+
+    const ResamplingTables* tables[4];
+    std::shared_ptr<const ResamplingTables> gamma_tables = get_resampling_tables(bit_depth, false);
+    std::shared_ptr<const ResamplingTables> linear_tables;
+
+    bool linear_channel = (channel == heif_channel_R ||
+                           channel == heif_channel_G ||
+                           channel == heif_channel_B ||
+                           channel == heif_channel_interleaved ||
+                           (channel == heif_channel_Y && m_colorspace == heif_colorspace_monochrome));
+
+    if (linear_light && linear_channel) {
+      linear_tables = get_resampling_tables(bit_depth, true);
+    }
+
+    for (int c=0;c<nc;c++) {
+      // the fourth interleaved component is alpha
+      tables[c] = (linear_tables && c<3 ? linear_tables.get() : gamma_tables.get());
+    }
+
+
+    int out_w = std::max(1, plane.width * width/m_width);
+    int out_h = std::max(1, plane.height * height/m_height);
+
+    out_img->add_plane(channel, out_w, out_h, plane.bit_depth);
+
+    int out_stride = 0;
+    uint8_t* out_data = out_img->get_plane(channel, &out_stride);
+
+    if (bit_depth <= 8) {
+      scale_plane_box<uint8_t>(plane.mem.data(), plane.stride, plane.width, plane.height,
+                               out_data, out_stride, out_w, out_h,
+                               nc, tables);
+    }
+    else {
+      scale_plane_box<uint16_t>(reinterpret_cast<const uint16_t*>(plane.mem.data()), plane.stride/2,
+                                plane.width, plane.height,
+                                reinterpret_cast<uint16_t*>(out_data), out_stride/2, out_w, out_h,
+                                nc, tables);
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+ImageStatistics::ImageStatistics(int width, int height, int preview_downscale)
+  : m_width(width),
+    m_height(height),
+    m_preview_downscale(preview_downscale)
+{
+  if (m_preview_downscale > 0) {
+    m_preview_width  = (width  + preview_downscale - 1) / preview_downscale;
+    m_preview_height = (height + preview_downscale - 1) / preview_downscale;
+
+    m_preview_sum.resize(m_preview_width * m_preview_height);
+  }
+}
+
+
+std::vector<uint32_t>& ImageStatistics::histogram(heif_channel channel)
+{
+  std::vector<uint32_t>& hist = m_histograms[channel];
+  if (hist.empty()) {
+    hist.resize(256);
+  }
+
+  return hist;
+}
+
+
+void ImageStatistics::add_row(heif_channel channel, int x0, int y,
+                              const uint8_t* data, int n, int pixel_stride)
+{
+  uint32_t* hist = histogram(channel).data();
+
+  for (int i=0;i<n;i++) {
+    hist[data[i*pixel_stride]]++;
+  }
+
+
+  // --- accumulate preview
+
+  if (channel == heif_channel_Y && m_preview_downscale > 0) {
+    uint32_t* sums = &m_preview_sum[(y / m_preview_downscale) * m_preview_width];
+
+    int px  = x0 / m_preview_downscale;
+    int cnt = x0 % m_preview_downscale;
+
+    for (int i=0;i<n;i++) {
+      sums[px] += data[i*pixel_stride];
+
+      if (++cnt == m_preview_downscale) {
+        cnt = 0;
+        px++;
+      }
+    }
+  }
+}
+
+
+void ImageStatistics::add_RGB_row(int x0, int y,
+                                  const uint8_t* r, const uint8_t* g, const uint8_t* b,
+                                  int n, int pixel_stride)
+{
+  uint32_t* hist_r = histogram(heif_channel_R).data();
+  uint32_t* hist_g = histogram(heif_channel_G).data();
+  uint32_t* hist_b = histogram(heif_channel_B).data();
+
+  for (int i=0;i<n;i++) {
+    hist_r[r[i*pixel_stride]]++;
+    hist_g[g[i*pixel_stride]]++;
+    hist_b[b[i*pixel_stride]]++;
+  }
+
+
+  // --- accumulate preview (BT.601 luma weights in 8 bit fixed point)
+
+  if (m_preview_downscale > 0) {
+    uint32_t* sums = &m_preview_sum[(y / m_preview_downscale) * m_preview_width];
+
+    int px  = x0 / m_preview_downscale;
+    int cnt = x0 % m_preview_downscale;
+
+    for (int i=0;i<n;i++) {
+      sums[px] += (77 * r[i*pixel_stride] +
+                   150 * g[i*pixel_stride] +
+                   29 * b[i*pixel_stride] + 128) >> 8;
+
+      if (++cnt == m_preview_downscale) {
+        cnt = 0;
+        px++;
+      }
+    }
+  }
+}
+
+
+bool ImageStatistics::has_channel(heif_channel channel) const
+{
+  return m_histograms.find(channel) != m_histograms.end();
+}
+
+
+void ImageStatistics::get_channel_statistics(heif_channel channel,
+                                             struct heif_channel_statistics* out) const
+{
+  memset(out, 0, sizeof(struct heif_channel_statistics));
+
+  auto iter = m_histograms.find(channel);
+  if (iter == m_histograms.end()) {
+    return;
+  }
+
+  const std::vector<uint32_t>& hist = iter->second;
+
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  bool first = true;
+
+  for (int i=0;i<256;i++) {
+    out->histogram[i] = hist[i];
+
+    if (hist[i]) {
+      if (first) {
+        out->min = i;
+        first = false;
+      }
+
+      out->max = i;
+    }
+
+    count += hist[i];
+    sum += static_cast<uint64_t>(hist[i]) * i;
+  }
+
+  if (count) {
+    out->mean = static_cast<double>(sum) / static_cast<double>(count);
+  }
+}
+
+
+std::shared_ptr<HeifPixelImage> ImageStatistics::get_luma_preview() const
+{
+  if (m_preview_downscale == 0) {
+    return nullptr;
+  }
+
+  auto preview = std::make_shared<HeifPixelImage>();
+  preview->create(m_preview_width, m_preview_height,
+                  heif_colorspace_monochrome, heif_chroma_monochrome);
+  preview->add_plane(heif_channel_Y, m_preview_width, m_preview_height, 8);
+
+  int stride = 0;
+  uint8_t* p = preview->get_plane(heif_channel_Y, &stride);
+
+  for (int y=0;y<m_preview_height;y++) {
+    int block_h = std::min(m_preview_downscale, m_height - y*m_preview_downscale);
+
+    for (int x=0;x<m_preview_width;x++) {
+      int block_w = std::min(m_preview_downscale, m_width - x*m_preview_downscale);
+      uint32_t n = block_w * block_h;
+
+      p[y*stride + x] = static_cast<uint8_t>((m_preview_sum[y*m_preview_width + x] + n/2) / n);
+    }
+  }
+
+  return preview;
+}
+
+
+void HeifPixelImage::compute_statistics(int preview_downscale)
+{
+  auto stats = std::make_shared<ImageStatistics>(m_width, m_height, preview_downscale);
+
+  // Statistics are only collected for 8-bit samples.
+  for (const auto& plane_pair : m_planes) {
+    heif_channel channel = plane_pair.first;
+    const ImagePlane& plane = plane_pair.second;
+    const uint8_t* data = plane.mem.data();
+
+    if (plane.bit_depth != 8) {
+      continue;
+    }
+
+    if (channel == heif_channel_interleaved) {
+      int bpp = (m_chroma == heif_chroma_interleaved_32bit ? 4 : 3);
+
+      for (int y=0;y<plane.height;y++) {
+        const uint8_t* row = data + y*plane.stride;
+        stats->add_RGB_row(0, y, row, row+1, row+2, plane.width, bpp);
+        if (bpp==4) {
+          stats->add_row(heif_channel_Alpha, 0, y, row+3, plane.width, 4);
+        }
+      }
+    }
+    else if (channel == heif_channel_R) {
+      auto iter_g = m_planes.find(heif_channel_G);
+      auto iter_b = m_planes.find(heif_channel_B);
+      if (iter_g == m_planes.end() || iter_g->second.bit_depth != 8 ||
+          iter_b == m_planes.end() || iter_b->second.bit_depth != 8) {
+        continue;
+      }
+
+      const ImagePlane& plane_g = iter_g->second;
+      const ImagePlane& plane_b = iter_b->second;
+
+      for (int y=0;y<plane.height;y++) {
+        stats->add_RGB_row(0, y,
+                           data + y*plane.stride,
+                           plane_g.mem.data() + y*plane_g.stride,
+                           plane_b.mem.data() + y*plane_b.stride,
+                           plane.width, 1);
+      }
+    }
+    else if (channel == heif_channel_G || channel == heif_channel_B) {
+      // handled together with the R channel
+    }
+    else {
+      for (int y=0;y<plane.height;y++) {
+        stats->add_row(channel, 0, y, data + y*plane.stride, plane.width);
+      }
+    }
+  }
+
+  // Images without any 8-bit channel have no statistics.
+  if (!stats->empty()) {
+    m_statistics = stats;
+  }
+}
+
+
+namespace {
+  struct BilinearTap {
+    int pos0, pos1;
+    float weight1;  // weight of pos1, pos0 is weighted by (1-weight1)
+  };
+}
+
+
+// Compute the sampling positions for resizing 'in_size' pixels to 'out_size' pixels.
+// Pixel centers are aligned (no corner alignment). 'subsampling' is the chroma subsampling
+// factor of the plane in this direction and 'plane_size' its number of samples.
+static std::vector<BilinearTap> compute_bilinear_taps(int out_size, int in_size,
+                                                      int subsampling, int plane_size)
+{
+  std::vector<BilinearTap> taps(out_size);
+
+  const float scale = static_cast<float>(in_size) / static_cast<float>(out_size);
+
+  for (int i=0;i<out_size;i++) {
+    float pos = ((static_cast<float>(i) + 0.5f) * scale) / static_cast<float>(subsampling) - 0.5f;
+    if (pos < 0) {
+      pos = 0;
+    }
+
+    int p0 = static_cast<int>(pos);
+    if (p0 > plane_size-1) {
+      p0 = plane_size-1;
+    }
+
+    float w = pos - static_cast<float>(p0);
+    if (w > 1.0f) {
+      w = 1.0f;
+    }
+
+    taps[i].pos0 = p0;
+    taps[i].pos1 = (p0+1 < plane_size) ? p0+1 : p0;
+    taps[i].weight1 = w;
+  }
+
+  return taps;
+}
+
+
+template <typename T>
+static void interpolate_row(const T* row0, const T* row1, float weight1,
+                            const std::vector<BilinearTap>& taps, float* out)
+{
+  const float weight0 = 1.0f - weight1;
+  const size_t n = taps.size();
+
+  for (size_t x=0;x<n;x++) {
+    const BilinearTap& tap = taps[x];
+    float top    = static_cast<float>(row0[tap.pos0]) * (1.0f-tap.weight1) +
+                   static_cast<float>(row0[tap.pos1]) * tap.weight1;
+    float bottom = static_cast<float>(row1[tap.pos0]) * (1.0f-tap.weight1) +
+                   static_cast<float>(row1[tap.pos1]) * tap.weight1;
+    out[x] = top * weight0 + bottom * weight1;
+  }
+}
+
+
+static inline float clip_float(float x, float maxval)
+{
+  return x < 0.0f ? 0.0f : (x > maxval ? maxval : x);
+}
+
+
+Error HeifPixelImage::convert_to_tensor(float* out, int width, int height,
+                                        heif_tensor_layout layout,
+                                        const float scale[3], const float offset[3]) const
+{
+  std::vector<heif_channel> channels;
+
+  if (m_colorspace == heif_colorspace_YCbCr) {
+    channels = { heif_channel_Y, heif_channel_Cb, heif_channel_Cr };
+  }
+  else if (m_colorspace == heif_colorspace_RGB && m_chroma == heif_chroma_444) {
+    channels = { heif_channel_R, heif_channel_G, heif_channel_B };
+  }
+  else if (m_colorspace == heif_colorspace_monochrome) {
+    channels = { heif_channel_Y };
+  }
+  else {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_color_conversion);
+  }
+
+  const int bit_depth = get_bits_per_pixel(channels[0]);
+
+  for (heif_channel channel : channels) {
+    if (!has_channel(channel)) {
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Nonexisting_image_channel_referenced);
+    }
+
+    if (get_bits_per_pixel(channel) != bit_depth || bit_depth < 1 || bit_depth > 16) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Unsupported_bit_depth);
+    }
+  }
+
+  const bool high_bit_depth = (bit_depth > 8);
+  const float maxval = static_cast<float>((1 << bit_depth) - 1);
+
+
+  // --- range and matrix of YCbCr and monochrome input, in code values of 'bit_depth'
+
+  ConversionSource matrix;
+  matrix.bit_depth = bit_depth;
+  set_YCbCr_matrix(matrix, m_color_profile.get());
+
+
+  // --- code values are normalized to 0..255 before 'scale' and 'offset' are applied
+
+  float out_scale[3];
+  for (int c=0;c<3;c++) {
+    out_scale[c] = scale[c] * 255.0f / maxval;
+  }
+
+
+  // --- precompute the horizontal and vertical sampling positions for each plane
+
+  const size_t nChannels = channels.size();
+
+  std::vector<std::vector<BilinearTap>> xtaps(nChannels), ytaps(nChannels);
+  std::vector<const uint8_t*> planes(nChannels);
+  std::vector<int> strides(nChannels);
+
+  for (size_t c=0;c<nChannels;c++) {
+    const ImagePlane& plane = m_planes.find(channels[c])->second;
+
+    int sub_x = (plane.width  < m_width)  ? 2 : 1;
+    int sub_y = (plane.height < m_height) ? 2 : 1;
+
+    xtaps[c] = compute_bilinear_taps(width,  m_width,  sub_x, plane.width);
+    ytaps[c] = compute_bilinear_taps(height, m_height, sub_y, plane.height);
+
+    planes[c] = plane.mem.data();
+    strides[c] = plane.stride;
+  }
+
+
+  // --- process output row by row
+
+  std::vector<float> row_buffer(width * nChannels);
+  std::vector<float> rgb_buffer(width * 3);
+
+  float* out_r = rgb_buffer.data();
+  float* out_g = rgb_buffer.data() + width;
+  float* out_b = rgb_buffer.data() + 2*width;
+
+  const size_t plane_size = static_cast<size_t>(width) * height;
+
+  for (int y=0;y<height;y++) {
+
+    // resize
+
+    for (size_t c=0;c<nChannels;c++) {
+      const BilinearTap& tap = ytaps[c][y];
+      const uint8_t* row0 = planes[c] + static_cast<ptrdiff_t>(tap.pos0) * strides[c];
+      const uint8_t* row1 = planes[c] + static_cast<ptrdiff_t>(tap.pos1) * strides[c];
+
+      if (high_bit_depth) {
+        interpolate_row(reinterpret_cast<const uint16_t*>(row0),
+                        reinterpret_cast<const uint16_t*>(row1),
+                        tap.weight1, xtaps[c], row_buffer.data() + c*width);
+      }
+      else {
+        interpolate_row(row0, row1, tap.weight1, xtaps[c], row_buffer.data() + c*width);
+      }
+    }
+
+
+    // color conversion
+
+    const float* in0 = row_buffer.data();
+
+    if (m_colorspace == heif_colorspace_YCbCr) {
+      const float* in_cb = row_buffer.data() + width;
+      const float* in_cr = row_buffer.data() + 2*width;
+
+      for (int x=0;x<width;x++) {
+        float yv = matrix.scale_y * (in0[x] - matrix.offset_y);
+        float cb = in_cb[x] - matrix.offset_c;
+        float cr = in_cr[x] - matrix.offset_c;
+
+        out_r[x] = clip_float(yv + matrix.cr_r * cr, maxval);
+        out_g[x] = clip_float(yv - matrix.cb_g * cb - matrix.cr_g * cr, maxval);
+        out_b[x] = clip_float(yv + matrix.cb_b * cb, maxval);
+      }
+    }
+    else if (m_colorspace == heif_colorspace_RGB) {
+      memcpy(out_r, in0, width*3*sizeof(float));
+    }
+    else {
+      // limited range luma is expanded to full range
+      for (int x=0;x<width;x++) {
+        out_r[x] = clip_float(matrix.scale_y * (in0[x] - matrix.offset_y), maxval);
+      }
+
+      memcpy(out_g, out_r, width*sizeof(float));
+      memcpy(out_b, out_r, width*sizeof(float));
+    }
+
+
+    // normalization and output
+
+    if (layout == heif_tensor_layout_NCHW) {
+      for (int c=0;c<3;c++) {
+        const float* in = rgb_buffer.data() + c*width;
+        float* dst = out + c*plane_size + static_cast<size_t>(y)*width;
+
+        const float s = out_scale[c];
+        const float o = offset[c];
+
+        for (int x=0;x<width;x++) {
+          dst[x] = in[x] * s + o;
+        }
+      }
+    }
+    else {
+      float* dst = out + static_cast<size_t>(y)*width*3;
+
+      for (int x=0;x<width;x++) {
+        dst[3*x+0] = out_r[x] * out_scale[0] + offset[0];
+        dst[3*x+1] = out_g[x] * out_scale[1] + offset[1];
+        dst[3*x+2] = out_b[x] * out_scale[2] + offset[2];
+      }
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifPixelImage::convert_to_interleaved(uint8_t* out, int out_stride,
+                                             const struct heif_interleaved_layout& layout,
+                                             const struct heif_decoding_options* options) const
+{
+  int order = layout.channel_order;
+  if (order < heif_channel_order_RGB || order > heif_channel_order_XBGR) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 "Unknown channel order");
+  }
+
+  const int bytes_per_pixel = (order == heif_channel_order_RGB ||
+                               order == heif_channel_order_BGR) ? 3 : 4;
+
+  if (out_stride < m_width * bytes_per_pixel) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 "Output stride too small");
+  }
+
+  RGB8Target dst;
+  dst.planes[0] = out;
+  dst.strides[0] = out_stride;
+  dst.padding_value = layout.padding_value;
+
+  RGB8Layout rgb8_layout;
+  rgb8_layout.planar = false;
+  rgb8_layout.channel_order = layout.channel_order;
+  rgb8_layout.premultiplied_alpha = (layout.premultiplied_alpha != 0);
+
+  std::shared_ptr<const ColorProfile> out_profile;
+  auto color_transform = get_transform_to_sRGB(options, out_profile);
+
+  // No statistics are collected, the caller's buffer has no place to return them.
+  RowPostprocessing post;
+  post.color_transform = color_transform.get();
+
+  if (!convert_to_RGB8_target(*this, dst, rgb8_layout,
+                              options, get_HDR_transfer_characteristics(options), post)) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_color_conversion);
+  }
+
+  return Error::Ok;
+}
@@ -24,15 +24,111 @@
 
 #include "heif.h"
 #include "error.h"
+#include "heif_colorprofile.h"
 
 #include <vector>
 #include <memory>
 #include <map>
 #include <set>
+#include <string>
 
 
 namespace heif {
 
+class HeifPixelImage;
+
+
+// Per-channel histograms and an optional downscaled luma preview. The statistics are
+// accumulated row by row in the pass that writes the final output image, so that no
+// extra pass over the image is needed.
+class ImageStatistics
+{
+ public:
+  // 'preview_downscale' is the downscaling factor for the luma preview (0 = no preview).
+  ImageStatistics(int width, int height, int preview_downscale);
+
+  // Add 'n' 8-bit samples of a single channel, starting at image position (x0,y).
+  // Samples of the Y channel are also added to the luma preview.
+  void add_row(heif_channel channel, int x0, int y,
+               const uint8_t* data, int n, int pixel_stride = 1);
+
+  // Add 'n' RGB pixels, starting at image position (x0,y). The luma preview is computed
+  // from the RGB values.
+  void add_RGB_row(int x0, int y,
+                   const uint8_t* r, const uint8_t* g, const uint8_t* b,
+                   int n, int pixel_stride);
+
+  bool has_channel(heif_channel channel) const;
+
+  // Whether no samples have been added to any channel yet.
+  bool empty() const { return m_histograms.empty(); }
+
+  void get_channel_statistics(heif_channel channel, struct heif_channel_statistics* out) const;
+
+  // Returns nullptr if no preview was requested.
+  std::shared_ptr<HeifPixelImage> get_luma_preview() const;
+
+ private:
+  std::map<heif_channel, std::vector<uint32_t>> m_histograms;
+
+  int m_width, m_height;
+  int m_preview_downscale;
+  int m_preview_width = 0, m_preview_height = 0;
+  std::vector<uint32_t> m_preview_sum;
+
+  std::vector<uint32_t>& histogram(heif_channel channel);
+};
+
+
+// Work that the color conversion kernels apply to each 8-bit output row while it is
+// still in the cache: the optional transform to sRGB and the statistics collection.
+struct RowPostprocessing
+{
+  const ColorTransformLUT* color_transform = nullptr;
+  ImageStatistics* stats = nullptr;
+
+  void process_RGB_row(int y, uint8_t* r, uint8_t* g, uint8_t* b, int n, int pixel_stride) const;
+
+  void process_alpha_row(int y, const uint8_t* a, int n, int pixel_stride) const;
+};
+
+
+// Memory of an image plane. It is allocated on the heap or mapped from a temporary file,
+// which lets the operating system page out parts of very large images.
+class PlaneMemory
+{
+ public:
+  PlaneMemory() = default;
+  PlaneMemory(PlaneMemory&& other);
+  PlaneMemory& operator=(PlaneMemory&& other);
+  ~PlaneMemory();
+
+  PlaneMemory(const PlaneMemory&) = delete;
+  PlaneMemory& operator=(const PlaneMemory&) = delete;
+
+  // Zero-initialized memory on the heap.
+  void allocate(size_t size);
+
+  // Zero-initialized memory mapped from a temporary file in 'directory' (the system
+  // temporary directory if empty). The file is deleted right away and only exists while
+  // it is mapped. Returns false if the file cannot be created or mapped.
+  bool map_temporary_file(size_t size, const std::string& directory);
+
+  uint8_t* data() { return m_data; }
+  const uint8_t* data() const { return m_data; }
+
+  bool is_file_backed() const { return m_mapped; }
+
+ private:
+  std::vector<uint8_t> m_heap;
+  uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+  bool m_mapped = false;
+
+  void release();
+};
+
+
 class HeifPixelImage : public std::enable_shared_from_this<HeifPixelImage>,
                        public ErrorBuffer
 {
@@ -44,6 +140,13 @@ class HeifPixelImage : public std::enable_shared_from_this<HeifPixelImage>,
 
   void add_plane(heif_channel channel, int width, int height, int bit_depth);
 
+  // Allocate all planes added from now on in memory-mapped temporary files (see PlaneMemory).
+  // Falls back to heap memory if the file cannot be mapped. Images derived from this one
+  // by conversions and transformations use the same storage.
+  void set_file_backed(const std::string& directory);
+
+  bool is_file_backed() const { return m_file_backed; }
+
   bool has_channel(heif_channel channel) const;
 
 
@@ -70,8 +173,13 @@ class HeifPixelImage : public std::enable_shared_from_this<HeifPixelImage>,
                                     heif_channel src_channel,
                                     heif_channel dst_channel);
 
+  // If statistics collection is switched on in the decoding options, the output image
+  // carries statistics that were accumulated during the conversion.
+  // If 'convert_to_sRGB' is set, 8-bit RGB output is transformed from the image's color
+  // profile to sRGB.
   std::shared_ptr<HeifPixelImage> convert_colorspace(heif_colorspace colorspace,
-                                                     heif_chroma chroma) const;
+                                                     heif_chroma chroma,
+                                                     const struct heif_decoding_options* options = nullptr) const;
 
   Error rotate_ccw(int angle_degrees,
                    std::shared_ptr<HeifPixelImage>& out_img);
@@ -81,22 +189,66 @@ class HeifPixelImage : public std::enable_shared_from_this<HeifPixelImage>,
   Error crop(int left,int right,int top,int bottom,
              std::shared_ptr<HeifPixelImage>& out_img) const;
 
+  // Remove the Cb and Cr planes of a YCbCr image and turn it into a monochrome image.
+  // The luma plane is kept as is, without copying.
+  void drop_chroma_planes();
+
   Error fill_RGB_16bit(uint16_t r, uint16_t g, uint16_t b, uint16_t a);
 
+  Error fill_plane_16bit(heif_channel channel, uint16_t value);
+
   Error overlay(std::shared_ptr<HeifPixelImage>& overlay, int dx,int dy);
 
   Error scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& output, int width,int height) const;
 
+  // Resample with an area-averaging box filter. If 'linear_light' is set, the color
+  // samples are averaged in linear light, assuming the sRGB transfer curve.
+  Error scale_box(std::shared_ptr<HeifPixelImage>& output, int width,int height,
+                  bool linear_light) const;
+
+  // Convert to 8-bit RGB(A) with the channel order given in 'layout' and write the result
+  // into 'out', which must hold get_height() rows of 'out_stride' bytes.
+  // Dithering, tone mapping and the conversion to sRGB are taken from 'options'.
+  Error convert_to_interleaved(uint8_t* out, int out_stride,
+                               const struct heif_interleaved_layout& layout,
+                               const struct heif_decoding_options* options = nullptr) const;
+
+  // The color profile of the decoded image, or nullptr if the file does not specify one.
+  void set_color_profile(std::shared_ptr<const ColorProfile> profile) { m_color_profile = profile; }
+
+  std::shared_ptr<const ColorProfile> get_color_profile() const { return m_color_profile; }
+
+  void set_statistics(std::shared_ptr<const ImageStatistics> stats) { m_statistics = stats; }
+
+  std::shared_ptr<const ImageStatistics> get_statistics() const { return m_statistics; }
+
+  // Compute the statistics in a separate pass over the image. This is only used when they
+  // could not be collected while generating the image.
+  void compute_statistics(int preview_downscale);
+
+  // Convert to RGB, resize (bilinear) to width x height and normalize into a float tensor
+  // with 3*width*height entries. 'scale' and 'offset' are applied per channel to the
+  // RGB values in the range 0..255, whatever the bit depth: out = value*scale + offset.
+  Error convert_to_tensor(float* out, int width, int height,
+                          heif_tensor_layout layout,
+                          const float scale[3], const float offset[3]) const;
+
  private:
   struct ImagePlane {
     int width;
     int height;
     int bit_depth;
 
-    std::vector<uint8_t> mem;
+    PlaneMemory mem;
     int stride;
   };
 
+  bool m_file_backed = false;
+  std::string m_file_backing_directory;
+
+  // Allocate the planes of this image the same way (heap or file) as those of 'image'.
+  void copy_storage_mode_from(const HeifPixelImage& image);
+
   int m_width = 0;
   int m_height = 0;
   heif_colorspace m_colorspace = heif_colorspace_undefined;
@@ -104,11 +256,23 @@ class HeifPixelImage : public std::enable_shared_from_this<HeifPixelImage>,
 
   std::map<heif_channel, ImagePlane> m_planes;
 
-  std::shared_ptr<HeifPixelImage> convert_YCbCr420_to_RGB() const;
-  std::shared_ptr<HeifPixelImage> convert_YCbCr420_to_RGB24() const;
-  std::shared_ptr<HeifPixelImage> convert_YCbCr420_to_RGB32() const;
-  std::shared_ptr<HeifPixelImage> convert_RGB_to_RGB24() const;
-  std::shared_ptr<HeifPixelImage> convert_mono_to_RGB(int bpp) const;
+  std::shared_ptr<const ColorProfile> m_color_profile;
+
+  std::shared_ptr<const ImageStatistics> m_statistics;
+
+  // Returns the transform to sRGB if requested in the options and needed for the color
+  // profile of this image. 'out_profile' is set to the color profile of the output.
+  std::shared_ptr<const ColorTransformLUT> get_transform_to_sRGB(const struct heif_decoding_options* options,
+                                                                 std::shared_ptr<const ColorProfile>& out_profile) const;
+
+  // Returns PQ or HLG if tone mapping is to be applied, unspecified otherwise.
+  heif_transfer_characteristics get_HDR_transfer_characteristics(const struct heif_decoding_options* options) const;
+
+  // Convert YCbCr, monochrome or planar RGB input of any bit depth up to 16 bits to 8-bit RGB
+  // (planar 4:4:4 or interleaved 24/32 bit).
+  std::shared_ptr<HeifPixelImage> convert_to_RGB8(heif_chroma target_chroma,
+                                                  const struct heif_decoding_options* options,
+                                                  const RowPostprocessing& post) const;
 };
 
 
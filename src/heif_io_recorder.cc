@@ -0,0 +1,297 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2017 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "heif_io_recorder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+using namespace heif;
+
+
+static const char* stage_name(heif_io_stage stage)
+{
+  switch (stage) {
+  case heif_io_stage_open: return "open";
+  case heif_io_stage_image_data: return "image_data";
+  case heif_io_stage_metadata: return "metadata";
+  }
+
+  return "unknown";
+}
+
+
+void IORecorder::record_read(uint64_t offset, uint64_t length,
+                             heif_io_stage stage, heif_image_id item)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (!m_reads.empty()) {
+    heif_io_read& last = m_reads.back();
+    if (last.offset + last.length == offset &&
+        last.stage == stage &&
+        last.item_id == item) {
+      last.length += length;
+      return;
+    }
+  }
+
+  heif_io_read read;
+  read.offset = offset;
+  read.length = length;
+  read.stage = stage;
+  read.item_id = item;
+  m_reads.push_back(read);
+}
+
+
+void IORecorder::set_file_size(uint64_t size)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_file_size = size;
+}
+
+
+std::vector<heif_io_read> IORecorder::get_reads() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_reads;
+}
+
+
+void IORecorder::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_reads.clear();
+  m_file_size = 0;
+}
+
+
+Error IORecorder::write_trace(const char* filename) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  FILE* fp = fopen(filename, "w");
+  if (!fp) {
+    return Error(heif_error_Encoding_error, heif_suberror_Cannot_write_output_data);
+  }
+
+  fprintf(fp, "# libheif I/O trace v1\n");
+  if (m_file_size) {
+    fprintf(fp, "# file_size %llu\n", (unsigned long long)m_file_size);
+  }
+
+  for (const auto& read : m_reads) {
+    fprintf(fp, "%llu %llu %s %u\n",
+            (unsigned long long)read.offset,
+            (unsigned long long)read.length,
+            stage_name(read.stage),
+            read.item_id);
+  }
+
+  if (fclose(fp) != 0) {
+    return Error(heif_error_Encoding_error, heif_suberror_Cannot_write_output_data);
+  }
+
+  return Error::Ok;
+}
+
+
+static const size_t cRecordingBlockSize = 4096;
+
+
+RecordingStreamBuffer::RecordingStreamBuffer(std::streambuf* source,
+                                             std::shared_ptr<IORecorder> recorder,
+                                             heif_io_stage stage, heif_image_id item)
+  : m_source(source),
+    m_recorder(std::move(recorder)),
+    m_cache(cRecordingBlockSize),
+    m_stage(stage),
+    m_item(item)
+{
+  // Continue at the current position of the source.
+  pos_type pos = m_source->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+  if (pos != pos_type(off_type(-1))) {
+    m_position = static_cast<uint64_t>(off_type(pos));
+    m_source_position = m_position;
+  }
+
+  setg(nullptr, nullptr, nullptr);
+}
+
+
+void RecordingStreamBuffer::set_stage(heif_io_stage stage, heif_image_id item)
+{
+  m_stage = stage;
+  m_item = item;
+}
+
+
+std::streamsize RecordingStreamBuffer::read_source(uint64_t position, char* s, std::streamsize n)
+{
+  if (position != m_source_position) {
+    pos_type pos = m_source->pubseekpos(static_cast<off_type>(position), std::ios_base::in);
+    if (pos == pos_type(off_type(-1))) {
+      return 0;
+    }
+
+    m_source_position = position;
+  }
+
+  std::streamsize size = m_source->sgetn(s, n);
+  if (size > 0) {
+    m_source_position += static_cast<uint64_t>(size);
+  }
+
+  return size;
+}
+
+
+bool RecordingStreamBuffer::fill_cache()
+{
+  if (m_position >= m_cache_position &&
+      m_position < m_cache_position + m_cache_size) {
+    return true;
+  }
+
+  std::streamsize size = read_source(m_position, m_cache.data(),
+                                     static_cast<std::streamsize>(m_cache.size()));
+
+  m_cache_position = m_position;
+  m_cache_size = (size > 0 ? static_cast<uint64_t>(size) : 0);
+
+  return m_cache_size > 0;
+}
+
+
+std::streamsize RecordingStreamBuffer::xsgetn(char* s, std::streamsize n)
+{
+  const uint64_t start = m_position;
+  std::streamsize total = 0;
+
+  while (total < n) {
+    std::streamsize size;
+
+    if (m_position >= m_cache_position &&
+        m_position < m_cache_position + m_cache_size) {
+      size = static_cast<std::streamsize>(std::min<uint64_t>(m_cache_position + m_cache_size - m_position,
+                                                             static_cast<uint64_t>(n - total)));
+      memcpy(s + total, m_cache.data() + (m_position - m_cache_position), static_cast<size_t>(size));
+    }
+    else if (n - total >= static_cast<std::streamsize>(m_cache.size())) {
+      // Large reads bypass the cache.
+      size = read_source(m_position, s + total, n - total);
+    }
+    else if (fill_cache()) {
+      continue;
+    }
+    else {
+      break;
+    }
+
+    if (size <= 0) {
+      break;
+    }
+
+    m_position += static_cast<uint64_t>(size);
+    total += size;
+  }
+
+  if (total > 0) {
+    m_recorder->record_read(start, static_cast<uint64_t>(total), m_stage, m_item);
+  }
+
+  return total;
+}
+
+
+RecordingStreamBuffer::int_type RecordingStreamBuffer::underflow()
+{
+  // Peeking at the next byte is not a read of the caller and is not recorded.
+  if (!fill_cache()) {
+    return traits_type::eof();
+  }
+
+  return traits_type::to_int_type(m_cache[static_cast<size_t>(m_position - m_cache_position)]);
+}
+
+
+RecordingStreamBuffer::int_type RecordingStreamBuffer::uflow()
+{
+  int_type c = underflow();
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    return c;
+  }
+
+  m_recorder->record_read(m_position, 1, m_stage, m_item);
+  m_position++;
+
+  return c;
+}
+
+
+std::streamsize RecordingStreamBuffer::showmanyc()
+{
+  if (m_position >= m_cache_position &&
+      m_position < m_cache_position + m_cache_size) {
+    return static_cast<std::streamsize>(m_cache_position + m_cache_size - m_position);
+  }
+
+  return 0;
+}
+
+
+RecordingStreamBuffer::pos_type RecordingStreamBuffer::seekoff(off_type off,
+                                                               std::ios_base::seekdir dir,
+                                                               std::ios_base::openmode which)
+{
+  if (dir == std::ios_base::cur) {
+    off += static_cast<off_type>(m_position);
+    dir = std::ios_base::beg;
+  }
+
+  if (dir == std::ios_base::beg) {
+    if (off < 0) {
+      return pos_type(off_type(-1));
+    }
+
+    // The source is only moved when the next byte is not in the cache.
+    m_position = static_cast<uint64_t>(off);
+    return pos_type(off);
+  }
+
+  pos_type pos = m_source->pubseekoff(off, dir, which);
+  if (pos != pos_type(off_type(-1))) {
+    m_position = static_cast<uint64_t>(off_type(pos));
+    m_source_position = m_position;
+  }
+
+  return pos;
+}
+
+
+RecordingStreamBuffer::pos_type RecordingStreamBuffer::seekpos(pos_type pos,
+                                                               std::ios_base::openmode which)
+{
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
@@ -0,0 +1,110 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2017 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBHEIF_HEIF_IO_RECORDER_H
+#define LIBHEIF_HEIF_IO_RECORDER_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <vector>
+
+#include "error.h"
+
+
+namespace heif {
+
+// Log of the byte ranges read from an input file. Consecutive reads of the same
+// stage and item are merged into a single range.
+class IORecorder
+{
+ public:
+  void record_read(uint64_t offset, uint64_t length, heif_io_stage stage, heif_image_id item);
+
+  void set_file_size(uint64_t size);
+
+  std::vector<heif_io_read> get_reads() const;
+
+  void clear();
+
+  // Text trace with one read per line: "<offset> <length> <stage> <item ID>".
+  Error write_trace(const char* filename) const;
+
+ private:
+  mutable std::mutex m_mutex;
+  std::vector<heif_io_read> m_reads;
+  uint64_t m_file_size = 0;
+};
+
+
+// Reads from another stream buffer and records the ranges that were read, as requested
+// by the reader. Small reads are served from an internal block cache, which is never
+// recorded itself. Reads are attributed to the current stage and item.
+class RecordingStreamBuffer : public std::streambuf
+{
+ public:
+  RecordingStreamBuffer(std::streambuf* source, std::shared_ptr<IORecorder> recorder,
+                        heif_io_stage stage = heif_io_stage_open, heif_image_id item = 0);
+
+  void set_stage(heif_io_stage stage, heif_image_id item);
+
+ protected:
+  std::streamsize xsgetn(char* s, std::streamsize n) override;
+
+  int_type underflow() override;
+
+  int_type uflow() override;
+
+  std::streamsize showmanyc() override;
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+ private:
+  // Read up to 'n' bytes at 'position' from the source.
+  std::streamsize read_source(uint64_t position, char* s, std::streamsize n);
+
+  // Make the cache hold the byte at 'm_position'. Returns false at the end of the input.
+  bool fill_cache();
+
+  std::streambuf* m_source;
+  std::shared_ptr<IORecorder> m_recorder;
+
+  // The get area is always empty, so that every read passes through this class and can
+  // be recorded. The cache holds the block at 'm_cache_position'.
+  std::vector<char> m_cache;
+  uint64_t m_cache_position = 0;
+  uint64_t m_cache_size = 0;
+
+  uint64_t m_position = 0;         // file position of the next byte to read
+  uint64_t m_source_position = 0;  // file position of the source
+
+  heif_io_stage m_stage;
+  heif_image_id m_item;
+};
+
+}
+
+#endif